@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test and benchmark of the capture file and of its replay
+    (capture.h).
+
+    - round trip: random packets, every field drawn at random, floats
+      included, are read back bit for bit with their capture time, across
+      several RAM batches;
+    - size cap: the file stays within capture_size_kb, the packets beyond
+      it are counted as discarded, the ones captured are read back;
+    - idle flush: a record stays in RAM for CAPTURE_FLUSH_MS, no longer;
+    - damaged files: a record cut at the end ends the capture, a file that
+      is not a capture is refused;
+    - later versions: a record header larger than CAPTURE_REC_SIZE is
+      skipped up to the payload;
+    - replay: every packet in order as fast as possible, the pace of the
+      capture scaled by the speed, the loops;
+    - throughput: records captured and read per second.
+
+    Build and run on the host, include/ holding stand-ins for the headers of
+    the firmware tree:
+
+        gcc -O2 -Iinclude -I.. -o capture_test capture_test.c ../capture.c ../logcat.c -lpthread
+        ./capture_test -d /tmp
+
+    Only the reader mapping the file is tested, the one of the Linux builds.
+    -d directory of the capture files (/tmp), -n records of the throughput
+    run (1000000), -x random seed. Exits with a failure when a check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf, fopen */
+#include <stdlib.h>     /* malloc, free, strtoul, strtoull */
+#include <string.h>     /* memset, memcpy, memcmp */
+#include <time.h>       /* clock_gettime, nanosleep */
+#include <unistd.h>     /* getopt, unlink, truncate */
+#include <sys/stat.h>   /* stat */
+
+#include "logcat.h"
+#include "capture.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define TEST_PKT_NB         3000        /* packets of the round trip, about 100 RAM batches */
+#define TEST_EUI            0x0102030405060708ULL
+#define TEST_PATH_MAX       (CAPTURE_PATH_MAX + 8)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: " __VA_ARGS__); \
+            nb_fail += 1; \
+        } \
+    } while (0)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static char path[TEST_PATH_MAX];
+static char path_v2[TEST_PATH_MAX];
+static struct lgw_pkt_rx_s pkts[TEST_PKT_NB];
+static struct timeval times[TEST_PKT_NB];
+static uint64_t rand_state = 88172645463325252ULL;
+static unsigned nb_fail;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static long file_size(const char *p) {
+    struct stat st;
+
+    return (stat(p, &st) == 0) ? (long)st.st_size : -1;
+}
+
+static float rand_float(void) {
+    uint32_t u = (uint32_t)rand_next();
+    float f;
+
+    memcpy(&f, &u, sizeof f);
+    return f;
+}
+
+/* every field at random, floats as any bit pattern; capture times 10 ms apart */
+static void make_pkts(void) {
+    unsigned i, k;
+
+    for (i = 0; i < TEST_PKT_NB; ++i) {
+        struct lgw_pkt_rx_s *p = &pkts[i];
+
+        memset(p, 0, sizeof *p);
+        p->freq_hz = (uint32_t)rand_next();
+        p->if_chain = (uint8_t)rand_next();
+        p->status = (uint8_t)rand_next();
+        p->count_us = (uint32_t)rand_next();
+        p->rf_chain = (uint8_t)rand_next();
+        p->modulation = (uint8_t)rand_next();
+        p->bandwidth = (uint8_t)rand_next();
+        p->datarate = (uint32_t)rand_next();
+        p->coderate = (uint8_t)rand_next();
+        p->rssi = rand_float();
+        p->snr = rand_float();
+        p->snr_min = rand_float();
+        p->snr_max = rand_float();
+        p->crc = (uint16_t)rand_next();
+        p->size = (uint16_t)(rand_next() % (sizeof p->payload + 1));
+        for (k = 0; k < p->size; ++k) {
+            p->payload[k] = (uint8_t)rand_next();
+        }
+        times[i].tv_sec = 1609459200 + i / 100;
+        times[i].tv_usec = (i % 100) * 10000;
+    }
+}
+
+static bool same_pkt(unsigned i, const struct lgw_pkt_rx_s *p, const struct timeval *t) {
+    const struct lgw_pkt_rx_s *r = &pkts[i];
+
+    return (p->freq_hz == r->freq_hz) && (p->if_chain == r->if_chain) && (p->status == r->status) &&
+           (p->count_us == r->count_us) && (p->rf_chain == r->rf_chain) && (p->modulation == r->modulation) &&
+           (p->bandwidth == r->bandwidth) && (p->datarate == r->datarate) && (p->coderate == r->coderate) &&
+           (memcmp(&p->rssi, &r->rssi, sizeof r->rssi) == 0) && (memcmp(&p->snr, &r->snr, sizeof r->snr) == 0) &&
+           (memcmp(&p->snr_min, &r->snr_min, sizeof r->snr_min) == 0) && (memcmp(&p->snr_max, &r->snr_max, sizeof r->snr_max) == 0) &&
+           (p->crc == r->crc) && (p->size == r->size) && (memcmp(p->payload, r->payload, r->size) == 0) &&
+           (t->tv_sec == times[i].tv_sec) && (t->tv_usec == times[i].tv_usec);
+}
+
+/* records read back from a file and compared with the first ones of pkts, -1 if it cannot be opened */
+static int read_back(const char *p, unsigned max) {
+    struct capture_reader_s reader;
+    struct lgw_pkt_rx_s pkt;
+    struct timeval t;
+    unsigned n = 0;
+
+    if (capture_reader_open(&reader, p) != 0) {
+        return -1;
+    }
+    CHECK(reader.gw_eui == TEST_EUI, "gateway EUI %016llX\n", (unsigned long long)reader.gw_eui);
+    while (capture_reader_next(&reader, &pkt, &t) == 1) {
+        if ((n >= max) || !same_pkt(n, &pkt, &t)) {
+            CHECK(false, "record %u of %s differs\n", n, p);
+            break;
+        }
+        ++n;
+    }
+    capture_reader_close(&reader);
+    return (int)n;
+}
+
+static void write_all(const char *p, uint32_t size_max, struct capture_s *cap) {
+    unsigned i;
+
+    CHECK(capture_open(cap, p, size_max, TEST_EUI) == 0, "open %s\n", p);
+    for (i = 0; i < TEST_PKT_NB; ++i) {
+        capture_write(cap, 1, &pkts[i], &times[i]);
+    }
+    capture_close(cap);
+}
+
+static void test_round_trip(void) {
+    struct capture_s cap;
+
+    write_all(path, 0, &cap);
+    CHECK(cap.nb_rec == TEST_PKT_NB, "%u records captured\n", cap.nb_rec);
+    CHECK(file_size(path) == (long)cap.size, "file of %ld bytes, %u written\n", file_size(path), cap.size);
+    CHECK(read_back(path, TEST_PKT_NB) == TEST_PKT_NB, "round trip\n");
+    printf("# %u packets round-tripped, %u bytes\n", TEST_PKT_NB, cap.size);
+}
+
+static void test_size_cap(void) {
+    struct capture_s cap;
+    int n;
+
+    write_all(path, 64 * 1024, &cap);
+    n = read_back(path, TEST_PKT_NB);
+    CHECK(file_size(path) <= 64 * 1024, "file of %ld bytes for a cap of 64 KB\n", file_size(path));
+    CHECK((cap.nb_rec + cap.nb_dropped == TEST_PKT_NB) && (cap.nb_dropped > 0), "%u captured, %u discarded\n", cap.nb_rec, cap.nb_dropped);
+    CHECK(n == (int)cap.nb_rec, "%d records read, %u captured\n", n, cap.nb_rec);
+    printf("# 64 KB cap: %u packets captured, %u discarded\n", cap.nb_rec, cap.nb_dropped);
+}
+
+static void test_idle_flush(void) {
+    struct capture_s cap;
+    struct timeval t;
+
+    CHECK(capture_open(&cap, path, 0, TEST_EUI) == 0, "open\n");
+    capture_write(&cap, 1, &pkts[0], &times[0]);
+    t = times[0];
+    t.tv_sec += CAPTURE_FLUSH_MS / 1000 - 1;
+    capture_flush_if_due(&cap, &t);
+    CHECK(file_size(path) <= CAPTURE_HDR_SIZE, "record written %d s after its capture\n", CAPTURE_FLUSH_MS / 1000 - 1);
+    t.tv_sec += 2;
+    capture_flush_if_due(&cap, &t);
+    CHECK(file_size(path) == (long)(CAPTURE_HDR_SIZE + CAPTURE_REC_SIZE + pkts[0].size), "record not written %d s after its capture\n", CAPTURE_FLUSH_MS / 1000 + 1);
+    capture_close(&cap);
+}
+
+static void test_damaged(void) {
+    struct capture_s cap;
+    FILE *f;
+    long len;
+
+    write_all(path, 0, &cap);
+    len = file_size(path);
+    CHECK(truncate(path, len - 1) == 0, "truncate\n");
+    CHECK(read_back(path, TEST_PKT_NB) == TEST_PKT_NB - 1, "last record cut by 1 byte\n");
+    CHECK(truncate(path, CAPTURE_HDR_SIZE + CAPTURE_REC_SIZE - 1) == 0, "truncate\n");
+    CHECK(read_back(path, TEST_PKT_NB) == 0, "first record header cut\n");
+    CHECK(truncate(path, CAPTURE_HDR_SIZE - 1) == 0, "truncate\n");
+    CHECK(read_back(path, TEST_PKT_NB) == -1, "header cut accepted\n");
+
+    f = fopen(path, "wb");
+    if (f != NULL) {
+        fputs("{\"rxpk\":[{\"tmst\":1}]}\n", f);
+        fclose(f);
+    }
+    CHECK(read_back(path, TEST_PKT_NB) == -1, "JSON file accepted as a capture\n");
+}
+
+/* the file rewritten as a version 2 capture, with 6 more bytes per record header */
+static void test_later_version(void) {
+    struct capture_s cap;
+    uint8_t *data, *out;
+    long len, off, o = 0;
+    uint16_t size;
+    FILE *f;
+
+    write_all(path, 0, &cap);
+    len = file_size(path);
+    data = malloc(len);
+    out = malloc(len + 6 * TEST_PKT_NB);
+    f = fopen(path, "rb");
+    if ((data == NULL) || (out == NULL) || (f == NULL) || (fread(data, len, 1, f) != 1)) {
+        fprintf(stderr, "ERROR: cannot read %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+
+    memcpy(out, data, CAPTURE_HDR_SIZE);
+    out[4] = 2;
+    out[6] = CAPTURE_REC_SIZE + 6;
+    o = CAPTURE_HDR_SIZE;
+    for (off = CAPTURE_HDR_SIZE; off < len; off += CAPTURE_REC_SIZE + size) {
+        size = (uint16_t)(data[off + 44] | (data[off + 45] << 8));
+        memcpy(&out[o], &data[off], CAPTURE_REC_SIZE);
+        memset(&out[o + CAPTURE_REC_SIZE], 0xA5, 6);
+        memcpy(&out[o + CAPTURE_REC_SIZE + 6], &data[off + CAPTURE_REC_SIZE], size);
+        o += CAPTURE_REC_SIZE + 6 + size;
+    }
+    f = fopen(path_v2, "wb");
+    if ((f == NULL) || (fwrite(out, o, 1, f) != 1)) {
+        fprintf(stderr, "ERROR: cannot write %s\n", path_v2);
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    free(out);
+    free(data);
+
+    CHECK(read_back(path_v2, TEST_PKT_NB) == TEST_PKT_NB, "version 2 capture\n");
+    unlink(path_v2);
+}
+
+static void test_replay(void) {
+    struct capture_replay_s replay;
+    struct lgw_pkt_rx_s rx[8];
+    struct timespec pause = { 0, 1000000 };
+    struct capture_s cap;
+    unsigned n, k;
+    double t0, dt;
+    int nb;
+
+    /* as fast as possible, by 8 */
+    write_all(path, 0, &cap);
+    CHECK(capture_replay_open(&replay, path, 0, false) == 0, "replay open\n");
+    for (n = 0; !replay.done; ) {
+        nb = capture_replay_receive(&replay, 8, rx);
+        for (k = 0; k < (unsigned)nb; ++k, ++n) {
+            CHECK((n < TEST_PKT_NB) && same_pkt(n, &rx[k], &times[n]), "packet %u replayed wrong\n", n);
+        }
+    }
+    CHECK(n == TEST_PKT_NB, "%u packets replayed\n", n);
+    CHECK(capture_replay_receive(&replay, 8, rx) == 0, "packets after the end\n");
+    capture_replay_close(&replay);
+
+    /* the first 201 packets span 2 s, replayed at 5x */
+    capture_open(&cap, path, 0, TEST_EUI);
+    for (n = 0; n < 201; ++n) {
+        capture_write(&cap, 1, &pkts[n], &times[n]);
+    }
+    capture_close(&cap);
+    CHECK(capture_replay_open(&replay, path, 5.0, false) == 0, "replay open\n");
+    t0 = now_s();
+    for (n = 0; !replay.done; ) {
+        n += (unsigned)capture_replay_receive(&replay, 8, rx);
+        nanosleep(&pause, NULL);
+    }
+    dt = now_s() - t0;
+    CHECK((n == 201) && (dt > 0.38) && (dt < 0.5), "%u packets of a 2 s capture replayed at 5x in %.3f s\n", n, dt);
+    capture_replay_close(&replay);
+    printf("# 2 s capture replayed at 5x in %.3f s\n", dt);
+
+    /* in a loop */
+    CHECK(capture_replay_open(&replay, path, 0, true) == 0, "replay open\n");
+    for (n = 0; n < 3 * 201; ) {
+        n += (unsigned)capture_replay_receive(&replay, 8, rx);
+    }
+    CHECK(!replay.done && (replay.nb_loops == 3), "%u loops after %u packets\n", replay.nb_loops, n);
+    capture_replay_close(&replay);
+}
+
+static void bench(uint32_t nb) {
+    struct capture_reader_s reader;
+    struct capture_s cap;
+    struct lgw_pkt_rx_s pkt;
+    struct timeval t;
+    uint32_t i, n = 0;
+    double t0, dt_write, dt_read;
+
+    for (i = 0; i < TEST_PKT_NB; ++i) {
+        pkts[i].size = 20;
+    }
+    capture_open(&cap, path, 0, TEST_EUI);
+    t0 = now_s();
+    for (i = 0; i < nb; i += 2) {
+        capture_write(&cap, 2, &pkts[i % (TEST_PKT_NB - 1)], &times[i % (TEST_PKT_NB - 1)]);
+    }
+    capture_close(&cap);
+    dt_write = now_s() - t0;
+
+    capture_reader_open(&reader, path);
+    t0 = now_s();
+    while (capture_reader_next(&reader, &pkt, &t) == 1) {
+        ++n;
+    }
+    dt_read = now_s() - t0;
+    capture_reader_close(&reader);
+    CHECK(n == cap.nb_rec, "%u records read, %u captured\n", n, cap.nb_rec);
+
+    printf("# %u packets of 20 bytes: captured at %.0f k/s (%.0f ns each), read at %.0f k/s (%.0f ns each)\n",
+           cap.nb_rec, cap.nb_rec / dt_write / 1e3, dt_write * 1e9 / cap.nb_rec, n / dt_read / 1e3, dt_read * 1e9 / n);
+}
+
+static void usage(void) {
+    printf("Usage: capture_test [-d directory] [-n records] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    const char *dir = "/tmp";
+    uint32_t nb = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hd:n:x:")) != -1) {
+        switch (opt) {
+            case 'd': dir = optarg; break;
+            case 'n': nb = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if ((snprintf(path, sizeof path, "%s/capture_test.lgwc", dir) >= (int)sizeof path) ||
+        (snprintf(path_v2, sizeof path_v2, "%s/capture_test_v2.lgwc", dir) >= (int)sizeof path_v2)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    logcat_init(NULL);
+    logcat_set_level(LOGCAT_NB, 0);
+
+    make_pkts();
+    test_round_trip();
+    test_size_cap();
+    test_idle_flush();
+    test_damaged();
+    test_later_version();
+    test_replay();
+    if (nb > 0) {
+        bench(nb);
+    }
+    unlink(path);
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test of the concentrator counter to UTC mapping (clocksync.h), on a
+    simulated concentrator clock sampled every 10 s as by thread_timersync.
+
+    - no mapping: the conversions fail before the first sample;
+    - drift: crystals from -40 to +40 ppm, estimated within 1 ppm;
+    - tracking: 23.5 ppm drift, 100 us of read jitter, outliers, slow reads,
+      a 3 s step of the system clock and counter wrap-arounds. A packet 5 s
+      after each sample is converted within 300 us, back and forth within
+      2 us; the outliers and slow reads are rejected, the step restarts the
+      fit once;
+    - readers: a second thread reads the model and converts between every
+      two samples of the tracking run, every model it reads must be
+      consistent. The thread sanitizer reports the copy of the model as a
+      race, it does not follow the sequence counter;
+    - throughput: conversions per second.
+
+    Build and run on the host:
+
+        gcc -O2 -I.. -o clocksync_test clocksync_test.c ../clocksync.c -lpthread -lm
+        ./clocksync_test
+
+    -n samples of the tracking run (2000), -r conversions of the throughput
+    run (10000000), -x random seed. Exits with a failure when a check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf */
+#include <stdlib.h>     /* strtoul, strtoull */
+#include <time.h>       /* clock_gettime */
+#include <pthread.h>    /* pthread_create */
+#include <sched.h>      /* sched_yield */
+#include <unistd.h>     /* getopt */
+
+#include "clocksync.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define SAMPLE_US           10000000LL  /* sampling period of thread_timersync */
+#define UTC0_US             1609459200000000LL
+#define CNT0                4000000000u /* wraps after 295 s */
+#define JITTER_US           100.0       /* standard deviation of the middle of a read */
+#define READ_US             300         /* duration of a read */
+#define OUTLIER_US          50000
+#define SLOW_READ_US        5000        /* beyond CLOCKSYNC_READ_MAX_US */
+#define STEP_US             3000000     /* SNTP step of the system clock */
+#define PKT_DELAY_US        5000000     /* packet received after the sample */
+#define SETTLE_NB           50          /* samples before the fit is checked */
+#define STEP_SETTLE_NB      10          /* samples after the step before the fit is checked again */
+#define DRIFT_TOL_PPB       1000        /* about 5 standard deviations of the fit of 32 samples with 100 us of jitter */
+#define CONV_TOL_US         300         /* about 8 standard deviations of the time of a packet 5 s after the newest sample */
+#define INV_TOL_US          2
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: " __VA_ARGS__); \
+            nb_fail += 1; \
+        } \
+    } while (0)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static struct clocksync_s cs;
+static bool reader_stop;
+static uint32_t reader_nb; /* conversions made by the reader thread */
+static bool reader_torn; /* a model read by the reader thread was not consistent */
+static uint64_t rand_state = 88172645463325252ULL;
+static unsigned nb_fail;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+/* about normal, mean 0, standard deviation 1 */
+static double rand_gauss(void) {
+    double s = 0;
+    int i;
+
+    for (i = 0; i < 12; ++i) {
+        s += (double)(rand_next() >> 11) / 9007199254740992.0;
+    }
+    return s - 6.0;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void us_to_tv(int64_t us, struct timeval *tv) {
+    tv->tv_sec = (time_t)(us / 1000000);
+    tv->tv_usec = (suseconds_t)(us % 1000000);
+}
+
+static int64_t tv_to_us(const struct timeval *tv) {
+    return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* counter ticks in t_us of UTC, for a counter slower by drift_ppm */
+static uint32_t cnt_ticks(int64_t t_us, double drift_ppm) {
+    return (uint32_t)(int64_t)((double)t_us / (1.0 + drift_ppm * 1e-6));
+}
+
+/* a read of the counter at utc_us, its middle off by jit_us, lasting read_us */
+static int sample(uint32_t cnt, int64_t utc_us, int64_t jit_us, int64_t read_us) {
+    struct timeval before, after;
+
+    us_to_tv(utc_us + jit_us - read_us / 2, &before);
+    us_to_tv(utc_us + jit_us + read_us / 2, &after);
+    return clocksync_sample(&cs, cnt, &before, &after);
+}
+
+static void *reader(void *arg) {
+    struct clocksync_model_s m;
+    struct timeval utc;
+    uint32_t cnt;
+
+    (void)arg;
+    while (!__atomic_load_n(&reader_stop, __ATOMIC_RELAXED)) {
+        clocksync_get(&cs, &m);
+        if (m.valid && (m.nb_used > 1)) {
+            if ((m.drift_ppb < m.drift_min_ppb) || (m.drift_ppb > m.drift_max_ppb) || (m.nb_rejected > m.nb_sample) || (m.nb_used > CLOCKSYNC_WIN)) {
+                __atomic_store_n(&reader_torn, true, __ATOMIC_RELAXED);
+            }
+            if (clocksync_to_utc(&cs, m.cnt_ref, &utc) == 0) {
+                clocksync_to_cnt(&cs, &utc, &cnt);
+            }
+        }
+        __atomic_add_fetch(&reader_nb, 1, __ATOMIC_RELAXED);
+        sched_yield();
+    }
+    return NULL;
+}
+
+/* let the reader thread convert at least once */
+static void reader_wait(void) {
+    uint32_t nb = __atomic_load_n(&reader_nb, __ATOMIC_RELAXED);
+
+    while (__atomic_load_n(&reader_nb, __ATOMIC_RELAXED) == nb) {
+        sched_yield();
+    }
+}
+
+static void test_no_mapping(void) {
+    struct timeval utc = {1609459200, 0};
+    uint32_t cnt;
+
+    clocksync_init(&cs);
+    CHECK(clocksync_to_utc(&cs, 1234, &utc) == -1, "counter converted without a sample\n");
+    CHECK(clocksync_to_cnt(&cs, &utc, &cnt) == -1, "UTC converted without a sample\n");
+    printf("# no mapping before the first sample\n");
+}
+
+static void test_drift(void) {
+    static const double drift_ppm[5] = { -40.0, -10.0, 0.0, 10.0, 40.0 };
+    struct clocksync_model_s m;
+    int32_t expect_ppb;
+    int64_t t;
+    int i, n;
+
+    for (i = 0; i < 5; ++i) {
+        clocksync_init(&cs);
+        for (n = 0; n < 3 * CLOCKSYNC_WIN; ++n) {
+            t = n * SAMPLE_US;
+            sample(CNT0 + cnt_ticks(t, drift_ppm[i]), UTC0_US + t, (int64_t)(rand_gauss() * JITTER_US), READ_US);
+        }
+        clocksync_get(&cs, &m);
+        /* UTC = cnt * (1 + drift_ppb / 1e9) */
+        expect_ppb = (int32_t)(drift_ppm[i] * 1000.0);
+        CHECK(abs(m.drift_ppb - expect_ppb) <= DRIFT_TOL_PPB, "%.1f ppm crystal estimated at %d ppb\n", drift_ppm[i], m.drift_ppb);
+    }
+    printf("# drift from -40 to +40 ppm estimated within %d ppb\n", DRIFT_TOL_PPB);
+}
+
+static void test_tracking(uint32_t nb) {
+    const double drift_ppm = 23.5;
+    struct clocksync_model_s m;
+    struct timeval utc;
+    pthread_t thr;
+    uint32_t nb_injected = 0;
+    uint32_t cnt, cnt_pkt, back;
+    int64_t utc0 = UTC0_US;
+    int64_t t, jit, read, err;
+    int64_t err_max = 0;
+    int32_t inv_max = 0;
+    bool clean, settled;
+    uint32_t n;
+
+    clocksync_init(&cs);
+    reader_stop = false;
+    reader_nb = 0;
+    reader_torn = false;
+    pthread_create(&thr, NULL, reader, NULL);
+    for (n = 0; n < nb; ++n) {
+        t = n * SAMPLE_US;
+        if (n == nb / 2) {
+            utc0 += STEP_US;
+        }
+        cnt = CNT0 + cnt_ticks(t, drift_ppm);
+        jit = (int64_t)(rand_gauss() * JITTER_US);
+        read = READ_US;
+        /* the samples confirming the step are clean */
+        clean = (n >= nb / 2) && (n < nb / 2 + CLOCKSYNC_JUMP_NB);
+        if (!clean && (n % 97 == 5)) {
+            jit += OUTLIER_US;
+            nb_injected += 1;
+        } else if (!clean && (n % 211 == 7)) {
+            read = SLOW_READ_US;
+            nb_injected += 1;
+        }
+        sample(cnt, utc0 + t, jit, read);
+        reader_wait();
+
+        settled = (n >= SETTLE_NB) && ((n < nb / 2) || (n >= nb / 2 + STEP_SETTLE_NB));
+        if (!settled) {
+            continue;
+        }
+        cnt_pkt = cnt + cnt_ticks(PKT_DELAY_US, drift_ppm);
+        if (clocksync_to_utc(&cs, cnt_pkt, &utc) != 0) {
+            CHECK(0, "sample %u: no mapping\n", n);
+            continue;
+        }
+        err = tv_to_us(&utc) - (utc0 + t + PKT_DELAY_US);
+        err = (err < 0) ? -err : err;
+        err_max = (err > err_max) ? err : err_max;
+        CHECK(clocksync_to_cnt(&cs, &utc, &back) == 0, "sample %u: UTC not converted back\n", n);
+        inv_max = (abs((int32_t)(back - cnt_pkt)) > inv_max) ? abs((int32_t)(back - cnt_pkt)) : inv_max;
+    }
+    __atomic_store_n(&reader_stop, true, __ATOMIC_RELAXED);
+    pthread_join(thr, NULL);
+
+    clocksync_get(&cs, &m);
+    CHECK(err_max <= CONV_TOL_US, "packet time off by up to %lld us\n", (long long)err_max);
+    CHECK(inv_max <= INV_TOL_US, "counter converted back off by up to %d us\n", inv_max);
+    CHECK(abs(m.drift_ppb - (int32_t)(drift_ppm * 1000.0)) <= DRIFT_TOL_PPB, "drift estimated at %d ppb\n", m.drift_ppb);
+    CHECK(m.nb_sample == nb, "%u samples counted instead of %u\n", m.nb_sample, nb);
+    CHECK(m.nb_restart == 1, "%u restarts for one step\n", m.nb_restart);
+    CHECK((m.nb_rejected >= nb_injected) && (m.nb_rejected <= nb_injected + CLOCKSYNC_JUMP_NB - 1), "%u samples rejected, %u outliers and slow reads\n", m.nb_rejected, nb_injected);
+    CHECK(!reader_torn, "the reader thread saw an inconsistent model\n");
+    printf("# %u samples: drift %d ppb, residual %u us, packet time within %lld us, back within %d us, %u rejected, %u restart, %u conversions by the reader\n",
+           nb, m.drift_ppb, m.resid_us, (long long)err_max, inv_max, m.nb_rejected, m.nb_restart, reader_nb);
+}
+
+static void bench(uint32_t nb) {
+    struct timeval utc;
+    uint32_t cnt = 0;
+    uint32_t i;
+    double t0, dt;
+
+    t0 = now_s();
+    for (i = 0; i < nb; ++i) {
+        clocksync_to_utc(&cs, i * 1000, &utc);
+        cnt += (uint32_t)utc.tv_usec;
+    }
+    dt = now_s() - t0;
+    printf("# %u conversions to UTC: %.1f ns each (%u)\n", nb, dt * 1e9 / nb, cnt & 1);
+}
+
+static void usage(void) {
+    printf("Usage: clocksync_test [-n samples] [-r conversions] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    uint32_t nb = 2000;
+    uint32_t nb_conv = 10000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:r:x:")) != -1) {
+        switch (opt) {
+            case 'n': nb = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': nb_conv = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if (nb < 2 * (SETTLE_NB + STEP_SETTLE_NB)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    test_no_mapping();
+    test_drift();
+    test_tracking(nb);
+    if (nb_conv > 0) {
+        bench(nb_conv);
+    }
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test and benchmark of the device table (devtable.h).
+
+    - counters: FCnt gaps, duplicates, wrap-around and resets, the RSSI and
+      SNR averages and the per-SF counters of one device;
+    - eviction: random uplinks of 120 devices through a table of 37. The
+      devices tracked must be the 37 most recently heard ones, every entry
+      must be found from its DevAddr and the recency list must cover them
+      all, newest first;
+    - throughput: updates of a fleet in steady state, updates with twice as
+      many devices as the table holds (an eviction on most new devices),
+      lookups. The table is checked again after each run.
+
+    Build and run on the host:
+
+        gcc -O2 -I.. -o devtable_bench devtable_bench.c ../devtable.c
+        ./devtable_bench -d 50000
+
+    -d devices of the throughput runs (50000), -n updates per run (2000000),
+    -x random seed. Exits with a failure when a check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf */
+#include <stdlib.h>     /* malloc, calloc, free, strtoul, strtoull */
+#include <string.h>     /* memset */
+#include <time.h>       /* clock_gettime */
+#include <unistd.h>     /* getopt */
+
+#include "devtable.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define SMALL_MAX           37          /* devices of the eviction test table */
+#define SMALL_DEV_NB        120         /* devices heard by the eviction test */
+#define SMALL_UPDATE_NB     200000
+#define SMALL_CHECK_EVERY   997
+#define DEV_ADDR_BASE       0x26011000  /* DevAddrs allocated in sequence, as by a network server */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: " __VA_ARGS__); \
+            nb_fail += 1; \
+        } \
+    } while (0)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint64_t rand_state = 88172645463325252ULL;
+static unsigned nb_fail;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* every entry found from its DevAddr, the recency list covers them all, newest first */
+static bool table_ok(const struct devtable_s *t) {
+    const struct devtable_entry_s *e = NULL;
+    const struct devtable_entry_s *prev = NULL;
+    uint32_t nb_used = 0;
+    uint32_t nb_list = 0;
+    uint32_t i;
+
+    for (i = 0; i <= t->mask; ++i) {
+        if (t->slot[i].used) {
+            nb_used += 1;
+            if (devtable_find(t, t->slot[i].dev_addr) != &t->slot[i]) {
+                return false;
+            }
+        }
+    }
+    while ((e = devtable_next(t, e)) != NULL) {
+        if ((!e->used) || ((prev != NULL) && (prev->last_seen < e->last_seen)) || (nb_list > nb_used)) {
+            return false;
+        }
+        prev = e;
+        nb_list += 1;
+    }
+    return (nb_used == t->nb) && (nb_list == t->nb) && (t->nb <= t->nb_max);
+}
+
+static void test_counters(void) {
+    static uint8_t buf[4096];
+    struct devtable_s t;
+    const struct devtable_entry_s *e;
+    int i;
+
+    devtable_init(&t, buf, 4);
+    devtable_update(&t, DEV_ADDR_BASE, 10, -100.0f, -5.0f, 12, 20, 1);
+    devtable_update(&t, DEV_ADDR_BASE, 11, -100.0f, -5.0f, 12, 20, 2);
+    devtable_update(&t, DEV_ADDR_BASE, 11, -100.0f, -5.0f, 12, 20, 3);       /* duplicate */
+    devtable_update(&t, DEV_ADDR_BASE, 15, -100.0f, -5.0f, 12, 20, 4);       /* 3 lost */
+    devtable_update(&t, DEV_ADDR_BASE, 65534, -100.0f, -5.0f, 12, 20, 5);    /* reset, gap over DEVTABLE_FCNT_GAP_MAX */
+    devtable_update(&t, DEV_ADDR_BASE, 1, -100.0f, -5.0f, 12, 20, 6);        /* wrap-around, 2 lost */
+    e = devtable_update(&t, DEV_ADDR_BASE, 1 + DEVTABLE_FCNT_GAP_MAX, -100.0f, -5.0f, 12, 20, 7); /* largest gap, not a reset */
+    CHECK(e->nb_pkt == 7, "%u uplinks counted instead of 7\n", e->nb_pkt);
+    CHECK(e->nb_dup == 1, "%u duplicates instead of 1\n", e->nb_dup);
+    CHECK(e->nb_reset == 1, "%u resets instead of 1\n", e->nb_reset);
+    CHECK(e->nb_lost == 3 + 2 + DEVTABLE_FCNT_GAP_MAX - 1, "%u uplinks lost instead of %u\n", e->nb_lost, 3 + 2 + DEVTABLE_FCNT_GAP_MAX - 1);
+    CHECK(e->sf_nb[12 - DEVTABLE_SF_MIN] == 7, "%u SF12 uplinks instead of 7\n", e->sf_nb[12 - DEVTABLE_SF_MIN]);
+
+    /* the averages follow a new level, within the truncation of the EWMA steps */
+    for (i = 0; i < 100; ++i) {
+        e = devtable_update(&t, DEV_ADDR_BASE, (uint16_t)(2 + DEVTABLE_FCNT_GAP_MAX + i), -80.0f, 7.5f, 7, 20, 8 + i);
+    }
+    CHECK((e->rssi_avg <= -80 * 16) && (e->rssi_avg > -80 * 16 - (1 << DEVTABLE_EWMA_SHIFT)), "RSSI average %.2f dB instead of -80\n", e->rssi_avg / 16.0);
+    CHECK((e->snr_avg <= 120) && (e->snr_avg > 120 - (1 << DEVTABLE_EWMA_SHIFT)), "SNR average %.2f dB instead of 7.5\n", e->snr_avg / 16.0);
+    CHECK((e->sf_nb[0] == 100) && (e->sf_last == 7), "%u SF7 uplinks instead of 100\n", e->sf_nb[0]);
+    CHECK(t.nb == 1, "%u devices instead of 1\n", t.nb);
+    printf("# counters: gaps, duplicates, wrap-around, resets, averages and SF\n");
+}
+
+static void test_eviction(void) {
+    static uint8_t buf[4096];
+    struct devtable_s t;
+    uint32_t heard[SMALL_DEV_NB]; /* update of the last uplink of each device, 0 = never */
+    uint32_t rank, i, k, d;
+    bool tracked;
+
+    if (devtable_size(SMALL_MAX) > sizeof buf) {
+        CHECK(0, "eviction test buffer too small\n");
+        return;
+    }
+    memset(heard, 0, sizeof heard);
+    devtable_init(&t, buf, SMALL_MAX);
+    for (i = 1; i <= SMALL_UPDATE_NB; ++i) {
+        d = (uint32_t)(rand_next() % SMALL_DEV_NB);
+        devtable_update(&t, DEV_ADDR_BASE + d, (uint16_t)i, -90.0f, 0.0f, 9, 20, i);
+        heard[d] = i;
+        if ((i % SMALL_CHECK_EVERY) != 0) {
+            continue;
+        }
+        if (!table_ok(&t)) {
+            CHECK(0, "update %u: table inconsistent\n", i);
+            return;
+        }
+        /* the devices tracked are the SMALL_MAX most recently heard */
+        for (d = 0; d < SMALL_DEV_NB; ++d) {
+            rank = 0;
+            for (k = 0; k < SMALL_DEV_NB; ++k) {
+                rank += (heard[k] > heard[d]) ? 1 : 0;
+            }
+            tracked = devtable_find(&t, DEV_ADDR_BASE + d) != NULL;
+            if (tracked != ((heard[d] != 0) && (rank < SMALL_MAX))) {
+                CHECK(0, "update %u: device %u heard %u updates ago %s\n", i, d, i - heard[d], tracked ? "still tracked" : "evicted");
+                return;
+            }
+        }
+    }
+    printf("# eviction: %u devices through a table of %u, %u evicted, least recently heard first\n", SMALL_DEV_NB, SMALL_MAX, t.nb_evicted);
+}
+
+/* updates of devices drawn among nb_dev, one in ten after a lost uplink */
+static double run_updates(struct devtable_s *t, uint16_t *fcnt, uint32_t nb_dev, uint32_t nb, uint32_t now) {
+    uint32_t i, d;
+    double t0 = now_s();
+
+    for (i = 0; i < nb; ++i) {
+        d = (uint32_t)(rand_next() % nb_dev);
+        fcnt[d] += ((rand_next() % 10) == 0) ? 2 : 1;
+        devtable_update(t, DEV_ADDR_BASE + d, fcnt[d], -100.0f + (float)(d % 40), 5.0f, 7 + d % 6, 25, now + i / 100);
+    }
+    return (now_s() - t0) * 1e9 / nb;
+}
+
+static void bench(uint32_t nb_dev, uint32_t nb) {
+    struct devtable_s t;
+    size_t size = devtable_size(nb_dev);
+    void *buf = malloc(size);
+    uint16_t *fcnt = calloc(2 * (size_t)nb_dev, sizeof *fcnt);
+    uint32_t i, hit = 0;
+    double ns, t0;
+
+    if ((buf == NULL) || (fcnt == NULL)) {
+        CHECK(0, "no memory for %u devices\n", nb_dev);
+        free(buf);
+        free(fcnt);
+        return;
+    }
+    devtable_init(&t, buf, nb_dev);
+    printf("# %u devices: %u slots of %u bytes, %zu bytes\n", nb_dev, t.mask + 1, (unsigned)sizeof(struct devtable_entry_s), size);
+
+    ns = run_updates(&t, fcnt, nb_dev, nb, 0);
+    CHECK(table_ok(&t), "steady state: table inconsistent\n");
+    CHECK(t.nb_evicted == 0, "steady state: %u evictions\n", t.nb_evicted);
+    printf("# steady state: %.1f ns per update, %u devices tracked\n", ns, t.nb);
+
+    ns = run_updates(&t, fcnt, 2 * nb_dev, nb, nb);
+    CHECK(table_ok(&t), "churn: table inconsistent\n");
+    CHECK(t.nb == nb_dev, "churn: %u devices tracked instead of %u\n", t.nb, nb_dev);
+    printf("# churn of %u devices: %.1f ns per update, %u evicted\n", 2 * nb_dev, ns, t.nb_evicted);
+
+    t0 = now_s();
+    for (i = 0; i < nb; ++i) {
+        hit += (devtable_find(&t, DEV_ADDR_BASE + (uint32_t)(rand_next() % (2 * nb_dev))) != NULL) ? 1 : 0;
+    }
+    printf("# lookup: %.1f ns, %.1f%% found\n", (now_s() - t0) * 1e9 / nb, 100.0 * hit / nb);
+    free(buf);
+    free(fcnt);
+}
+
+static void usage(void) {
+    printf("Usage: devtable_bench [-d devices] [-n updates] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    uint32_t nb_dev = 50000;
+    uint32_t nb = 2000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hd:n:x:")) != -1) {
+        switch (opt) {
+            case 'd': nb_dev = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'n': nb = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    test_counters();
+    test_eviction();
+    if ((nb_dev > 0) && (nb > 0)) {
+        bench(nb_dev, nb);
+    }
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
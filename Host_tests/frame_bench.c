@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test and benchmark of the LoRaWAN MAC header decoder
+    (lorawan_frame.h).
+
+    - known frames: every MType, with and without FPort, FOpts overrunning
+      the frame, MAC commands both in FOpts and in FPort 0, bad sizes and
+      major versions, with the expected result;
+    - fuzzing: random frames and random mutations of valid frames, each one
+      in a buffer of exactly its size, so an address sanitizer build catches
+      a read past the end. The fields of the accepted frames must stay
+      within the frame;
+    - throughput: the frames of a typical gateway (data uplinks, a few joins
+      and proprietary relay frames) decoded in a loop.
+
+    Build and run on the host:
+
+        gcc -O2 -I.. -o frame_bench frame_bench.c ../lorawan_frame.c
+        ./frame_bench
+
+    or, for the fuzzing:
+
+        gcc -O1 -g -fsanitize=address,undefined -I.. -o frame_bench frame_bench.c ../lorawan_frame.c
+        ./frame_bench -n 10000000
+
+    -n fuzzed frames (1000000), -r decoded frames of the throughput run
+    (20000000), -x random seed. Exits with a failure when a check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf */
+#include <stdlib.h>     /* malloc, free, strtoul, strtoull */
+#include <string.h>     /* memcpy */
+#include <time.h>       /* clock_gettime */
+#include <unistd.h>     /* getopt */
+
+#include "lorawan_frame.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define BENCH_FRAME_MAX     255
+#define BENCH_MIX_NB        64
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct vector_s {
+    const char      *name;
+    uint8_t         size;
+    uint8_t         buf[40];
+    enum lorawan_frame_error_e err;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static const struct vector_s vectors[] = {
+    { "unconfirmed uplink, FPort 1", 18,
+      { 0x40, 0x04, 0x03, 0x02, 0x01, 0x80, 0x2A, 0x00, 0x01, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_OK },
+    { "confirmed uplink, no FPort", 12,
+      { 0x80, 0x04, 0x03, 0x02, 0x01, 0x00, 0x01, 0x00, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_OK },
+    { "uplink, 2 bytes of FOpts, FPort 5", 16,
+      { 0x40, 0x04, 0x03, 0x02, 0x01, 0x02, 0x07, 0x00, 0x02, 0x03, 0x05, 0xAA, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_OK },
+    { "uplink, MAC commands in FPort 0", 15,
+      { 0x40, 0x04, 0x03, 0x02, 0x01, 0x00, 0x07, 0x00, 0x00, 0x02, 0x03, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_OK },
+    { "uplink, FOpts and FPort 0", 16,
+      { 0x40, 0x04, 0x03, 0x02, 0x01, 0x01, 0x07, 0x00, 0x02, 0x00, 0x03, 0xAA, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_ERROR_FPORT0 },
+    { "downlink, FOpts and FPort 0", 15,
+      { 0x60, 0x04, 0x03, 0x02, 0x01, 0x21, 0x07, 0x00, 0x02, 0x00, 0xAA, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_ERROR_FPORT0 },
+    { "FOpts overrunning the frame", 14,
+      { 0x40, 0x04, 0x03, 0x02, 0x01, 0x0F, 0x07, 0x00, 0x02, 0x03, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_ERROR_FOPTS },
+    { "uplink shorter than its FHDR", 11,
+      { 0x40, 0x04, 0x03, 0x02, 0x01, 0x00, 0x07, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_ERROR_TOO_SHORT },
+    { "major version 1", 12,
+      { 0x41, 0x04, 0x03, 0x02, 0x01, 0x00, 0x01, 0x00, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_ERROR_MAJOR },
+    { "join request", 23,
+      { 0x00, 0x32, 0xD7, 0x7B, 0x3E, 0xE2, 0x7C, 0xA9, 0x14, 0x01, 0x00, 0x00, 0x90, 0x49, 0xD5, 0xB3, 0x70, 0x34, 0x12, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_OK },
+    { "join request, 1 byte too long", 24,
+      { 0x00, 0x32, 0xD7, 0x7B, 0x3E, 0xE2, 0x7C, 0xA9, 0x14, 0x01, 0x00, 0x00, 0x90, 0x49, 0xD5, 0xB3, 0x70, 0x34, 0x12, 0x00, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_ERROR_JOIN_SIZE },
+    { "join accept", 17,
+      { 0x20, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_OK },
+    { "join accept, 20 bytes", 20,
+      { 0x20, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_ERROR_JOIN_SIZE },
+    { "rejoin request type 0", 19,
+      { 0xC0, 0x00, 0x01, 0x02, 0x03, 0x01, 0x00, 0x00, 0x90, 0x49, 0xD5, 0xB3, 0x70, 0x05, 0x00, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_OK },
+    { "rejoin request type 3", 19,
+      { 0xC0, 0x03, 0x01, 0x02, 0x03, 0x01, 0x00, 0x00, 0x90, 0x49, 0xD5, 0xB3, 0x70, 0x05, 0x00, 0x11, 0x22, 0x33, 0x44 },
+      LORAWAN_FRAME_ERROR_JOIN_SIZE },
+    { "proprietary relay frame", 13,
+      { 0xE0, 0x12, 0x04, 0x01, 0x00, 0xFF, 0xFF, 0x07, 0x00, 0x09, 0x00, 0x01, 0x00 },
+      LORAWAN_FRAME_OK },
+    { "MHDR and 3 bytes", 4,
+      { 0x40, 0x11, 0x22, 0x33 },
+      LORAWAN_FRAME_ERROR_TOO_SHORT },
+    { "empty", 0, { 0 }, LORAWAN_FRAME_ERROR_TOO_SHORT }
+};
+
+static uint64_t rand_state = 88172645463325252ULL;
+static unsigned nb_fail;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void fail(const char *what, const uint8_t *buf, uint16_t size) {
+    uint16_t i;
+
+    nb_fail += 1;
+    fprintf(stderr, "FAIL: %s:", what);
+    for (i = 0; i < size; ++i) {
+        fprintf(stderr, " %02X", buf[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+/* the fields of an accepted frame, all within the frame */
+static bool view_consistent(const struct lorawan_frame_view *v) {
+    if ((v->mic_offset + LORAWAN_MIC_SIZE != v->size) || (v->payload_offset + v->payload_size != v->mic_offset)) {
+        return false;
+    }
+    if (v->has_fhdr && (v->fopts_offset + v->fopts_len + (v->has_fport ? 1 : 0) != v->payload_offset)) {
+        return false;
+    }
+    if (v->has_fport && (v->fport == 0) && (v->fopts_len > 0)) {
+        return false;
+    }
+    return v->has_fhdr || !v->has_fport;
+}
+
+static void check_vectors(void) {
+    struct lorawan_frame_view view;
+    enum lorawan_frame_error_e err;
+    unsigned i;
+
+    for (i = 0; i < sizeof vectors / sizeof vectors[0]; ++i) {
+        err = lorawan_frame_parse(vectors[i].buf, vectors[i].size, &view);
+        if (err != vectors[i].err) {
+            fprintf(stderr, "FAIL: %s: error %d, %d expected\n", vectors[i].name, err, vectors[i].err);
+            nb_fail += 1;
+        } else if ((err == LORAWAN_FRAME_OK) && !view_consistent(&view)) {
+            fail(vectors[i].name, vectors[i].buf, vectors[i].size);
+        }
+    }
+    if (lorawan_frame_parse(NULL, 0, &view) != LORAWAN_FRAME_ERROR_INVALID) {
+        fprintf(stderr, "FAIL: NULL buffer accepted\n");
+        nb_fail += 1;
+    }
+    printf("# %u known frames checked\n", i);
+}
+
+/* a random frame, or a valid one with a few bytes changed, or cut, or extended */
+static uint16_t fuzz_frame(uint8_t *buf) {
+    const struct vector_s *v;
+    uint16_t size;
+    unsigned i, n;
+
+    if (rand_next() % 4 == 0) {
+        size = (uint16_t)(rand_next() % (BENCH_FRAME_MAX + 1));
+        for (i = 0; i < size; ++i) {
+            buf[i] = (uint8_t)rand_next();
+        }
+        return size;
+    }
+    v = &vectors[rand_next() % (sizeof vectors / sizeof vectors[0])];
+    size = v->size;
+    memcpy(buf, v->buf, size);
+    switch (rand_next() % 3) {
+        case 0:
+            size = (size > 0) ? (uint16_t)(rand_next() % size) : 0;
+            break;
+        case 1:
+            n = (unsigned)(rand_next() % 16);
+            for (i = 0; i < n; ++i) {
+                buf[size++] = (uint8_t)rand_next();
+            }
+            break;
+        default:
+            break;
+    }
+    n = (unsigned)(rand_next() % 4);
+    for (i = 0; (i < n) && (size > 0); ++i) {
+        buf[rand_next() % size] ^= (uint8_t)(1 << (rand_next() % 8));
+    }
+    return size;
+}
+
+static void fuzz(unsigned long nb) {
+    uint8_t frame[BENCH_FRAME_MAX + 16];
+    struct lorawan_frame_view view;
+    unsigned long n, nb_ok = 0, nb_err[8] = { 0 };
+    enum lorawan_frame_error_e err;
+    uint8_t *buf;
+    uint16_t size;
+    double t0;
+
+    t0 = now_s();
+    for (n = 0; n < nb; ++n) {
+        size = fuzz_frame(frame);
+        /* exactly the size of the frame, a read past its end is caught by the sanitizer */
+        buf = malloc((size > 0) ? size : 1);
+        if (buf == NULL) {
+            fprintf(stderr, "ERROR: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(buf, frame, size);
+        err = lorawan_frame_parse(buf, size, &view);
+        if (err == LORAWAN_FRAME_OK) {
+            nb_ok += 1;
+            if (!view_consistent(&view)) {
+                fail("inconsistent view", buf, size);
+            }
+        } else if ((unsigned)err < 8) {
+            nb_err[err] += 1;
+        }
+        free(buf);
+    }
+    printf("# %lu fuzzed frames in %.2f s: %lu accepted, %lu too short, %lu bad major, %lu FOpts overrun, %lu join size, %lu FOpts with FPort 0\n",
+           nb, now_s() - t0, nb_ok, nb_err[LORAWAN_FRAME_ERROR_TOO_SHORT], nb_err[LORAWAN_FRAME_ERROR_MAJOR],
+           nb_err[LORAWAN_FRAME_ERROR_FOPTS], nb_err[LORAWAN_FRAME_ERROR_JOIN_SIZE], nb_err[LORAWAN_FRAME_ERROR_FPORT0]);
+}
+
+static void throughput(unsigned long nb) {
+    static uint8_t mix[BENCH_MIX_NB][BENCH_FRAME_MAX];
+    uint16_t mix_size[BENCH_MIX_NB];
+    struct lorawan_frame_view view;
+    volatile uint32_t sink = 0;
+    unsigned long n;
+    unsigned i, j;
+    double t0, dt;
+
+    /* mostly data uplinks of 6 to 51 bytes of FRMPayload, 1 join in 16, 1 relay frame in 16 */
+    for (i = 0; i < BENCH_MIX_NB; ++i) {
+        const struct vector_s *v = (i % 16 == 5) ? &vectors[9] : (i % 16 == 11) ? &vectors[15] : &vectors[0];
+
+        memcpy(mix[i], v->buf, v->size);
+        mix_size[i] = v->size;
+        if (v == &vectors[0]) {
+            mix_size[i] = (uint16_t)(9 + 6 + rand_next() % 46 + LORAWAN_MIC_SIZE);
+            for (j = 9; j < mix_size[i]; ++j) {
+                mix[i][j] = (uint8_t)rand_next();
+            }
+        }
+    }
+
+    t0 = now_s();
+    for (n = 0; n < nb; ++n) {
+        i = (unsigned)(n % BENCH_MIX_NB);
+        if (lorawan_frame_parse(mix[i], mix_size[i], &view) == LORAWAN_FRAME_OK) {
+            sink += view.dev_addr ^ view.payload_size;
+        }
+    }
+    dt = now_s() - t0;
+    printf("# %lu frames decoded in %.3f s: %.1f ns per frame, %.1f M frames per s\n", nb, dt, dt * 1e9 / (double)nb, (double)nb / dt / 1e6);
+    (void)sink;
+}
+
+static void usage(void) {
+    printf("Usage: frame_bench [-n fuzzed frames] [-r decoded frames] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    unsigned long nb_fuzz = 1000000;
+    unsigned long nb_run = 20000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:r:x:")) != -1) {
+        switch (opt) {
+            case 'n': nb_fuzz = strtoul(optarg, NULL, 0); break;
+            case 'r': nb_run = strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    check_vectors();
+    fuzz(nb_fuzz);
+    if (nb_run > 0) {
+        throughput(nb_run);
+    }
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host stand-in for the trace header of the firmware tree: the log levels
+    of the forwarder, for the modules logging through logcat.h.
+*/
+
+#ifndef _LORA_PKTFWD_TRACE_H
+#define _LORA_PKTFWD_TRACE_H
+
+#include <stdio.h>      /* printf */
+
+#define LORAPF_ERROR_       1
+#define LORAPF_WARN_        2
+#define LORAPF_INFO_        3
+#define LORAPF_DEBUG_       4
+
+#ifndef LORAPF_DEBUG_LEVEL
+#define LORAPF_DEBUG_LEVEL  LORAPF_INFO_
+#endif
+
+#define MSG(args...)        printf(args)
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host benchmark of the per-packet cost of the logger (logcat.h), at each
+    level from none to debug.
+
+    The packets go through the log sites of the upstream path of the
+    forwarder: the fetch of a batch of 8 packets, the frame of each packet,
+    the repeater, and the warning on an unknown status, 1 packet in 16. For
+    each level:
+    - compiled out: the sites above the level are removed by LOGCAT_MAX_<cat>,
+      the others are deferred;
+    - deferred: every site compiled in, the ones above the level filtered at
+      run time, the others copied to the ring, the time of the packet thread
+      and, apart, the one of logcat_drain formatting them after each batch;
+    - synchronous: every site compiled in, the messages formatted by the
+      packet thread.
+
+    The lines are counted and discarded, the time to write them to the UART
+    is not included. The time of a batch without any site, the clock read
+    included, is subtracted.
+
+    Build and run on the host:
+
+        gcc -O2 -Iinclude -I.. -o logcat_bench logcat_bench.c ../logcat.c -lpthread
+        ./logcat_bench
+
+    -n packets per run (1000000), -x random seed.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf */
+#include <stdlib.h>     /* strtoul, strtoull */
+#include <string.h>     /* strlen */
+#include <time.h>       /* clock_gettime */
+#include <unistd.h>     /* getopt */
+
+#include "trace.h"
+
+/* one subsystem per level compiled in, up filtered at run time only */
+#define LOGCAT_MAX_MAIN         0
+#define LOGCAT_MAX_DOWN         LORAPF_ERROR_
+#define LOGCAT_MAX_JIT          LORAPF_WARN_
+#define LOGCAT_MAX_REPEATER     LORAPF_INFO_
+#define LOGCAT_MAX_CONFIG       LORAPF_DEBUG_
+#define LOGCAT_MAX_UP           LORAPF_DEBUG_
+
+#include "logcat.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define BATCH_NB            8       /* packets per fetch of the forwarder */
+#define PKT_MIX_NB          256
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+/* log sites of a batch of packets, the ones of thread_up and the repeater in pkt_fwd.c */
+#define BATCH_SITES(cat) \
+    static void batch_##cat(const struct pkt_s *pkt, int nb) { \
+        int i; \
+        LOGCAT_DEBUG(cat, "[rx  ] %d packets fetched\n", nb); \
+        for (i = 0; i < nb; ++i) { \
+            const struct pkt_s *p = &pkt[i]; \
+            if (p->join) { \
+                LOGCAT_DEBUG(cat, "[up  ] JoinRequest from DevEUI: %016llX\n", p->dev_eui); \
+            } else { \
+                LOGCAT_DEBUG(cat, "[up  ] %s from mote: %08X (fcnt=%u)\n", p->mtype, p->dev_addr, p->fcnt); \
+            } \
+            if (p->status != 0x10) { \
+                LOGCAT_WARN(cat, "[up  ] received packet with unknown status %u (size %u, modulation %u, BW %u, DR %u, RSSI %.1f)\n", p->status, p->size, 0x10u, 0x03u, p->datarate, p->rssi); \
+            } \
+            LOGCAT_DEBUG(cat, "[rep ] %u bytes repeated on %u Hz\n", p->size, p->freq_hz); \
+        } \
+    }
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct pkt_s {
+    bool                join;
+    unsigned long long  dev_eui;
+    const char          *mtype;
+    uint32_t            dev_addr;
+    unsigned            fcnt;
+    unsigned            status;
+    unsigned            size;
+    unsigned            datarate;
+    uint32_t            freq_hz;
+    float               rssi;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint64_t rand_state = 88172645463325252ULL;
+static volatile size_t nb_byte;
+static unsigned long nb_line;
+
+static struct pkt_s mix[PKT_MIX_NB];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void line_discard(const char *line) {
+    nb_byte += strlen(line);
+    nb_line += 1;
+}
+
+static void batch_empty(const struct pkt_s *pkt, int nb) {
+    (void)pkt;
+    (void)nb;
+}
+
+BATCH_SITES(MAIN)
+BATCH_SITES(DOWN)
+BATCH_SITES(JIT)
+BATCH_SITES(REPEATER)
+BATCH_SITES(CONFIG)
+BATCH_SITES(UP)
+
+static void (*const batch_out[])(const struct pkt_s *, int) = {batch_MAIN, batch_DOWN, batch_JIT, batch_REPEATER, batch_CONFIG};
+
+static void mix_init(void) {
+    static const char *mtype[] = {"UnconfirmedDataUp", "ConfirmedDataUp"};
+    int i;
+
+    for (i = 0; i < PKT_MIX_NB; ++i) {
+        mix[i].join = (i % 16 == 3);
+        mix[i].dev_eui = rand_next();
+        mix[i].mtype = mtype[rand_next() % 2];
+        mix[i].dev_addr = (uint32_t)rand_next();
+        mix[i].fcnt = (unsigned)(rand_next() % 65536);
+        mix[i].status = (i % 16 == 7) ? 0x01 : 0x10;
+        mix[i].size = (unsigned)(13 + rand_next() % 52);
+        mix[i].datarate = 2u << (rand_next() % 6);
+        mix[i].freq_hz = 868100000 + 200000 * (uint32_t)(rand_next() % 3);
+        mix[i].rssi = -120.0f + (float)(rand_next() % 900) / 10.0f;
+    }
+}
+
+/* ns per packet of the packet thread, and of logcat_drain when deferred */
+static double run(void (*batch)(const struct pkt_s *, int), bool defer, unsigned long nb, double *drain_ns) {
+    double t_put = 0.0;
+    double t_drain = 0.0;
+    double t0, t1;
+    unsigned long n;
+
+    logcat_defer(defer);
+    for (n = 0; n < nb; n += BATCH_NB) {
+        t0 = now_s();
+        batch(&mix[n % PKT_MIX_NB], BATCH_NB);
+        t1 = now_s();
+        logcat_drain();
+        t_put += t1 - t0;
+        t_drain += now_s() - t1;
+    }
+    logcat_defer(false);
+    *drain_ns = t_drain * 1e9 / (double)nb;
+    return t_put * 1e9 / (double)nb;
+}
+
+static void usage(void) {
+    printf("Usage: logcat_bench [-n packets] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    static const char *level_str[] = {"none", "error", "warn", "info", "debug"};
+    struct logcat_stat_s stat;
+    unsigned long nb = 1000000;
+    double base_ns, base_drain, out_ns, def_ns, sync_ns, out_drain, def_drain, sync_drain;
+    unsigned long line_def;
+    int level, opt;
+
+    while ((opt = getopt(argc, argv, "hn:x:")) != -1) {
+        switch (opt) {
+            case 'n': nb = strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    nb = (nb + BATCH_NB - 1) / BATCH_NB * BATCH_NB;
+    if (nb == 0) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    mix_init();
+    logcat_init(line_discard);
+    base_ns = run(batch_empty, true, nb, &base_drain);
+    printf("# %lu packets per run, %d per fetch, ns per packet, %.1f + %.1f of an empty batch subtracted\n", nb, BATCH_NB, base_ns, base_drain);
+    printf("# level   compiled out  deferred (+ drain)  synchronous  lines per packet\n");
+    for (level = 0; level <= LORAPF_DEBUG_; ++level) {
+        logcat_set_level(LOGCAT_NB, LORAPF_DEBUG_);
+        out_ns = run(batch_out[level], true, nb, &out_drain);
+        logcat_set_level(LOGCAT_NB, level);
+        nb_line = 0;
+        def_ns = run(batch_UP, true, nb, &def_drain);
+        line_def = nb_line;
+        sync_ns = run(batch_UP, false, nb, &sync_drain);
+        printf("# %-7s %12.1f  %8.1f (+ %5.1f)  %11.1f  %16.3f\n", level_str[level], out_ns - base_ns, def_ns - base_ns, def_drain - base_drain, sync_ns - base_ns, (double)line_def / (double)nb);
+    }
+    logcat_get_stat(&stat);
+    printf("# %u messages, %u dropped, %u waiting at most\n", stat.nb_put, stat.nb_dropped, stat.nb_max);
+    return (stat.nb_dropped == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
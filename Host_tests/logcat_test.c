@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test of the logger (logcat.h), every line compared with the one
+    snprintf writes for the same format and arguments.
+
+    - conversions: d i u o x X c f F e E g G a A s p and %%, the length
+      modifiers hh h l ll z j t, the flags, width and precision, written in
+      the format or given with *, negative ones included, deferred and
+      synchronous;
+    - truncation: the string arguments of a deferred message beyond
+      LOGCAT_STR_SIZE bytes, the lines beyond LOGCAT_LINE_SIZE, the format
+      written as is from an argument that cannot be copied;
+    - full ring: the messages beyond LOGCAT_RING_NB are dropped, counted and
+      reported by logcat_drain, an error is written at once, after the
+      messages waiting, even on a full ring;
+    - levels: a message above the level set at run time, or above the one
+      compiled in, is not logged;
+    - random: random values, widths and precisions through * conversions.
+
+    Build and run on the host:
+
+        gcc -O2 -Iinclude -I.. -o logcat_test logcat_test.c ../logcat.c -lpthread
+        ./logcat_test
+
+    -n random messages (100000), -x random seed. Exits with a failure when a
+    check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stddef.h>     /* size_t, ptrdiff_t */
+#include <stdio.h>      /* printf, fprintf, snprintf */
+#include <stdlib.h>     /* strtoul, strtoull */
+#include <string.h>     /* strcmp, strncpy, memset */
+#include <limits.h>     /* INT_MIN, LLONG_MIN, ULLONG_MAX */
+#include <unistd.h>     /* getopt */
+
+#include "logcat.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define LINE_NB             (LOGCAT_RING_NB + 8)    /* lines kept by the test output */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: " __VA_ARGS__); \
+            nb_fail += 1; \
+        } \
+    } while (0)
+
+/* log a message at level and drain it */
+#define LOG_LINE(level, ...) do { \
+        nb_line = 0; \
+        logcat_put((level), __VA_ARGS__); \
+        logcat_drain(); \
+    } while (0)
+
+/* log a message at level and compare the line with snprintf */
+#define CMP(level, ...) do { \
+        char ref[LOGCAT_LINE_SIZE]; \
+        snprintf(ref, sizeof ref, __VA_ARGS__); \
+        LOG_LINE((level), __VA_ARGS__); \
+        compare(__LINE__, ref); \
+    } while (0)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint64_t rand_state = 88172645463325252ULL;
+static unsigned nb_fail;
+static unsigned nb_cmp;
+
+static char lines[LINE_NB][LOGCAT_LINE_SIZE];
+static int nb_line;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static void line_keep(const char *line) {
+    if (nb_line < LINE_NB) {
+        strncpy(lines[nb_line], line, LOGCAT_LINE_SIZE - 1);
+        lines[nb_line][LOGCAT_LINE_SIZE - 1] = '\0';
+    }
+    nb_line += 1;
+}
+
+static void compare(int src_line, const char *ref) {
+    nb_cmp += 1;
+    if (nb_line != 1) {
+        CHECK(false, "line %d: %d lines written instead of 1\n", src_line, nb_line);
+        return;
+    }
+    CHECK(strcmp(lines[0], ref) == 0, "line %d: \"%s\" instead of \"%s\"\n", src_line, lines[0], ref);
+}
+
+static void test_conversions(bool defer) {
+    volatile int zero = 0;
+    const char *null_str = (zero == 0) ? NULL : "";
+    signed char sc = -100;
+    short sh = -30000;
+    size_t sz = 123456789;
+    intmax_t im = -9876543210LL;
+    uintmax_t um = 9876543210ULL;
+    ptrdiff_t pd = -4096;
+    double pi = 3.14159265358979;
+    int x = 0;
+
+    logcat_defer(defer);
+    nb_cmp = 0;
+
+    CMP(LORAPF_INFO_, "no conversion\n");
+    CMP(LORAPF_INFO_, "100%% %d%%, %%s %%%%\n", 5);
+    CMP(LORAPF_INFO_, "%d %i %d %d %i\n", 0, -42, INT_MIN, INT_MAX, 7);
+    CMP(LORAPF_INFO_, "%u %o %x %X %u\n", 0u, 0755u, 0xdeadbeefu, 0xcafeu, UINT_MAX);
+    CMP(LORAPF_INFO_, "[%5d] [%-5d] [%05d] [%+d] [% d] [%+05d] [%-+6d]\n", 42, 42, 42, 42, 42, -42, 7);
+    CMP(LORAPF_INFO_, "[%#o] [%#x] [%#X] [%08x] [%.5u] [%8.3x] [%.0d]\n", 8u, 255u, 255u, 0xabu, 12u, 0xfu, 0);
+    CMP(LORAPF_INFO_, "%hhd %hhu %hhx %hd %hu %hx\n", sc, 300, 0x1ff, sh, 70000, 0x12345);
+    CMP(LORAPF_INFO_, "%ld %lu %lx %li\n", LONG_MIN, ULONG_MAX, 0x7fffffffL, -1L);
+    CMP(LORAPF_INFO_, "%lld %llu %llX %016llX %lli\n", LLONG_MIN, ULLONG_MAX, 0x0123456789abcdefULL, 0x1ULL, LLONG_MAX);
+    CMP(LORAPF_INFO_, "%zu %zx %jd %ju %td %tx\n", sz, sz, im, um, pd, (ptrdiff_t)255);
+    CMP(LORAPF_INFO_, "%c%c%c [%3c] [%-3c]\n", 'a', 'b', 'c', 'x', 'y');
+    CMP(LORAPF_INFO_, "%f %F %.3f [%10.2f] [%-10.1f] [%+.0f] [%#.0f]\n", pi, -pi, pi, pi, -pi, 2.5, 3.0);
+    CMP(LORAPF_INFO_, "%e %E %.2e %g %G %g %g\n", pi, -1e-20, 6.02e23, pi, 1e-10, 100000.0, 1e6);
+    CMP(LORAPF_INFO_, "%a %A %.2a %f %f\n", pi, -0.5, 1.0, 1.0 / zero, -0.0);
+    CMP(LORAPF_INFO_, "[%s] [%10s] [%-10s] [%.3s] [%s] [%s]\n", "abc", "right", "left", "truncated", "", null_str);
+    CMP(LORAPF_INFO_, "%p %p\n", (void *)&x, (void *)NULL);
+
+    /* width and precision given as arguments */
+    CMP(LORAPF_INFO_, "[%*d] [%-*d] [%*d]\n", 6, 42, 6, 42, -6, 42);
+    CMP(LORAPF_INFO_, "[%.*f] [%.*f] [%.*d]\n", 2, pi, -1, pi, 4, 7);
+    CMP(LORAPF_INFO_, "[%*.*s] [%-*.*s]\n", 8, 3, "abcdef", 8, -2, "abc");
+    CMP(LORAPF_INFO_, "[%*.*e] [%0*x]\n", 12, 2, pi, 6, 0xffu);
+
+    printf("# conversions, %s: %u lines compared\n", defer ? "deferred" : "synchronous", nb_cmp);
+}
+
+static void test_truncation(void) {
+    const char *s70 = "0123456789012345678901234567890123456789012345678901234567890123456789";
+    char s40[41];
+    char ref[LOGCAT_LINE_SIZE];
+    struct logcat_stat_s stat;
+    volatile int w200 = 200;
+    int n_left;
+
+    memset(s40, 'a', 40);
+    s40[40] = '\0';
+    n_left = LOGCAT_STR_SIZE - 1 - 41;
+
+    /* deferred, the strings share LOGCAT_STR_SIZE bytes, terminating nulls included */
+    logcat_defer(true);
+    CMP(LORAPF_INFO_, "[%s] %d\n", s40, 1);
+    snprintf(ref, sizeof ref, "[%s] [%.*s] []\n", s40, n_left, s40);
+    LOG_LINE(LORAPF_INFO_, "[%s] [%s] [%s]\n", s40, s40, "lost");
+    compare(__LINE__, ref);
+    snprintf(ref, sizeof ref, "[%.*s]\n", LOGCAT_STR_SIZE - 1, s70);
+    LOG_LINE(LORAPF_INFO_, "[%s]\n", s70);
+    compare(__LINE__, ref);
+
+    /* synchronous, the strings are not copied */
+    logcat_defer(false);
+    CMP(LORAPF_INFO_, "[%s] [%s] [%s]\n", s40, s40, s40);
+
+    /* lines truncated to LOGCAT_LINE_SIZE - 1 characters, deferred and synchronous */
+    logcat_defer(true);
+    CMP(LORAPF_INFO_, "%*d|%*d|%s\n", w200, 1, w200 / 2, 2, "end");
+    CMP(LORAPF_INFO_, "%*s|%d\n", w200 + w200 / 2, "x", 3);
+    logcat_defer(false);
+    CMP(LORAPF_INFO_, "%*d|%*d|%s\n", w200, 1, w200 / 2, 2, "end");
+
+    /* deferred, written as is from the argument that cannot be copied */
+    logcat_defer(true);
+    LOG_LINE(LORAPF_INFO_, "%d %d %d %d %d %d %d %d %d\n", 1, 2, 3, 4, 5, 6, 7, 8, 9);
+    compare(__LINE__, "1 2 3 4 5 6 7 8 %d\n");
+    LOG_LINE(LORAPF_INFO_, "%d %d %d %d %d %d %d %*d\n", 1, 2, 3, 4, 5, 6, 7, 3, 8);
+    compare(__LINE__, "1 2 3 4 5 6 7 %*d\n");
+    LOG_LINE(LORAPF_INFO_, "%d %Lf %d\n", 1, (long double)2.0, 3);
+    compare(__LINE__, "1 %Lf %d\n");
+    LOG_LINE(LORAPF_INFO_, "%d %ls\n", 1, L"wide");
+    compare(__LINE__, "1 %ls\n");
+    logcat_get_stat(&stat);
+    CHECK(stat.nb_dropped == 0, "%u messages dropped\n", stat.nb_dropped);
+    printf("# truncation: string arguments at %u bytes, lines at %u characters, %u arguments\n", LOGCAT_STR_SIZE, LOGCAT_LINE_SIZE - 1, LOGCAT_ARG_MAX);
+}
+
+static void test_ring(void) {
+    struct logcat_stat_s stat;
+    char ref[LOGCAT_LINE_SIZE];
+    int i;
+
+    logcat_init(line_keep);
+    logcat_defer(true);
+    nb_line = 0;
+
+    /* an error is written at once, after the messages waiting */
+    logcat_put(LORAPF_INFO_, "info %d\n", 1);
+    CHECK(nb_line == 0, "deferred message written by logcat_put\n");
+    logcat_put(LORAPF_ERROR_, "error %d\n", 2);
+    CHECK((nb_line == 2) && (strcmp(lines[0], "info 1\n") == 0) && (strcmp(lines[1], "error 2\n") == 0), "error not written at once after the message waiting\n");
+    CHECK(logcat_drain() == 0, "ring not empty after an error\n");
+
+    /* fill the ring, drop, then an error */
+    nb_line = 0;
+    for (i = 0; i < LOGCAT_RING_NB + 5; ++i) {
+        logcat_put(LORAPF_INFO_, "message %d\n", i);
+    }
+    CHECK(nb_line == 0, "%d deferred messages written by logcat_put\n", nb_line);
+    logcat_get_stat(&stat);
+    CHECK((stat.nb_dropped == 5) && (stat.nb_max == LOGCAT_RING_NB), "full ring: %u dropped, %u at most\n", stat.nb_dropped, stat.nb_max);
+    logcat_put(LORAPF_ERROR_, "error on a full ring %s\n", "written");
+    CHECK(nb_line == LOGCAT_RING_NB + 2, "%d lines written on an error with a full ring\n", nb_line);
+    for (i = 0; (i < LOGCAT_RING_NB) && (i < nb_line); ++i) {
+        snprintf(ref, sizeof ref, "message %d\n", i);
+        CHECK(strcmp(lines[i], ref) == 0, "full ring: \"%s\" instead of \"%s\"\n", lines[i], ref);
+    }
+    snprintf(ref, sizeof ref, "[log ] %u messages dropped, the log ring was full\n", 5u);
+    CHECK((nb_line > LOGCAT_RING_NB) && (strcmp(lines[LOGCAT_RING_NB], ref) == 0), "no drop notice\n");
+    CHECK((nb_line > LOGCAT_RING_NB + 1) && (strcmp(lines[LOGCAT_RING_NB + 1], "error on a full ring written\n") == 0), "error on a full ring not written\n");
+
+    /* drops are reported once */
+    nb_line = 0;
+    logcat_put(LORAPF_WARN_, "warn %d\n", 3);
+    CHECK((logcat_drain() == 1) && (nb_line == 1), "drop notice written again\n");
+    logcat_get_stat(&stat);
+    CHECK(stat.nb_put == LOGCAT_RING_NB + 9, "%u messages put instead of %u\n", stat.nb_put, LOGCAT_RING_NB + 9);
+    CHECK(stat.nb_drained + stat.nb_dropped == stat.nb_put, "%u written and %u dropped of %u\n", stat.nb_drained, stat.nb_dropped, stat.nb_put);
+
+    /* the ring is drained when the deferral stops */
+    nb_line = 0;
+    logcat_put(LORAPF_INFO_, "info %d\n", 4);
+    logcat_defer(false);
+    CHECK(nb_line == 1, "ring not drained by logcat_defer(false)\n");
+    printf("# full ring: %u messages kept, the others dropped and reported, errors written at once\n", LOGCAT_RING_NB);
+}
+
+static void test_levels(void) {
+    logcat_init(line_keep);
+    nb_line = 0;
+    LOGCAT_INFO(UP, "kept %d\n", 1);
+    CHECK(nb_line == 1, "info message not logged at the info level\n");
+    logcat_set_level(LOGCAT_UP, LORAPF_WARN_);
+    LOGCAT_INFO(UP, "filtered %d\n", 2);
+    LOGCAT_INFO(DOWN, "kept %d\n", 3);
+    CHECK(nb_line == 2, "info message logged at the warn level\n");
+    logcat_set_level(LOGCAT_NB, LORAPF_DEBUG_);
+    LOGCAT_DEBUG(UP, "compiled out %d\n", 4);
+    CHECK(nb_line == 2 + ((LOGCAT_MAX_UP >= LORAPF_DEBUG_) ? 1 : 0), "debug message logged above the level compiled in\n");
+    CHECK(logcat_set_level(LOGCAT_NB + 1, 0) == -1, "level set on a subsystem that does not exist\n");
+    CHECK((logcat_find("repeater") == LOGCAT_REPEATER) && (logcat_find("none") == -1), "subsystem names\n");
+    CHECK(strcmp(logcat_name(logcat_find("config")), "config") == 0, "subsystem names\n");
+    logcat_set_level(LOGCAT_NB, LORAPF_INFO_);
+    printf("# levels: run-time level and level compiled in (%d) applied\n", LOGCAT_MAX_UP);
+}
+
+static void test_random(uint32_t nb) {
+    static const char *str[] = {"", "a", "up", "JoinRequest", "UnconfirmedDataUp", "0123456789abcdef0123456789abcdef"};
+    const char *s;
+    long long ll;
+    unsigned long long ull;
+    double d;
+    int w1, w2, w3, p1, p2, p3, p4;
+    uint32_t i;
+
+    logcat_init(line_keep);
+    nb_cmp = 0;
+    for (i = 0; i < nb; ++i) {
+        logcat_defer((i & 1) == 0);
+        w1 = (int)(rand_next() % 41) - 20;
+        w2 = (int)(rand_next() % 41) - 20;
+        w3 = (int)(rand_next() % 41) - 20;
+        p1 = (int)(rand_next() % 15) - 2;
+        p2 = (int)(rand_next() % 15) - 2;
+        p3 = (int)(rand_next() % 15) - 2;
+        p4 = (int)(rand_next() % 15) - 2;
+        ll = (long long)rand_next() >> (rand_next() % 64);
+        ull = rand_next() >> (rand_next() % 64);
+        s = str[rand_next() % (sizeof str / sizeof str[0])];
+        d = (double)(long long)rand_next() / (double)(1ULL << (rand_next() % 64));
+        CMP(LORAPF_INFO_, "[%*.*lld] [%-*.*llx] [%.*s]\n", w1, p1, ll, w2, p2, ull, p3, s);
+        CMP(LORAPF_INFO_, "[%*.*e] [%*.*g] [%c]\n", w3, p4, d, w1, p2, d, (int)('a' + i % 26));
+    }
+    logcat_defer(false);
+    printf("# random: %u lines compared\n", nb_cmp);
+}
+
+static void usage(void) {
+    printf("Usage: logcat_test [-n messages] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    uint32_t nb = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:x:")) != -1) {
+        switch (opt) {
+            case 'n': nb = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    logcat_init(line_keep);
+    test_conversions(true);
+    test_conversions(false);
+    test_truncation();
+    test_ring();
+    test_levels();
+    test_random(nb);
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Local upstream server for testing the forwarder: answers PUSH_DATA
+    (JSON rxpk or PKT_PUSH_BIN records, see uplink_bin.h) and PULL_DATA
+    like a network server, and reports how the uplinks arrive:
+
+    - datagrams, packets, packets per datagram and bytes per packet, to see
+      the coalescing of push_mtu and push_flush_us at work;
+    - status reports;
+    - datagrams received again with the token and size of a recent one,
+      the retransmissions of a PUSH_DATA whose ACK was late or lost.
+
+    The ACKs can be delayed (-d, -j) and dropped (-l), to give the
+    forwarder the backhaul of a cellular link: its RTT estimate, time-outs
+    and store-and-forward can be observed in its statistics. Run one
+    instance per entry of "servers" to test the fan-out.
+
+    Point server_address of gateway_conf to the host, feed the forwarder
+    with a capture (replay_path, e.g. from Multiple_devices_simulation/
+    fleet_gen) for a repeatable load, then build and run on the host:
+
+        gcc -O2 -DUPLINK_BIN_DECODER_ONLY -I.. -o push_server push_server.c ../uplink_bin.c -lm
+        ./push_server -p 1700 -d 800 -j 400 -l 0.05
+
+    -p UDP port (1700), -d ACK delay in ms (0), -j random extra delay of the
+    ACKs in ms (0), -l fraction of the ACKs dropped (0), -s interval between
+    two reports in s (10), -x random seed. Ctrl-C prints the totals.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#define _GNU_SOURCE     /* memmem */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf */
+#include <stdlib.h>     /* atoi, atof, strtoull */
+#include <string.h>     /* memset, memcpy, memcmp, memmem */
+#include <signal.h>     /* sigaction */
+#include <time.h>       /* clock_gettime */
+#include <unistd.h>     /* getopt, close */
+#include <sys/select.h> /* select */
+#include <sys/socket.h> /* socket, bind, recvfrom, sendto */
+#include <netinet/in.h> /* sockaddr_in6 */
+
+#include "uplink_bin.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define PROTOCOL_VERSION    2
+#define PKT_PUSH_DATA       0
+#define PKT_PUSH_ACK        1
+#define PKT_PULL_DATA       2
+#define PKT_PULL_ACK        4
+#define PKT_PUSH_BIN        0x10
+
+#define SERV_HDR_SIZE       12      /* version, token, identifier, gateway EUI */
+#define SERV_DGRAM_MAX      65536
+#define SERV_ACK_NB         4096    /* ACKs waiting for their delay */
+#define SERV_TOKEN_NB       1024    /* tokens remembered to spot the retransmissions */
+#define SERV_TOKEN_S        30      /* how long a token is remembered */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct ack_s {
+    uint64_t        due_ns;
+    struct sockaddr_in6 addr;
+    socklen_t       addr_len;
+    uint8_t         buf[4];
+};
+
+struct token_s {
+    uint64_t        seen_ns;
+    uint8_t         eui[8];
+    uint16_t        token;
+    uint16_t        size;
+};
+
+struct serv_stat_s {
+    uint64_t        nb_dgram;   /* PUSH_DATA and PKT_PUSH_BIN datagrams */
+    uint64_t        nb_bytes;   /* bytes of these datagrams, UDP payload */
+    uint64_t        nb_pkt;     /* rxpk objects and binary records */
+    uint64_t        nb_bin;     /* PKT_PUSH_BIN datagrams */
+    uint64_t        nb_status;  /* status reports */
+    uint64_t        nb_retx;    /* datagrams with the token and size of a recent one */
+    uint64_t        nb_ack;     /* PUSH_ACK sent */
+    uint64_t        nb_ack_lost; /* PUSH_ACK dropped on purpose */
+    uint64_t        nb_pull;    /* PULL_DATA answered */
+    uint64_t        nb_invalid; /* datagrams not understood */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static struct ack_s ack[SERV_ACK_NB];
+static unsigned ack_head, ack_nb;
+static struct token_s token[SERV_TOKEN_NB];
+static unsigned token_head;
+static struct serv_stat_s total, period;
+
+static double ack_delay_ms = 0;
+static double ack_jitter_ms = 0;
+static double ack_loss = 0;
+static uint64_t rand_state = 88172645463325252ULL;
+
+static volatile sig_atomic_t exit_sig = 0;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static double rand_unit(void) {
+    return (double)(rand_next() >> 11) / 9007199254740992.0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sig_handler(int sig) {
+    (void)sig;
+    exit_sig = 1;
+}
+
+/* true if the gateway sent a datagram of this token and size recently, it is remembered otherwise */
+static bool token_seen(const uint8_t *eui, uint16_t tok, int size, uint64_t now) {
+    unsigned i;
+
+    for (i = 0; i < SERV_TOKEN_NB; ++i) {
+        if ((token[i].seen_ns != 0) && (token[i].token == tok) && (token[i].size == size) && (memcmp(token[i].eui, eui, 8) == 0) &&
+            (now - token[i].seen_ns < SERV_TOKEN_S * 1000000000ULL)) {
+            return true;
+        }
+    }
+    token[token_head].seen_ns = now;
+    token[token_head].token = tok;
+    token[token_head].size = (uint16_t)size;
+    memcpy(token[token_head].eui, eui, 8);
+    token_head = (token_head + 1) % SERV_TOKEN_NB;
+    return false;
+}
+
+static unsigned count_str(const uint8_t *buf, int size, const char *str) {
+    const uint8_t *p = buf, *end = buf + size;
+    size_t len = strlen(str);
+    unsigned n = 0;
+
+    while ((p < end) && ((p = memmem(p, (size_t)(end - p), str, len)) != NULL)) {
+        n += 1;
+        p += len;
+    }
+    return n;
+}
+
+/* packets of a PKT_PUSH_BIN body, -1 if it is not valid */
+static int count_bin(const uint8_t *buf, int size) {
+    struct uplink_bin_rec rec;
+    uint8_t nb_rec;
+    int off, len, n;
+
+    off = uplink_bin_decode_hdr(buf, size, &nb_rec);
+    if (off < 0) {
+        return -1;
+    }
+    for (n = 0; n < nb_rec; ++n) {
+        len = uplink_bin_decode(&buf[off], size - off, &rec);
+        if (len < 0) {
+            return -1;
+        }
+        off += len;
+    }
+    return (off == size) ? n : -1;
+}
+
+static void ack_queue(const uint8_t *hdr, uint8_t type, const struct sockaddr_in6 *addr, socklen_t addr_len, uint64_t now) {
+    struct ack_s *a;
+    double delay_ms;
+
+    if ((type == PKT_PUSH_ACK) && (rand_unit() < ack_loss)) {
+        total.nb_ack_lost += 1;
+        period.nb_ack_lost += 1;
+        return;
+    }
+    if (ack_nb >= SERV_ACK_NB) {
+        return;
+    }
+    /* the ring stays in due order, a jittered ACK waits for the one before it */
+    delay_ms = (type == PKT_PUSH_ACK) ? ack_delay_ms + ack_jitter_ms * rand_unit() : 0;
+    a = &ack[(ack_head + ack_nb) % SERV_ACK_NB];
+    a->due_ns = now + (uint64_t)(delay_ms * 1e6);
+    if ((ack_nb > 0) && (a->due_ns < ack[(ack_head + ack_nb - 1) % SERV_ACK_NB].due_ns)) {
+        a->due_ns = ack[(ack_head + ack_nb - 1) % SERV_ACK_NB].due_ns;
+    }
+    a->addr = *addr;
+    a->addr_len = addr_len;
+    a->buf[0] = PROTOCOL_VERSION;
+    a->buf[1] = hdr[1];
+    a->buf[2] = hdr[2];
+    a->buf[3] = type;
+    ack_nb += 1;
+}
+
+static void ack_send(int sock, uint64_t now) {
+    struct ack_s *a;
+
+    while ((ack_nb > 0) && (ack[ack_head].due_ns <= now)) {
+        a = &ack[ack_head];
+        sendto(sock, a->buf, sizeof a->buf, 0, (const struct sockaddr *)&a->addr, a->addr_len);
+        if (a->buf[3] == PKT_PUSH_ACK) {
+            total.nb_ack += 1;
+            period.nb_ack += 1;
+        }
+        ack_head = (ack_head + 1) % SERV_ACK_NB;
+        ack_nb -= 1;
+    }
+}
+
+static void account(struct serv_stat_s *s, int size, int nb_pkt, bool bin, unsigned nb_status, bool retx) {
+    s->nb_dgram += 1;
+    s->nb_bytes += (uint64_t)size;
+    s->nb_pkt += (uint64_t)nb_pkt;
+    s->nb_bin += bin ? 1 : 0;
+    s->nb_status += nb_status;
+    s->nb_retx += retx ? 1 : 0;
+}
+
+static void receive(int sock, uint64_t now) {
+    static uint8_t buf[SERV_DGRAM_MAX];
+    struct sockaddr_in6 addr;
+    socklen_t addr_len = sizeof addr;
+    unsigned nb_status = 0;
+    bool retx;
+    int size, nb_pkt;
+
+    size = (int)recvfrom(sock, buf, sizeof buf, 0, (struct sockaddr *)&addr, &addr_len);
+    if ((size < 4) || (buf[0] != PROTOCOL_VERSION)) {
+        total.nb_invalid += 1;
+        return;
+    }
+    switch (buf[3]) {
+        case PKT_PUSH_DATA:
+        case PKT_PUSH_BIN:
+            if (size < SERV_HDR_SIZE) {
+                total.nb_invalid += 1;
+                return;
+            }
+            if (buf[3] == PKT_PUSH_BIN) {
+                nb_pkt = count_bin(&buf[SERV_HDR_SIZE], size - SERV_HDR_SIZE);
+            } else {
+                nb_pkt = (int)count_str(&buf[SERV_HDR_SIZE], size - SERV_HDR_SIZE, "\"tmst\":");
+                nb_status = count_str(&buf[SERV_HDR_SIZE], size - SERV_HDR_SIZE, "\"stat\":{");
+            }
+            if (nb_pkt < 0) {
+                total.nb_invalid += 1;
+                return;
+            }
+            retx = token_seen(&buf[4], (uint16_t)(buf[1] | (buf[2] << 8)), size, now);
+            account(&total, size, nb_pkt, buf[3] == PKT_PUSH_BIN, nb_status, retx);
+            account(&period, size, nb_pkt, buf[3] == PKT_PUSH_BIN, nb_status, retx);
+            ack_queue(buf, PKT_PUSH_ACK, &addr, addr_len, now);
+            break;
+        case PKT_PULL_DATA:
+            total.nb_pull += 1;
+            period.nb_pull += 1;
+            ack_queue(buf, PKT_PULL_ACK, &addr, addr_len, now);
+            break;
+        default:
+            total.nb_invalid += 1;
+            break;
+    }
+}
+
+static void report(const char *what, const struct serv_stat_s *s) {
+    printf("# %s: %llu datagrams (%llu binary), %llu packets, %.2f packets per datagram, %.1f bytes per packet, %llu status reports\n",
+           what, (unsigned long long)s->nb_dgram, (unsigned long long)s->nb_bin, (unsigned long long)s->nb_pkt,
+           (s->nb_dgram > 0) ? (double)s->nb_pkt / (double)s->nb_dgram : 0.0,
+           (s->nb_pkt > 0) ? (double)s->nb_bytes / (double)s->nb_pkt : 0.0, (unsigned long long)s->nb_status);
+    printf("# %s: %llu retransmitted, %llu ACKs sent, %llu dropped, %llu PULL_DATA, %llu invalid\n",
+           what, (unsigned long long)s->nb_retx, (unsigned long long)s->nb_ack, (unsigned long long)s->nb_ack_lost,
+           (unsigned long long)s->nb_pull, (unsigned long long)s->nb_invalid);
+    fflush(stdout);
+}
+
+static void usage(void) {
+    printf("Usage: push_server [-p port] [-d ACK delay ms] [-j ACK jitter ms] [-l ACK loss] [-s report interval s] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    struct sockaddr_in6 addr;
+    struct sigaction sigact;
+    struct timeval tv;
+    uint64_t now, next_report, wait_ns, report_ns = 10000000000ULL;
+    int port = 1700, sock, opt, off = 0;
+    fd_set fds;
+
+    while ((opt = getopt(argc, argv, "hp:d:j:l:s:x:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'd': ack_delay_ms = atof(optarg); break;
+            case 'j': ack_jitter_ms = atof(optarg); break;
+            case 'l': ack_loss = atof(optarg); break;
+            case 's': report_ns = (uint64_t)(atof(optarg) * 1e9); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if ((port <= 0) || (port > 65535) || (report_ns == 0)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    /* IPv6 socket accepting IPv4 as well */
+    sock = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        fprintf(stderr, "ERROR: failed to open the socket\n");
+        return EXIT_FAILURE;
+    }
+    setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof off);
+    memset(&addr, 0, sizeof addr);
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons((uint16_t)port);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        fprintf(stderr, "ERROR: failed to bind port %d\n", port);
+        close(sock);
+        return EXIT_FAILURE;
+    }
+    memset(&sigact, 0, sizeof sigact);
+    sigact.sa_handler = sig_handler;
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+
+    printf("### listening on port %d, ACKs after %.0f + [0, %.0f] ms, %.1f%% dropped\n", port, ack_delay_ms, ack_jitter_ms, 100.0 * ack_loss);
+    fflush(stdout);
+    next_report = now_ns() + report_ns;
+    while (!exit_sig) {
+        now = now_ns();
+        wait_ns = (next_report > now) ? next_report - now : 0;
+        if ((ack_nb > 0) && (ack[ack_head].due_ns < now + wait_ns)) {
+            wait_ns = (ack[ack_head].due_ns > now) ? ack[ack_head].due_ns - now : 0;
+        }
+        tv.tv_sec = (time_t)(wait_ns / 1000000000ULL);
+        tv.tv_usec = (suseconds_t)((wait_ns % 1000000000ULL) / 1000);
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        if (select(sock + 1, &fds, NULL, NULL, &tv) > 0) {
+            receive(sock, now_ns());
+        }
+        now = now_ns();
+        ack_send(sock, now);
+        if (now >= next_report) {
+            report("last period", &period);
+            memset(&period, 0, sizeof period);
+            next_report += report_ns;
+        }
+    }
+    report("total", &total);
+    close(sock);
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
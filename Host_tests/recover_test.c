@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test of the escalation of the concentrator recovery (recover.h),
+    on a simulated clock.
+
+    - one outage: a tier is applied again until it failed RECOVER_RETRY_NB
+      times over RECOVER_RETRY_MS, at the fetch period and with slow
+      fetches, three failures in a row only flush the FIFO, the reset is
+      applied again once reached, the downtime runs from the first failure;
+    - hold period: an error within RECOVER_HOLD_MS of a recovery continues
+      the escalation where it was, at RECOVER_HOLD_MS and after it recovery
+      starts again from the FIFO flush;
+    - random outages: the tier of every failure is checked against the
+      rule, the downtimes against the clock.
+
+    Build and run on the host:
+
+        gcc -O2 -I.. -o recover_test recover_test.c ../recover.c
+        ./recover_test
+
+    -n random outages (100000), -x random seed. Exits with a failure when a
+    check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdio.h>      /* printf, fprintf */
+#include <stdlib.h>     /* strtoul, strtoull */
+#include <string.h>     /* memset */
+#include <unistd.h>     /* getopt */
+
+#include "recover.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define MS                  1000000ULL  /* ns */
+#define FETCH_MS            10          /* fetch period of the forwarder */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: " __VA_ARGS__); \
+            nb_fail += 1; \
+        } \
+    } while (0)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint64_t rand_state = 88172645463325252ULL;
+static unsigned nb_fail;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+/* index of the first failure at tier, failures every step_ms, -1 if not reached within nb */
+static int first_failure(enum recover_tier_e tier, uint32_t step_ms, int nb) {
+    struct recover_s rec;
+    uint64_t t = 1000 * MS;
+    int i;
+
+    memset(&rec, 0, sizeof rec);
+    for (i = 0; i < nb; ++i, t += step_ms * MS) {
+        if (recover_escalate(&rec, t) == tier) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void test_outage(void) {
+    struct recover_s rec;
+    uint64_t t = 1000 * MS;
+    enum recover_tier_e tier;
+    uint32_t down_ms;
+    int i, k;
+
+    /* a glitch of three failed fetches is handled by flushes */
+    memset(&rec, 0, sizeof rec);
+    for (i = 0; i < 3; ++i) {
+        tier = recover_escalate(&rec, t);
+        CHECK(tier == RECOVER_FLUSH, "failure %d of a glitch: tier %d\n", i + 1, tier);
+        t += FETCH_MS * MS;
+    }
+    down_ms = recover_end(&rec, t);
+    CHECK(down_ms == 3 * FETCH_MS, "downtime %u ms instead of %u ms\n", down_ms, 3 * FETCH_MS);
+    CHECK(rec.tier == RECOVER_FLUSH, "recovery accounted against tier %d\n", rec.tier);
+    CHECK(rec.down_ns == 0, "outage still in progress after a good fetch\n");
+
+    /* at the fetch period, each tier lasts RECOVER_RETRY_MS */
+    k = RECOVER_RETRY_MS / FETCH_MS;
+    i = first_failure(RECOVER_RESTART, FETCH_MS, 10 * k);
+    CHECK(i == k, "restart at failure %d instead of %d\n", i, k);
+    i = first_failure(RECOVER_RESET, FETCH_MS, 10 * k);
+    CHECK(i == 2 * k, "reset at failure %d instead of %d\n", i, 2 * k);
+
+    /* failures slower than RECOVER_RETRY_MS: each tier is applied RECOVER_RETRY_NB times */
+    i = first_failure(RECOVER_RESTART, 2 * RECOVER_RETRY_MS, 100);
+    CHECK(i == RECOVER_RETRY_NB, "slow failures: restart at failure %d instead of %d\n", i, RECOVER_RETRY_NB);
+    i = first_failure(RECOVER_RESET, 2 * RECOVER_RETRY_MS, 100);
+    CHECK(i == 2 * RECOVER_RETRY_NB, "slow failures: reset at failure %d instead of %d\n", i, 2 * RECOVER_RETRY_NB);
+
+    /* the reset is applied again */
+    memset(&rec, 0, sizeof rec);
+    for (i = 0, t = 1000 * MS; i < 4 * k; ++i, t += FETCH_MS * MS) {
+        tier = recover_escalate(&rec, t);
+    }
+    CHECK(tier == RECOVER_RESET, "failure %d of one outage: tier %d\n", 4 * k, tier);
+    printf("# one outage: flush for %u ms, restart for %u ms, then reset, at a fetch every %u ms\n", RECOVER_RETRY_MS, RECOVER_RETRY_MS, FETCH_MS);
+}
+
+static void test_hold(void) {
+    struct recover_s rec;
+    uint64_t t = 1000 * MS;
+    uint64_t t0 = t;
+    enum recover_tier_e tier;
+    int i;
+
+    /* recoveries holding less than RECOVER_HOLD_MS: the failures add up */
+    memset(&rec, 0, sizeof rec);
+    for (i = 0; i < RECOVER_RETRY_NB; ++i) {
+        tier = recover_escalate(&rec, t);
+        CHECK(tier == RECOVER_FLUSH, "error %d within the hold period: tier %d\n", i + 1, tier);
+        recover_end(&rec, t += FETCH_MS * MS);
+        t += (RECOVER_HOLD_MS - 1) * MS;
+    }
+    CHECK(t - t0 >= RECOVER_RETRY_MS * MS, "test too short\n");
+    tier = recover_escalate(&rec, t);
+    CHECK(tier == RECOVER_RESTART, "error %d within the hold period: tier %d\n", RECOVER_RETRY_NB + 1, tier);
+    recover_end(&rec, t += FETCH_MS * MS);
+    tier = recover_escalate(&rec, t += FETCH_MS * MS);
+    CHECK(tier == RECOVER_RESTART, "error right after a restart: tier %d\n", tier);
+    recover_end(&rec, t += FETCH_MS * MS);
+
+    /* a recovery holding RECOVER_HOLD_MS, then longer: back to the flush */
+    tier = recover_escalate(&rec, t += RECOVER_HOLD_MS * MS);
+    CHECK(tier == RECOVER_FLUSH, "error after exactly the hold period: tier %d\n", tier);
+    recover_end(&rec, t += FETCH_MS * MS);
+    tier = recover_escalate(&rec, t += 3600000 * MS);
+    CHECK(tier == RECOVER_FLUSH, "error after an hour: tier %d\n", tier);
+    printf("# hold period: escalation continues within %u ms of a recovery, starts over after it\n", RECOVER_HOLD_MS);
+}
+
+/* outages of 1 to 6 failures at the fetch period, clean periods on both sides of the hold period */
+static void test_random(uint32_t nb) {
+    struct recover_s rec;
+    uint64_t t = 1000 * MS;
+    uint64_t up = 0;
+    uint64_t down;
+    uint64_t tier_t = 0;
+    uint32_t tier_nb = 0;
+    uint32_t tiers[RECOVER_TIER_NB] = {0};
+    enum recover_tier_e prev = RECOVER_NONE;
+    enum recover_tier_e tier, want;
+    uint32_t down_ms;
+    uint32_t i, k, nb_fetch;
+
+    memset(&rec, 0, sizeof rec);
+    for (i = 0; i < nb; ++i) {
+        down = t;
+        nb_fetch = 1 + (uint32_t)(rand_next() % 6);
+        for (k = 0; k < nb_fetch; ++k) {
+            if ((k == 0) && ((prev == RECOVER_NONE) || ((t - up) >= RECOVER_HOLD_MS * MS))) {
+                prev = RECOVER_NONE;
+            }
+            want = prev;
+            if ((prev == RECOVER_NONE) || ((prev < RECOVER_RESET) && (tier_nb >= RECOVER_RETRY_NB) && ((t - tier_t) >= RECOVER_RETRY_MS * MS))) {
+                want = prev + 1;
+                tier_t = t;
+                tier_nb = 0;
+            }
+            tier_nb += 1;
+            tier = recover_escalate(&rec, t);
+            if (tier != want) {
+                CHECK(0, "outage %u, failure %u: tier %d instead of %d\n", i, k + 1, tier, want);
+                return;
+            }
+            prev = tier;
+            t += (1 + rand_next() % (2 * FETCH_MS)) * MS;
+        }
+        down_ms = recover_end(&rec, t);
+        if (down_ms != (uint32_t)((t - down) / MS)) {
+            CHECK(0, "outage %u: downtime %u ms instead of %u ms\n", i, down_ms, (uint32_t)((t - down) / MS));
+            return;
+        }
+        tiers[rec.tier] += 1;
+        up = t;
+        t += (rand_next() % (2 * RECOVER_HOLD_MS)) * MS;
+    }
+    printf("# %u random outages recovered by flush %u, restart %u, reset %u\n", nb, tiers[RECOVER_FLUSH], tiers[RECOVER_RESTART], tiers[RECOVER_RESET]);
+}
+
+static void usage(void) {
+    printf("Usage: recover_test [-n outages] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    uint32_t nb = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:x:")) != -1) {
+        switch (opt) {
+            case 'n': nb = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    test_outage();
+    test_hold();
+    test_random(nb);
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test of the listen before talk of the repeater (relay_lbt in
+    relay.h), the admission relay_tx runs with the RX FIFO packet count it
+    reads right before lgw_send, on a simulated clock:
+
+    - a packet is only taken once it is due, a FIFO count of 0 transmits it;
+    - busy channel: a FIFO count above 0 at the time of the emission defers
+      the transmission, the packet stays queued, nb_busy counts it and the
+      next attempt waits at least the guard time;
+    - backoff window: each busy channel doubles the window the random
+      backoff is drawn in, up to RELAY_BACKOFF_SHIFT times, a transmission
+      or a packet queued after the previous ones were dropped brings it
+      back. The draws of many repeaters are checked against the window;
+    - deadline: a channel busy until the time to live of the packet drops
+      it, nb_late counts it;
+    - random loads: the packet taken is always the oldest one, deferrals
+      and transmissions match the FIFO counts given.
+
+    Build and run on the host:
+
+        gcc -O2 -Iinclude -I.. -o relay_test relay_test.c ../relay.c ../lorawan_frame.c
+        ./relay_test
+
+    -n random attempts (100000), -x random seed. Exits with a failure when
+    a check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf */
+#include <stdlib.h>     /* strtoul, strtoull */
+#include <string.h>     /* memset, memcmp */
+#include <unistd.h>     /* getopt */
+
+#include "loragw_hal.h"
+#include "relay.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define MS                  1000000ULL  /* ns */
+#define PKT_SIZE            20
+#define SEED_NB             4000        /* repeaters drawing the backoff */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: " __VA_ARGS__); \
+            nb_fail += 1; \
+        } \
+    } while (0)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint64_t rand_state = 88172645463325252ULL;
+static unsigned nb_fail;
+
+static const struct relay_cfg_s cfg = {869525000, 0, 14, DR_LORA_SF7, 100, RELAY_GUARD_MS, RELAY_BACKOFF_MS};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+/* unconfirmed data uplink, the FCnt tells the packets apart */
+static void uplink_build(struct lgw_pkt_rx_s *pkt, uint16_t fcnt) {
+    unsigned i;
+
+    memset(pkt, 0, sizeof *pkt);
+    pkt->freq_hz = 868100000;
+    pkt->status = STAT_CRC_OK;
+    pkt->modulation = MOD_LORA;
+    pkt->bandwidth = BW_125KHZ;
+    pkt->datarate = DR_LORA_SF9;
+    pkt->coderate = CR_LORA_4_5;
+    pkt->payload[0] = 0x40;
+    pkt->payload[1] = 0x01;
+    pkt->payload[4] = 0x26;
+    pkt->payload[6] = fcnt & 0xFF;
+    pkt->payload[7] = fcnt >> 8;
+    pkt->payload[8] = 1;
+    for (i = 9; i < PKT_SIZE; ++i) {
+        pkt->payload[i] = (uint8_t)(fcnt * 31 + i);
+    }
+    pkt->size = PKT_SIZE;
+}
+
+static uint16_t tx_fcnt(const struct lgw_pkt_tx_s *tx) {
+    return (uint16_t)(tx->payload[6] | (tx->payload[7] << 8));
+}
+
+static void test_lbt(void) {
+    static struct relay_s relay;
+    struct lgw_pkt_rx_s pkt;
+    struct lgw_pkt_tx_s tx;
+    uint64_t t = 1000 * MS;
+    uint64_t due;
+    int x;
+
+    relay_init(&relay, &cfg, 1);
+    uplink_build(&pkt, 1);
+    CHECK(relay_push(&relay, &pkt, t) == 0, "valid uplink not queued\n");
+    due = relay_next_ns(&relay);
+    CHECK(due >= t + RELAY_GUARD_MS * MS, "packet due %llu ns after the uplink, before the guard time\n", (unsigned long long)(due - t));
+
+    /* not due yet: nothing to do, busy or not */
+    x = relay_lbt(&relay, due - 1, 1, &tx);
+    CHECK(x == 0, "relay_lbt returned %d before the packet is due\n", x);
+    CHECK(relay.stat.nb_busy == 0, "busy channel accounted with nothing due\n");
+
+    /* due, a packet arrived in the RX FIFO: deferred, still queued */
+    x = relay_lbt(&relay, due, 1, &tx);
+    CHECK(x == -1, "relay_lbt returned %d on a busy channel\n", x);
+    CHECK(relay.nb == 1, "%u packets queued after a deferral\n", relay.nb);
+    CHECK(relay.stat.nb_busy == 1, "nb_busy %u after a deferral\n", relay.stat.nb_busy);
+    CHECK(relay.stat.nb_sent == 0, "packet sent on a busy channel\n");
+    CHECK(relay_next_ns(&relay) >= due + RELAY_GUARD_MS * MS, "next attempt %lld ns after the busy channel, before the guard time\n", (long long)(relay_next_ns(&relay) - due));
+
+    /* due again, FIFO empty: transmitted */
+    due = relay_next_ns(&relay);
+    x = relay_lbt(&relay, due, 0, &tx);
+    CHECK(x == 1, "relay_lbt returned %d on a free channel\n", x);
+    CHECK((tx.size == PKT_SIZE) && (memcmp(tx.payload, pkt.payload, PKT_SIZE) == 0), "packet transmitted is not the one queued\n");
+    CHECK((tx.freq_hz == cfg.freq_hz) && (tx.tx_mode == IMMEDIATE), "packet not transmitted on the repeater channel\n");
+    CHECK(relay.nb == 0, "%u packets queued after the transmission\n", relay.nb);
+    printf("# busy channel: transmission deferred, packet kept, sent on the next free channel\n");
+}
+
+static void test_backoff(void) {
+    static struct relay_s relay;
+    struct lgw_pkt_rx_s pkt;
+    struct lgw_pkt_tx_s tx;
+    uint64_t t = 1000 * MS;
+    uint64_t now, window_ns, max_ns;
+    double sum;
+    unsigned shift, k, want;
+    uint32_t seed, nb;
+
+    for (shift = 0; shift <= RELAY_BACKOFF_SHIFT + 1; ++shift) {
+        want = (shift < RELAY_BACKOFF_SHIFT) ? shift : RELAY_BACKOFF_SHIFT;
+        window_ns = ((uint64_t)RELAY_BACKOFF_MS << want) * MS;
+        max_ns = 0;
+        sum = 0;
+        nb = 0;
+        for (seed = 1; seed <= SEED_NB; ++seed) {
+            relay_init(&relay, &cfg, seed);
+            uplink_build(&pkt, 1);
+            relay_push(&relay, &pkt, t);
+            now = t;
+            for (k = 0; (k < shift) && (relay.nb > 0); ++k) {
+                /* a packet queued behind, so the queue outlives a backoff longer than the time to live */
+                uplink_build(&pkt, (uint16_t)(k + 2));
+                relay_push(&relay, &pkt, now);
+                now = relay_next_ns(&relay);
+                relay_lbt(&relay, now, 1, &tx);
+            }
+            if (k < shift) {
+                continue; /* every packet went past its deadline before the last busy channel */
+            }
+            if (relay.backoff_shift != want) {
+                CHECK(0, "backoff doubled %u times after %u busy channels\n", relay.backoff_shift, shift);
+                return;
+            }
+            sum += (double)relay.backoff_ns;
+            max_ns = (relay.backoff_ns > max_ns) ? relay.backoff_ns : max_ns;
+            nb += 1;
+        }
+        CHECK(nb >= SEED_NB / 10, "after %u busy channels: only %u repeaters kept a packet\n", shift, nb);
+        CHECK(max_ns < window_ns, "after %u busy channels: backoff of %llu ms out of the %llu ms window\n", shift, (unsigned long long)(max_ns / MS), (unsigned long long)(window_ns / MS));
+        CHECK(max_ns > window_ns * 9 / 10, "after %u busy channels: longest backoff %llu ms, the %llu ms window is not used\n", shift, (unsigned long long)(max_ns / MS), (unsigned long long)(window_ns / MS));
+        CHECK((sum / nb > 0.45 * window_ns) && (sum / nb < 0.55 * window_ns), "after %u busy channels: mean backoff %.0f ms in a %llu ms window\n", shift, sum / nb / MS, (unsigned long long)(window_ns / MS));
+        printf("# %u busy channels: backoff within %llu ms, mean %.0f ms over %u repeaters\n", shift, (unsigned long long)(window_ns / MS), sum / nb / MS, nb);
+    }
+
+    /* a packet queued once the previous ones were dropped starts from the first window */
+    relay_init(&relay, &cfg, 5);
+    uplink_build(&pkt, 1);
+    relay_push(&relay, &pkt, t);
+    while ((now = relay_next_ns(&relay)) != 0) {
+        relay_lbt(&relay, now, 1, &tx);
+    }
+    uplink_build(&pkt, 2);
+    relay_push(&relay, &pkt, now = t + 10000 * MS);
+    CHECK(relay.backoff_shift == 0, "backoff window doubled %u times for a packet queued after a drop\n", relay.backoff_shift);
+    CHECK(relay_next_ns(&relay) < now + (RELAY_GUARD_MS + RELAY_BACKOFF_MS) * MS, "packet queued after a drop due %llu ms later\n", (unsigned long long)((relay_next_ns(&relay) - now) / MS));
+
+    /* a transmission brings the window back */
+    relay_init(&relay, &cfg, 7);
+    uplink_build(&pkt, 1);
+    relay_push(&relay, &pkt, t);
+    uplink_build(&pkt, 2);
+    relay_push(&relay, &pkt, t);
+    relay_lbt(&relay, relay_next_ns(&relay), 1, &tx);
+    relay_lbt(&relay, relay_next_ns(&relay), 1, &tx);
+    CHECK(relay_lbt(&relay, relay_next_ns(&relay), 0, &tx) == 1, "packet not sent on a free channel\n");
+    relay_sent(&relay, relay_next_ns(&relay), 50000);
+    CHECK(relay.backoff_shift == 0, "backoff window doubled %u times after a transmission\n", relay.backoff_shift);
+}
+
+static void test_deadline(void) {
+    static struct relay_s relay;
+    struct lgw_pkt_rx_s pkt;
+    struct lgw_pkt_tx_s tx;
+    uint64_t t = 1000 * MS;
+    uint64_t next;
+    unsigned nb = 0;
+
+    relay_init(&relay, &cfg, 3);
+    uplink_build(&pkt, 1);
+    relay_push(&relay, &pkt, t);
+    /* busy at every attempt */
+    while (((next = relay_next_ns(&relay)) != 0) && (nb < 100)) {
+        CHECK(relay_lbt(&relay, next, 1, &tx) == -1, "attempt %u on a busy channel not deferred\n", nb);
+        nb += 1;
+    }
+    CHECK(relay.nb == 0, "packet still queued after %u busy channels\n", nb);
+    CHECK(relay.stat.nb_late == 1, "nb_late %u after the deadline\n", relay.stat.nb_late);
+    CHECK(relay.stat.nb_expired == 0, "packet accounted as expired instead of late\n");
+    CHECK(relay.stat.nb_sent == 0, "packet sent on a busy channel\n");
+    CHECK(relay.stat.nb_busy == nb, "nb_busy %u after %u busy channels\n", relay.stat.nb_busy, nb);
+    printf("# deadline: dropped after %u busy channels, within %u ms\n", nb, RELAY_TTL_MS);
+}
+
+/* packets queued at random, attempts at random with random FIFO counts */
+static void test_random(uint32_t nb) {
+    static struct relay_s relay;
+    struct lgw_pkt_rx_s pkt;
+    struct lgw_pkt_tx_s tx;
+    uint64_t t = 1000 * MS;
+    uint64_t next;
+    uint16_t fcnt = 0;
+    uint16_t head = 0;
+    uint32_t nb_busy = 0, nb_sent = 0;
+    uint32_t i, busy_old, late_old, exp_old;
+    int32_t nb_rx;
+    int x;
+
+    relay_init(&relay, &cfg, 11);
+    for (i = 0; i < nb; ++i) {
+        t += (1 + rand_next() % 200) * MS;
+        if (rand_next() % 3 == 0) {
+            exp_old = relay.stat.nb_expired;
+            uplink_build(&pkt, fcnt);
+            if (relay_push(&relay, &pkt, t) == 0) {
+                fcnt += 1;
+            }
+            head += (uint16_t)(relay.stat.nb_expired - exp_old);
+            relay_rx_seen(&relay, t);
+            continue;
+        }
+        next = relay_next_ns(&relay);
+        nb_rx = (rand_next() % 4 == 0) ? (int32_t)(1 + rand_next() % 3) : 0;
+        busy_old = relay.stat.nb_busy;
+        late_old = relay.stat.nb_late;
+        exp_old = relay.stat.nb_expired;
+        x = relay_lbt(&relay, t, nb_rx, &tx);
+        head += (uint16_t)(relay.stat.nb_expired - exp_old);
+        if ((next == 0) || (t < next)) {
+            if (x != 0) {
+                CHECK(0, "attempt %u: relay_lbt returned %d before a packet is due\n", i, x);
+                return;
+            }
+            continue;
+        }
+        if ((x == 0) && (relay.nb == 0)) {
+            continue; /* the packets due expired */
+        }
+        if (nb_rx > 0) {
+            if ((x != -1) || (relay.stat.nb_busy != busy_old + 1)) {
+                CHECK(0, "attempt %u: %d packets in the FIFO, relay_lbt returned %d\n", i, nb_rx, x);
+                return;
+            }
+            head += (uint16_t)(relay.stat.nb_late - late_old);
+            nb_busy += 1;
+        } else {
+            if ((x != 1) || (tx_fcnt(&tx) != head)) {
+                CHECK(0, "attempt %u: free channel, relay_lbt returned %d with FCnt %u instead of %u\n", i, x, tx_fcnt(&tx), head);
+                return;
+            }
+            relay_sent(&relay, t, 50000);
+            head += 1;
+            nb_sent += 1;
+        }
+    }
+    CHECK(relay.stat.nb_busy == nb_busy, "nb_busy %u, %u deferrals\n", relay.stat.nb_busy, nb_busy);
+    CHECK(relay.stat.nb_queued == (uint32_t)(relay.stat.nb_sent + relay.stat.nb_expired + relay.stat.nb_late + relay.nb), "queued %u != sent %u + expired %u + late %u + waiting %u\n", relay.stat.nb_queued, relay.stat.nb_sent, relay.stat.nb_expired, relay.stat.nb_late, relay.nb);
+    printf("# %u random attempts: %u sent, %u deferred, %u late, %u expired\n", nb, nb_sent, nb_busy, relay.stat.nb_late, relay.stat.nb_expired);
+}
+
+static void usage(void) {
+    printf("Usage: relay_test [-n attempts] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    uint32_t nb = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:x:")) != -1) {
+        switch (opt) {
+            case 'n': nb = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    test_lbt();
+    test_backoff();
+    test_deadline();
+    test_random(nb);
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
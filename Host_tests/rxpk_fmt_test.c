@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test and benchmark of the rxpk serialization (rxpk_fmt.h).
+
+    - base64: random buffers encoded and decoded against a byte-at-a-time
+      reference, padded and unpadded input, corrupted characters, output
+      buffers one byte too short. Every buffer is allocated at its exact
+      size, so an address sanitizer build catches an access past its end;
+    - formatters: random values against printf;
+    - rxpk objects: random packets serialized by rxpk_serialize and by the
+      snprintf serializer it replaced, compared byte for byte. The only
+      difference allowed is a value rounding to zero from below, printed
+      "0" instead of "-0";
+    - time: ns per packet of both serializers and of the base64 encoder.
+
+    Build and run on the host:
+
+        gcc -O2 -Iinclude -I.. -o rxpk_fmt_test rxpk_fmt_test.c ../rxpk_fmt.c -lm
+        ./rxpk_fmt_test
+
+    This tests the portable base64 code, the one of the Xtensa target; add
+    -mssse3 to test the vector code. -n random cases per check (200000), -r
+    serialized packets of the timing run (1000000), -x random seed. Exits
+    with a failure when a check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf, snprintf */
+#include <stdlib.h>     /* malloc, free, strtoul, strtoull */
+#include <string.h>     /* memcpy, memcmp, memmove, strstr */
+#include <time.h>       /* clock_gettime, gmtime_r */
+#include <sys/time.h>   /* timeval */
+#include <unistd.h>     /* getopt */
+
+#include "loragw_hal.h"
+#include "rxpk_fmt.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define TEST_B64_MAX        300         /* bytes of the random base64 buffers */
+#define TEST_RXPK_SIZE      600         /* one rxpk object, 255-byte payload included */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static const uint8_t lora_dr[6] = { DR_LORA_SF7, DR_LORA_SF8, DR_LORA_SF9, DR_LORA_SF10, DR_LORA_SF11, DR_LORA_SF12 };
+static const uint8_t lora_bw[3] = { BW_125KHZ, BW_250KHZ, BW_500KHZ };
+static const uint8_t lora_cr[5] = { 0, CR_LORA_4_5, CR_LORA_4_6, CR_LORA_4_7, CR_LORA_4_8 };
+static const uint8_t stat_hal[3] = { STAT_CRC_OK, STAT_CRC_BAD, STAT_NO_CRC };
+
+static const int64_t pow10_i64[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static const char b64_ref[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static uint64_t rand_state = 88172645463325252ULL;
+static unsigned nb_fail;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc((size > 0) ? size : 1);
+
+    if (p == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/* one byte at a time, padded */
+static int ref_b64_encode(const uint8_t *in, int size, char *out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    int i, j = 0;
+
+    for (i = 0; i < size; ++i) {
+        acc = (acc << 8) | in[i];
+        bits += 8;
+        while (bits >= 6) {
+            bits -= 6;
+            out[j++] = b64_ref[(acc >> bits) & 0x3F];
+        }
+    }
+    if (bits > 0) {
+        out[j++] = b64_ref[(acc << (6 - bits)) & 0x3F];
+    }
+    while (j % 4 != 0) {
+        out[j++] = '=';
+    }
+    out[j] = 0;
+    return j;
+}
+
+static void check_b64(unsigned long nb) {
+    uint8_t data[TEST_B64_MAX];
+    char ref[TEST_B64_MAX * 2];
+    char *enc;
+    uint8_t *in, *dec;
+    unsigned long n;
+    int size, len, ref_len, in_len, pos, r;
+    bool padded;
+
+    for (n = 0; n < nb; ++n) {
+        size = (int)(rand_next() % TEST_B64_MAX);
+        for (r = 0; r < size; ++r) {
+            data[r] = (uint8_t)rand_next();
+        }
+        ref_len = ref_b64_encode(data, size, ref);
+
+        /* encode, into a buffer of exactly the size asked for, then one byte shorter */
+        in = xmalloc(size);
+        memcpy(in, data, size);
+        enc = xmalloc(ref_len + 1);
+        len = rxpk_b64_encode(in, size, enc, ref_len + 1);
+        if ((len != ref_len) || (memcmp(enc, ref, ref_len + 1) != 0)) {
+            fprintf(stderr, "FAIL: base64 encode of %d bytes\n", size);
+            nb_fail += 1;
+        }
+        if (rxpk_b64_encode(in, size, enc, ref_len) != -1) {
+            fprintf(stderr, "FAIL: base64 encode of %d bytes in %d characters\n", size, ref_len);
+            nb_fail += 1;
+        }
+        free(enc);
+        free(in);
+
+        /* decode, padded or not, into a buffer of exactly the size, then one byte shorter */
+        padded = (rand_next() % 2) == 0;
+        in_len = ref_len;
+        while (!padded && (in_len > 0) && (ref[in_len - 1] == '=')) {
+            --in_len;
+        }
+        enc = xmalloc(in_len);
+        memcpy(enc, ref, in_len);
+        dec = xmalloc(size);
+        len = rxpk_b64_decode(enc, in_len, dec, size);
+        if ((len != size) || (memcmp(dec, data, size) != 0)) {
+            fprintf(stderr, "FAIL: base64 decode of %d characters (%s)\n", in_len, padded ? "padded" : "unpadded");
+            nb_fail += 1;
+        }
+        if ((size > 0) && (rxpk_b64_decode(enc, in_len, dec, size - 1) != -1)) {
+            fprintf(stderr, "FAIL: base64 decode of %d bytes in %d\n", size, size - 1);
+            nb_fail += 1;
+        }
+
+        /* a character outside of the alphabet anywhere before the padding */
+        if (size > 0) {
+            pos = (int)(rand_next() % (unsigned)(((size * 4) + 2) / 3));
+            enc[pos] = "!*-.:@_~\x80 "[rand_next() % 10];
+            if (rxpk_b64_decode(enc, in_len, dec, size) != -1) {
+                fprintf(stderr, "FAIL: corrupted base64 accepted at %d of %d\n", pos, in_len);
+                nb_fail += 1;
+            }
+        }
+        free(dec);
+        free(enc);
+    }
+    printf("# %lu base64 buffers checked\n", nb);
+}
+
+static void check_formatters(unsigned long nb) {
+    char ref[32], out[32];
+    unsigned long n;
+    uint32_t u;
+    int32_t v;
+    unsigned width, dec;
+    int64_t a;
+    char *end;
+
+    for (n = 0; n < nb; ++n) {
+        /* spread over the bit lengths, most values would have 10 digits otherwise */
+        u = (uint32_t)(rand_next() >> (32 + rand_next() % 32));
+        v = (int32_t)(uint32_t)(rand_next() >> (32 + rand_next() % 32));
+
+        end = rxpk_fmt_u32(out, u);
+        snprintf(ref, sizeof ref, "%u", u);
+        if ((size_t)(end - out) != strlen(ref) || (memcmp(out, ref, end - out) != 0)) {
+            fprintf(stderr, "FAIL: rxpk_fmt_u32(%u)\n", u);
+            nb_fail += 1;
+        }
+        end = rxpk_fmt_i32(out, v);
+        snprintf(ref, sizeof ref, "%d", v);
+        if ((size_t)(end - out) != strlen(ref) || (memcmp(out, ref, end - out) != 0)) {
+            fprintf(stderr, "FAIL: rxpk_fmt_i32(%d)\n", v);
+            nb_fail += 1;
+        }
+        width = 1 + (unsigned)(rand_next() % 9);
+        end = rxpk_fmt_digits(out, u, width);
+        snprintf(ref, sizeof ref, "%0*u", (int)width, u);
+        if ((end - out != (int)width) || (memcmp(out, ref + strlen(ref) - width, width) != 0)) {
+            fprintf(stderr, "FAIL: rxpk_fmt_digits(%u, %u)\n", u, width);
+            nb_fail += 1;
+        }
+        dec = 1 + (unsigned)(rand_next() % 9);
+        end = rxpk_fmt_fixed(out, v, dec);
+        a = (v < 0) ? -(int64_t)v : v;
+        snprintf(ref, sizeof ref, "%s%lld.%0*lld", (v < 0) ? "-" : "", (long long)(a / pow10_i64[dec]), (int)dec, (long long)(a % pow10_i64[dec]));
+        if ((size_t)(end - out) != strlen(ref) || (memcmp(out, ref, end - out) != 0)) {
+            fprintf(stderr, "FAIL: rxpk_fmt_fixed(%d, %u)\n", v, dec);
+            nb_fail += 1;
+        }
+    }
+    printf("# %lu values formatted\n", nb);
+}
+
+/* a received packet, every field drawn from the values the concentrator gives */
+static void rand_pkt(struct lgw_pkt_rx_s *p, struct timeval *t, uint16_t size) {
+    uint16_t i;
+
+    memset(p, 0, sizeof *p);
+    p->freq_hz = 863000000 + (uint32_t)(rand_next() % 7000000);
+    p->if_chain = (uint8_t)(rand_next() % LGW_IF_CHAIN_NB);
+    p->rf_chain = (uint8_t)(rand_next() % LGW_RF_CHAIN_NB);
+    p->count_us = (uint32_t)rand_next();
+    p->status = stat_hal[rand_next() % 3];
+    if (rand_next() % 10 == 0) {
+        p->modulation = MOD_FSK;
+        p->datarate = (uint32_t)(500 + rand_next() % 250000);
+    } else {
+        p->modulation = MOD_LORA;
+        p->datarate = lora_dr[rand_next() % 6];
+        p->bandwidth = lora_bw[rand_next() % 3];
+        p->coderate = lora_cr[rand_next() % 5];
+    }
+    /* SX1301 register steps, and arbitrary floats */
+    if (rand_next() % 2 == 0) {
+        p->rssi = -140.0f + (float)(rand_next() % 1300) / 10.0f;
+        p->snr = -20.0f + (float)(rand_next() % 128) / 4.0f;
+    } else {
+        p->rssi = -140.0f + (float)(rand_next() % 1000000) / 7692.3f;
+        p->snr = -20.0f + (float)(rand_next() % 1000000) / 31250.7f;
+    }
+    p->size = size;
+    for (i = 0; i < size; ++i) {
+        p->payload[i] = (uint8_t)rand_next();
+    }
+    t->tv_sec = (time_t)(rand_next() % 4102444800ULL);
+    t->tv_usec = (suseconds_t)(rand_next() % 1000000);
+}
+
+/* the serializer rxpk_serialize replaced, from pkt_fwd.c */
+static int ref_rxpk(const struct lgw_pkt_rx_s *p, const struct timeval *rx_time, char *buf, int size) {
+    const char *sf, *bw, *cr;
+    struct tm x;
+    time_t t;
+    int j;
+    int index = 0;
+
+    t = rx_time->tv_sec;
+    gmtime_r(&t, &x);
+    j = snprintf(buf, size, "{\"tmst\":%u,\"time\":\"%04i-%02i-%02iT%02i:%02i:%02i.%06liZ\",\"chan\":%1u,\"rfch\":%1u,\"freq\":%.6lf",
+            p->count_us, (x.tm_year)+1900, (x.tm_mon)+1, x.tm_mday, x.tm_hour, x.tm_min, x.tm_sec, (long)rx_time->tv_usec,
+            p->if_chain, p->rf_chain, ((double)p->freq_hz / 1e6));
+    if ((j < 0) || (j >= size)) {
+        return -1;
+    }
+    index += j;
+
+    switch (p->status) {
+        case STAT_CRC_OK:  j = snprintf(buf + index, size - index, ",\"stat\":1");  break;
+        case STAT_CRC_BAD: j = snprintf(buf + index, size - index, ",\"stat\":-1"); break;
+        case STAT_NO_CRC:  j = snprintf(buf + index, size - index, ",\"stat\":0");  break;
+        default: return -1;
+    }
+    if ((j < 0) || (j >= (size - index))) {
+        return -1;
+    }
+    index += j;
+
+    if (p->modulation == MOD_LORA) {
+        switch (p->datarate) {
+            case DR_LORA_SF7:  sf = "SF7";  break;
+            case DR_LORA_SF8:  sf = "SF8";  break;
+            case DR_LORA_SF9:  sf = "SF9";  break;
+            case DR_LORA_SF10: sf = "SF10"; break;
+            case DR_LORA_SF11: sf = "SF11"; break;
+            case DR_LORA_SF12: sf = "SF12"; break;
+            default: return -1;
+        }
+        switch (p->bandwidth) {
+            case BW_125KHZ: bw = "BW125"; break;
+            case BW_250KHZ: bw = "BW250"; break;
+            case BW_500KHZ: bw = "BW500"; break;
+            default: return -1;
+        }
+        switch (p->coderate) {
+            case CR_LORA_4_5: cr = "4/5"; break;
+            case CR_LORA_4_6: cr = "4/6"; break;
+            case CR_LORA_4_7: cr = "4/7"; break;
+            case CR_LORA_4_8: cr = "4/8"; break;
+            case 0:           cr = "OFF"; break;
+            default: return -1;
+        }
+        j = snprintf(buf + index, size - index, ",\"modu\":\"LORA\",\"datr\":\"%s%s\",\"codr\":\"%s\",\"lsnr\":%.1f", sf, bw, cr, p->snr);
+    } else if (p->modulation == MOD_FSK) {
+        j = snprintf(buf + index, size - index, ",\"modu\":\"FSK\",\"datr\":%u", p->datarate);
+    } else {
+        return -1;
+    }
+    if ((j < 0) || (j >= (size - index))) {
+        return -1;
+    }
+    index += j;
+
+    j = snprintf(buf + index, size - index, ",\"rssi\":%.0f,\"size\":%u,\"data\":\"", p->rssi, p->size);
+    if ((j < 0) || (j >= (size - index))) {
+        return -1;
+    }
+    index += j;
+    if (size - index < ((p->size + 2) / 3) * 4 + 3) {
+        return -1;
+    }
+    index += ref_b64_encode(p->payload, p->size, buf + index);
+    buf[index++] = '"';
+    buf[index++] = '}';
+    buf[index] = 0;
+
+    return index;
+}
+
+/* printf keeps the sign of a value rounding to zero from below, the formatters do not */
+static void drop_minus_zero(char *s, const char *field) {
+    char *f = strstr(s, field);
+    size_t n = strlen(field);
+
+    if ((f != NULL) && (f[n] == '-') && (f[n + 1] == '0') && ((f[n + 2] == ',') || ((f[n + 2] == '.') && (f[n + 3] == '0') && (f[n + 4] == ',')))) {
+        memmove(f + n, f + n + 1, strlen(f + n + 1) + 1);
+    }
+}
+
+static void check_rxpk(unsigned long nb) {
+    struct lgw_pkt_rx_s p;
+    struct timeval t;
+    char ref[TEST_RXPK_SIZE];
+    char *out;
+    unsigned long n, nb_minus_zero = 0;
+    int ref_len, len;
+
+    for (n = 0; n < nb; ++n) {
+        rand_pkt(&p, &t, (uint16_t)(rand_next() % 256));
+        ref_len = ref_rxpk(&p, &t, ref, sizeof ref);
+        if (ref_len < 0) {
+            fprintf(stderr, "ERROR: reference serializer failed\n");
+            exit(EXIT_FAILURE);
+        }
+        drop_minus_zero(ref, "\"lsnr\":");
+        drop_minus_zero(ref, "\"rssi\":");
+        if ((int)strlen(ref) != ref_len) {
+            nb_minus_zero += 1;
+            ref_len = (int)strlen(ref);
+        }
+
+        /* exactly the room needed, terminator included, then one byte less */
+        out = xmalloc(ref_len + 1);
+        len = rxpk_serialize(&p, &t, out, ref_len + 1);
+        if ((len != ref_len) || (memcmp(out, ref, ref_len + 1) != 0)) {
+            fprintf(stderr, "FAIL: rxpk object differs\n  %s\n  %.*s\n", ref, (len > 0) ? len : 0, out);
+            nb_fail += 1;
+        }
+        if (rxpk_serialize(&p, &t, out, ref_len) != -1) {
+            fprintf(stderr, "FAIL: rxpk object of %d bytes written in %d\n", ref_len + 1, ref_len);
+            nb_fail += 1;
+        }
+        free(out);
+    }
+
+    /* unknown metadata */
+    rand_pkt(&p, &t, 20);
+    p.status = STAT_UNDEFINED;
+    if (rxpk_serialize(&p, &t, ref, sizeof ref) != -1) {
+        fprintf(stderr, "FAIL: packet with an unknown status serialized\n");
+        nb_fail += 1;
+    }
+    rand_pkt(&p, &t, 20);
+    p.modulation = MOD_LORA;
+    p.datarate = DR_UNDEFINED;
+    if (rxpk_serialize(&p, &t, ref, sizeof ref) != -1) {
+        fprintf(stderr, "FAIL: LoRa packet with an unknown datarate serialized\n");
+        nb_fail += 1;
+    }
+    printf("# %lu rxpk objects identical to the snprintf ones, %lu of them with a -0 dropped\n", nb, nb_minus_zero);
+}
+
+/* ns per packet of a 20-byte SF9 uplink, and of base64 alone on 20 and 255 bytes */
+static void timing(unsigned long nb) {
+    struct lgw_pkt_rx_s p;
+    struct timeval t;
+    char out[TEST_RXPK_SIZE];
+    volatile int sink = 0;
+    unsigned long n;
+    double t0, new_ns, ref_ns, b64_20_ns, b64_255_ns;
+
+    do {
+        rand_pkt(&p, &t, 20);
+    } while (p.modulation != MOD_LORA);
+    p.datarate = DR_LORA_SF9;
+
+    t0 = now_s();
+    for (n = 0; n < nb; ++n) {
+        p.count_us += 1;
+        sink += rxpk_serialize(&p, &t, out, sizeof out);
+    }
+    new_ns = (now_s() - t0) * 1e9 / (double)nb;
+    t0 = now_s();
+    for (n = 0; n < nb; ++n) {
+        p.count_us += 1;
+        sink += ref_rxpk(&p, &t, out, sizeof out);
+    }
+    ref_ns = (now_s() - t0) * 1e9 / (double)nb;
+    t0 = now_s();
+    for (n = 0; n < nb; ++n) {
+        p.payload[0] = (uint8_t)n;
+        sink += rxpk_b64_encode(p.payload, 20, out, sizeof out);
+    }
+    b64_20_ns = (now_s() - t0) * 1e9 / (double)nb;
+    t0 = now_s();
+    for (n = 0; n < nb; ++n) {
+        p.payload[0] = (uint8_t)n;
+        sink += rxpk_b64_encode(p.payload, 255, out, sizeof out);
+    }
+    b64_255_ns = (now_s() - t0) * 1e9 / (double)nb;
+
+    printf("# rxpk object of a 20-byte uplink: %.1f ns, %.1f ns with snprintf, %.1fx faster\n", new_ns, ref_ns, ref_ns / new_ns);
+    printf("# base64: %.1f ns for 20 bytes, %.1f ns for 255 bytes\n", b64_20_ns, b64_255_ns);
+    (void)sink;
+}
+
+static void usage(void) {
+    printf("Usage: rxpk_fmt_test [-n random cases] [-r serialized packets] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    unsigned long nb_case = 200000;
+    unsigned long nb_run = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:r:x:")) != -1) {
+        switch (opt) {
+            case 'n': nb_case = strtoul(optarg, NULL, 0); break;
+            case 'r': nb_run = strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    check_b64(nb_case);
+    check_formatters(nb_case * 10);
+    check_rxpk(nb_case);
+    if (nb_run > 0) {
+        timing(nb_run);
+    }
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host benchmark of the upstream stages timed by the forwarder when it is
+    built with FWD_BENCH (bench_path).
+
+    The packets go through the code of the forwarder, stage by stage:
+    - fetch: capture_replay_receive, up to 8 packets per call, as the
+      forwarder replaying a capture at replay_speed 0;
+    - decode: lorawan_frame_parse and devtable_update of the CRC-OK
+      uplinks, per packet. chanstat_add is left out, it calls the time on
+      air of the HAL;
+    - serialize: rxpk_serialize, or uplink_bin_encode with -b, per packet.
+
+    Without -f, a capture of the uplinks of a fleet of devices is written
+    first. The result is one JSON line with the keys of the bench_path
+    report, so runs of two builds, or a run on the host and a report of the
+    gateway, can be compared line by line. The RX-to-UDP latency needs the
+    sockets and is only in the report of the forwarder.
+
+    Build and run on the host:
+
+        gcc -O2 -Iinclude -I.. -o stage_bench stage_bench.c ../capture.c ../lorawan_frame.c ../devtable.c ../rxpk_fmt.c ../uplink_bin.c ../logcat.c -lpthread -lm
+        ./stage_bench -o bench.json
+
+    -f capture to replay instead of the generated one, -d directory of the
+    generated capture (/tmp), -n packets generated (200000), -b binary
+    records, -l build label ("host"), -o file the line is appended to
+    (standard output), -x random seed. Exits with a failure when a packet is
+    lost or cannot be serialized.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf, fopen */
+#include <stdlib.h>     /* malloc, free, strtoul, strtoull */
+#include <string.h>     /* memset */
+#include <time.h>       /* clock_gettime */
+#include <sys/time.h>   /* gettimeofday */
+#include <unistd.h>     /* getopt, unlink */
+
+#include "logcat.h"
+#include "capture.h"
+#include "lorawan_frame.h"
+#include "devtable.h"
+#include "rxpk_fmt.h"
+#include "uplink_bin.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define BENCH_FETCH_MAX     8           /* packets per fetch, NB_PKT_MAX of the forwarder */
+#define BENCH_DEV_NB        1000        /* devices of the generated fleet */
+#define BENCH_DEV_MAX       1024        /* devices tracked, dev_max of the forwarder */
+#define BENCH_OUT_SIZE      600         /* one rxpk object, 255-byte payload included */
+#define BENCH_EUI           0x0102030405060708ULL
+#define BENCH_PATH_MAX      (CAPTURE_PATH_MAX + 8)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+enum bench_stage_e {
+    BENCH_FETCH = 0,
+    BENCH_DECODE,
+    BENCH_SERIALIZE,
+    BENCH_STAGE_NB
+};
+
+struct bench_stage_s {
+    uint32_t        nb;
+    uint64_t        sum_ns;
+    uint32_t        max_ns;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static const uint32_t chan_freq[8] = { 867100000, 867300000, 867500000, 867700000, 867900000, 868100000, 868300000, 868500000 };
+static const uint8_t lora_dr[6] = { DR_LORA_SF7, DR_LORA_SF8, DR_LORA_SF9, DR_LORA_SF10, DR_LORA_SF11, DR_LORA_SF12 };
+
+static struct bench_stage_s stage[BENCH_STAGE_NB];
+static struct devtable_s devtable;
+static uint64_t rand_state = 88172645463325252ULL;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static inline uint64_t bench_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* same accounting as bench_add of the forwarder */
+static void bench_add(enum bench_stage_e s, uint32_t nb, uint64_t t0) {
+    uint64_t ns = bench_ns() - t0;
+    struct bench_stage_s *b = &stage[s];
+
+    b->nb += nb;
+    b->sum_ns += ns;
+    if (ns / nb > b->max_ns) {
+        b->max_ns = (uint32_t)(ns / nb);
+    }
+}
+
+/* unconfirmed data uplink of a device of the fleet, FPort 1 to 223 */
+static void make_uplink(struct lgw_pkt_rx_s *p, uint32_t fcnt) {
+    uint32_t dev_addr = 0x26010000 + (uint32_t)(rand_next() % BENCH_DEV_NB);
+    unsigned chan_i = (unsigned)(rand_next() % 8);
+    uint16_t size = (uint16_t)(LORAWAN_DATA_MIN_SIZE + 1 + 10 + rand_next() % 42);
+    unsigned k;
+
+    memset(p, 0, sizeof *p);
+    p->freq_hz = chan_freq[chan_i];
+    p->if_chain = (uint8_t)chan_i;
+    p->rf_chain = (chan_i < 5) ? 0 : 1;
+    p->status = STAT_CRC_OK;
+    p->count_us = fcnt * 1000;
+    p->modulation = MOD_LORA;
+    p->bandwidth = BW_125KHZ;
+    p->datarate = lora_dr[rand_next() % 6];
+    p->coderate = CR_LORA_4_5;
+    p->rssi = -120.0f + (float)(rand_next() % 90);
+    p->snr = -15.0f + (float)(rand_next() % 250) / 10.0f;
+    p->snr_min = p->snr - 1.0f;
+    p->snr_max = p->snr + 1.0f;
+    p->crc = (uint16_t)rand_next();
+    p->size = size;
+    p->payload[0] = 0x40; /* UnconfirmedDataUp, LoRaWAN R1 */
+    p->payload[1] = (uint8_t)dev_addr;
+    p->payload[2] = (uint8_t)(dev_addr >> 8);
+    p->payload[3] = (uint8_t)(dev_addr >> 16);
+    p->payload[4] = (uint8_t)(dev_addr >> 24);
+    p->payload[5] = 0x00; /* FCtrl, no FOpts */
+    p->payload[6] = (uint8_t)fcnt;
+    p->payload[7] = (uint8_t)(fcnt >> 8);
+    p->payload[8] = (uint8_t)(1 + rand_next() % 223);
+    for (k = 9; k < size; ++k) {
+        p->payload[k] = (uint8_t)rand_next();
+    }
+}
+
+/* capture of nb uplinks, 1 ms apart */
+static int make_capture(const char *path, uint32_t nb) {
+    struct capture_s cap;
+    struct lgw_pkt_rx_s pkt;
+    struct timeval t;
+    uint32_t i;
+
+    if (capture_open(&cap, path, 0, BENCH_EUI) != 0) {
+        fprintf(stderr, "ERROR: failed to create %s\n", path);
+        return -1;
+    }
+    for (i = 0; i < nb; ++i) {
+        make_uplink(&pkt, i);
+        t.tv_sec = 1609459200 + i / 1000;
+        t.tv_usec = (i % 1000) * 1000;
+        capture_write(&cap, 1, &pkt, &t);
+    }
+    capture_close(&cap);
+    return 0;
+}
+
+static void stage_json(FILE *f, const char *name, const struct bench_stage_s *b, bool last) {
+    fprintf(f, "\"%s\":{\"nb\":%u,\"avg_ns\":%llu,\"max_ns\":%u}%s", name, b->nb, (b->nb > 0) ? (unsigned long long)(b->sum_ns / b->nb) : 0ULL, b->max_ns, last ? "" : ",");
+}
+
+static void usage(void) {
+    printf("Usage: stage_bench [-f capture] [-d directory] [-n packets] [-b] [-l label] [-o report] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    const char *dir = "/tmp";
+    const char *replay_path = NULL;
+    const char *label = "host";
+    const char *out_path = NULL;
+    char gen_path[BENCH_PATH_MAX];
+    bool binary = false;
+    uint32_t nb_gen = 200000;
+    struct capture_replay_s replay;
+    struct lgw_pkt_rx_s rx[BENCH_FETCH_MAX];
+    struct lorawan_frame_view frame;
+    struct timeval now;
+    uint8_t out[BENCH_OUT_SIZE];
+    uint32_t nb_rx = 0;
+    uint32_t nb_fwd = 0;
+    uint32_t nb_invalid = 0;
+    void *dev_buf;
+    uint64_t t0;
+    double run_s;
+    FILE *f = stdout;
+    int nb, i, x;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hf:d:n:bl:o:x:")) != -1) {
+        switch (opt) {
+            case 'f': replay_path = optarg; break;
+            case 'd': dir = optarg; break;
+            case 'n': nb_gen = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'b': binary = true; break;
+            case 'l': label = optarg; break;
+            case 'o': out_path = optarg; break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    logcat_init(NULL);
+    logcat_set_level(LOGCAT_NB, 0);
+
+    if (replay_path == NULL) {
+        if (snprintf(gen_path, sizeof gen_path, "%s/stage_bench.lgwc", dir) >= (int)sizeof gen_path) {
+            usage();
+            return EXIT_FAILURE;
+        }
+        if (make_capture(gen_path, nb_gen) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (capture_replay_open(&replay, (replay_path != NULL) ? replay_path : gen_path, 0, false) != 0) {
+        fprintf(stderr, "ERROR: failed to open %s\n", (replay_path != NULL) ? replay_path : gen_path);
+        return EXIT_FAILURE;
+    }
+    dev_buf = malloc(devtable_size(BENCH_DEV_MAX));
+    if (dev_buf == NULL) {
+        return EXIT_FAILURE;
+    }
+    devtable_init(&devtable, dev_buf, BENCH_DEV_MAX);
+
+    run_s = (double)bench_ns() / 1e9;
+    while (1) {
+        t0 = bench_ns();
+        nb = capture_replay_receive(&replay, BENCH_FETCH_MAX, rx);
+        bench_add(BENCH_FETCH, 1, t0);
+        if (nb == 0) {
+            break;
+        }
+        nb_rx += nb;
+        gettimeofday(&now, NULL);
+
+        t0 = bench_ns();
+        for (i = 0; i < nb; ++i) {
+            if (lorawan_frame_parse(rx[i].payload, rx[i].size, &frame) != LORAWAN_FRAME_OK) {
+                nb_invalid += 1;
+            } else if (frame.has_fhdr && (rx[i].status == STAT_CRC_OK) && lorawan_frame_is_uplink(&frame)) {
+                devtable_update(&devtable, frame.dev_addr, frame.fcnt, rx[i].rssi, rx[i].snr, (rx[i].modulation == MOD_LORA) ? __builtin_ctz(rx[i].datarate) + 6 : 0, (uint8_t)rx[i].size, (uint32_t)now.tv_sec);
+            }
+        }
+        bench_add(BENCH_DECODE, nb, t0);
+
+        for (i = 0; i < nb; ++i) {
+            t0 = bench_ns();
+            if (binary) {
+                x = uplink_bin_encode(&rx[i], &now, out, sizeof out);
+            } else {
+                x = rxpk_serialize(&rx[i], &now, (char *)out, sizeof out);
+            }
+            if (x > 0) {
+                bench_add(BENCH_SERIALIZE, 1, t0);
+                nb_fwd += 1;
+            }
+        }
+    }
+    run_s = (double)bench_ns() / 1e9 - run_s;
+    capture_replay_close(&replay);
+    if (replay_path == NULL) {
+        unlink(gen_path);
+    }
+    free(dev_buf);
+
+    if (out_path != NULL) {
+        f = fopen(out_path, "a");
+        if (f == NULL) {
+            fprintf(stderr, "ERROR: failed to open %s\n", out_path);
+            return EXIT_FAILURE;
+        }
+    }
+    fprintf(f, "{\"build\":\"%s\",\"format\":\"%s\",\"rx\":%u,\"fwd\":%u,", label, binary ? "binary" : "json", nb_rx, nb_fwd);
+    stage_json(f, "fetch", &stage[BENCH_FETCH], false);
+    stage_json(f, "decode", &stage[BENCH_DECODE], false);
+    stage_json(f, "serialize", &stage[BENCH_SERIALIZE], true);
+    fprintf(f, "}\n");
+    if (f != stdout) {
+        fclose(f);
+    }
+    printf("# %u packets in %.3f s, %u not LoRaWAN, %u devices heard\n", nb_rx, run_s, nb_invalid, devtable.nb);
+
+    if ((replay_path == NULL) && ((nb_rx != nb_gen) || (nb_invalid != 0))) {
+        printf("### %u packets generated, %u replayed, %u not LoRaWAN\n", nb_gen, nb_rx, nb_invalid);
+        return EXIT_FAILURE;
+    }
+    if (nb_fwd != nb_rx) {
+        printf("### %u packets could not be serialized\n", nb_rx - nb_fwd);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test and benchmark of the binary uplink encoding (uplink_bin.h).
+
+    - round trip: random LoRa and FSK packets encoded into datagrams of
+      several records and decoded again, every field compared at the
+      resolution of the format;
+    - truncation: every record decoded from a buffer of exactly each of its
+      shorter sizes must be rejected, in an address sanitizer build a read
+      past the end is caught;
+    - size and time: bytes and ns per packet of a binary record against a
+      JSON rxpk object written by rxpk_serialize, for a few payload sizes.
+
+    Build and run on the host:
+
+        gcc -O2 -Iinclude -I.. -o uplink_bin_bench uplink_bin_bench.c ../uplink_bin.c ../rxpk_fmt.c -lm
+        ./uplink_bin_bench
+
+    -n random packets of the round trip (200000), -r encoded packets per
+    payload size of the timing run (2000000), -x random seed. Exits with a
+    failure when a check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf */
+#include <stdlib.h>     /* malloc, free, strtoul, strtoull */
+#include <string.h>     /* memcpy, memcmp */
+#include <math.h>       /* lroundf, fabsf */
+#include <time.h>       /* clock_gettime */
+#include <sys/time.h>   /* timeval */
+#include <unistd.h>     /* getopt */
+
+#include "loragw_hal.h"
+#include "uplink_bin.h"
+#include "rxpk_fmt.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define BENCH_DGRAM_SIZE    1472        /* Ethernet MTU minus IP and UDP headers */
+#define BENCH_JSON_SIZE     600         /* one rxpk object, 255-byte payload included */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static const uint8_t lora_dr[6] = { DR_LORA_SF7, DR_LORA_SF8, DR_LORA_SF9, DR_LORA_SF10, DR_LORA_SF11, DR_LORA_SF12 };
+static const uint8_t lora_bw[3] = { BW_125KHZ, BW_250KHZ, BW_500KHZ };
+static const uint16_t lora_bw_khz[3] = { 125, 250, 500 };
+static const uint8_t lora_cr[5] = { 0, CR_LORA_4_5, CR_LORA_4_6, CR_LORA_4_7, CR_LORA_4_8 };
+static const uint8_t stat_hal[3] = { STAT_CRC_OK, STAT_CRC_BAD, STAT_NO_CRC };
+
+static uint64_t rand_state = 88172645463325252ULL;
+static unsigned nb_fail;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* a received packet, on a 100 Hz frequency grid; lbw, lcr, lstat return the table indexes drawn */
+static void rand_pkt(struct lgw_pkt_rx_s *p, struct timeval *t, uint16_t size, int *lbw, int *lcr, int *lstat) {
+    uint16_t i;
+
+    memset(p, 0, sizeof *p);
+    p->freq_hz = 863000000 + 100 * (uint32_t)(rand_next() % 70000);
+    p->if_chain = (uint8_t)(rand_next() % LGW_IF_CHAIN_NB);
+    p->rf_chain = (uint8_t)(rand_next() % LGW_RF_CHAIN_NB);
+    p->count_us = (uint32_t)rand_next();
+    *lstat = (int)(rand_next() % 3);
+    p->status = stat_hal[*lstat];
+    if (rand_next() % 10 == 0) {
+        p->modulation = MOD_FSK;
+        p->datarate = 1000 * (uint32_t)(1 + rand_next() % 127);
+        *lbw = 0;
+        *lcr = 0;
+    } else {
+        p->modulation = MOD_LORA;
+        p->datarate = lora_dr[rand_next() % 6];
+        *lbw = (int)(rand_next() % 3);
+        p->bandwidth = lora_bw[*lbw];
+        *lcr = (int)(rand_next() % 5);
+        p->coderate = lora_cr[*lcr];
+    }
+    p->rssi = -139.0f + (float)(rand_next() % 12900) / 100.0f;
+    p->snr = -20.0f + (float)(rand_next() % 3200) / 100.0f;
+    p->size = size;
+    for (i = 0; i < size; ++i) {
+        p->payload[i] = (uint8_t)rand_next();
+    }
+    t->tv_sec = 1600000000 + (time_t)(rand_next() % 400000000);
+    t->tv_usec = (suseconds_t)(rand_next() % 1000000);
+}
+
+/* a decoded record against the packet it was encoded from, at the resolution of the format */
+static bool rec_matches(const struct uplink_bin_rec *r, const struct lgw_pkt_rx_s *p, const struct timeval *t, int lbw, int lcr, int lstat) {
+    long rssi = lroundf(p->rssi);
+
+    if ((r->tmst != p->count_us) || (r->utc_sec != (uint32_t)t->tv_sec) || (r->freq_hz != p->freq_hz)) {
+        return false;
+    }
+    if ((r->rf_chain != p->rf_chain) || (r->if_chain != p->if_chain) || (r->status != lstat)) {
+        return false;
+    }
+    if (p->modulation == MOD_FSK) {
+        if (!r->fsk || (r->fsk_bps != p->datarate) || (r->coderate != 0)) {
+            return false;
+        }
+    } else if (r->fsk || (r->sf != 6 + __builtin_ctz(p->datarate)) || (r->bw_khz != lora_bw_khz[lbw]) || (r->coderate != lcr)) {
+        return false;
+    }
+    /* RSSI on a signed byte, the weakest SF12 packets are reported at -128 dBm */
+    if ((r->rssi != ((rssi < -128) ? -128 : rssi)) || (fabsf(r->snr - p->snr) > 0.126f)) {
+        return false;
+    }
+    return (r->size == p->size) && (memcmp(r->payload, p->payload, p->size) == 0);
+}
+
+/* datagrams of random packets, filled up to the MTU, decoded again */
+static void round_trip(unsigned long nb) {
+    static struct lgw_pkt_rx_s pkts[64];
+    static struct timeval times[64];
+    static int lbw[64], lcr[64], lstat[64];
+    uint8_t dgram[BENCH_DGRAM_SIZE];
+    struct uplink_bin_rec rec;
+    unsigned long n = 0, nb_dgram = 0;
+    uint8_t nb_rec;
+    int len, j, k, off;
+
+    while (n < nb) {
+        dgram[0] = UPLINK_BIN_VERSION;
+        len = UPLINK_BIN_HDR_SIZE;
+        for (k = 0; (k < 64) && (n < nb); ++k, ++n) {
+            rand_pkt(&pkts[k], &times[k], (uint16_t)(rand_next() % 256), &lbw[k], &lcr[k], &lstat[k]);
+            j = uplink_bin_encode(&pkts[k], &times[k], dgram + len, BENCH_DGRAM_SIZE - len);
+            if (j < 0) {
+                if (BENCH_DGRAM_SIZE - len >= UPLINK_BIN_REC_SIZE + pkts[k].size) {
+                    fprintf(stderr, "FAIL: packet of %u bytes not encoded with %d bytes left\n", pkts[k].size, BENCH_DGRAM_SIZE - len);
+                    nb_fail += 1;
+                }
+                break;
+            }
+            if (j != UPLINK_BIN_REC_SIZE + pkts[k].size) {
+                fprintf(stderr, "FAIL: record of %d bytes for a payload of %u\n", j, pkts[k].size);
+                nb_fail += 1;
+            }
+            len += j;
+        }
+        dgram[1] = (uint8_t)k;
+        nb_dgram += 1;
+
+        off = uplink_bin_decode_hdr(dgram, len, &nb_rec);
+        if ((off != UPLINK_BIN_HDR_SIZE) || (nb_rec != k)) {
+            fprintf(stderr, "FAIL: datagram header\n");
+            nb_fail += 1;
+            continue;
+        }
+        for (j = 0; j < nb_rec; ++j) {
+            int r = uplink_bin_decode(dgram + off, len - off, &rec);
+
+            if ((r < 0) || !rec_matches(&rec, &pkts[j], &times[j], lbw[j], lcr[j], lstat[j])) {
+                fprintf(stderr, "FAIL: record %d of %d decoded wrong\n", j, nb_rec);
+                nb_fail += 1;
+                break;
+            }
+            off += r;
+        }
+        if ((j == nb_rec) && (off != len)) {
+            fprintf(stderr, "FAIL: %d bytes left after the last record\n", len - off);
+            nb_fail += 1;
+        }
+    }
+    printf("# %lu packets round-tripped in %lu datagrams, %.1f packets per datagram\n", nb, nb_dgram, (double)nb / (double)nb_dgram);
+}
+
+/* records cut short are rejected; the encoder refuses a buffer too small by one byte */
+static void truncation(unsigned nb) {
+    uint8_t rec_buf[UPLINK_BIN_REC_MAX];
+    struct lgw_pkt_rx_s p;
+    struct uplink_bin_rec rec;
+    struct timeval t;
+    uint8_t *buf;
+    unsigned n;
+    int lbw, lcr, lstat, len, cut;
+
+    for (n = 0; n < nb; ++n) {
+        rand_pkt(&p, &t, (uint16_t)(rand_next() % 256), &lbw, &lcr, &lstat);
+        len = uplink_bin_encode(&p, &t, rec_buf, sizeof rec_buf);
+        if (uplink_bin_encode(&p, &t, rec_buf, len - 1) != -1) {
+            fprintf(stderr, "FAIL: record of %d bytes encoded in %d\n", len, len - 1);
+            nb_fail += 1;
+        }
+        for (cut = 0; cut < len; ++cut) {
+            buf = malloc((cut > 0) ? cut : 1);
+            if (buf == NULL) {
+                fprintf(stderr, "ERROR: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(buf, rec_buf, cut);
+            if (uplink_bin_decode(buf, cut, &rec) != -1) {
+                fprintf(stderr, "FAIL: record of %d bytes decoded from %d\n", len, cut);
+                nb_fail += 1;
+            }
+            free(buf);
+        }
+    }
+    printf("# %u records rejected at every truncated size\n", nb);
+}
+
+/* bytes and encoding time of one SF9 uplink, binary record against JSON object */
+static void size_and_time(unsigned long nb) {
+    static const uint16_t sizes[4] = { 12, 20, 51, 222 };
+    uint8_t rec_buf[UPLINK_BIN_REC_MAX];
+    char json[BENCH_JSON_SIZE];
+    struct lgw_pkt_rx_s p;
+    struct timeval t;
+    volatile int sink = 0;
+    unsigned long n;
+    unsigned i;
+    int lbw, lcr, lstat, bin_len, json_len;
+    double t0, bin_ns, json_ns;
+
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; ++i) {
+        do {
+            rand_pkt(&p, &t, sizes[i], &lbw, &lcr, &lstat);
+        } while (p.modulation != MOD_LORA);
+        p.datarate = DR_LORA_SF9;
+        p.bandwidth = BW_125KHZ;
+        p.coderate = CR_LORA_4_5;
+        p.status = STAT_CRC_OK;
+
+        bin_len = uplink_bin_encode(&p, &t, rec_buf, sizeof rec_buf);
+        json_len = rxpk_serialize(&p, &t, json, sizeof json);
+        if ((bin_len < 0) || (json_len < 0)) {
+            fprintf(stderr, "FAIL: %u-byte packet not encoded\n", sizes[i]);
+            nb_fail += 1;
+            continue;
+        }
+
+        t0 = now_s();
+        for (n = 0; n < nb; ++n) {
+            p.count_us += 1;
+            sink += uplink_bin_encode(&p, &t, rec_buf, sizeof rec_buf);
+        }
+        bin_ns = (now_s() - t0) * 1e9 / (double)nb;
+        t0 = now_s();
+        for (n = 0; n < nb; ++n) {
+            p.count_us += 1;
+            sink += rxpk_serialize(&p, &t, json, sizeof json);
+        }
+        json_ns = (now_s() - t0) * 1e9 / (double)nb;
+
+        printf("# %3u-byte payload: binary %3d bytes %6.1f ns, JSON %3d bytes %6.1f ns, %.1fx smaller\n",
+               sizes[i], bin_len, bin_ns, json_len, json_ns, (double)json_len / (double)bin_len);
+    }
+    (void)sink;
+}
+
+static void usage(void) {
+    printf("Usage: uplink_bin_bench [-n round-trip packets] [-r encoded packets] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    unsigned long nb_pkt = 200000;
+    unsigned long nb_run = 2000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:r:x:")) != -1) {
+        switch (opt) {
+            case 'n': nb_pkt = strtoul(optarg, NULL, 0); break;
+            case 'r': nb_run = strtoul(optarg, NULL, 0); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    round_trip(nb_pkt);
+    truncation(1000);
+    if (nb_run > 0) {
+        size_and_time(nb_run);
+    }
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
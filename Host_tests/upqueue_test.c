@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Host test and benchmark of the persistent uplink queue (upqueue.h).
+
+    - round trip: the packets fetched are the ones pushed, in order, field
+      by field; a nack gives them back;
+    - reboot: the records and the acknowledged cursor survive a close and an
+      open;
+    - torn write: a segment cut in the middle of its last record, or with a
+      byte changed in a record, is cut before that record on open, and the
+      records written afterwards follow the valid ones;
+    - full log: the oldest records are dropped and counted, the ones fetched
+      stay contiguous and end with the last one pushed;
+    - throughput: records pushed with a flush, and an fsync, per batch as the
+      upstream thread does, then fetched and acknowledged.
+
+    Build and run on the host, include/ holding stand-ins for the headers of
+    the firmware tree:
+
+        gcc -O2 -Iinclude -I.. -o upqueue_test upqueue_test.c ../upqueue.c ../logcat.c -lpthread
+        ./upqueue_test -d /tmp
+
+    -d directory of the log files (/tmp), -n records of the throughput run
+    (100000), -l payload size (20). Exits with a failure when a check fails.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf, fopen */
+#include <stdlib.h>     /* strtoul */
+#include <string.h>     /* memset, memcmp */
+#include <time.h>       /* clock_gettime */
+#include <unistd.h>     /* getopt, unlink, truncate */
+#include <sys/stat.h>   /* stat */
+
+#include "logcat.h"
+#include "upqueue.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define TEST_FETCH_NB       8       /* packets per fetch, as the upstream thread */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: " __VA_ARGS__); \
+            nb_fail += 1; \
+        } \
+    } while (0)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static char base[UPQUEUE_PATH_MAX];
+static unsigned payload_size = 20;
+static unsigned nb_fail;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void log_remove(void) {
+    static const char * const ext[4] = { ".0", ".1", ".idx", ".tmp" };
+    char path[UPQUEUE_PATH_MAX + 8];
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        snprintf(path, sizeof path, "%s%s", base, ext[i]);
+        unlink(path);
+    }
+}
+
+static long seg_size(int seg) {
+    char path[UPQUEUE_PATH_MAX + 8];
+    struct stat st;
+
+    snprintf(path, sizeof path, "%s.%d", base, seg);
+    return (stat(path, &st) == 0) ? (long)st.st_size : -1;
+}
+
+/* packet number i, every field derived from i */
+static void make_pkt(uint32_t i, struct lgw_pkt_rx_s *pkt, struct timeval *tv) {
+    unsigned k;
+
+    memset(pkt, 0, sizeof *pkt);
+    pkt->freq_hz = 867100000 + 200000 * (i % 8);
+    pkt->if_chain = (uint8_t)(i % 8);
+    pkt->status = STAT_CRC_OK;
+    pkt->count_us = i * 1000003u;
+    pkt->modulation = MOD_LORA;
+    pkt->bandwidth = BW_125KHZ;
+    pkt->datarate = DR_LORA_SF7 << (i % 6);
+    pkt->coderate = CR_LORA_4_5;
+    pkt->rssi = -40.0f - (float)(i % 90);
+    pkt->snr = 10.0f - (float)(i % 30) / 2;
+    pkt->crc = (uint16_t)(i * 7);
+    pkt->size = (uint16_t)payload_size;
+    for (k = 0; k < pkt->size; ++k) {
+        pkt->payload[k] = (uint8_t)(i >> (8 * (k % 4)));
+    }
+    tv->tv_sec = 1609459200 + i / 10;
+    tv->tv_usec = (i % 10) * 100000;
+}
+
+static bool same_pkt(uint32_t i, const struct lgw_pkt_rx_s *pkt, const struct timeval *tv) {
+    struct lgw_pkt_rx_s ref;
+    struct timeval ref_tv;
+
+    make_pkt(i, &ref, &ref_tv);
+    return (pkt->freq_hz == ref.freq_hz) && (pkt->if_chain == ref.if_chain) && (pkt->status == ref.status) &&
+           (pkt->count_us == ref.count_us) && (pkt->modulation == ref.modulation) && (pkt->bandwidth == ref.bandwidth) &&
+           (pkt->datarate == ref.datarate) && (pkt->coderate == ref.coderate) && (pkt->rssi == ref.rssi) &&
+           (pkt->snr == ref.snr) && (pkt->crc == ref.crc) && (pkt->size == ref.size) &&
+           (memcmp(pkt->payload, ref.payload, ref.size) == 0) &&
+           (tv->tv_sec == ref_tv.tv_sec) && (tv->tv_usec == ref_tv.tv_usec);
+}
+
+static void push_range(struct upqueue_s *q, uint32_t from, uint32_t to) {
+    struct lgw_pkt_rx_s pkt;
+    struct timeval tv;
+    uint32_t i;
+
+    for (i = from; i < to; ++i) {
+        make_pkt(i, &pkt, &tv);
+        CHECK(upqueue_push(q, &pkt, &tv) == 0, "push %u\n", i);
+    }
+}
+
+/* fetch up to nb records, they must be first, first + 1... return the number fetched */
+static uint32_t fetch_expect(struct upqueue_s *q, uint32_t first, uint32_t nb, bool ack) {
+    struct lgw_pkt_rx_s pkts[TEST_FETCH_NB];
+    struct timeval tv[TEST_FETCH_NB];
+    uint32_t n = 0;
+    int got, i;
+
+    while (n < nb) {
+        got = upqueue_fetch(q, ((nb - n) < TEST_FETCH_NB) ? (int)(nb - n) : TEST_FETCH_NB, pkts, tv);
+        if (got <= 0) {
+            break;
+        }
+        for (i = 0; i < got; ++i) {
+            CHECK(same_pkt(first + n + (uint32_t)i, &pkts[i], &tv[i]), "record %u differs\n", first + n + (uint32_t)i);
+        }
+        n += (uint32_t)got;
+        if (ack) {
+            upqueue_ack(q);
+        }
+    }
+    return n;
+}
+
+static void test_round_trip(void) {
+    struct upqueue_s q;
+
+    log_remove();
+    CHECK(upqueue_open(&q, base, 256 * 1024) == 0, "open\n");
+    push_range(&q, 0, 1000);
+    CHECK(upqueue_pending(&q) == 1000, "%u pending, 1000 expected\n", upqueue_pending(&q));
+    CHECK(fetch_expect(&q, 0, 10, false) == 10, "fetch\n");
+    upqueue_nack(&q);
+    CHECK(upqueue_pending(&q) == 1000, "%u pending after a nack\n", upqueue_pending(&q));
+    CHECK(fetch_expect(&q, 0, 1000, true) == 1000, "fetch after a nack\n");
+    CHECK(upqueue_pending(&q) == 0, "%u pending after the acks\n", upqueue_pending(&q));
+    upqueue_close(&q);
+    printf("# round trip: 1000 records\n");
+}
+
+static void test_reboot(void) {
+    struct upqueue_s q;
+
+    log_remove();
+    CHECK(upqueue_open(&q, base, 256 * 1024) == 0, "open\n");
+    push_range(&q, 0, 200);
+    CHECK(fetch_expect(&q, 0, 40, true) == 40, "fetch\n");
+    upqueue_close(&q);
+
+    CHECK(upqueue_open(&q, base, 256 * 1024) == 0, "reopen\n");
+    CHECK(upqueue_pending(&q) == 160, "%u pending after a reboot, 160 expected\n", upqueue_pending(&q));
+    push_range(&q, 200, 250);
+    CHECK(fetch_expect(&q, 40, 210, true) == 210, "fetch after a reboot\n");
+    CHECK(q.nb_corrupted == 0, "%u corrupted\n", q.nb_corrupted);
+    upqueue_close(&q);
+    printf("# reboot: cursor and records kept\n");
+}
+
+static void test_torn(void) {
+    char path[UPQUEUE_PATH_MAX + 8];
+    struct upqueue_s q;
+    long len, rec;
+    FILE *f;
+    int c;
+
+    /* power loss in the middle of the last record */
+    log_remove();
+    CHECK(upqueue_open(&q, base, 256 * 1024) == 0, "open\n");
+    push_range(&q, 0, 100);
+    upqueue_close(&q);
+    len = seg_size(0);
+    rec = len / 100;
+    snprintf(path, sizeof path, "%s.0", base);
+    CHECK(truncate(path, len - 5) == 0, "truncate\n");
+
+    CHECK(upqueue_open(&q, base, 256 * 1024) == 0, "open after a torn write\n");
+    CHECK(upqueue_pending(&q) == 99, "%u pending after a torn write, 99 expected\n", upqueue_pending(&q));
+    CHECK(q.nb_corrupted == 1, "%u corrupted, 1 expected\n", q.nb_corrupted);
+    /* the next record overwrites the torn one */
+    push_range(&q, 99, 100);
+    CHECK(fetch_expect(&q, 0, 100, true) == 100, "fetch after a torn write\n");
+    upqueue_close(&q);
+
+    /* a byte changed in the middle of record 50 */
+    log_remove();
+    CHECK(upqueue_open(&q, base, 256 * 1024) == 0, "open\n");
+    push_range(&q, 0, 100);
+    upqueue_close(&q);
+    f = fopen(path, "r+b");
+    CHECK(f != NULL, "open %s\n", path);
+    if (f != NULL) {
+        fseek(f, 50 * rec + rec / 2, SEEK_SET);
+        c = fgetc(f);
+        fseek(f, 50 * rec + rec / 2, SEEK_SET);
+        fputc(c ^ 0x01, f);
+        fclose(f);
+    }
+    CHECK(upqueue_open(&q, base, 256 * 1024) == 0, "open after a bad CRC\n");
+    CHECK(upqueue_pending(&q) == 50, "%u pending after a bad CRC, 50 expected\n", upqueue_pending(&q));
+    CHECK(fetch_expect(&q, 0, 50, true) == 50, "fetch after a bad CRC\n");
+    upqueue_close(&q);
+    printf("# torn write and bad CRC: log cut before the record\n");
+}
+
+static void test_full(void) {
+    struct lgw_pkt_rx_s pkts[TEST_FETCH_NB];
+    struct timeval tv[TEST_FETCH_NB];
+    struct upqueue_s q;
+    uint32_t pending, first, n = 0;
+    int got;
+
+    log_remove();
+    CHECK(upqueue_open(&q, base, UPQUEUE_SIZE_MIN) == 0, "open\n");
+    push_range(&q, 0, 2000);
+    pending = upqueue_pending(&q);
+    CHECK(q.nb_dropped > 0, "nothing dropped on a full log\n");
+    CHECK(pending + q.nb_dropped == 2000, "%u pending + %u dropped, 2000 expected\n", pending, q.nb_dropped);
+
+    /* the oldest record left is the first one after the dropped ones */
+    got = upqueue_fetch(&q, 1, pkts, tv);
+    CHECK(got == 1, "fetch\n");
+    upqueue_nack(&q);
+    for (first = 0; (got == 1) && (first < 2000) && !same_pkt(first, &pkts[0], &tv[0]); ++first) {
+    }
+    CHECK(first == q.nb_dropped, "oldest record %u, %u expected\n", first, q.nb_dropped);
+    n = fetch_expect(&q, first, 2000 - first, true);
+    CHECK(n == 2000 - first, "%u fetched, %u expected\n", n, 2000 - first);
+    upqueue_close(&q);
+    printf("# full log: %u records dropped, %u replayed\n", q.nb_dropped, n);
+}
+
+static void bench(uint32_t nb) {
+    struct lgw_pkt_rx_s pkt;
+    struct upqueue_s q;
+    struct timeval tv;
+    double t0, dt;
+    uint32_t i, n;
+    long bytes;
+
+    log_remove();
+    if (upqueue_open(&q, base, 64 * 1024 * 1024) != 0) {
+        fprintf(stderr, "ERROR: failed to open %s\n", base);
+        nb_fail += 1;
+        return;
+    }
+    t0 = now_s();
+    for (i = 0; i < nb; ++i) {
+        make_pkt(i, &pkt, &tv);
+        upqueue_push(&q, &pkt, &tv);
+    }
+    upqueue_flush(&q);
+    dt = now_s() - t0;
+    bytes = seg_size(0) + ((seg_size(1) > 0) ? seg_size(1) : 0);
+    printf("# write: %u records (%ld bytes) in %.3f s, %.0f records per s, %.2f MB/s\n", nb, bytes, dt, nb / dt, bytes / dt / 1e6);
+
+    t0 = now_s();
+    n = fetch_expect(&q, i - upqueue_pending(&q), upqueue_pending(&q), true);
+    dt = now_s() - t0;
+    printf("# replay: %u records in %.3f s, %.0f records per s\n", n, dt, n / dt);
+    upqueue_close(&q);
+    log_remove();
+}
+
+static void usage(void) {
+    printf("Usage: upqueue_test [-d directory] [-n records] [-l payload size]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    const char *dir = "/tmp";
+    uint32_t nb = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hd:n:l:")) != -1) {
+        switch (opt) {
+            case 'd': dir = optarg; break;
+            case 'n': nb = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'l': payload_size = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if ((payload_size < 4) || (payload_size > 255) || (snprintf(base, sizeof base, "%s/upqueue_test", dir) >= (int)sizeof base)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    logcat_init(NULL);
+    logcat_set_level(LOGCAT_NB, LORAPF_ERROR_);
+
+    test_round_trip();
+    test_reboot();
+    test_torn();
+    test_full();
+    log_remove();
+    if (nb > 0) {
+        bench(nb);
+    }
+    if (nb_fail > 0) {
+        printf("### %u checks failed\n", nb_fail);
+        return EXIT_FAILURE;
+    }
+    printf("### all checks passed\n");
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -5,6 +5,8 @@ nrofslots = timespan/timeinterval;
 
 freqspan = 125e3; %hz : 125khz
 freqinterval = 100; %hz
+% freqspan and freqinterval are not used here, collision_sim.c models the
+% carrier offsets and the 8 channels of the gateway
 
 start_channel = 1;
 end_channel = 6;
@@ -4,6 +4,8 @@ nrofslots = timespan/timeinterval;
 
 freqspan = 125e3; %hz : 125khz -> 868.7 - 869.2 MHZ
 freqinterval = 100; %hz
+% freqspan and freqinterval are not used here, collision_sim.c models the
+% carrier offsets and the 8 channels of the gateway
 nrofchannels = 6;
 
 ft = zeros(nrofslots, nrofchannels);
@@ -0,0 +1,106 @@
+clear all, close all;
+% Capacity gain of the gateway ADR recommendations (adr.c), with the
+% collision model of Device_collision_1000.m: 10 ms slots, one logical
+% channel per spreading factor, a packet fails when it overlaps another one
+% on the same channel.
+timespan = 60*1000; %ms
+timeinterval = 10; %ms
+nrofslots = timespan/timeinterval;
+
+nrofchannels = 6;
+
+maxnrofdevices = 1000;
+devicestepsize = 10;
+nrofdevices = devicestepsize:devicestepsize:maxnrofdevices;
+nrofpackets = 1;
+lora_duration = [12  293 682;
+        11  547 365;
+        10  976 204;
+        09 1757 113;
+        08 3125  64;
+        07 5478  36;
+        06 9375 21];
+
+%RADIO (log-distance path loss of Bor et al., 20 dB better for a gateway on a mast)
+radius = 1000; %m, devices uniformly spread around the gateway
+txpower = 14; %dBm
+noisefloor = -174 + 10*log10(125e3) + 6; %dBm, 6 dB noise figure
+pl_d0 = 40; pl_0 = 107.41; pl_n = 2.08; pl_sigma = 3.57;
+
+%ADR (same tables as adr.c)
+snr_floor = [-20 -17.5 -15 -12.5 -10 -7.5]; % SF12 .. SF7, by logical channel
+adr_margin = 10; %dB
+adr_step = 3; %dB
+
+% 1: random SF (Device_collision_1000.m), 2: all devices at SF12, 3: ADR
+results = zeros(length(nrofdevices), 3);
+
+for n = 1:length(nrofdevices)
+    nr = nrofdevices(n);
+
+    d = max(radius * sqrt(rand(nr, 1)), 1);
+    snr = txpower - (pl_0 + 10*pl_n*log10(d/pl_d0) + pl_sigma*randn(nr, 1)) - noisefloor;
+
+    adr_sf = ones(nr, 1);
+    nstep = floor((snr - snr_floor(1) - adr_margin) / adr_step);
+    adr_sf(nstep > 0) = 1 + min(nstep(nstep > 0), nrofchannels - 1);
+
+    sf_modes = [randi([1 nrofchannels], [nr 1]) ones(nr, 1) adr_sf];
+    time = rand(nr, 1);
+
+    for mode = 1:3
+        sf = sf_modes(:, mode);
+        ft = zeros(nrofslots, nrofchannels);
+        ft2 = zeros(nrofslots, nrofchannels);
+        colission = zeros(nr, 1);
+
+        % below the demodulation floor of its SF, a packet is lost anyway
+        colission(snr < snr_floor(sf)') = 1;
+
+        for i = 1:nr
+            duration = lora_duration(sf(i), 3);
+            time_offset = floor((nrofslots - duration/timeinterval) * time(i));
+            for j = 1:ceil(duration/timeinterval)
+                if j+time_offset > nrofslots
+                    continue
+                end
+                if ft(j+time_offset, sf(i)) == 0
+                    ft(j+time_offset, sf(i)) = 1;
+                    ft2(j+time_offset, sf(i)) = i;
+                else
+                    ft(j+time_offset, sf(i)) = ft(j+time_offset, sf(i)) + 1;
+                    colission(i) = 1;
+                    colission(ft2(j+time_offset, sf(i))) = 1;
+                end
+            end
+        end
+        results(n, mode) = 100*sum(colission)/nr;
+    end
+end
+
+% devices served with less than 10% packet error rate
+capacity = zeros(1, 3);
+for mode = 1:3
+    ok = find(results(:, mode) < 10);
+    if ~isempty(ok)
+        capacity(mode) = nrofdevices(ok(end));
+    end
+end
+capacity
+
+figure(98)
+titlestring = sprintf('Lora packet collision simulation withing 125 kH, devices within %d m\ntransmitting once within 60 seconds', ...
+        radius);
+title(titlestring);
+xlabel('Number of 25 byte  messages / minute') % x-axis label
+ylabel('Packet error rate (%)'), ylim([0 100])
+hold on
+plot(nrofdevices, results(:, 1))
+plot(nrofdevices, results(:, 2))
+plot(nrofdevices, results(:, 3))
+legend(sprintf('random SF (%d devices < 10%%)', capacity(1)), ...
+       sprintf('SF12, no ADR (%d devices < 10%%)', capacity(2)), ...
+       sprintf('gateway ADR (%d devices < 10%%)', capacity(3)));
+grid on,hold off;
+
+saveas(figure(98), sprintf('lora_%d_dev_adr.png', maxnrofdevices));
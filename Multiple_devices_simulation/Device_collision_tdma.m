@@ -0,0 +1,103 @@
+clear all, close all;
+% Time-slotted schedule of the repeater (tdma.h) against random access, with
+% the collision model of Device_collision_1000.m: 10 ms slots, one logical
+% channel per spreading factor, one 25 byte message per device and minute,
+% a packet fails when it overlaps another one on the same channel.
+%
+% 1: ALOHA, random SF (Device_collision_1000.m)
+% 2: ALOHA, all devices at SF7
+% 3: TDMA at SF7 with the forwarder defaults: 60 s superframe, 500 ms
+%    beacon, 120 slots of 450 ms. The devices beyond the slots send in the
+%    contention part, between the last slot and the beacon lead.
+timespan = 60*1000; %ms
+timeinterval = 10; %ms
+nrofslots = timespan/timeinterval;
+nrofchannels = 6;
+
+maxnrofdevices = 300;
+devicestepsize = 5;
+nrofdevices = devicestepsize:devicestepsize:maxnrofdevices;
+nrofruns = 20;
+lora_duration = [12  293 682;
+        11  547 365;
+        10  976 204;
+        09 1757 113;
+        08 3125  64;
+        07 5478  36;
+        06 9375 21];
+packetduration = floor(lora_duration(:,3)/timeinterval);
+
+%TDMA (DEFAULT_TDMA_* of pkt_fwd.c, TDMA_BEACON_LEAD_MS of tdma.h)
+beacon_ms = 500;
+slot_ms = 450;
+tdma_slots = 120;
+beacon_lead_ms = 500;
+contention = [(beacon_ms + tdma_slots*slot_ms) (timespan - beacon_lead_ms)]/timeinterval;
+
+results = zeros(length(nrofdevices), 3);
+
+for n = 1:length(nrofdevices)
+    nr = nrofdevices(n);
+
+    for run = 1:nrofruns
+        for mode = 1:3
+            if mode == 1
+                sf = randi([1 nrofchannels], nr, 1);
+                span = [0 nrofslots];
+            elseif mode == 2
+                sf = 6*ones(nr, 1);
+                span = [0 nrofslots];
+            else
+                % the devices with a slot never collide
+                sf = 6*ones(max(nr - tdma_slots, 0), 1);
+                span = contention;
+            end
+
+            ft = zeros(nrofslots, nrofchannels);
+            time_offset = zeros(length(sf), 1);
+            for i = 1:length(sf)
+                duration = packetduration(sf(i));
+                time_offset(i) = span(1) + floor((span(2) - span(1) - duration) * rand(1,1));
+                ft(time_offset(i)+1:time_offset(i)+duration, sf(i)) = ft(time_offset(i)+1:time_offset(i)+duration, sf(i)) + 1;
+            end
+            colission = 0;
+            for i = 1:length(sf)
+                duration = packetduration(sf(i));
+                if max(ft(time_offset(i)+1:time_offset(i)+duration, sf(i))) > 1
+                    colission = colission + 1;
+                end
+            end
+            results(n, mode) = results(n, mode) + 100*colission/nr/nrofruns;
+        end
+    end
+end
+
+% devices served before the packet error rate reaches 5%
+fiveperc = zeros(1, 3);
+for mode = 1:3
+    over = find(results(:, mode) >= 5, 1);
+    if isempty(over)
+        fiveperc(mode) = maxnrofdevices;
+    elseif over > 1
+        fiveperc(mode) = nrofdevices(over - 1);
+    end
+end
+fiveperc
+
+figure(96)
+titlestring = sprintf('Lora packet collision simulation withing 125 kH\nrandom access against %d slots of %d ms per minute', ...
+        tdma_slots, slot_ms);
+title(titlestring);
+xlabel('Number of 25 byte  messages / minute') % x-axis label
+ylabel('Packet error rate (%)'), ylim([0 100])
+hold on
+plot(nrofdevices, results(:, 1))
+plot(nrofdevices, results(:, 2))
+plot(nrofdevices, results(:, 3))
+plot(nrofdevices, 5*ones(size(nrofdevices)), 'k--')
+legend(sprintf('ALOHA, random SF (%d devices < 5%%)', fiveperc(1)), ...
+       sprintf('ALOHA, SF7 (%d devices < 5%%)', fiveperc(2)), ...
+       sprintf('TDMA, SF7 (%d devices < 5%%)', fiveperc(3)));
+grid on,hold off;
+
+saveas(figure(96), sprintf('lora_%d_dev_tdma.png', maxnrofdevices));
@@ -0,0 +1,185 @@
+clear all, close all;
+% Fast-path ACK of the repeater (RELAYNET_UP / RELAYNET_ACK in relaynet.h)
+% against the polling of the "Repeticao Um Canal" scripts. Every device
+% sends one message, 10 ms slots on one channel, a frame fails when it
+% overlaps another one or when it is lost on the link (per).
+%
+% 1: the device sends its message every 10 s until it reads b'1'. The
+%    repeater polls every 5 s, answers b'1' to everybody and is deaf for
+%    9 s after a message (1 s sleep, LoRaWAN resend, 5 s sleep).
+% 2: the repeater listens all the time and sends an ACK addressed to the
+%    device 200 ms after the end of the uplink, the device listens for
+%    500 ms and retransmits after a random exponential backoff.
+timespan = 600*1000; %ms
+timeinterval = 10; %ms
+nrofslots = timespan/timeinterval;
+startspan = 60*1000/timeinterval; % devices send their message within the first minute
+
+per = 0.1;
+nrofruns = 20;
+nrofdevices = [1 2 5 10 20];
+
+up = 6;            % uplink, SF7 29 bytes: 56 ms
+ack_old = 3;       % b'1', SF7: 26 ms
+ack_new = 4;       % relay ACK, SF7 9 bytes: 36 ms
+ack_delay = 20;    % RELAYNET_ACK_DELAY_US
+rx_window = 50;    % RX_WINDOW_MS of the device script
+max_tries = 6;     % MAX_TRIES of the device script
+backoff = 100;     % first backoff of the device script
+old_period = 1000; % device retransmission interval
+old_poll = 500;    % repeater poll interval
+old_deaf = 900;    % repeater deaf after a message
+
+% transmissions per delivered message, delivered (%), falsely ACKed (%), time to ACK (s)
+results = zeros(length(nrofdevices), 2, 4);
+
+for mode = 1:2
+for n = 1:length(nrofdevices)
+    nr = nrofdevices(n);
+    acc = zeros(1, 4);
+
+    for run = 1:nrofruns
+        air = zeros(nrofslots + 2*old_period, 1); % frames in the air, per slot
+        rep = zeros(nrofslots + 2*old_period, 1); % repeater transmitting
+        next_tx = randi([1 startspan], nr, 1);
+        tx_start = zeros(nr, 1); tx_end = inf(nr, 1); tx_first = zeros(nr, 1);
+        win_end = inf(nr, 1);
+        tries = zeros(nr, 1); got = zeros(nr, 1); acked = zeros(nr, 1);
+        done = zeros(nr, 1); done_t = zeros(nr, 1); failed = zeros(nr, 1);
+        acks = zeros(0, 3); % start, end, device (0: everybody)
+        deaf_until = 0; buffer = []; next_poll = old_poll;
+
+        for t = 1:nrofslots
+            % device transmissions
+            for i = 1:nr
+                if next_tx(i) == t && ~done(i)
+                    if mode == 1 && acked(i)
+                        done(i) = 1; done_t(i) = t;
+                        continue
+                    end
+                    tx_start(i) = t; tx_end(i) = t + up - 1; next_tx(i) = inf;
+                    tries(i) = tries(i) + 1;
+                    if tx_first(i) == 0
+                        tx_first(i) = t;
+                    end
+                    air(t:t+up-1) = air(t:t+up-1) + 1;
+                end
+            end
+
+            % repeater poll
+            if mode == 1 && t == next_poll
+                if ~isempty(buffer)
+                    buffer(1) = [];
+                    acks(end+1, :) = [t t+ack_old-1 0];
+                    deaf_until = t + old_deaf;
+                    next_poll = t + old_deaf;
+                else
+                    next_poll = t + old_poll;
+                end
+            end
+
+            % repeater transmissions
+            for k = 1:size(acks, 1)
+                if acks(k, 1) == t
+                    air(acks(k, 1):acks(k, 2)) = air(acks(k, 1):acks(k, 2)) + 1;
+                    rep(acks(k, 1):acks(k, 2)) = 1;
+                end
+            end
+
+            % end of the uplinks
+            for i = 1:nr
+                if tx_end(i) == t
+                    s = tx_start(i);
+                    ok = all(air(s:t) == 1) && ~any(rep(s:t)) && rand > per;
+                    if mode == 1
+                        ok = ok && s > deaf_until;
+                    end
+                    if ok
+                        got(i) = 1;
+                        if mode == 1
+                            if ~any(buffer == i)
+                                buffer(end+1) = i;
+                            end
+                        else
+                            acks(end+1, :) = [t+ack_delay t+ack_delay+ack_new-1 i];
+                        end
+                    end
+                    if mode == 1
+                        next_tx(i) = s + old_period;
+                    else
+                        win_end(i) = t + rx_window;
+                    end
+                    tx_end(i) = inf;
+                end
+            end
+
+            % end of the ACKs, a device transmitting does not hear them
+            for k = 1:size(acks, 1)
+                if acks(k, 2) == t
+                    clean = all(air(acks(k, 1):t) == 1);
+                    if acks(k, 3) == 0
+                        targets = 1:nr;
+                    else
+                        targets = acks(k, 3);
+                    end
+                    for j = targets
+                        busy = tries(j) > 0 && tx_start(j) <= t && tx_start(j) + up - 1 >= acks(k, 1);
+                        if clean && ~busy && rand > per
+                            acked(j) = 1;
+                        end
+                    end
+                end
+            end
+            if ~isempty(acks)
+                acks(acks(:, 2) <= t, :) = [];
+            end
+
+            % end of the RX windows
+            if mode == 2
+                for i = 1:nr
+                    if win_end(i) == t
+                        win_end(i) = inf;
+                        if acked(i)
+                            done(i) = 1; done_t(i) = t;
+                        elseif tries(i) >= max_tries
+                            done(i) = 1; done_t(i) = t; failed(i) = 1;
+                        else
+                            b = backoff * 2^(tries(i) - 1);
+                            next_tx(i) = t + b + randi([0 b]);
+                        end
+                    end
+                end
+            end
+        end
+
+        ok = find(done & ~failed & got & tx_first > 0);
+        if isempty(ok)
+            ack_time = 0;
+        else
+            ack_time = mean(done_t(ok) - tx_first(ok))*timeinterval/1000;
+        end
+        acc = acc + [sum(tries)/max(sum(got), 1), 100*sum(got)/nr, ...
+                     100*sum(acked & ~got)/nr, ack_time];
+    end
+    results(n, mode, :) = acc/nrofruns;
+end
+end
+
+squeeze(results(:, 1, :))
+squeeze(results(:, 2, :))
+
+figure(97)
+labels = {'Transmissions per delivered message', 'Delivered (%)', ...
+          'Falsely acknowledged (%)', 'Time to ACK (s)'};
+for k = 1:4
+    subplot(2, 2, k)
+    hold on
+    plot(nrofdevices, results(:, 1, k), '-o')
+    plot(nrofdevices, results(:, 2, k), '-o')
+    xlabel('Number of devices'), ylabel(labels{k})
+    grid on, hold off;
+end
+legend('polling, broadcast b''1''', 'relay ACK after 200 ms');
+sgtitle(sprintf('Repeater acknowledgements, one message per device, %d%% packet loss', per*100));
+
+saveas(figure(97), 'lora_relay_fast_ack.png');
@@ -0,0 +1,781 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Native LoRa collision simulator, the model of Device_collision_1000.m
+    with the frequencies of the gateway and the capture effect:
+
+    - the 8 chan_multiSF channels of Scripts/Pygate_no_tcp_as_gw/config.json,
+      radio_1 at 868.5 MHz with the IF -400k, -200k, 0 and radio_0 at
+      867.5 MHz with the IF -400k, -200k, 0, +200k, +400k, each freqspan
+      (125 kHz) wide. Every uplink is sent on a random channel.
+    - a carrier offset per device, from the error of its crystal (-o, ppm),
+      in steps of freqinterval (100 Hz). Two packets interfere in proportion
+      of the overlap of their bands, so channels closer than freqspan (-w)
+      interfere partially too.
+    - the interference model of ns-3 lorawan: the energy received from the
+      interferers of each spreading factor, over the time they overlap the
+      packet, against the SIR thresholds of Goursaud et al. A packet survives
+      a stronger co-SF interferer by 6 dB, a packet of another SF by -16 to
+      -36 dB.
+    - the sensitivity of each SF, the path loss of the devices spread in a
+      disk around the gateway (3GPP macro-cell model) and the 8 demodulators
+      of the SX1301.
+
+    The engine is a sweep line on the start of the packets: the devices are
+    kept in a heap by time of their next uplink, so packets are generated in
+    time order, and the packets still in the air are kept in frequency bins
+    of freqspan. A new packet is only compared to the packets of its bin and
+    of the 2 bins around it, a packet is accounted once the sweep line has
+    passed its end. Memory and time per packet depend on the packets in the
+    air, not on the duration, millions of packets per simulated hour run in
+    seconds.
+
+    The packets come from a model of the devices, or from a trace of the
+    gateway (-i): a capture file of the forwarder (capture.h), or a text file
+    with one packet per line
+
+        time_us,sf,freq_hz,size,rssi
+
+    time_us being the concentrator counter at the end of the packet, as the
+    count_us of the capture and the tmst of rxpk. Lines starting with # are
+    ignored, "-" reads the text from stdin. The packets only need to be in
+    order of their end, the trace is streamed through a reorder heap whose
+    size depends on the packets per second, not on the size of the trace.
+
+    -k scales the trace: k - 1 copies of the trace are added, each one
+    delayed by a random time within the period (-p), so every copy keeps the
+    inter-arrival times, bursts and periods of the recorded devices. The
+    trace only holds the packets the gateway demodulated, the losses are
+    the ones the recorded traffic causes to itself.
+
+    Received packets are sorted by headroom: how much stronger their
+    interference could be before they are lost.
+
+    Build and run on the host:
+
+        gcc -O2 -I.. -o collision_sim collision_sim.c -lm
+        ./collision_sim -n 20000 -t 3600
+        ./collision_sim -i capture.bin -k 10
+
+    -n devices (1000), -t simulated time in s (3600), -p uplink period in s
+    (60), -P Poisson arrivals instead of periodic ones, -l payload size (25),
+    -s SF, 0: random as the MATLAB models, 1: lowest SF with a 5 dB margin
+    (0), -c channels (8), -w channel spacing in Hz instead of the config.json
+    frequencies, -o crystal error in ppm (10), -r cell radius in km (2),
+    -d demodulators (8), -i trace, -k scale of the trace (1), -x random seed.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf, fopen, fread, fgets */
+#include <stdlib.h>     /* realloc, free, atoi, atof, strtod */
+#include <string.h>     /* memset, memcmp */
+#include <math.h>       /* pow, log10, ceil */
+#include <time.h>       /* clock */
+#include <unistd.h>     /* getopt */
+
+#include "capture_rec.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define SIM_CHAN_NB         8
+#define SIM_SF_MIN          7
+#define SIM_SF_NB           6           /* SF7 to SF12 */
+#define SIM_FREQ_SPAN       125000      /* freqspan, bandwidth of a channel (Hz) */
+#define SIM_FREQ_INTERVAL   100         /* freqinterval, resolution of the carrier offsets (Hz) */
+#define SIM_DEMOD_NB        8           /* parallel demodulators of the SX1301 */
+#define SIM_TX_DBM          14.0        /* device TX power */
+#define SIM_SF_MARGIN_DB    5.0         /* link margin of the SF chosen by distance (-s 1) */
+#define SIM_DIST_MIN_KM     0.01
+#define SIM_BIN_NB          128         /* frequency bins of freqspan, folded modulo SIM_BIN_NB */
+#define SIM_SCALE_MAX       100
+#define SIM_AIRTIME_MAX_US  10000000    /* longer than any 125 kHz packet, reorder window of the traces */
+
+/* outcome of a packet */
+#define PKT_OK              0
+#define PKT_WEAK            1           /* below the sensitivity of its SF */
+#define PKT_BUSY            2           /* all demodulators busy */
+#define PKT_LOST            3           /* interference */
+
+/* headroom of the received packets: dB of extra interference they survive */
+#define SIM_MARGIN_NB       5
+static const double margin_db[SIM_MARGIN_NB] = { 3, 6, 10, 20, 1e9 };
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct dev_s {
+    int64_t         next_us;    /* start of the next uplink */
+    int32_t         offset_hz;  /* carrier offset, from the crystal error */
+    float           rssi_dbm;
+    uint8_t         sf;
+};
+
+struct pkt_s {
+    int64_t         start_us;
+    int64_t         end_us;
+    int32_t         freq_hz;
+    double          p_mw;       /* received power */
+    double          e_int[SIM_SF_NB]; /* interference energy (mW.us) per SF of the interferers */
+    uint8_t         sf;
+    uint8_t         state;      /* PKT_OK, PKT_WEAK or PKT_BUSY when it starts */
+    bool            co_sf;      /* overlapped by a packet of its SF */
+};
+
+struct bin_s {
+    uint32_t        *idx;       /* packets in the air, index in the pool */
+    uint32_t        nb;
+    uint32_t        size;
+};
+
+struct sim_stat_s {
+    uint64_t        nb_sent[SIM_SF_NB];
+    uint64_t        nb_weak[SIM_SF_NB];
+    uint64_t        nb_busy[SIM_SF_NB];
+    uint64_t        nb_lost[SIM_SF_NB];
+    uint64_t        nb_ok[SIM_SF_NB];
+    uint64_t        nb_captured[SIM_SF_NB]; /* received despite a co-SF interferer */
+    uint64_t        nb_clear;   /* received without any interferer */
+    uint64_t        nb_margin[SIM_MARGIN_NB]; /* received with an interferer, per headroom */
+    uint32_t        max_air;    /* max packets in the air */
+};
+
+/* devices of the model */
+struct model_s {
+    uint32_t        nb_dev;
+    double          duration_s;
+    bool            poisson;    /* Poisson arrivals, periodic otherwise */
+    unsigned        size;       /* payload size */
+    unsigned        sf_mode;    /* 0: random, 1: by distance, SF otherwise */
+    unsigned        nb_chan;
+    int32_t         freq[SIM_CHAN_NB];
+    double          ppm;        /* crystal error */
+    double          radius_km;
+};
+
+/* packet of a trace, waiting in the reorder heap */
+struct trace_pkt_s {
+    int64_t         start_us;
+    uint32_t        dur_us;
+    int32_t         freq_hz;
+    float           rssi_dbm;
+    uint8_t         sf;
+};
+
+struct trace_s {
+    FILE            *file;
+    bool            capture;    /* capture file, text otherwise */
+    uint16_t        rec_size;   /* record header size of the capture */
+    uint32_t        last_cnt;   /* last count_us, to unwrap the counter */
+    int64_t         cnt_us;     /* unwrapped counter */
+    bool            started;
+    struct trace_pkt_s *heap;
+    uint32_t        nb;
+    uint32_t        size;
+    uint64_t        nb_rec;     /* records read */
+    uint64_t        nb_skipped; /* not LoRa 125 kHz, or malformed */
+    uint64_t        nb_crc_bad; /* received with a bad CRC by the gateway */
+};
+
+struct sim_s {
+    struct pkt_s    *pool;
+    uint32_t        *free;      /* free entries of the pool */
+    uint32_t        pool_size;
+    uint32_t        nb_free;
+    struct bin_s    bin[SIM_BIN_NB];
+    int64_t         demod_end[SIM_DEMOD_NB];
+    unsigned        nb_demod;
+    uint32_t        nb_air;
+    struct sim_stat_s stat;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+/* chan_multiSF_0 to chan_multiSF_7 of config.json */
+static const int32_t chan_freq[SIM_CHAN_NB] = {
+    868100000, 868300000, 868500000,                        /* radio_1 */
+    867100000, 867300000, 867500000, 867700000, 867900000   /* radio_0 */
+};
+
+/* min SIR (dB), row: SF of the packet, column: SF of the interferer, Goursaud et al. */
+static const double sir_db[SIM_SF_NB][SIM_SF_NB] = {
+    {   6, -16, -18, -19, -19, -20 },
+    { -24,   6, -20, -22, -22, -22 },
+    { -27, -27,   6, -23, -25, -25 },
+    { -30, -30, -30,   6, -26, -28 },
+    { -33, -33, -33, -33,   6, -29 },
+    { -36, -36, -36, -36, -36,   6 }
+};
+
+/* SX1276 datasheet, 125 kHz */
+static const double sensitivity_dbm[SIM_SF_NB] = { -123.0, -126.0, -129.0, -132.0, -134.5, -137.0 };
+
+static double sir_min[SIM_SF_NB][SIM_SF_NB]; /* sir_db, linear */
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    uint64_t x = rand_state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    rand_state = x;
+    return x;
+}
+
+/* uniform in [0, 1) */
+static double rand_unit(void) {
+    return (double)(rand_next() >> 11) / 9007199254740992.0;
+}
+
+/* time on air (us) of an explicit header packet with CRC and 8 symbols of preamble, cr 1 to 4: 4/5 to 4/8 */
+static uint32_t airtime_us(unsigned sf, unsigned size, unsigned cr) {
+    double t_sym = (double)(1U << sf) * 1e6 / SIM_FREQ_SPAN;
+    int de = (sf >= 11) ? 1 : 0;
+    double n = ceil((8.0 * size - 4.0 * sf + 28 + 16) / (4.0 * (sf - 2 * de)));
+
+    if (n < 0) {
+        n = 0;
+    }
+    return (uint32_t)((8 + 4.25 + 8 + n * (cr + 4)) * t_sym);
+}
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (p == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void heap_down(struct dev_s *dev, uint32_t *heap, uint32_t nb, uint32_t i) {
+    uint32_t c, tmp;
+
+    for (c = 2 * i + 1; c < nb; i = c, c = 2 * i + 1) {
+        if ((c + 1 < nb) && (dev[heap[c + 1]].next_us < dev[heap[c]].next_us)) {
+            c += 1;
+        }
+        if (dev[heap[i]].next_us <= dev[heap[c]].next_us) {
+            break;
+        }
+        tmp = heap[i];
+        heap[i] = heap[c];
+        heap[c] = tmp;
+    }
+}
+
+/* account a packet the sweep line has passed */
+static void sim_close(struct sim_s *sim, uint32_t i) {
+    struct pkt_s *p = &sim->pool[i];
+    double e_sig = p->p_mw * (double)(p->end_us - p->start_us);
+    double m = 0;
+    bool clear = true;
+    unsigned s = p->sf - SIM_SF_MIN;
+    unsigned k;
+
+    if (p->state == PKT_OK) {
+        for (k = 0; k < SIM_SF_NB; ++k) {
+            if (p->e_int[k] <= 0) {
+                continue;
+            }
+            if (e_sig < p->e_int[k] * sir_min[s][k]) {
+                p->state = PKT_LOST;
+                break;
+            }
+            if (clear || (e_sig / (p->e_int[k] * sir_min[s][k]) < m)) {
+                m = e_sig / (p->e_int[k] * sir_min[s][k]);
+            }
+            clear = false;
+        }
+    }
+    switch (p->state) {
+        case PKT_OK:
+            sim->stat.nb_ok[s] += 1;
+            sim->stat.nb_captured[s] += p->co_sf ? 1 : 0;
+            if (clear) {
+                sim->stat.nb_clear += 1;
+            } else {
+                for (k = 0; 10 * log10(m) >= margin_db[k]; ++k);
+                sim->stat.nb_margin[k] += 1;
+            }
+            break;
+        case PKT_WEAK:
+            sim->stat.nb_weak[s] += 1;
+            break;
+        case PKT_BUSY:
+            sim->stat.nb_busy[s] += 1;
+            break;
+        default:
+            sim->stat.nb_lost[s] += 1;
+            break;
+    }
+    sim->free[sim->nb_free++] = i;
+    sim->nb_air -= 1;
+}
+
+/* add a packet, packets must come in order of start */
+static void sim_packet(struct sim_s *sim, int64_t start_us, uint32_t dur_us, int32_t freq_hz, unsigned sf, double rssi_dbm) {
+    struct pkt_s *p, *q;
+    struct bin_s *b;
+    uint32_t i, j;
+    int64_t end;
+    unsigned k, n;
+    int32_t df;
+    double frac, ov;
+
+    if (sim->nb_free == 0) {
+        n = sim->pool_size ? 2 * sim->pool_size : 1024;
+        sim->pool = xrealloc(sim->pool, n * sizeof *sim->pool);
+        sim->free = xrealloc(sim->free, n * sizeof *sim->free);
+        for (i = n; i > sim->pool_size; --i) {
+            sim->free[sim->nb_free++] = i - 1;
+        }
+        sim->pool_size = n;
+    }
+    i = sim->free[--sim->nb_free];
+    p = &sim->pool[i];
+    memset(p, 0, sizeof *p);
+    p->start_us = start_us;
+    p->end_us = start_us + dur_us;
+    p->freq_hz = freq_hz;
+    p->p_mw = pow(10.0, rssi_dbm / 10.0);
+    p->sf = (uint8_t)sf;
+    sim->stat.nb_sent[sf - SIM_SF_MIN] += 1;
+    if (rssi_dbm < sensitivity_dbm[sf - SIM_SF_MIN]) {
+        p->state = PKT_WEAK;
+    } else {
+        p->state = PKT_BUSY;
+        for (k = 0; k < sim->nb_demod; ++k) {
+            if (sim->demod_end[k] <= start_us) {
+                sim->demod_end[k] = p->end_us;
+                p->state = PKT_OK;
+                break;
+            }
+        }
+    }
+
+    /* interference with the packets in the air, in the bins freqspan around */
+    n = (unsigned)(freq_hz / SIM_FREQ_SPAN) + SIM_BIN_NB;
+    for (k = n - 1; k <= n + 1; ++k) {
+        b = &sim->bin[k % SIM_BIN_NB];
+        for (j = 0; j < b->nb; ) {
+            q = &sim->pool[b->idx[j]];
+            if (q->end_us <= start_us) {
+                sim_close(sim, b->idx[j]);
+                b->idx[j] = b->idx[--b->nb];
+                continue;
+            }
+            j += 1;
+            df = (q->freq_hz > freq_hz) ? (q->freq_hz - freq_hz) : (freq_hz - q->freq_hz);
+            if (df >= SIM_FREQ_SPAN) {
+                continue;
+            }
+            frac = (double)(SIM_FREQ_SPAN - df) / SIM_FREQ_SPAN;
+            end = (q->end_us < p->end_us) ? q->end_us : p->end_us;
+            ov = frac * (double)(end - start_us);
+            q->e_int[sf - SIM_SF_MIN] += p->p_mw * ov;
+            p->e_int[q->sf - SIM_SF_MIN] += q->p_mw * ov;
+            if (q->sf == sf) {
+                q->co_sf = true;
+                p->co_sf = true;
+            }
+        }
+    }
+    b = &sim->bin[n % SIM_BIN_NB];
+    if (b->nb == b->size) {
+        b->size = b->size ? 2 * b->size : 64;
+        b->idx = xrealloc(b->idx, b->size * sizeof *b->idx);
+    }
+    b->idx[b->nb++] = i;
+    sim->nb_air += 1;
+    if (sim->nb_air > sim->stat.max_air) {
+        sim->stat.max_air = sim->nb_air;
+    }
+}
+
+/* account the packets still in the air */
+static void sim_flush(struct sim_s *sim) {
+    unsigned k;
+
+    for (k = 0; k < SIM_BIN_NB; ++k) {
+        while (sim->bin[k].nb > 0) {
+            sim_close(sim, sim->bin[k].idx[--sim->bin[k].nb]);
+        }
+    }
+}
+
+static void sim_print(const struct sim_s *sim, double elapsed) {
+    const struct sim_stat_s *st = &sim->stat;
+    uint64_t tot[6] = { 0, 0, 0, 0, 0, 0 };
+    unsigned s;
+
+    printf("SF   %10s %10s %10s %10s %10s %10s %8s\n", "sent", "weak", "busy", "collided", "received", "captured", "PER (%)");
+    for (s = 0; s < SIM_SF_NB; ++s) {
+        if (st->nb_sent[s] == 0) {
+            continue;
+        }
+        printf("SF%-2u %10llu %10llu %10llu %10llu %10llu %10llu %8.2f\n", s + SIM_SF_MIN,
+               (unsigned long long)st->nb_sent[s], (unsigned long long)st->nb_weak[s],
+               (unsigned long long)st->nb_busy[s], (unsigned long long)st->nb_lost[s],
+               (unsigned long long)st->nb_ok[s], (unsigned long long)st->nb_captured[s],
+               100.0 * (double)(st->nb_sent[s] - st->nb_ok[s]) / (double)st->nb_sent[s]);
+        tot[0] += st->nb_sent[s];
+        tot[1] += st->nb_weak[s];
+        tot[2] += st->nb_busy[s];
+        tot[3] += st->nb_lost[s];
+        tot[4] += st->nb_ok[s];
+        tot[5] += st->nb_captured[s];
+    }
+    printf("all  %10llu %10llu %10llu %10llu %10llu %10llu %8.2f\n",
+           (unsigned long long)tot[0], (unsigned long long)tot[1], (unsigned long long)tot[2],
+           (unsigned long long)tot[3], (unsigned long long)tot[4], (unsigned long long)tot[5],
+           tot[0] ? 100.0 * (double)(tot[0] - tot[4]) / (double)tot[0] : 0.0);
+    printf("# headroom of the received packets: %llu without interferer", (unsigned long long)st->nb_clear);
+    for (s = 0; s < SIM_MARGIN_NB; ++s) {
+        if (s + 1 < SIM_MARGIN_NB) {
+            printf(", %llu < %.0f dB", (unsigned long long)st->nb_margin[s], margin_db[s]);
+        } else {
+            printf(", %llu >= %.0f dB\n", (unsigned long long)st->nb_margin[s], margin_db[s - 1]);
+        }
+    }
+    printf("# %llu packets in %.2f s (%.0f packets/s), up to %u in the air\n", (unsigned long long)tot[0],
+           elapsed, (elapsed > 0) ? (double)tot[0] / elapsed : 0.0, st->max_air);
+}
+
+/* feed the uplinks of the devices of the model to the simulation, in order of start */
+static void model_run(struct sim_s *sim, const struct model_s *m, double period_s) {
+    struct dev_s *dev;
+    uint32_t *heap;
+    uint32_t dur[SIM_SF_NB];
+    int32_t off_max;
+    int64_t end_us, t;
+    double d_km, u;
+    uint32_t i;
+    unsigned s, c;
+
+    for (s = 0; s < SIM_SF_NB; ++s) {
+        dur[s] = airtime_us(s + SIM_SF_MIN, m->size, 1);
+    }
+    /* a device further than a quarter of the band is not demodulated anyway */
+    off_max = SIM_FREQ_SPAN / 4;
+    dev = xrealloc(NULL, m->nb_dev * sizeof *dev);
+    heap = xrealloc(NULL, m->nb_dev * sizeof *heap);
+    for (i = 0; i < m->nb_dev; ++i) {
+        u = (2 * rand_unit() - 1) * m->ppm * 1e-6 * chan_freq[0] / SIM_FREQ_INTERVAL;
+        dev[i].offset_hz = (int32_t)lround(u) * SIM_FREQ_INTERVAL;
+        dev[i].offset_hz = (dev[i].offset_hz > off_max) ? off_max : (dev[i].offset_hz < -off_max) ? -off_max : dev[i].offset_hz;
+        d_km = m->radius_km * sqrt(rand_unit());
+        d_km = (d_km < SIM_DIST_MIN_KM) ? SIM_DIST_MIN_KM : d_km;
+        dev[i].rssi_dbm = (float)(SIM_TX_DBM - (128.1 + 37.6 * log10(d_km)));
+        if (m->sf_mode == 0) {
+            dev[i].sf = (uint8_t)(SIM_SF_MIN + rand_next() % SIM_SF_NB);
+        } else if (m->sf_mode == 1) {
+            for (s = 0; (s < SIM_SF_NB - 1) && (dev[i].rssi_dbm < sensitivity_dbm[s] + SIM_SF_MARGIN_DB); ++s);
+            dev[i].sf = (uint8_t)(SIM_SF_MIN + s);
+        } else {
+            dev[i].sf = (uint8_t)m->sf_mode;
+        }
+        dev[i].next_us = (int64_t)(rand_unit() * period_s * 1e6);
+        heap[i] = i;
+    }
+    for (i = m->nb_dev / 2 + 1; i > 0; --i) {
+        heap_down(dev, heap, m->nb_dev, i - 1);
+    }
+
+    end_us = (int64_t)(m->duration_s * 1e6);
+    while (dev[heap[0]].next_us < end_us) {
+        i = heap[0];
+        t = dev[i].next_us;
+        c = (unsigned)(rand_next() % m->nb_chan);
+        sim_packet(sim, t, dur[dev[i].sf - SIM_SF_MIN], m->freq[c] + dev[i].offset_hz, dev[i].sf, dev[i].rssi_dbm);
+        if (m->poisson) {
+            dev[i].next_us = t + (int64_t)(-log(1.0 - rand_unit()) * period_s * 1e6);
+        } else {
+            dev[i].next_us = t + (int64_t)(period_s * 1e6);
+        }
+        heap_down(dev, heap, m->nb_dev, 0);
+    }
+    free(heap);
+    free(dev);
+}
+
+static inline uint16_t get_le16(const uint8_t *b) {
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *b) {
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static int trace_open(struct trace_s *tr, const char *path) {
+    uint8_t hdr[CAPTURE_HDR_SIZE];
+    int c;
+
+    memset(tr, 0, sizeof *tr);
+    if (strcmp(path, "-") == 0) {
+        tr->file = stdin;
+        return 0;
+    }
+    tr->file = fopen(path, "rb");
+    if (tr->file == NULL) {
+        return -1;
+    }
+    c = fgetc(tr->file);
+    if (c == CAPTURE_MAGIC[0]) {
+        if ((fread(&hdr[1], 1, CAPTURE_HDR_SIZE - 1, tr->file) != CAPTURE_HDR_SIZE - 1) || (memcmp(&hdr[1], &CAPTURE_MAGIC[1], 3) != 0)) {
+            fclose(tr->file);
+            return -1;
+        }
+        tr->capture = true;
+        tr->rec_size = get_le16(&hdr[CAPTURE_HDR_OFF_REC_SIZE]);
+        if (tr->rec_size < CAPTURE_REC_SIZE) {
+            fclose(tr->file);
+            return -1;
+        }
+    } else if (c != EOF) {
+        ungetc(c, tr->file);
+    }
+    return 0;
+}
+
+/* read the next LoRa packet of the trace: 1 if one was read, 0 at the end */
+static int trace_read(struct trace_s *tr, struct trace_pkt_s *pkt) {
+    uint8_t rec[CAPTURE_REC_SIZE];
+    char line[256];
+    uint32_t rssi, cnt;
+    unsigned sf, cr, size;
+    int64_t t;
+    char *p;
+
+    while (1) {
+        if (tr->capture) {
+            if (fread(rec, 1, CAPTURE_REC_SIZE, tr->file) != CAPTURE_REC_SIZE) {
+                return 0;
+            }
+            size = get_le16(&rec[CAPTURE_REC_OFF_SIZE]);
+            /* fields appended by a later version, then the payload, are skipped */
+            if (fseek(tr->file, (long)(tr->rec_size - CAPTURE_REC_SIZE) + size, SEEK_CUR) != 0) {
+                return 0;
+            }
+            tr->nb_rec += 1;
+            for (sf = SIM_SF_MIN; (sf < SIM_SF_MIN + SIM_SF_NB) && (get_le32(&rec[CAPTURE_REC_OFF_DATARATE]) != ((uint32_t)CAPTURE_DR_LORA_SF7 << (sf - 7))); ++sf);
+            cr = rec[CAPTURE_REC_OFF_CODERATE];
+            if ((rec[CAPTURE_REC_OFF_MODULATION] != CAPTURE_MOD_LORA) || (rec[CAPTURE_REC_OFF_BANDWIDTH] != CAPTURE_BW_125KHZ) || (sf == SIM_SF_MIN + SIM_SF_NB) || (cr < CAPTURE_CR_LORA_4_5) || (cr > CAPTURE_CR_LORA_4_5 + 3)) {
+                tr->nb_skipped += 1;
+                continue;
+            }
+            tr->nb_crc_bad += (rec[CAPTURE_REC_OFF_STATUS] == CAPTURE_STAT_CRC_BAD) ? 1 : 0;
+            cnt = get_le32(&rec[CAPTURE_REC_OFF_COUNT_US]);
+            pkt->freq_hz = (int32_t)get_le32(&rec[CAPTURE_REC_OFF_FREQ_HZ]);
+            rssi = get_le32(&rec[CAPTURE_REC_OFF_RSSI]);
+            memcpy(&pkt->rssi_dbm, &rssi, sizeof pkt->rssi_dbm);
+        } else {
+            if (fgets(line, sizeof line, tr->file) == NULL) {
+                return 0;
+            }
+            if ((line[0] == '#') || (line[0] == '\n') || (line[0] == '\r')) {
+                continue;
+            }
+            tr->nb_rec += 1;
+            p = line;
+            t = strtoll(p, &p, 10);
+            sf = (unsigned)strtoul(p + (*p == ','), &p, 10);
+            pkt->freq_hz = (int32_t)strtol(p + (*p == ','), &p, 10);
+            size = (unsigned)strtoul(p + (*p == ','), &p, 10);
+            pkt->rssi_dbm = (float)strtod(p + (*p == ','), &p);
+            if ((sf < SIM_SF_MIN) || (sf >= SIM_SF_MIN + SIM_SF_NB) || (size > 255) || (pkt->freq_hz <= 0)) {
+                tr->nb_skipped += 1;
+                continue;
+            }
+            cr = 1;
+            cnt = (uint32_t)t;
+        }
+        /* the counter wraps every 71 minutes, packets may be slightly out of order */
+        if (!tr->started) {
+            tr->cnt_us = cnt;
+            tr->started = true;
+        } else {
+            tr->cnt_us += (int32_t)(cnt - tr->last_cnt);
+        }
+        tr->last_cnt = cnt;
+        pkt->sf = (uint8_t)sf;
+        pkt->dur_us = airtime_us(sf, size, cr);
+        pkt->start_us = tr->cnt_us - pkt->dur_us;
+        return 1;
+    }
+}
+
+static void trace_push(struct trace_s *tr, const struct trace_pkt_s *pkt) {
+    uint32_t i, up;
+
+    if (tr->nb == tr->size) {
+        tr->size = tr->size ? 2 * tr->size : 1024;
+        tr->heap = xrealloc(tr->heap, tr->size * sizeof *tr->heap);
+    }
+    for (i = tr->nb++; i > 0; i = up) {
+        up = (i - 1) / 2;
+        if (tr->heap[up].start_us <= pkt->start_us) {
+            break;
+        }
+        tr->heap[i] = tr->heap[up];
+    }
+    tr->heap[i] = *pkt;
+}
+
+static void trace_pop(struct trace_s *tr, struct trace_pkt_s *pkt) {
+    struct trace_pkt_s last = tr->heap[--tr->nb];
+    uint32_t i, c;
+
+    *pkt = tr->heap[0];
+    for (i = 0, c = 1; c < tr->nb; i = c, c = 2 * i + 1) {
+        if ((c + 1 < tr->nb) && (tr->heap[c + 1].start_us < tr->heap[c].start_us)) {
+            c += 1;
+        }
+        if (last.start_us <= tr->heap[c].start_us) {
+            break;
+        }
+        tr->heap[i] = tr->heap[c];
+    }
+    if (tr->nb > 0) {
+        tr->heap[i] = last;
+    }
+}
+
+/* feed a trace and its scaled copies to the simulation, in order of start */
+static void trace_run(struct sim_s *sim, struct trace_s *tr, unsigned scale, double period_s) {
+    int64_t delay[SIM_SCALE_MAX];
+    struct trace_pkt_s pkt, copy;
+    unsigned k;
+
+    delay[0] = 0;
+    for (k = 1; k < scale; ++k) {
+        delay[k] = (int64_t)(rand_unit() * period_s * 1e6);
+    }
+    while (trace_read(tr, &pkt) == 1) {
+        for (k = 0; k < scale; ++k) {
+            copy = pkt;
+            copy.start_us += delay[k];
+            trace_push(tr, &copy);
+        }
+        /* nothing read later, or its delayed copies, starts before this packet ended less the longest airtime */
+        while ((tr->nb > 0) && (tr->heap[0].start_us < pkt.start_us + pkt.dur_us - SIM_AIRTIME_MAX_US)) {
+            trace_pop(tr, &copy);
+            sim_packet(sim, copy.start_us, copy.dur_us, copy.freq_hz, copy.sf, copy.rssi_dbm);
+        }
+    }
+    while (tr->nb > 0) {
+        trace_pop(tr, &copy);
+        sim_packet(sim, copy.start_us, copy.dur_us, copy.freq_hz, copy.sf, copy.rssi_dbm);
+    }
+}
+
+static void usage(void) {
+    printf("Usage: collision_sim [-n devices] [-t seconds] [-p period_s] [-P] [-l size] [-s sf]\n");
+    printf("                     [-c channels] [-w spacing_hz] [-o ppm] [-r radius_km] [-d demods] [-x seed]\n");
+    printf("       collision_sim -i trace [-k scale] [-p period_s] [-d demods] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    static struct sim_s sim;
+    struct model_s m = { 1000, 3600, false, 25, 0, SIM_CHAN_NB, { 0 }, 10, 2 };
+    struct trace_s trace;
+    const char *trace_path = NULL;
+    unsigned scale = 1;
+    double period_s = 60;
+    int32_t spacing = 0;
+    unsigned nb_demod = SIM_DEMOD_NB;
+    clock_t clk;
+    unsigned s, c, k;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:t:p:Pl:s:c:w:o:r:d:i:k:x:")) != -1) {
+        switch (opt) {
+            case 'n': m.nb_dev = (uint32_t)atol(optarg); break;
+            case 't': m.duration_s = atof(optarg); break;
+            case 'p': period_s = atof(optarg); break;
+            case 'P': m.poisson = true; break;
+            case 'l': m.size = (unsigned)atoi(optarg); break;
+            case 's': m.sf_mode = (unsigned)atoi(optarg); break;
+            case 'c': m.nb_chan = (unsigned)atoi(optarg); break;
+            case 'w': spacing = atoi(optarg); break;
+            case 'o': m.ppm = atof(optarg); break;
+            case 'r': m.radius_km = atof(optarg); break;
+            case 'd': nb_demod = (unsigned)atoi(optarg); break;
+            case 'i': trace_path = optarg; break;
+            case 'k': scale = (unsigned)atoi(optarg); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if ((m.nb_dev == 0) || (m.duration_s <= 0) || (period_s <= 0) || (m.size > 255) || (m.nb_chan < 1) || (m.nb_chan > SIM_CHAN_NB) ||
+        ((m.sf_mode > 1) && ((m.sf_mode < SIM_SF_MIN) || (m.sf_mode >= SIM_SF_MIN + SIM_SF_NB))) ||
+        (spacing < 0) || (m.ppm < 0) || (m.radius_km <= 0) || (nb_demod < 1) || (nb_demod > SIM_DEMOD_NB) ||
+        (scale < 1) || (scale > SIM_SCALE_MAX)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    for (s = 0; s < SIM_SF_NB; ++s) {
+        for (k = 0; k < SIM_SF_NB; ++k) {
+            sir_min[s][k] = pow(10.0, sir_db[s][k] / 10.0);
+        }
+    }
+    for (c = 0; c < m.nb_chan; ++c) {
+        m.freq[c] = (spacing > 0) ? chan_freq[0] + (int32_t)c * spacing : chan_freq[c];
+    }
+    memset(&sim, 0, sizeof sim);
+    sim.nb_demod = nb_demod;
+
+    if (trace_path != NULL) {
+        if (trace_open(&trace, trace_path) != 0) {
+            fprintf(stderr, "ERROR: failed to open trace \"%s\"\n", trace_path);
+            return EXIT_FAILURE;
+        }
+        printf("### trace %s, x%u, copies delayed within %.0f s\n", trace_path, scale, period_s);
+        clk = clock();
+        trace_run(&sim, &trace, scale, period_s);
+        printf("# trace: %llu records, %llu skipped (not LoRa 125 kHz), %llu with a bad CRC at the gateway\n",
+               (unsigned long long)trace.nb_rec, (unsigned long long)trace.nb_skipped, (unsigned long long)trace.nb_crc_bad);
+        if (trace.file != stdin) {
+            fclose(trace.file);
+        }
+        free(trace.heap);
+    } else {
+        printf("### %u devices, %.0f s, 1 uplink of %u bytes every %.0f s%s, %u channels, +/-%.1f ppm, %.1f km\n",
+               m.nb_dev, m.duration_s, m.size, period_s, m.poisson ? " (Poisson)" : "", m.nb_chan, m.ppm, m.radius_km);
+        clk = clock();
+        model_run(&sim, &m, period_s);
+    }
+
+    sim_flush(&sim);
+    sim_print(&sim, (double)(clock() - clk) / CLOCKS_PER_SEC);
+
+    for (k = 0; k < SIM_BIN_NB; ++k) {
+        free(sim.bin[k].idx);
+    }
+    free(sim.pool);
+    free(sim.free);
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,645 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Load generator: a fleet of devices behaving like the test scripts,
+    written as the packets the concentrator would return, in a capture file
+    of the forwarder (capture.h).
+
+    Three kinds of devices, from the scripts of Scripts/:
+
+    - First_communication_Lopy_to_Gateway: OTAA join on the 3 default
+      channels, then an unconfirmed "testes" uplink at DR5 every 10 s on the
+      8 channels. A fraction of the devices (-c) send confirmed uplinks and
+      retransmit them until they are acknowledged, as LoRaWAN does.
+    - Lopy_to_lopy_lopy (-R): raw LoRa, 16 bytes every 5 s at SF7.
+    - Repetição Um Canal/ENDDEVICE (-E): RELAYNET_UP frames (relaynet.h) on
+      868.1 MHz at SF7, once a minute, retransmitted with an exponential
+      backoff while the ACK of the repeater is missing.
+
+    Bursty devices (-B) send -b uplinks in a row, one per RX window cycle,
+    instead of one per period.
+
+    The gateway side is the one of collision_sim.c, simplified: the 8
+    demodulators of the SX1301, the sensitivity of each SF, and the capture
+    of co-SF packets of the same channel: a packet overlapped by another
+    one less than 6 dB weaker is reported with a bad CRC. Join-accepts and
+    ACKs are lost with a probability (-a), or when the uplink was.
+
+    The capture time of the records starts at 2021-01-01 and the counter at
+    a random value, so the counter wraps within 71 minutes. The forwarder
+    replays the file in place of the concentrator with, in gateway_conf:
+
+        "replay_path": "fleet.lgwc",
+        "replay_speed": 0
+
+    a speed of 0 feeding the packets as fast as the forwarder takes them.
+    The file can be analyzed by collision_sim -i as well, and timed on the
+    host through the upstream stages with Host_tests/stage_bench -f.
+
+    Build and run on the host:
+
+        gcc -O2 -I.. -o fleet_gen fleet_gen.c -lm
+        ./fleet_gen -n 5000 -t 3600 -o fleet.lgwc
+
+    -n devices (1000), -t simulated time in s (600), -o capture file
+    (fleet.lgwc), -p period of the LoRaWAN devices in s (10), -c fraction of
+    LoRaWAN devices sending confirmed uplinks (0.1), -R fraction of raw LoRa
+    devices (0), -E fraction of relay devices (0), -B fraction of bursty
+    devices (0), -b uplinks per burst (5), -l payload size (6), -s DR of the
+    LoRaWAN devices, -1: random (5), -a ACK loss (0.05), -g gateway EUI
+    (hex), -x random seed.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf, fopen, fwrite */
+#include <stdlib.h>     /* realloc, free, atoi, atof, strtoull */
+#include <string.h>     /* memset, memcpy */
+#include <math.h>       /* ceil */
+#include <time.h>       /* clock */
+#include <unistd.h>     /* getopt */
+
+#include "capture_rec.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define GEN_CHAN_NB         8
+#define GEN_JOIN_CHAN_NB    3           /* default EU868 channels, the others come with the join-accept */
+#define GEN_SF_MIN          7
+#define GEN_SF_NB           6
+#define GEN_BW_HZ           125000
+#define GEN_DEMOD_NB        8
+#define GEN_CAPTURE_DB      6.0         /* co-SF capture threshold */
+#define GEN_NOISE_DBM       -117.0      /* noise floor in 125 kHz, 6 dB noise figure */
+#define GEN_EPOCH_S         1609459200  /* capture time of the first packet, 2021-01-01 */
+#define GEN_PAYLOAD_MAX     64
+
+/* LoRaWAN timings (s): RX windows, join-accept, ACK_TIMEOUT */
+#define GEN_RX2_US          2000000
+#define GEN_JOIN_RX2_US     6000000
+#define GEN_ACK_TIMEOUT_US  2000000     /* 1 to 3 s */
+#define GEN_NB_TRANS_MAX    8
+
+/* Lopy_to_lopy_lopy and ENDDEVICE */
+#define GEN_RAW_PERIOD_US   5000000
+#define GEN_RAW_SIZE        16
+#define GEN_RELAY_PERIOD_US 60000000
+#define GEN_RELAY_FREQ      868100000
+#define GEN_RELAY_ACK_US    (200000 + 36000 + 548000) /* RELAYNET_ACK_DELAY_US, ACK airtime, RX window of the device script to everybody */
+#define GEN_RELAY_BACKOFF_US 1000000
+#define GEN_RELAY_TRIES     6
+
+enum gen_kind_e {
+    KIND_LORAWAN = 0,
+    KIND_RAW,
+    KIND_RELAY
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct dev_s {
+    int64_t         next_us;    /* start of the next transmission */
+    int64_t         period_us;  /* start of the next period */
+    uint64_t        dev_eui;
+    uint32_t        dev_addr;   /* 0 until joined */
+    uint16_t        fcnt;
+    uint16_t        nonce;
+    float           rssi_dbm;
+    uint8_t         kind;
+    uint8_t         sf;
+    uint8_t         tries;      /* transmissions of the current frame */
+    uint8_t         burst;      /* uplinks left in the burst */
+    bool            confirmed;
+    bool            bursty;
+};
+
+/* packet in the air */
+struct air_s {
+    int64_t         start_us;
+    int64_t         end_us;
+    uint32_t        dev;
+    int32_t         freq_hz;
+    uint8_t         chan;
+    uint8_t         sf;
+    bool            demod;      /* a demodulator locked on it */
+    bool            lost;       /* destroyed by a co-SF packet */
+    uint8_t         size;
+    uint8_t         payload[GEN_PAYLOAD_MAX];
+};
+
+struct gen_stat_s {
+    uint64_t        nb_tx;      /* transmissions */
+    uint64_t        nb_join;    /* join-requests */
+    uint64_t        nb_joined;
+    uint64_t        nb_retx;    /* retransmissions, confirmed uplinks and relay frames */
+    uint64_t        nb_given_up; /* frames never acknowledged */
+    uint64_t        nb_weak;    /* below the sensitivity */
+    uint64_t        nb_busy;    /* all demodulators busy */
+    uint64_t        nb_ok;      /* records with a good CRC */
+    uint64_t        nb_bad;     /* records with a bad CRC */
+    uint32_t        max_air;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+/* chan_multiSF_0 to chan_multiSF_7 of config.json, the first 3 are the join channels */
+static const int32_t chan_freq[GEN_CHAN_NB] = {
+    868100000, 868300000, 868500000, 867100000, 867300000, 867500000, 867700000, 867900000
+};
+
+/* SX1276 datasheet, 125 kHz */
+static const double sensitivity_dbm[GEN_SF_NB] = { -123.0, -126.0, -129.0, -132.0, -134.5, -137.0 };
+
+/* app_eui and app_key of the scripts */
+static const uint64_t app_eui = 0x14a97ce23e7bd732ULL;
+static const uint8_t raw_payload[GEN_RAW_SIZE] = {
+    0xF8, 0x72, 0x45, 0xC0, 0x83, 0xE9, 0x12, 0x5C, 0x79, 0x78, 0x35, 0x2A, 0x58, 0xCA, 0x3E, 0x3A
+};
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+static struct dev_s *dev;
+static uint32_t *heap;          /* devices waiting to transmit, by next_us */
+static uint32_t heap_nb;
+static struct air_s *air;       /* packets in the air, heap by end_us */
+static uint32_t air_nb, air_size;
+static int64_t demod_end[GEN_DEMOD_NB];
+static struct gen_stat_s stat;
+
+static unsigned payload_size = 6;
+static double ack_loss = 0.05;
+static int64_t period_us = 10000000;
+static unsigned burst_len = 5;
+
+static FILE *out;
+static uint32_t cnt_base;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    uint64_t x = rand_state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    rand_state = x;
+    return x;
+}
+
+/* uniform in [0, 1) */
+static double rand_unit(void) {
+    return (double)(rand_next() >> 11) / 9007199254740992.0;
+}
+
+static int64_t rand_us(int64_t max) {
+    return (max > 0) ? (int64_t)(rand_next() % (uint64_t)max) : 0;
+}
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (p == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/* time on air (us) of an explicit header packet with CRC, CR 4/5, 8 symbols of preamble */
+static uint32_t airtime_us(unsigned sf, unsigned size) {
+    double t_sym = (double)(1U << sf) * 1e6 / GEN_BW_HZ;
+    int de = (sf >= 11) ? 1 : 0;
+    double n = ceil((8.0 * size - 4.0 * sf + 28 + 16) / (4.0 * (sf - 2 * de)));
+
+    if (n < 0) {
+        n = 0;
+    }
+    return (uint32_t)((8 + 4.25 + 8 + n * 5) * t_sym);
+}
+
+static inline void put_le16(uint8_t *b, uint16_t v) {
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+}
+
+static inline void put_le32(uint8_t *b, uint32_t v) {
+    put_le16(b, (uint16_t)v);
+    put_le16(&b[2], (uint16_t)(v >> 16));
+}
+
+static inline void put_le64(uint8_t *b, uint64_t v) {
+    put_le32(b, (uint32_t)v);
+    put_le32(&b[4], (uint32_t)(v >> 32));
+}
+
+/* CRC-16/CCITT of the payload, as the radio computes it */
+static uint16_t crc16(const uint8_t *b, unsigned len) {
+    uint16_t crc = 0;
+    unsigned i, k;
+
+    for (i = 0; i < len; ++i) {
+        crc ^= (uint16_t)(b[i] << 8);
+        for (k = 0; k < 8; ++k) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void heap_push(uint32_t d) {
+    uint32_t i, up;
+
+    for (i = heap_nb++; i > 0; i = up) {
+        up = (i - 1) / 2;
+        if (dev[heap[up]].next_us <= dev[d].next_us) {
+            break;
+        }
+        heap[i] = heap[up];
+    }
+    heap[i] = d;
+}
+
+static uint32_t heap_pop(void) {
+    uint32_t d = heap[0];
+    uint32_t last = heap[--heap_nb];
+    uint32_t i, c;
+
+    for (i = 0, c = 1; c < heap_nb; i = c, c = 2 * i + 1) {
+        if ((c + 1 < heap_nb) && (dev[heap[c + 1]].next_us < dev[heap[c]].next_us)) {
+            c += 1;
+        }
+        if (dev[last].next_us <= dev[heap[c]].next_us) {
+            break;
+        }
+        heap[i] = heap[c];
+    }
+    if (heap_nb > 0) {
+        heap[i] = last;
+    }
+    return d;
+}
+
+static void air_push(const struct air_s *a) {
+    uint32_t i, up;
+
+    if (air_nb == air_size) {
+        air_size = air_size ? 2 * air_size : 256;
+        air = xrealloc(air, air_size * sizeof *air);
+    }
+    for (i = air_nb++; i > 0; i = up) {
+        up = (i - 1) / 2;
+        if (air[up].end_us <= a->end_us) {
+            break;
+        }
+        air[i] = air[up];
+    }
+    air[i] = *a;
+}
+
+static void air_pop(struct air_s *a) {
+    struct air_s last = air[--air_nb];
+    uint32_t i, c;
+
+    *a = air[0];
+    for (i = 0, c = 1; c < air_nb; i = c, c = 2 * i + 1) {
+        if ((c + 1 < air_nb) && (air[c + 1].end_us < air[c].end_us)) {
+            c += 1;
+        }
+        if (last.end_us <= air[c].end_us) {
+            break;
+        }
+        air[i] = air[c];
+    }
+    if (air_nb > 0) {
+        air[i] = last;
+    }
+}
+
+/* capture record of a packet, see capture_rec.h */
+static void write_record(const struct air_s *a, bool crc_ok) {
+    uint8_t rec[CAPTURE_REC_SIZE];
+    const struct dev_s *d = &dev[a->dev];
+    int64_t t = (int64_t)GEN_EPOCH_S * 1000000 + a->end_us;
+    float rssi = d->rssi_dbm;
+    float snr = (float)(rssi - GEN_NOISE_DBM);
+    float snr_min = snr - 1.0f;
+    float snr_max = snr + 1.0f;
+
+    memset(rec, 0, sizeof rec);
+    put_le32(&rec[CAPTURE_REC_OFF_TIME_S], (uint32_t)(t / 1000000));
+    put_le32(&rec[CAPTURE_REC_OFF_TIME_US], (uint32_t)(t % 1000000));
+    put_le32(&rec[CAPTURE_REC_OFF_COUNT_US], cnt_base + (uint32_t)a->end_us);
+    put_le32(&rec[CAPTURE_REC_OFF_FREQ_HZ], (uint32_t)a->freq_hz);
+    put_le32(&rec[CAPTURE_REC_OFF_DATARATE], (uint32_t)CAPTURE_DR_LORA_SF7 << (a->sf - 7));
+    memcpy(&rec[CAPTURE_REC_OFF_RSSI], &rssi, 4);
+    memcpy(&rec[CAPTURE_REC_OFF_SNR], &snr, 4);
+    memcpy(&rec[CAPTURE_REC_OFF_SNR_MIN], &snr_min, 4);
+    memcpy(&rec[CAPTURE_REC_OFF_SNR_MAX], &snr_max, 4);
+    put_le16(&rec[CAPTURE_REC_OFF_CRC], crc16(a->payload, a->size));
+    rec[CAPTURE_REC_OFF_IF_CHAIN] = a->chan;
+    rec[CAPTURE_REC_OFF_RF_CHAIN] = (a->chan < GEN_JOIN_CHAN_NB) ? 1 : 0; /* radio_1 at 868.5 MHz, radio_0 at 867.5 MHz */
+    rec[CAPTURE_REC_OFF_STATUS] = crc_ok ? CAPTURE_STAT_CRC_OK : CAPTURE_STAT_CRC_BAD;
+    rec[CAPTURE_REC_OFF_MODULATION] = CAPTURE_MOD_LORA;
+    rec[CAPTURE_REC_OFF_BANDWIDTH] = CAPTURE_BW_125KHZ;
+    rec[CAPTURE_REC_OFF_CODERATE] = CAPTURE_CR_LORA_4_5;
+    put_le16(&rec[CAPTURE_REC_OFF_SIZE], a->size);
+    fwrite(rec, 1, sizeof rec, out);
+    fwrite(a->payload, 1, a->size, out);
+}
+
+/* build the next frame of a device */
+static void build_frame(uint32_t i, struct air_s *a) {
+    struct dev_s *d = &dev[i];
+    uint8_t *p = a->payload;
+    unsigned k;
+
+    switch (d->kind) {
+        case KIND_RAW:
+            memcpy(p, raw_payload, GEN_RAW_SIZE);
+            a->size = GEN_RAW_SIZE;
+            break;
+        case KIND_RELAY:
+            /* RELAYNET_UP: MHDR, version and type, hops, source, next hop, sequence, then dev_eui */
+            p[0] = 0xE0;
+            p[1] = 0x12;
+            p[2] = 0x00;
+            put_le16(&p[3], (uint16_t)d->dev_eui);
+            put_le16(&p[5], 0xFFFF);
+            put_le16(&p[7], d->fcnt);
+            put_le64(&p[9], d->dev_eui);
+            a->size = 17;
+            break;
+        default:
+            if (d->dev_addr == 0) {
+                /* join-request: MHDR, AppEUI, DevEUI, DevNonce, MIC */
+                p[0] = 0x00;
+                put_le64(&p[1], app_eui);
+                put_le64(&p[9], d->dev_eui);
+                put_le16(&p[17], d->nonce);
+                put_le32(&p[19], (uint32_t)rand_next());
+                a->size = 23;
+            } else {
+                /* data uplink: MHDR, DevAddr, FCtrl, FCnt, FPort, FRMPayload, MIC */
+                p[0] = d->confirmed ? 0x80 : 0x40;
+                put_le32(&p[1], d->dev_addr);
+                p[5] = 0x00;
+                put_le16(&p[6], d->fcnt);
+                p[8] = 1;
+                for (k = 0; k < payload_size; ++k) {
+                    p[9 + k] = (uint8_t)"testes"[k % 6];
+                }
+                put_le32(&p[9 + payload_size], (uint32_t)rand_next() ^ d->fcnt);
+                a->size = (uint8_t)(13 + payload_size);
+            }
+            break;
+    }
+}
+
+static void start_packet(uint32_t i) {
+    struct dev_s *d = &dev[i];
+    struct air_s a;
+    unsigned k;
+    bool joining = (d->kind == KIND_LORAWAN) && (d->dev_addr == 0);
+
+    memset(&a, 0, sizeof a);
+    a.dev = i;
+    a.sf = d->sf;
+    a.start_us = d->next_us;
+    build_frame(i, &a);
+    a.end_us = a.start_us + airtime_us(a.sf, a.size);
+    if (d->kind == KIND_RELAY) {
+        a.freq_hz = GEN_RELAY_FREQ;
+        a.chan = 0;
+    } else {
+        a.chan = (uint8_t)(rand_next() % (joining ? GEN_JOIN_CHAN_NB : GEN_CHAN_NB));
+        a.freq_hz = chan_freq[a.chan];
+    }
+    stat.nb_tx += 1;
+    stat.nb_join += joining ? 1 : 0;
+    stat.nb_retx += (d->tries > 0) ? 1 : 0;
+    d->tries += 1;
+
+    if (d->rssi_dbm < sensitivity_dbm[a.sf - GEN_SF_MIN]) {
+        stat.nb_weak += 1;
+    } else {
+        for (k = 0; k < GEN_DEMOD_NB; ++k) {
+            if (demod_end[k] <= a.start_us) {
+                demod_end[k] = a.end_us;
+                a.demod = true;
+                break;
+            }
+        }
+        stat.nb_busy += a.demod ? 0 : 1;
+    }
+
+    /* co-SF capture with the packets in the air on the channel */
+    for (k = 0; k < air_nb; ++k) {
+        if ((air[k].freq_hz != a.freq_hz) || (air[k].sf != a.sf)) {
+            continue;
+        }
+        if (dev[air[k].dev].rssi_dbm - d->rssi_dbm < GEN_CAPTURE_DB) {
+            air[k].lost = true;
+        }
+        if (d->rssi_dbm - dev[air[k].dev].rssi_dbm < GEN_CAPTURE_DB) {
+            a.lost = true;
+        }
+    }
+    air_push(&a);
+    if (air_nb > stat.max_air) {
+        stat.max_air = air_nb;
+    }
+}
+
+/* schedule the next frame of a device */
+static void next_frame(struct dev_s *d, int64_t now) {
+    int64_t period = (d->kind == KIND_RAW) ? GEN_RAW_PERIOD_US : (d->kind == KIND_RELAY) ? GEN_RELAY_PERIOD_US : period_us;
+
+    d->tries = 0;
+    d->fcnt += 1;
+    if (d->burst > 1) {
+        d->burst -= 1;
+        d->next_us = now + GEN_RX2_US;
+        return;
+    }
+    d->burst = d->bursty ? (uint8_t)burst_len : 1;
+    d->period_us += period;
+    d->next_us = (d->period_us > now) ? d->period_us : now;
+}
+
+/* account a packet the sweep has passed, write its record and let the device react */
+static void end_packet(void) {
+    struct air_s a;
+    struct dev_s *d;
+    bool ok, acked;
+
+    air_pop(&a);
+    d = &dev[a.dev];
+    ok = a.demod && !a.lost;
+    if (a.demod) {
+        write_record(&a, ok);
+        stat.nb_ok += ok ? 1 : 0;
+        stat.nb_bad += ok ? 0 : 1;
+    }
+    acked = ok && (rand_unit() >= ack_loss);
+
+    switch (d->kind) {
+        case KIND_RAW:
+            next_frame(d, a.end_us);
+            break;
+        case KIND_RELAY:
+            if (acked || (d->tries >= GEN_RELAY_TRIES)) {
+                stat.nb_given_up += acked ? 0 : 1;
+                next_frame(d, a.end_us + GEN_RELAY_ACK_US);
+            } else {
+                d->next_us = a.end_us + GEN_RELAY_ACK_US + (GEN_RELAY_BACKOFF_US << (d->tries - 1)) + rand_us(GEN_RELAY_BACKOFF_US << (d->tries - 1));
+            }
+            break;
+        default:
+            if (d->dev_addr == 0) {
+                d->nonce += 1;
+                d->tries = 0;
+                if (acked) {
+                    d->dev_addr = 0x26000000 | (uint32_t)(d->dev_eui & 0xFFFFFF);
+                    stat.nb_joined += 1;
+                    d->period_us = a.end_us + GEN_JOIN_RX2_US;
+                    d->next_us = d->period_us;
+                } else {
+                    d->next_us = a.end_us + GEN_JOIN_RX2_US + rand_us(GEN_ACK_TIMEOUT_US);
+                }
+            } else if (!d->confirmed || acked || (d->tries >= GEN_NB_TRANS_MAX)) {
+                stat.nb_given_up += (d->confirmed && !acked) ? 1 : 0;
+                next_frame(d, a.end_us + GEN_RX2_US);
+            } else {
+                /* same frame again after the RX windows and ACK_TIMEOUT */
+                d->next_us = a.end_us + GEN_RX2_US + GEN_ACK_TIMEOUT_US / 2 + rand_us(GEN_ACK_TIMEOUT_US);
+            }
+            break;
+    }
+    heap_push(a.dev);
+}
+
+static void usage(void) {
+    printf("Usage: fleet_gen [-n devices] [-t seconds] [-o file] [-p period_s] [-c confirmed] [-R raw] [-E relay]\n");
+    printf("                 [-B bursty] [-b burst] [-l size] [-s dr] [-a ack_loss] [-g gw_eui] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    uint32_t nb_dev = 1000;
+    double duration_s = 600;
+    const char *path = "fleet.lgwc";
+    double confirmed = 0.1;
+    double raw = 0;
+    double relay = 0;
+    double bursty = 0;
+    int dr = 5;
+    uint64_t gw_eui = 0;
+    uint8_t hdr[CAPTURE_HDR_SIZE];
+    int64_t end_us;
+    clock_t clk;
+    double elapsed, u;
+    uint32_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:t:o:p:c:R:E:B:b:l:s:a:g:x:")) != -1) {
+        switch (opt) {
+            case 'n': nb_dev = (uint32_t)atol(optarg); break;
+            case 't': duration_s = atof(optarg); break;
+            case 'o': path = optarg; break;
+            case 'p': period_us = (int64_t)(atof(optarg) * 1e6); break;
+            case 'c': confirmed = atof(optarg); break;
+            case 'R': raw = atof(optarg); break;
+            case 'E': relay = atof(optarg); break;
+            case 'B': bursty = atof(optarg); break;
+            case 'b': burst_len = (unsigned)atoi(optarg); break;
+            case 'l': payload_size = (unsigned)atoi(optarg); break;
+            case 's': dr = atoi(optarg); break;
+            case 'a': ack_loss = atof(optarg); break;
+            case 'g': gw_eui = strtoull(optarg, NULL, 16); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if ((nb_dev == 0) || (duration_s <= 0) || (period_us <= 0) || (raw + relay > 1) || (raw < 0) || (relay < 0) ||
+        (burst_len < 1) || (burst_len > 255) || (payload_size > GEN_PAYLOAD_MAX - 13) || (dr < -1) || (dr > 5)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    out = fopen(path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR: failed to create \"%s\"\n", path);
+        return EXIT_FAILURE;
+    }
+    memcpy(hdr, CAPTURE_MAGIC, 4);
+    put_le16(&hdr[CAPTURE_HDR_OFF_VERSION], CAPTURE_VERSION);
+    put_le16(&hdr[CAPTURE_HDR_OFF_REC_SIZE], CAPTURE_REC_SIZE);
+    put_le64(&hdr[CAPTURE_HDR_OFF_GW_EUI], gw_eui);
+    fwrite(hdr, 1, sizeof hdr, out);
+    cnt_base = (uint32_t)rand_next();
+
+    dev = xrealloc(NULL, nb_dev * sizeof *dev);
+    heap = xrealloc(NULL, nb_dev * sizeof *heap);
+    memset(dev, 0, nb_dev * sizeof *dev);
+    for (i = 0; i < nb_dev; ++i) {
+        u = rand_unit();
+        dev[i].kind = (u < raw) ? KIND_RAW : (u < raw + relay) ? KIND_RELAY : KIND_LORAWAN;
+        dev[i].dev_eui = 0x70B3D54990000000ULL | i;
+        dev[i].nonce = (uint16_t)rand_next();
+        dev[i].fcnt = (dev[i].kind == KIND_RELAY) ? (uint16_t)rand_next() : 0;
+        dev[i].rssi_dbm = (float)(-135.0 + 75.0 * rand_unit());
+        dev[i].confirmed = (dev[i].kind == KIND_LORAWAN) && (rand_unit() < confirmed);
+        dev[i].bursty = rand_unit() < bursty;
+        dev[i].burst = dev[i].bursty ? (uint8_t)burst_len : 1;
+        /* DR5 is SF7, DR0 SF12 */
+        dev[i].sf = (uint8_t)((dev[i].kind != KIND_LORAWAN) ? GEN_SF_MIN : (dr < 0) ? GEN_SF_MIN + (unsigned)(rand_next() % GEN_SF_NB) : (unsigned)(12 - dr));
+        /* the scripts are started over the first period */
+        dev[i].period_us = rand_us((dev[i].kind == KIND_RAW) ? GEN_RAW_PERIOD_US : (dev[i].kind == KIND_RELAY) ? GEN_RELAY_PERIOD_US : period_us);
+        dev[i].next_us = dev[i].period_us;
+        heap_push(i);
+    }
+
+    printf("### %u devices, %.0f s, to %s\n", nb_dev, duration_s, path);
+    clk = clock();
+    end_us = (int64_t)(duration_s * 1e6);
+    while ((air_nb > 0) || ((heap_nb > 0) && (dev[heap[0]].next_us < end_us))) {
+        if ((air_nb > 0) && ((heap_nb == 0) || (air[0].end_us <= dev[heap[0]].next_us) || (dev[heap[0]].next_us >= end_us))) {
+            end_packet();
+        } else {
+            start_packet(heap_pop());
+        }
+    }
+    elapsed = (double)(clock() - clk) / CLOCKS_PER_SEC;
+    fclose(out);
+
+    printf("# transmissions: %llu, %llu join-requests, %u/%u devices joined, %llu retransmissions, %llu frames not acknowledged\n",
+           (unsigned long long)stat.nb_tx, (unsigned long long)stat.nb_join, (unsigned)stat.nb_joined, nb_dev,
+           (unsigned long long)stat.nb_retx, (unsigned long long)stat.nb_given_up);
+    printf("# gateway: %llu CRC OK, %llu CRC bad, %llu below sensitivity, %llu without demodulator, up to %u in the air\n",
+           (unsigned long long)stat.nb_ok, (unsigned long long)stat.nb_bad, (unsigned long long)stat.nb_weak,
+           (unsigned long long)stat.nb_busy, stat.max_air);
+    printf("# %llu records (%.1f per s of simulated time) generated in %.2f s\n", (unsigned long long)(stat.nb_ok + stat.nb_bad),
+           (double)(stat.nb_ok + stat.nb_bad) / duration_s, elapsed);
+
+    free(air);
+    free(heap);
+    free(dev);
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Listen before talk of the repeater (relay.h) with several repeaters in
+    range of each other: they hear the same uplinks and relay them on the
+    same channel to one gateway, out of reach of the devices.
+
+    - Poisson uplinks on 8 channels at SF7 to SF9, valid 20 bytes
+      unconfirmed uplinks. Two uplinks overlapping on the same channel and
+      SF are lost for everybody;
+    - every repeater hears every uplink, unless it transmits during it, and
+      the relays of the other repeaters, unless it transmits or two relays
+      overlap;
+    - each repeater runs the fetch loop of thread_up: a fetch returning
+      packets is followed by the next one 1 ms later, relay_tx runs after
+      an empty fetch, then the loop sleeps FETCH_SLEEP_MS. The RX FIFO
+      count relay_tx reads is the packets ending within PROBE_MS of the
+      fetch, it is given to relay_lbt;
+    - the gateway gets a relay when no other relay overlaps it. An uplink
+      is delivered when at least one of its relays got through.
+
+    -o runs the scheduler without listen before talk: no backoff, no FIFO
+    probe, the relays of the other repeaters do not cancel the copies
+    waiting.
+
+    Build and run on the host:
+
+        gcc -O2 -I../Host_tests/include -I.. -o lbt_sim lbt_sim.c ../relay.c ../lorawan_frame.c -lm
+        ./lbt_sim -r 0.5 -n 3
+        ./lbt_sim -r 0.5 -n 3 -o
+
+    -r uplinks per second (0.5), -n repeaters (3), -t simulated time in s
+    (3600), -b max random backoff in ms (RELAY_BACKOFF_MS), -o without
+    listen before talk, -x random seed.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf */
+#include <stdlib.h>     /* calloc, free, atof, atoi, strtoull */
+#include <string.h>     /* memset, memcpy */
+#include <math.h>       /* log, ceil */
+#include <unistd.h>     /* getopt */
+
+#include "loragw_hal.h"
+#include "relay.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define SIM_REP_MAX         8
+#define SIM_CHAN_NB         8
+#define SIM_SF_MIN          7
+#define SIM_SF_NB           3           /* SF7 to SF9 */
+#define SIM_SIZE            20
+#define SIM_RELAY_FREQ      869525000
+#define SIM_UP_FREQ         868100000
+
+#define FETCH_SLEEP_MS      50          /* thread_up, wait after an empty fetch */
+#define FETCH_MS            1           /* thread_up, time of a fetch returning packets */
+#define PROBE_MS            1           /* relay_tx, from the empty fetch to the RX FIFO probe */
+
+#define MS                  1000000ULL  /* ns */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct up_s {
+    uint64_t        start_ns;
+    uint64_t        end_ns;
+    uint8_t         chan;
+    uint8_t         sf;
+    bool            lost;       /* collision between uplinks */
+    bool            delivered;
+};
+
+/* transmission of a repeater */
+struct rtx_s {
+    uint64_t        start_ns;
+    uint64_t        end_ns;
+    uint32_t        up;         /* index of the uplink */
+    int             rep;
+    bool            clean;      /* no other relay overlaps it */
+};
+
+struct rep_s {
+    struct relay_s  relay;
+    uint64_t        fetch_ns;   /* next fetch */
+    uint64_t        tx_end_ns;
+    uint32_t        up_next;    /* first uplink not fetched */
+    uint32_t        rtx_next;   /* first relay not fetched */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+static struct up_s *up;
+static uint32_t nb_up;
+static struct rtx_s *rtx;
+static uint32_t nb_rtx;
+static uint32_t size_rtx;
+static struct rep_s rep[SIM_REP_MAX];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+/* exponential, mean m */
+static double rand_exp(double m) {
+    return -m * log(((double)(rand_next() >> 11) + 1.0) / 9007199254740993.0);
+}
+
+/* time on air (us) of a 20 bytes packet, explicit header, CRC, CR 4/5 */
+static uint32_t airtime_us(unsigned sf) {
+    double t_sym = (double)(1U << sf) * 1e3 / 125.0;
+    double n = ceil((8.0 * SIM_SIZE - 4.0 * sf + 28 + 16) / (4.0 * sf));
+
+    return (uint32_t)((8 + 4.25 + 8 + n * 5) * t_sym);
+}
+
+/* unconfirmed data uplink, the index of the uplink in the FRMPayload */
+static void uplink_build(struct lgw_pkt_rx_s *pkt, uint32_t i) {
+    unsigned k;
+
+    memset(pkt, 0, sizeof *pkt);
+    pkt->freq_hz = SIM_UP_FREQ;
+    pkt->status = STAT_CRC_OK;
+    pkt->modulation = MOD_LORA;
+    pkt->bandwidth = BW_125KHZ;
+    pkt->datarate = DR_LORA_SF7 << (up[i].sf - SIM_SF_MIN);
+    pkt->coderate = CR_LORA_4_5;
+    pkt->payload[0] = 0x40;
+    pkt->payload[1] = (uint8_t)i;
+    pkt->payload[4] = 0x26;
+    pkt->payload[8] = 1;
+    memcpy(&pkt->payload[9], &i, sizeof i);
+    for (k = 9 + sizeof i; k < SIM_SIZE; ++k) {
+        pkt->payload[k] = (uint8_t)(i * 31 + k);
+    }
+    pkt->size = SIM_SIZE;
+}
+
+/* a relay of another repeater, received on the relay channel unless the repeater or a third one transmits during it */
+static bool rtx_heard(uint32_t k, int r) {
+    uint32_t j;
+
+    if (rtx[k].rep == r) {
+        return false;
+    }
+    for (j = k; (j-- > 0) && (rtx[j].start_ns + 1000 * MS > rtx[k].start_ns);) {
+        if (rtx[j].end_ns > rtx[k].start_ns) {
+            return false;
+        }
+    }
+    return (k + 1 >= nb_rtx) || (rtx[k + 1].start_ns >= rtx[k].end_ns);
+}
+
+/* the repeater transmitted during the uplink */
+static bool up_blinded(uint32_t i, int r) {
+    uint32_t k;
+
+    for (k = nb_rtx; k-- > 0;) {
+        if (rtx[k].end_ns + 10000 * MS < up[i].start_ns) {
+            break;
+        }
+        if ((rtx[k].rep == r) && (rtx[k].start_ns < up[i].end_ns) && (rtx[k].end_ns > up[i].start_ns)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void usage(void) {
+    printf("Usage: lbt_sim [-r uplinks/s] [-n repeaters] [-t s] [-b backoff ms] [-o] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    struct relay_cfg_s cfg = {SIM_RELAY_FREQ, 0, 14, DR_LORA_SF7, 100, RELAY_GUARD_MS, RELAY_BACKOFF_MS};
+    struct lgw_pkt_rx_s pkt;
+    struct lgw_pkt_tx_s tx;
+    double rate = 0.5;
+    double duration_s = 3600;
+    bool lbt = true;
+    int nb_rep = 3;
+    uint64_t t, end_ns, probe_ns;
+    uint32_t nb_valid = 0, nb_deliv = 0, nb_clean = 0, nb_heard = 0, nb_blind = 0;
+    uint32_t nb_busy = 0, nb_late = 0, nb_cancel = 0, nb_expired = 0;
+    uint32_t i, k, size_up;
+    int32_t nb_rx;
+    int opt, r, n;
+    double s;
+
+    while ((opt = getopt(argc, argv, "hr:n:t:b:ox:")) != -1) {
+        switch (opt) {
+            case 'r': rate = atof(optarg); break;
+            case 'n': nb_rep = atoi(optarg); break;
+            case 't': duration_s = atof(optarg); break;
+            case 'b': cfg.backoff_ms = (uint16_t)atoi(optarg); break;
+            case 'o': lbt = false; break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if ((rate <= 0) || (nb_rep < 1) || (nb_rep > SIM_REP_MAX)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (!lbt) {
+        cfg.backoff_ms = 0;
+    }
+    end_ns = (uint64_t)(duration_s * 1e9);
+
+    /* the uplinks, the ones colliding on the same channel and SF are lost */
+    size_up = (uint32_t)(rate * duration_s * 1.5) + 1000;
+    up = calloc(size_up, sizeof *up);
+    size_rtx = size_up * nb_rep;
+    rtx = calloc(size_rtx, sizeof *rtx);
+    if ((up == NULL) || (rtx == NULL)) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (s = rand_exp(1.0 / rate); (s < duration_s - 5) && (nb_up < size_up); s += rand_exp(1.0 / rate)) {
+        up[nb_up].start_ns = (uint64_t)(s * 1e9);
+        up[nb_up].sf = (uint8_t)(SIM_SF_MIN + rand_next() % SIM_SF_NB);
+        up[nb_up].end_ns = up[nb_up].start_ns + airtime_us(up[nb_up].sf) * 1000ULL;
+        up[nb_up].chan = (uint8_t)(rand_next() % SIM_CHAN_NB);
+        nb_up += 1;
+    }
+    for (i = 0; i < nb_up; ++i) {
+        for (k = i + 1; (k < nb_up) && (up[k].start_ns < up[i].end_ns); ++k) {
+            if ((up[k].chan == up[i].chan) && (up[k].sf == up[i].sf)) {
+                up[i].lost = true;
+                up[k].lost = true;
+            }
+        }
+    }
+
+    for (r = 0; r < nb_rep; ++r) {
+        relay_init(&rep[r].relay, &cfg, (uint32_t)rand_next());
+        rep[r].fetch_ns = (rand_next() % FETCH_SLEEP_MS) * MS;
+    }
+    for (t = 0; t < end_ns; t += MS) {
+        for (r = 0; r < nb_rep; ++r) {
+            struct rep_s *p = &rep[r];
+
+            if (t < p->fetch_ns) {
+                continue;
+            }
+            n = 0;
+            /* uplinks ended since the last fetch */
+            for (; (p->up_next < nb_up) && (up[p->up_next].end_ns <= t); p->up_next += 1) {
+                i = p->up_next;
+                if (up[i].lost) {
+                    continue;
+                }
+                if (up_blinded(i, r)) {
+                    nb_blind += 1;
+                    continue;
+                }
+                nb_heard += 1;
+                uplink_build(&pkt, i);
+                relay_push(&p->relay, &pkt, t);
+                n += 1;
+            }
+            /* relays of the other repeaters, on the relay channel */
+            for (; (p->rtx_next < nb_rtx) && (rtx[p->rtx_next].end_ns <= t); p->rtx_next += 1) {
+                k = p->rtx_next;
+                if (!rtx_heard(k, r)) {
+                    continue;
+                }
+                if (lbt) {
+                    uplink_build(&pkt, rtx[k].up);
+                    pkt.freq_hz = SIM_RELAY_FREQ;
+                    pkt.datarate = cfg.datarate;
+                    relay_overheard(&p->relay, &pkt, t);
+                }
+                n += 1;
+            }
+            if (n > 0) {
+                relay_rx_seen(&p->relay, t);
+                p->fetch_ns = t + FETCH_MS * MS;
+                continue;
+            }
+            p->fetch_ns = t + FETCH_SLEEP_MS * MS;
+            if ((t < p->tx_end_ns) || (relay_peek(&p->relay, t, &tx) == 0)) {
+                continue;
+            }
+            /* RX FIFO probe: packets received since the empty fetch */
+            probe_ns = t + PROBE_MS * MS;
+            nb_rx = 0;
+            for (i = p->up_next; lbt && (i < nb_up) && (up[i].end_ns <= probe_ns); ++i) {
+                nb_rx += up[i].lost ? 0 : 1;
+            }
+            for (k = p->rtx_next; lbt && (k < nb_rtx); ++k) {
+                nb_rx += ((rtx[k].end_ns <= probe_ns) && (rtx[k].rep != r)) ? 1 : 0;
+            }
+            if ((relay_lbt(&p->relay, probe_ns, nb_rx, &tx) == 1) && (nb_rtx < size_rtx)) {
+                rtx[nb_rtx].start_ns = probe_ns;
+                rtx[nb_rtx].end_ns = probe_ns + airtime_us(SIM_SF_MIN) * 1000ULL;
+                memcpy(&rtx[nb_rtx].up, &tx.payload[9], sizeof rtx[nb_rtx].up);
+                rtx[nb_rtx].rep = r;
+                p->tx_end_ns = rtx[nb_rtx].end_ns;
+                relay_sent(&p->relay, probe_ns, airtime_us(SIM_SF_MIN));
+                nb_rtx += 1;
+            }
+        }
+    }
+
+    /* the gateway gets the relays no other relay overlaps */
+    for (k = 0; k < nb_rtx; ++k) {
+        rtx[k].clean = true;
+    }
+    for (k = 0; k < nb_rtx; ++k) {
+        for (i = k + 1; (i < nb_rtx) && (rtx[i].start_ns < rtx[k].end_ns); ++i) {
+            rtx[k].clean = false;
+            rtx[i].clean = false;
+        }
+    }
+    for (k = 0; k < nb_rtx; ++k) {
+        if (rtx[k].clean) {
+            nb_clean += 1;
+            up[rtx[k].up].delivered = true;
+        }
+    }
+    for (i = 0; i < nb_up; ++i) {
+        if (!up[i].lost) {
+            nb_valid += 1;
+            nb_deliv += up[i].delivered ? 1 : 0;
+        }
+    }
+    for (r = 0; r < nb_rep; ++r) {
+        nb_busy += rep[r].relay.stat.nb_busy;
+        nb_late += rep[r].relay.stat.nb_late;
+        nb_cancel += rep[r].relay.stat.nb_cancel;
+        nb_expired += rep[r].relay.stat.nb_expired;
+    }
+
+    printf("# %.2f uplinks/s for %.0f s, %d repeaters, %s\n", rate, duration_s, nb_rep, lbt ? "listen before talk" : "without listen before talk");
+    printf("# uplinks %u, delivered %u (%.1f%%), relays per uplink %.2f, relays colliding %.1f%%\n", nb_valid, nb_deliv, 100.0 * nb_deliv / nb_valid, (double)nb_rtx / nb_valid, (nb_rtx > 0) ? 100.0 * (nb_rtx - nb_clean) / nb_rtx : 0.0);
+    printf("# uplinks missed while relaying %.1f%%, deferred %u, late %u, cancelled %u, expired %u\n", 100.0 * nb_blind / (nb_blind + nb_heard), nb_busy, nb_late, nb_cancel, nb_expired);
+    free(up);
+    free(rtx);
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Delivery and latency of the multi-hop relay (relaynet.h over relay.h),
+    on a chain of a sink gateway and 3 repeaters, node 0 <- 1 <- 2 <- 3,
+    each one running the relay_input and relay_tx steps of the forwarder:
+
+    - good links between neighbours in the chain, heard at 5 dB of SNR and
+      lost with the given PER, weak links to the node two hops away, heard
+      at -s dB and delivered with probability -w;
+    - one device next to node -n sends a valid SF9 unconfirmed uplink on
+      868.1 MHz every -u s (+-20%), node -n - 1 hears it with probability
+      0.05. Uplinks are counted from 300 s on, once the routes are built;
+    - the relay frames go at SF7 on the relay channel, 10% duty cycle, the
+      backoff adds 250 ms per hop on average;
+    - half-duplex nodes, and co-channel collisions between frames
+      overlapping at a node hearing both;
+    - the fetch loop of every node polls every FETCH_SLEEP_MS, or at the
+      next step after a fetch returning packets, the steps of the nodes
+      are staggered.
+
+    A frame is delivered when the sink gets it through relaynet_input, the
+    latency runs from the end of the uplink to that fetch.
+
+    Build and run on the host:
+
+        gcc -O2 -I../Host_tests/include -I.. -o mesh_sim mesh_sim.c ../relay.c ../relaynet.c ../adr.c ../lorawan_frame.c -lm
+        ./mesh_sim -n 3 -p 0.1
+
+    -n node the device is next to, 1 to 3 (3), -p PER of the good links
+    (0.1), -w delivery of the weak links (0.2), -s SNR of the weak links in
+    dB (-5, above the link margin of relaynet.c from -2.5 on, so the weak
+    links are used as routes), -b max random backoff of the repeaters in ms
+    (RELAY_BACKOFF_MS, 0 for the scheduler without backoff), -u uplink period in s (60), -t simulated
+    time in s (21600), -x random seed.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf */
+#include <stdlib.h>     /* atof, atoi, strtoull */
+#include <string.h>     /* memset, memcpy */
+#include <math.h>       /* log, ceil */
+#include <unistd.h>     /* getopt */
+
+#include "loragw_hal.h"
+#include "relay.h"
+#include "relaynet.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define SIM_NODE_NB         4           /* sink and repeaters */
+#define SIM_DEV             SIM_NODE_NB /* index of the device in the links */
+#define SIM_AIR_NB          256
+#define SIM_AIR_KEEP_MS     3000        /* longer than any frame, a frame ending later can still collide with it */
+#define SIM_STEP_MS         10
+#define SIM_WARMUP_S        300         /* routes are built before the first uplink */
+#define SIM_DEV_FREQ        868100000
+#define SIM_RELAY_FREQ      869525000
+#define SIM_NODE_ID         100         /* node ID of the sink, the repeaters follow */
+#define SIM_SNR_GOOD        5.0f
+#define SIM_SF_MIN          7
+#define SIM_FIFO_NB         32          /* RX FIFO of a node */
+
+#define FETCH_SLEEP_MS      50          /* thread_up, wait after an empty fetch */
+#define NB_PKT_MAX          8           /* thread_up, packets per fetch */
+
+#define MS                  1000000ULL  /* ns */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* frame on the air */
+struct air_s {
+    uint64_t        start_ns;
+    uint64_t        end_ns;
+    int             from;       /* node or SIM_DEV */
+    bool            done;       /* given to the receivers */
+    struct lgw_pkt_rx_s pkt;
+};
+
+struct node_s {
+    struct relay_s  relay;
+    struct relaynet_s rn;
+    struct lgw_pkt_rx_s fifo[SIM_FIFO_NB];
+    int             nb_fifo;
+    uint64_t        fetch_ns;   /* next fetch */
+    uint64_t        tx_start_ns;
+    uint64_t        tx_end_ns;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+static double link_ok[SIM_NODE_NB + 1][SIM_NODE_NB + 1]; /* delivery probability, from, to */
+static float link_snr[SIM_NODE_NB + 1][SIM_NODE_NB + 1];
+static struct air_s air[SIM_AIR_NB];
+static struct node_s node[SIM_NODE_NB];
+static uint64_t up_end_ns[65536];   /* end of the uplink of each FCnt, 0 once delivered */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+/* uniform in [0, 1) */
+static double rand_unit(void) {
+    return (double)(rand_next() >> 11) / 9007199254740992.0;
+}
+
+/* put a frame on the air */
+static void air_put(int from, const struct lgw_pkt_tx_s *tx, uint64_t now) {
+    struct air_s *a;
+    unsigned i;
+
+    for (i = 0; (i < SIM_AIR_NB) && (air[i].end_ns != 0); ++i);
+    if (i == SIM_AIR_NB) {
+        fprintf(stderr, "WARNING: air full, frame dropped\n");
+        return;
+    }
+    a = &air[i];
+    memset(a, 0, sizeof *a);
+    a->start_ns = now;
+    a->end_ns = now + lgw_time_on_air((struct lgw_pkt_tx_s *)tx) * 1000ULL;
+    a->from = from;
+    a->pkt.freq_hz = tx->freq_hz;
+    a->pkt.status = STAT_CRC_OK;
+    a->pkt.modulation = MOD_LORA;
+    a->pkt.bandwidth = BW_125KHZ;
+    a->pkt.datarate = tx->datarate;
+    a->pkt.coderate = CR_LORA_4_5;
+    a->pkt.size = tx->size;
+    memcpy(a->pkt.payload, tx->payload, tx->size);
+}
+
+/* frames ending by now reach the nodes hearing them, unless a node was transmitting or got a collision */
+static void air_receive(uint64_t now) {
+    struct air_s *a, *b;
+    struct node_s *n;
+    bool collided;
+    unsigned i, k;
+    int r;
+
+    for (i = 0; i < SIM_AIR_NB; ++i) {
+        a = &air[i];
+        if ((a->end_ns == 0) || a->done || (a->end_ns > now)) {
+            continue;
+        }
+        a->done = true;
+        for (r = 0; r < SIM_NODE_NB; ++r) {
+            n = &node[r];
+            if ((r == a->from) || (rand_unit() >= link_ok[a->from][r])) {
+                continue;
+            }
+            if ((n->tx_start_ns < a->end_ns) && (n->tx_end_ns > a->start_ns)) {
+                continue;
+            }
+            collided = false;
+            for (k = 0; k < SIM_AIR_NB; ++k) {
+                b = &air[k];
+                if ((k != i) && (b->end_ns != 0) && (b->from != r) && (link_ok[b->from][r] > 0) && (b->pkt.freq_hz == a->pkt.freq_hz) && (b->start_ns < a->end_ns) && (b->end_ns > a->start_ns)) {
+                    collided = true;
+                    break;
+                }
+            }
+            if (collided || (n->nb_fifo >= SIM_FIFO_NB)) {
+                continue;
+            }
+            n->fifo[n->nb_fifo] = a->pkt;
+            n->fifo[n->nb_fifo].snr = link_snr[a->from][r];
+            n->nb_fifo += 1;
+        }
+    }
+    for (i = 0; i < SIM_AIR_NB; ++i) {
+        if ((air[i].end_ns != 0) && (air[i].end_ns + SIM_AIR_KEEP_MS * MS < now)) {
+            air[i].end_ns = 0;
+        }
+    }
+}
+
+/* relay_input of the forwarder, the sink accounts the delivered uplinks */
+static void node_input(int r, uint64_t now, double *lat_sum, double *lat_max, uint32_t *nb_deliv) {
+    struct node_s *n = &node[r];
+    struct lgw_pkt_rx_s out;
+    struct lgw_pkt_rx_s *p;
+    uint32_t now_s = (uint32_t)(now / 1000000000) + 1;
+    uint16_t fcnt;
+    double lat;
+    int i;
+
+    for (i = 0; i < n->nb_fifo; ++i) {
+        p = &n->fifo[i];
+        switch (relaynet_input(&n->rn, p, now_s)) {
+            case RELAYNET_PLAIN:
+                if (!n->rn.sink && (relaynet_encap(&n->rn, p, &out, now_s) == 0)) {
+                    relay_push(&n->relay, &out, now);
+                }
+                break;
+            case RELAYNET_FORWARD:
+                relay_push(&n->relay, p, now);
+                break;
+            case RELAYNET_DELIVER:
+                fcnt = (uint16_t)(p->payload[6] | (p->payload[7] << 8));
+                if (up_end_ns[fcnt] != 0) {
+                    lat = (now - up_end_ns[fcnt]) / 1e6;
+                    *lat_sum += lat;
+                    *lat_max = (lat > *lat_max) ? lat : *lat_max;
+                    *nb_deliv += 1;
+                    up_end_ns[fcnt] = 0;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    n->nb_fifo = 0;
+    relay_rx_seen(&n->relay, now);
+}
+
+/* relay_tx of the forwarder, after an empty fetch */
+static void node_tx(int r, uint64_t now) {
+    struct node_s *n = &node[r];
+    struct lgw_pkt_rx_s adv;
+    struct lgw_pkt_tx_s tx;
+
+    memset(&adv, 0, sizeof adv);
+    adv.status = STAT_CRC_OK;
+    adv.modulation = MOD_LORA;
+    adv.bandwidth = BW_125KHZ;
+    adv.datarate = DR_LORA_SF7;
+    adv.coderate = CR_LORA_4_5;
+    if (relaynet_adv(&n->rn, &adv, (uint32_t)(now / 1000000000) + 1) == 1) {
+        relay_push(&n->relay, &adv, now);
+    }
+    if ((now >= n->tx_end_ns) && (relay_pop(&n->relay, now, &tx) == 1)) {
+        relay_sent(&n->relay, now, lgw_time_on_air(&tx));
+        n->tx_start_ns = now;
+        n->tx_end_ns = now + lgw_time_on_air(&tx) * 1000ULL;
+        air_put(r, &tx, now);
+    }
+}
+
+/* unconfirmed data uplink: MHDR, DevAddr, FCtrl, FCnt, FPort, FRMPayload, MIC */
+static void uplink_build(struct lgw_pkt_tx_s *tx, uint16_t fcnt) {
+    unsigned i;
+
+    memset(tx, 0, sizeof *tx);
+    tx->freq_hz = SIM_DEV_FREQ;
+    tx->modulation = MOD_LORA;
+    tx->bandwidth = BW_125KHZ;
+    tx->datarate = DR_LORA_SF9;
+    tx->coderate = CR_LORA_4_5;
+    tx->preamble = 8;
+    tx->size = 20;
+    tx->payload[0] = 0x40;
+    tx->payload[1] = 0x01;
+    tx->payload[2] = 0x00;
+    tx->payload[3] = 0x00;
+    tx->payload[4] = 0x26;
+    tx->payload[5] = 0x00;
+    tx->payload[6] = fcnt & 0xFF;
+    tx->payload[7] = fcnt >> 8;
+    tx->payload[8] = 1;
+    for (i = 9; i < tx->size; ++i) {
+        tx->payload[i] = (uint8_t)rand_next();
+    }
+}
+
+static void usage(void) {
+    printf("Usage: mesh_sim [-n node] [-p PER] [-w delivery] [-s dB] [-b backoff ms] [-u s] [-t s] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+/* time on air (us), the formula of the HAL */
+uint32_t lgw_time_on_air(struct lgw_pkt_tx_s *packet) {
+    unsigned sf = SIM_SF_MIN + (unsigned)__builtin_ctz(packet->datarate / DR_LORA_SF7);
+    double t_sym = (double)(1U << sf) * 1e3 / 125.0;
+    int de = (sf >= 11) ? 1 : 0;
+    double n = ceil((8.0 * packet->size - 4.0 * sf + 28 + 16) / (4.0 * (sf - 2 * de)));
+
+    if (n < 0) {
+        n = 0;
+    }
+    return (uint32_t)((packet->preamble + 4.25 + 8 + n * (packet->coderate + 4)) * t_sym);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    struct relay_cfg_s cfg = {SIM_RELAY_FREQ, 0, 14, DR_LORA_SF7, 100, RELAY_GUARD_MS, RELAY_BACKOFF_MS};
+    struct lgw_pkt_tx_s tx;
+    const struct relaynet_route_s *route;
+    int dev_node = 3;
+    double per = 0.1;
+    double weak_ok = 0.2;
+    float weak_snr = -5.0f;
+    double period_s = 60;
+    double duration_s = 21600;
+    uint64_t t, end_ns, up_next;
+    uint32_t nb_up = 0, nb_deliv = 0;
+    double lat_sum = 0, lat_max = 0;
+    uint16_t fcnt = 0;
+    int opt, i, j;
+
+    while ((opt = getopt(argc, argv, "hn:p:w:s:b:u:t:x:")) != -1) {
+        switch (opt) {
+            case 'n': dev_node = atoi(optarg); break;
+            case 'p': per = atof(optarg); break;
+            case 'w': weak_ok = atof(optarg); break;
+            case 's': weak_snr = (float)atof(optarg); break;
+            case 'b': cfg.backoff_ms = (uint16_t)atoi(optarg); break;
+            case 'u': period_s = atof(optarg); break;
+            case 't': duration_s = atof(optarg); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if ((dev_node < 1) || (dev_node >= SIM_NODE_NB) || (period_s <= 0) || (duration_s <= SIM_WARMUP_S)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    /* the chain, the device next to dev_node */
+    for (i = 0; i < SIM_NODE_NB; ++i) {
+        for (j = 0; j < SIM_NODE_NB; ++j) {
+            if ((j == i + 1) || (i == j + 1)) {
+                link_ok[i][j] = 1 - per;
+                link_snr[i][j] = SIM_SNR_GOOD;
+            } else if ((j == i + 2) || (i == j + 2)) {
+                link_ok[i][j] = weak_ok;
+                link_snr[i][j] = weak_snr;
+            }
+        }
+    }
+    link_ok[SIM_DEV][dev_node] = 1 - per;
+    link_snr[SIM_DEV][dev_node] = SIM_SNR_GOOD;
+    link_ok[SIM_DEV][dev_node - 1] = 0.05;
+    link_snr[SIM_DEV][dev_node - 1] = weak_snr;
+
+    for (i = 0; i < SIM_NODE_NB; ++i) {
+        relay_init(&node[i].relay, &cfg, (uint32_t)rand_next());
+        relaynet_init(&node[i].rn, SIM_NODE_ID + i, i == 0, 4);
+        node[i].fetch_ns = (uint64_t)i * SIM_STEP_MS * MS;
+    }
+
+    end_ns = (uint64_t)(duration_s * 1e9);
+    up_next = SIM_WARMUP_S * 1000000000ULL;
+    for (t = 0; t < end_ns; t += SIM_STEP_MS * MS) {
+        if (t >= up_next) {
+            uplink_build(&tx, fcnt);
+            air_put(SIM_DEV, &tx, t);
+            up_end_ns[fcnt] = t + lgw_time_on_air(&tx) * 1000ULL;
+            fcnt += 1;
+            nb_up += 1;
+            up_next = t + (uint64_t)(period_s * (0.8 + 0.4 * rand_unit()) * 1e9);
+        }
+        air_receive(t);
+        for (i = 0; i < SIM_NODE_NB; ++i) {
+            if (t < node[i].fetch_ns) {
+                continue;
+            }
+            if (node[i].nb_fifo > 0) {
+                node_input(i, t, &lat_sum, &lat_max, &nb_deliv);
+                node[i].fetch_ns = t + SIM_STEP_MS * MS;
+            } else {
+                node_tx(i, t);
+                node[i].fetch_ns = t + FETCH_SLEEP_MS * MS;
+            }
+        }
+    }
+
+    printf("# device next to node %d, good links PER %.0f%%, weak links %.0f%% at %.1f dB, %u uplinks\n", dev_node, 100 * per, 100 * weak_ok, weak_snr, nb_up);
+    printf("# delivered %u (%.1f%%), latency avg %.0f ms, max %.0f ms\n", nb_deliv, 100.0 * nb_deliv / nb_up, (nb_deliv > 0) ? lat_sum / nb_deliv : 0.0, lat_max);
+    printf("# sink: delivered after 1/2/3/4 hops %u/%u/%u/%u\n", node[0].rn.stat.nb_deliv_hops[1], node[0].rn.stat.nb_deliv_hops[2], node[0].rn.stat.nb_deliv_hops[3], node[0].rn.stat.nb_deliv_hops[4]);
+    for (i = 0; i < SIM_NODE_NB; ++i) {
+        route = relaynet_route(&node[i].rn, (uint32_t)(end_ns / 1000000000));
+        printf("# node %d: orig %u fwd %u dup %u no route %u, relayed %u, expired %u, full %u", SIM_NODE_ID + i, node[i].rn.stat.nb_orig, node[i].rn.stat.nb_fwd, node[i].rn.stat.nb_dup, node[i].rn.stat.nb_no_route, node[i].relay.stat.nb_sent, node[i].relay.stat.nb_expired, node[i].relay.stat.nb_full);
+        if ((i > 0) && (route != NULL)) {
+            printf(", route via %u, %u hops\n", route->via, route->hops);
+        } else {
+            printf("\n");
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
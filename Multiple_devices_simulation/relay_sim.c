@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Throughput of the single-hop repeater (relay.h), the scheduler of the
+    forwarder running on a simulated concentrator:
+
+    - Poisson uplinks from devices spread over the 8 chan_multiSF channels
+      of Scripts/Pygate_no_tcp_as_gw/config.json, at a random SF from SF7 to
+      SF12, each one a valid unconfirmed data uplink of -l bytes, so
+      relay_push does not reject it;
+    - the concentrator is half-duplex: a packet whose airtime overlaps a
+      transmission of the repeater is lost, the others reach the RX FIFO at
+      the end of their airtime;
+    - the fetch loop of thread_up: a fetch returning packets is followed by
+      the next one, relay_tx only runs after an empty fetch, which is
+      followed by FETCH_SLEEP_MS. relay_tx runs right after the empty fetch,
+      so the RX FIFO probe never finds a packet here, see lbt_sim.c for
+      several repeaters.
+
+    The single-channel LoPy repeater of Scripts/Repetição Um Canal is run on
+    the same uplinks for comparison: it only hears the first channel at SF7,
+    and is deaf for a second after each packet, plus the time to send it
+    again.
+
+    Build and run on the host:
+
+        gcc -O2 -I../Host_tests/include -I.. -o relay_sim relay_sim.c ../relay.c ../lorawan_frame.c -lm
+        ./relay_sim -r 0.3
+        ./relay_sim -r 1.0 -s 0
+
+    -r uplinks per second, all devices (1.0), -t simulated time in s (3600),
+    -l payload size, 13 minimum (20), -s SF of the repeater, 0 keeps the SF
+    of the packet (7), -d duty cycle of the TX sub-band in % (10), -g guard
+    time in ms (RELAY_GUARD_MS), -b max random backoff in ms
+    (RELAY_BACKOFF_MS, 0 for the scheduler without backoff), -x random seed.
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf */
+#include <stdlib.h>     /* atof, atoi, strtoull */
+#include <string.h>     /* memset */
+#include <math.h>       /* log, ceil */
+#include <unistd.h>     /* getopt */
+
+#include "loragw_hal.h"
+#include "relay.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define SIM_CHAN_NB         8
+#define SIM_SF_MIN          7
+#define SIM_SF_NB           6           /* SF7 to SF12 */
+#define SIM_AIR_NB          256         /* packets in the air or in the RX FIFO */
+#define SIM_DEV_NB          1000        /* device addresses drawn by the uplinks */
+#define SIM_RELAY_FREQ      869525000   /* DEFAULT_RELAY_FREQ of the forwarder */
+#define SIM_SINGLE_DEAF_MS  1000        /* single-channel repeater, sleep after each packet */
+
+#define FETCH_SLEEP_MS      50          /* thread_up, wait after an empty fetch */
+#define FETCH_MS            1           /* thread_up, time of a fetch returning packets */
+#define NB_PKT_MAX          8           /* thread_up, packets per fetch */
+
+#define MS                  1000000ULL  /* ns */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* packet in the air, then in the RX FIFO */
+struct air_s {
+    uint64_t        end_ns;
+    bool            lost;       /* overlapped by a transmission of the repeater */
+    struct lgw_pkt_rx_s pkt;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+/* chan_multiSF_0 to chan_multiSF_7 of config.json */
+static const uint32_t chan_freq[SIM_CHAN_NB] = {
+    868100000, 868300000, 868500000,
+    867100000, 867300000, 867500000, 867700000, 867900000
+};
+
+static uint64_t rand_state = 88172645463325252ULL;
+
+static struct air_s air[SIM_AIR_NB];
+static unsigned nb_air;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint64_t rand_next(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+/* exponential, mean m */
+static double rand_exp(double m) {
+    return -m * log(((double)(rand_next() >> 11) + 1.0) / 9007199254740993.0);
+}
+
+/* unconfirmed data uplink: MHDR, DevAddr, FCtrl, FCnt, FPort, FRMPayload, MIC, random from FPort on */
+static void uplink_build(struct lgw_pkt_rx_s *pkt, unsigned size, uint32_t seq) {
+    uint32_t addr = 0x26000000 | (uint32_t)(rand_next() % SIM_DEV_NB);
+    unsigned i;
+
+    pkt->payload[0] = 0x40;
+    pkt->payload[1] = addr & 0xFF;
+    pkt->payload[2] = (addr >> 8) & 0xFF;
+    pkt->payload[3] = (addr >> 16) & 0xFF;
+    pkt->payload[4] = (addr >> 24) & 0xFF;
+    pkt->payload[5] = 0x00;
+    pkt->payload[6] = seq & 0xFF;
+    pkt->payload[7] = (seq >> 8) & 0xFF;
+    pkt->payload[8] = 1;
+    for (i = 9; i < size; ++i) {
+        pkt->payload[i] = (uint8_t)rand_next();
+    }
+    pkt->size = (uint16_t)size;
+}
+
+/* mark the packets in the air when the repeater starts transmitting, the RX chains are blind */
+static void air_blind(uint64_t t) {
+    unsigned i;
+
+    for (i = 0; i < nb_air; ++i) {
+        if (air[i].end_ns > t) {
+            air[i].lost = true;
+        }
+    }
+}
+
+/* lgw_receive: the packets that ended, in the order they ended, lost ones are dropped */
+static int air_fetch(uint64_t t, struct lgw_pkt_rx_s *rx, unsigned *nb_lost) {
+    unsigned i, k, first;
+    int n = 0;
+
+    while (n < NB_PKT_MAX) {
+        first = nb_air;
+        for (i = 0; i < nb_air; ++i) {
+            if ((air[i].end_ns <= t) && ((first == nb_air) || (air[i].end_ns < air[first].end_ns))) {
+                first = i;
+            }
+        }
+        if (first == nb_air) {
+            break;
+        }
+        if (air[first].lost) {
+            *nb_lost += 1;
+        } else {
+            rx[n++] = air[first].pkt;
+        }
+        for (k = first; k + 1 < nb_air; ++k) {
+            air[k] = air[k + 1];
+        }
+        nb_air -= 1;
+    }
+    return n;
+}
+
+static void usage(void) {
+    printf("Usage: relay_sim [-r uplinks/s] [-t s] [-l size] [-s sf] [-d duty %%] [-g guard ms] [-b backoff ms] [-x seed]\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+/* time on air (us) of the packets of the repeater, the formula of the HAL */
+uint32_t lgw_time_on_air(struct lgw_pkt_tx_s *packet) {
+    unsigned sf = SIM_SF_MIN + (unsigned)__builtin_ctz(packet->datarate / DR_LORA_SF7);
+    double t_sym = (double)(1U << sf) * 1e3 / 125.0;
+    int de = (sf >= 11) ? 1 : 0;
+    double n = ceil((8.0 * packet->size - 4.0 * sf + 28 + 16) / (4.0 * (sf - 2 * de)));
+
+    if (n < 0) {
+        n = 0;
+    }
+    return (uint32_t)((packet->preamble + 4.25 + 8 + n * (packet->coderate + 4)) * t_sym);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    static struct relay_s relay;
+    struct relay_cfg_s cfg = {SIM_RELAY_FREQ, 0, 14, DR_LORA_SF7, 100, RELAY_GUARD_MS, RELAY_BACKOFF_MS};
+    struct lgw_pkt_rx_s rx[NB_PKT_MAX];
+    struct lgw_pkt_tx_s tx;
+    double rate = 1.0;
+    double duration_s = 3600;
+    unsigned size = 20;
+    unsigned sf;
+    uint64_t t = 0, end_ns, next_up, air_ns;
+    uint64_t tx_end = 0;
+    uint64_t single_busy = 0;
+    uint32_t nb_up = 0, nb_heard = 0, nb_lost = 0, nb_overflow = 0, nb_single = 0;
+    int opt, n, i;
+
+    while ((opt = getopt(argc, argv, "hr:t:l:s:d:g:b:x:")) != -1) {
+        switch (opt) {
+            case 'r': rate = atof(optarg); break;
+            case 't': duration_s = atof(optarg); break;
+            case 'l': size = (unsigned)atoi(optarg); break;
+            case 's': sf = (unsigned)atoi(optarg); cfg.datarate = ((sf >= 7) && (sf <= 12)) ? (DR_LORA_SF7 << (sf - 7)) : 0; break;
+            case 'd': cfg.duty_permil = (uint16_t)(10 * atof(optarg)); break;
+            case 'g': cfg.guard_ms = (uint16_t)atoi(optarg); break;
+            case 'b': cfg.backoff_ms = (uint16_t)atoi(optarg); break;
+            case 'x': rand_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'h': usage(); return EXIT_SUCCESS;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+    if ((rate <= 0) || (size < 13) || (size > 255)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    relay_init(&relay, &cfg, (uint32_t)rand_next());
+    end_ns = (uint64_t)(duration_s * 1e9);
+    next_up = (uint64_t)(rand_exp(1.0 / rate) * 1e9);
+    while (t < end_ns) {
+        /* uplinks started by now, they reach the RX FIFO at the end of their airtime */
+        while (next_up <= t) {
+            struct air_s *a = &air[nb_air];
+
+            memset(&tx, 0, sizeof tx);
+            sf = SIM_SF_MIN + (unsigned)(rand_next() % SIM_SF_NB);
+            memset(a, 0, sizeof *a);
+            a->pkt.freq_hz = chan_freq[rand_next() % SIM_CHAN_NB];
+            a->pkt.status = STAT_CRC_OK;
+            a->pkt.modulation = MOD_LORA;
+            a->pkt.bandwidth = BW_125KHZ;
+            a->pkt.datarate = DR_LORA_SF7 << (sf - SIM_SF_MIN);
+            a->pkt.coderate = CR_LORA_4_5;
+            uplink_build(&a->pkt, size, nb_up);
+            tx.datarate = a->pkt.datarate;
+            tx.coderate = a->pkt.coderate;
+            tx.preamble = 8;
+            tx.size = a->pkt.size;
+            air_ns = lgw_time_on_air(&tx) * 1000ULL;
+            a->end_ns = next_up + air_ns;
+            a->lost = (next_up < tx_end);
+
+            /* the LoPy repeater: first channel at SF7, deaf after each packet */
+            if ((a->pkt.freq_hz == chan_freq[0]) && (sf == SIM_SF_MIN) && (next_up >= single_busy)) {
+                nb_single += 1;
+                single_busy = a->end_ns + SIM_SINGLE_DEAF_MS * MS + air_ns;
+            }
+            if (nb_air < SIM_AIR_NB - 1) {
+                nb_air += 1;
+            } else {
+                nb_overflow += 1;
+            }
+            nb_up += 1;
+            next_up += (uint64_t)(rand_exp(1.0 / rate) * 1e9);
+        }
+
+        /* thread_up iteration */
+        n = air_fetch(t, rx, &nb_lost);
+        if (n > 0) {
+            for (i = 0; i < n; ++i) {
+                relay_push(&relay, &rx[i], t);
+            }
+            relay_rx_seen(&relay, t);
+            nb_heard += (uint32_t)n;
+            t += FETCH_MS * MS;
+            continue;
+        }
+        if ((t >= tx_end) && (relay_pop(&relay, t, &tx) == 1)) {
+            relay_sent(&relay, t, lgw_time_on_air(&tx));
+            tx_end = t + lgw_time_on_air(&tx) * 1000ULL;
+            air_blind(t);
+        }
+        t += FETCH_SLEEP_MS * MS;
+    }
+
+    printf("# %.2f uplinks/s for %.0f s, relayed at %s, %.1f%% duty cycle, guard %u ms, backoff %u ms\n", rate, duration_s, (cfg.datarate != 0) ? "a fixed SF" : "the received SF", cfg.duty_permil / 10.0, cfg.guard_ms, cfg.backoff_ms);
+    printf("# uplinks %u, heard %u, lost while transmitting %u (%.1f%%)\n", nb_up, nb_heard, nb_lost, 100.0 * nb_lost / nb_up);
+    printf("# relayed %u (%.1f%%), queue full %u, expired %u, invalid %u\n", relay.stat.nb_sent, 100.0 * relay.stat.nb_sent / nb_up, relay.stat.nb_full, relay.stat.nb_expired, relay.stat.nb_invalid);
+    printf("# wait avg %.0f ms, max %u ms, airtime %.2f%%\n", (relay.stat.nb_sent > 0) ? relay.stat.wait_us / 1000.0 / relay.stat.nb_sent : 0.0, relay.stat.wait_max_us / 1000, 100.0 * relay.stat.airtime_us / (end_ns / 1000.0));
+    printf("# single-channel repeater: relayed %u (%.1f%%)\n", nb_single, 100.0 * nb_single / nb_up);
+    if (nb_overflow > 0) {
+        fprintf(stderr, "WARNING: %u uplinks over the simulated air, results are wrong\n", nb_overflow);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
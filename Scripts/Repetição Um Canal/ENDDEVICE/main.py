@@ -1,25 +1,138 @@
 from network import LoRa
 import socket
 import time
+import struct
 import ubinascii
+import crypto
 
 
 # Please pick the region that matches where you are using the device
 
 lora = LoRa(mode=LoRa.LORA, region=LoRa.EU868)
 s = socket.socket(socket.AF_LORA, socket.SOCK_RAW)
-s.setblocking(False)
+s.setblocking(True)
 app_eui = ubinascii.unhexlify('0000000000000000')
 app_key = ubinascii.unhexlify('F87245C083E9125C7978352A58CA3E3A')
 #uncomment to use LoRaWAN application provided dev_eui
 dev_eui = ubinascii.unhexlify('a91e9b43532f9ae9')
 
-sending=True
-while sending==True:
-    s.send(dev_eui)
-    time.sleep(10)
-    x=s.recv(64).rstrip()
-    print(str(x))
-    if str(x)=="b'1'":
-        sending=False
-        print("sent")
+# relay header (relaynet.h): Proprietary MHDR, version 1, type UP / ACK / BEACON
+RELAY_UP = b'\xe0\x12'
+RELAY_ACK = b'\xe0\x13'
+RELAY_BEACON = b'\xe0\x14'
+# the repeater addressed by the uplink answers 200 ms (RELAYNET_ACK_DELAY_US)
+# after the end of the uplink. Uplinks to everybody are answered by every
+# repeater hearing them, each one in one of 4 (RELAYNET_ACK_SLOT_NB) slots of
+# an SF7 ACK, 41 ms, plus 20 ms (RELAYNET_ACK_GUARD_US)
+BROADCAST = 0xFFFF
+ACK_DELAY_MS = 200
+ACK_SLOT_MS = 62
+ACK_SLOT_NB = 4
+ACK_MARGIN_MS = 100
+MAX_TRIES = 6
+# time-slotted schedule (tdma.h): beacons on the repeater channel, at SF9
+# unless the repeater has a spread_factor, 22 bytes
+BEACON_FREQ = 869525000
+BEACON_SF = 9
+BEACON_AIRTIME_MS = 165
+BEACON_LEAD_MS = 500
+NO_SLOT = 0xFF
+SLOT_GUARD_MS = 20
+PERIOD_S = 60
+UP_FREQ = lora.frequency()
+
+dev_id = dev_eui[7] << 8 | dev_eui[6]
+r = crypto.getrandbits(16)
+seq = r[0] | r[1] << 8
+slot = None
+node = BROADCAST    # repeater that acknowledged the last uplink
+tdma = True     # cleared when no beacon is heard, the repeater does not run the schedule
+
+def wait_ack(seq, nb_slot):
+    # the radio listens again as soon as the uplink is sent
+    global node
+    s.setblocking(False)
+    start = time.ticks_ms()
+    window = ACK_DELAY_MS + nb_slot * ACK_SLOT_MS + ACK_MARGIN_MS
+    ack = None
+    while ack is None and time.ticks_diff(time.ticks_ms(), start) < window:
+        x = s.recv(64)
+        if len(x) >= 9 and x[0:2] == RELAY_ACK:
+            _, src, next_id, ack_seq = struct.unpack('<BHHH', x[2:9])
+            if (next_id == dev_id) and (ack_seq == seq):
+                # the next uplinks are only answered by this repeater
+                node = src
+                # the slot of the device, when the repeater runs the schedule
+                ack = x[9] if len(x) >= 10 else NO_SLOT
+        else:
+            time.sleep_ms(5)
+    s.setblocking(True)
+    return ack
+
+def wait_beacon():
+    # listen on the beacon channel for one superframe at most
+    lora.init(mode=LoRa.LORA, region=LoRa.EU868, frequency=BEACON_FREQ, sf=BEACON_SF)
+    s.settimeout(PERIOD_S + 10)
+    layout = None
+    start = 0
+    try:
+        while layout is None:
+            x = s.recv(64)
+            if len(x) >= 22 and x[0:2] == RELAY_BEACON:
+                start = time.ticks_add(time.ticks_ms(), -BEACON_AIRTIME_MS)
+                layout = struct.unpack('<IHHHHB', x[9:22])
+    except OSError:
+        pass
+    s.settimeout(None)
+    lora.init(mode=LoRa.LORA, region=LoRa.EU868, frequency=UP_FREQ, sf=7)
+    return layout, start
+
+def wait_slot():
+    # time the uplink from the next beacon: in the slot of the device, or
+    # at random in the contention part to ask for a slot
+    global tdma
+    if not tdma:
+        return False
+    layout, start = wait_beacon()
+    if layout is None:
+        tdma = False
+        return False
+    _, period_s, beacon_ms, slot_ms, dev_ms, nb_slot = layout
+    if slot is not None and slot < nb_slot:
+        offset = beacon_ms + slot * slot_ms + SLOT_GUARD_MS
+    else:
+        first = beacon_ms + nb_slot * slot_ms
+        span = period_s * 1000 - BEACON_LEAD_MS - dev_ms - first
+        r = crypto.getrandbits(16)
+        offset = first + (r[0] | r[1] << 8) * max(span, 0) // 65536
+    time.sleep_ms(max(time.ticks_diff(time.ticks_add(start, offset), time.ticks_ms()), 0))
+    return True
+
+def send(data):
+    global seq, slot, node
+    seq = (seq + 1) & 0xFFFF
+    backoff = 1000
+    for tries in range(1, MAX_TRIES + 1):
+        # one try per superframe while beacons are heard
+        scheduled = wait_slot()
+        s.send(RELAY_UP + struct.pack('<BHHH', 0x00, dev_id, node, seq) + data)
+        ack = wait_ack(seq, ACK_SLOT_NB if node == BROADCAST else 1)
+        if ack is not None:
+            slot = None if ack == NO_SLOT else ack
+            return tries
+        # the repeater may be gone, the next try goes to everybody
+        node = BROADCAST
+        if not scheduled:
+            # random backoff, so devices colliding once do not collide again
+            time.sleep_ms(backoff + crypto.getrandbits(16)[0] * backoff // 256)
+            backoff = backoff * 2
+    return 0
+
+while True:
+    tries = send(dev_eui)
+    if tries > 0:
+        print("sent, " + str(tries) + " transmissions" + ("" if slot is None else ", slot " + str(slot)))
+    else:
+        print("not acknowledged")
+    if slot is None:
+        time.sleep(PERIOD_S)
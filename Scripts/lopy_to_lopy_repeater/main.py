@@ -1,18 +1,47 @@
 from network import LoRa
 import socket
 import time
+import crypto
 
 # Please pick the region that matches where you are using the device
 
 lora = LoRa(mode=LoRa.LORA, region=LoRa.EU868)
 s = socket.socket(socket.AF_LORA, socket.SOCK_RAW)
 s.setblocking(False)
+
+# listen before talk, as the repeater of the forwarder (relay.h)
+LBT_RSSI = -90      # dBm, the channel is free below
+BACKOFF_MS = 500    # random backoff before the emission, max
+BACKOFF_MAX_MS = 4000
+DEADLINE_MS = 2000  # RELAY_TTL_MS, packets not repeated by then are dropped
+
+deferred = 0
+dropped = 0
+
+def repeat(data, received):
+    global deferred, dropped
+    window = BACKOFF_MS
+    while True:
+        r = crypto.getrandbits(16)
+        time.sleep_ms((r[0] | r[1] << 8) * window // 65536)
+        if time.ticks_diff(time.ticks_ms(), received) > DEADLINE_MS:
+            dropped = dropped + 1
+            return False
+        if lora.ischannel_free(LBT_RSSI):
+            s.send(data)
+            return True
+        # a device or another repeater is transmitting
+        deferred = deferred + 1
+        window = min(window * 2, BACKOFF_MAX_MS)
+
 i = 0
 while True:
     (bytes, address)=s.recvfrom(64)  #permite obter o address do dispositivo tambem
     if len(bytes) != 0:
+        received = time.ticks_ms()
         print('Pong {}'.format(bytes))
-        s.send(bytes)
+        if repeat(bytes, received):
+            i = i+1
         print('Pongadd {}'.format(address))
-        i = i+1
-    time.sleep(5)
+        print('{} repeated, {} deferred on a busy channel, {} dropped past the deadline'.format(i, deferred, dropped))
+    time.sleep_ms(50)
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Adaptive data rate recommendations, see adr.h
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <math.h>       /* floorf */
+
+#include "adr.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+/* demodulation floor of SF7 to SF12, SX1301/SX1308 datasheet */
+static const float snr_floor[ADR_SF_MAX - ADR_SF_MIN + 1] = {-7.5f, -10.0f, -12.5f, -15.0f, -17.5f, -20.0f};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+float adr_snr_floor(uint8_t sf) {
+    return snr_floor[sf - ADR_SF_MIN];
+}
+
+int adr_recommend(float snr, uint8_t sf, float margin_db, struct adr_rec_s *rec) {
+    int nstep;
+
+    if ((sf < ADR_SF_MIN) || (sf > ADR_SF_MAX)) {
+        return -1;
+    }
+    rec->margin_db = snr - snr_floor[sf - ADR_SF_MIN] - margin_db;
+    nstep = (int)floorf(rec->margin_db / ADR_STEP_DB);
+    rec->sf = sf;
+    rec->txpow = 0;
+    for (; (nstep > 0) && (rec->sf > ADR_SF_MIN); --nstep) {
+        rec->sf -= 1;
+    }
+    for (; (nstep > 0) && (rec->txpow < ADR_TXPOW_NB - 1); --nstep) {
+        rec->txpow += 1;
+    }
+    for (; (nstep < 0) && (rec->sf < ADR_SF_MAX); ++nstep) {
+        rec->sf += 1;
+    }
+    return 0;
+}
+
+uint32_t adr_airtime_us(uint8_t sf, uint8_t size) {
+    uint32_t tsym_us = (1u << sf) * 8; /* 2^SF / 125 kHz */
+    int de = (sf >= 11) ? 1 : 0; /* low data rate optimization */
+    int num = 8 * size - 4 * sf + 28 + 16;
+    int den = 4 * (sf - 2 * de);
+    int nsym = 8;
+
+    if (num > 0) {
+        nsym += ((num + den - 1) / den) * 5; /* CR 4/5 */
+    }
+    /* preamble: 8 symbols + 4.25 */
+    return (tsym_us * 49) / 4 + nsym * tsym_us;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
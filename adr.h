@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Adaptive data rate recommendations from the SNR observed by the gateway,
+    following the Semtech network server algorithm: the margin above the
+    demodulation floor of the current spreading factor, minus an installation
+    margin, is spent in 3 dB steps, first on faster data rates, then on lower
+    TX power. A negative margin moves the device to slower data rates.
+
+    Uplinks do not carry the TX power of the device, recommendations assume it
+    transmits at full power (index 0). Regional parameters: EU868, 125 kHz.
+*/
+
+#ifndef _LORA_PKTFWD_ADR_H
+#define _LORA_PKTFWD_ADR_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define ADR_SF_MIN          7
+#define ADR_SF_MAX          12
+#define ADR_STEP_DB         3.0f    /* margin spent by one data rate or TX power step */
+#define ADR_TXPOW_NB        8       /* EU868 TXPower indexes, 2 dB apart below the max EIRP */
+#define ADR_MARGIN_DEFAULT  10.0f   /* installation margin (dB) */
+#define ADR_PKT_MIN         20      /* uplinks heard before a device gets a recommendation */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct adr_rec_s
+@brief Recommended settings of one device
+*/
+struct adr_rec_s {
+    uint8_t         sf;         /*!> spreading factor */
+    uint8_t         txpow;      /*!> TXPower index, 0 = max EIRP */
+    float           margin_db;  /*!> SNR above the floor of the current SF and the installation margin */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Lowest SNR a spreading factor demodulates.
+
+@param sf Spreading factor (7..12)
+@return SNR (dB)
+*/
+float adr_snr_floor(uint8_t sf);
+
+/**
+@brief Compute the data rate and TX power a device should use.
+
+@param snr SNR observed on the uplinks of the device (dB)
+@param sf Spreading factor of the uplinks
+@param margin_db Installation margin (dB)
+@param rec[out] Recommended settings
+@return 0 on success, -1 if sf is not a LoRa 125 kHz spreading factor
+*/
+int adr_recommend(float snr, uint8_t sf, float margin_db, struct adr_rec_s *rec);
+
+/**
+@brief Time on air of an uplink: 125 kHz, CR 4/5, explicit header, CRC, 8 symbols preamble.
+
+@param sf Spreading factor (7..12)
+@param size PHYPayload size
+@return time on air (us)
+*/
+uint32_t adr_airtime_us(uint8_t sf, uint8_t size);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Capture and replay of concentrator packet streams
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* fopen, fread, fwrite */
+#include <string.h>     /* memset, memcpy */
+#include <time.h>       /* clock_gettime */
+
+#if defined(__linux__)
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* close */
+#include <sys/mman.h>   /* mmap */
+#include <sys/stat.h>   /* fstat */
+#endif
+
+#include "logcat.h"
+#include "capture.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#if (CAPTURE_STAT_CRC_OK != STAT_CRC_OK) || (CAPTURE_STAT_CRC_BAD != STAT_CRC_BAD) || (CAPTURE_MOD_LORA != MOD_LORA) || \
+    (CAPTURE_BW_125KHZ != BW_125KHZ) || (CAPTURE_DR_LORA_SF7 != DR_LORA_SF7) || (CAPTURE_CR_LORA_4_5 != CR_LORA_4_5)
+#error "field values of capture_rec.h do not match loragw_hal.h"
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static inline void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline void put_f32(uint8_t *p, float v) {
+    uint32_t u;
+
+    memcpy(&u, &v, sizeof u);
+    put_le32(p, u);
+}
+
+static inline uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline float get_f32(const uint8_t *p) {
+    uint32_t u = get_le32(p);
+    float v;
+
+    memcpy(&v, &u, sizeof v);
+    return v;
+}
+
+static int batch_write(struct capture_s *cap) {
+    if (cap->batch_len == 0) {
+        return 0;
+    }
+    if (fwrite(cap->batch, cap->batch_len, 1, cap->file) != 1) {
+        LOGCAT_ERROR(UP, "[cap ] failed to write %u bytes to the capture\n", cap->batch_len);
+        cap->batch_len = 0;
+        return -1;
+    }
+    fflush(cap->file);
+    cap->size += cap->batch_len;
+    cap->batch_len = 0;
+    return 0;
+}
+
+static int rec_encode(const struct lgw_pkt_rx_s *p, const struct timeval *cap_time, uint8_t *buf) {
+    put_le32(&buf[CAPTURE_REC_OFF_TIME_S], (uint32_t)cap_time->tv_sec);
+    put_le32(&buf[CAPTURE_REC_OFF_TIME_US], (uint32_t)cap_time->tv_usec);
+    put_le32(&buf[CAPTURE_REC_OFF_COUNT_US], p->count_us);
+    put_le32(&buf[CAPTURE_REC_OFF_FREQ_HZ], p->freq_hz);
+    put_le32(&buf[CAPTURE_REC_OFF_DATARATE], p->datarate);
+    put_f32(&buf[CAPTURE_REC_OFF_RSSI], p->rssi);
+    put_f32(&buf[CAPTURE_REC_OFF_SNR], p->snr);
+    put_f32(&buf[CAPTURE_REC_OFF_SNR_MIN], p->snr_min);
+    put_f32(&buf[CAPTURE_REC_OFF_SNR_MAX], p->snr_max);
+    put_le16(&buf[CAPTURE_REC_OFF_CRC], p->crc);
+    buf[CAPTURE_REC_OFF_IF_CHAIN] = p->if_chain;
+    buf[CAPTURE_REC_OFF_RF_CHAIN] = p->rf_chain;
+    buf[CAPTURE_REC_OFF_STATUS] = p->status;
+    buf[CAPTURE_REC_OFF_MODULATION] = p->modulation;
+    buf[CAPTURE_REC_OFF_BANDWIDTH] = p->bandwidth;
+    buf[CAPTURE_REC_OFF_CODERATE] = p->coderate;
+    put_le16(&buf[CAPTURE_REC_OFF_SIZE], p->size);
+    memcpy(&buf[CAPTURE_REC_SIZE], p->payload, p->size);
+    return CAPTURE_REC_SIZE + p->size;
+}
+
+/* time elapsed from a to b, in microseconds */
+static inline int64_t tv_diff_us(const struct timeval *a, const struct timeval *b) {
+    return ((int64_t)b->tv_sec - a->tv_sec) * 1000000 + ((int64_t)b->tv_usec - a->tv_usec);
+}
+
+static inline int64_t ts_diff_us(const struct timespec *a, const struct timespec *b) {
+    return ((int64_t)b->tv_sec - a->tv_sec) * 1000000 + ((int64_t)b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int capture_open(struct capture_s *cap, const char *path, uint32_t size_max, uint64_t gw_eui) {
+    uint8_t hdr[CAPTURE_HDR_SIZE];
+
+    memset(cap, 0, sizeof *cap);
+    cap->size_max = size_max;
+    cap->file = fopen(path, "wb");
+    if (cap->file == NULL) {
+        LOGCAT_ERROR(UP, "[cap ] failed to create %s\n", path);
+        return -1;
+    }
+
+    memcpy(hdr, CAPTURE_MAGIC, 4);
+    put_le16(&hdr[CAPTURE_HDR_OFF_VERSION], CAPTURE_VERSION);
+    put_le16(&hdr[CAPTURE_HDR_OFF_REC_SIZE], CAPTURE_REC_SIZE);
+    put_le32(&hdr[CAPTURE_HDR_OFF_GW_EUI], (uint32_t)gw_eui);
+    put_le32(&hdr[CAPTURE_HDR_OFF_GW_EUI + 4], (uint32_t)(gw_eui >> 32));
+    if (fwrite(hdr, sizeof hdr, 1, cap->file) != 1) {
+        LOGCAT_ERROR(UP, "[cap ] failed to write the header of %s\n", path);
+        fclose(cap->file);
+        cap->file = NULL;
+        return -1;
+    }
+    cap->size = sizeof hdr;
+    LOGCAT_INFO(UP, "[cap ] capturing received packets to %s\n", path);
+    return 0;
+}
+
+void capture_close(struct capture_s *cap) {
+    if (cap->file == NULL) {
+        return;
+    }
+    batch_write(cap);
+    fclose(cap->file);
+    cap->file = NULL;
+    LOGCAT_INFO(UP, "[cap ] capture closed, %u packets, %u bytes, %u discarded\n", cap->nb_rec, cap->size, cap->nb_dropped);
+}
+
+int capture_write(struct capture_s *cap, int nb_pkt, const struct lgw_pkt_rx_s *pkts, const struct timeval *cap_time) {
+    uint32_t rec_len;
+    int i, nb = 0;
+
+    for (i = 0; i < nb_pkt; ++i) {
+        rec_len = CAPTURE_REC_SIZE + pkts[i].size;
+        if (!cap->full && (cap->size_max != 0) && (cap->size + cap->batch_len + rec_len > cap->size_max)) {
+            LOGCAT_WARN(UP, "[cap ] capture reached %u bytes, next packets are not captured\n", cap->size_max);
+            cap->full = true;
+        }
+        if (cap->full || (cap->file == NULL) || (pkts[i].size > sizeof pkts[i].payload)) {
+            cap->nb_dropped += 1;
+            continue;
+        }
+        if ((cap->batch_len + rec_len > CAPTURE_BATCH_SIZE) && (batch_write(cap) != 0)) {
+            cap->nb_dropped += 1;
+            continue;
+        }
+        if (cap->batch_len == 0) {
+            cap->batch_time = *cap_time;
+        }
+        cap->batch_len += rec_encode(&pkts[i], cap_time, &cap->batch[cap->batch_len]);
+        cap->nb_rec += 1;
+        ++nb;
+    }
+    return nb;
+}
+
+int capture_flush_if_due(struct capture_s *cap, const struct timeval *now) {
+    if ((cap->file == NULL) || (cap->batch_len == 0)) {
+        return 0;
+    }
+    if (tv_diff_us(&cap->batch_time, now) < (CAPTURE_FLUSH_MS * 1000LL)) {
+        return 0;
+    }
+    return batch_write(cap);
+}
+
+int capture_reader_open(struct capture_reader_s *reader, const char *path) {
+    uint8_t hdr[CAPTURE_HDR_SIZE];
+
+    memset(reader, 0, sizeof *reader);
+#if defined(__linux__)
+    {
+        struct stat st;
+        void *data;
+        int fd = open(path, O_RDONLY);
+
+        if (fd < 0) {
+            LOGCAT_ERROR(UP, "[cap ] failed to open %s\n", path);
+            return -1;
+        }
+        if ((fstat(fd, &st) == 0) && (st.st_size >= CAPTURE_HDR_SIZE)) {
+            data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+                reader->data = data;
+                reader->len = (size_t)st.st_size;
+            }
+        }
+        close(fd);
+    }
+#endif
+    if (reader->data != NULL) {
+        memcpy(hdr, reader->data, sizeof hdr);
+    } else {
+        reader->file = fopen(path, "rb");
+        if (reader->file == NULL) {
+            LOGCAT_ERROR(UP, "[cap ] failed to open %s\n", path);
+            return -1;
+        }
+        if (fread(hdr, sizeof hdr, 1, reader->file) != 1) {
+            memset(hdr, 0, sizeof hdr);
+        }
+    }
+
+    reader->rec_size = get_le16(&hdr[CAPTURE_HDR_OFF_REC_SIZE]);
+    if ((memcmp(hdr, CAPTURE_MAGIC, 4) != 0) || (reader->rec_size < CAPTURE_REC_SIZE)) {
+        LOGCAT_ERROR(UP, "[cap ] %s is not a capture file\n", path);
+        capture_reader_close(reader);
+        return -1;
+    }
+    if (get_le16(&hdr[CAPTURE_HDR_OFF_VERSION]) > CAPTURE_VERSION) {
+        LOGCAT_WARN(UP, "[cap ] %s is a version %u capture, fields added after version %u are ignored\n", path, get_le16(&hdr[CAPTURE_HDR_OFF_VERSION]), CAPTURE_VERSION);
+    }
+    reader->gw_eui = (uint64_t)get_le32(&hdr[CAPTURE_HDR_OFF_GW_EUI]) | ((uint64_t)get_le32(&hdr[CAPTURE_HDR_OFF_GW_EUI + 4]) << 32);
+    reader->off = CAPTURE_HDR_SIZE;
+    return 0;
+}
+
+void capture_reader_close(struct capture_reader_s *reader) {
+#if defined(__linux__)
+    if (reader->data != NULL) {
+        munmap((void *)reader->data, reader->len);
+    }
+#endif
+    if (reader->file != NULL) {
+        fclose(reader->file);
+    }
+    reader->data = NULL;
+    reader->file = NULL;
+}
+
+int capture_reader_next(struct capture_reader_s *reader, struct lgw_pkt_rx_s *pkt, struct timeval *cap_time) {
+    const uint8_t *r;
+    uint16_t size;
+
+    if (reader->data != NULL) {
+        if (reader->len - reader->off < reader->rec_size) {
+            return 0;
+        }
+        r = &reader->data[reader->off];
+        size = get_le16(&r[CAPTURE_REC_OFF_SIZE]);
+        if ((size > sizeof pkt->payload) || (reader->len - reader->off - reader->rec_size < size)) {
+            return 0; /* record cut by a power loss, or not a record */
+        }
+        memcpy(pkt->payload, &r[reader->rec_size], size);
+    } else if (reader->file != NULL) {
+        r = reader->rec;
+        if (fread(reader->rec, CAPTURE_REC_SIZE, 1, reader->file) != 1) {
+            return 0;
+        }
+        size = get_le16(&r[CAPTURE_REC_OFF_SIZE]);
+        if ((size > sizeof pkt->payload) || ((reader->rec_size > CAPTURE_REC_SIZE) && (fseek(reader->file, reader->rec_size - CAPTURE_REC_SIZE, SEEK_CUR) != 0))) {
+            return 0;
+        }
+        if ((size > 0) && (fread(pkt->payload, size, 1, reader->file) != 1)) {
+            return 0; /* record cut by a power loss */
+        }
+    } else {
+        return 0;
+    }
+
+    cap_time->tv_sec = get_le32(&r[CAPTURE_REC_OFF_TIME_S]);
+    cap_time->tv_usec = get_le32(&r[CAPTURE_REC_OFF_TIME_US]);
+    pkt->count_us = get_le32(&r[CAPTURE_REC_OFF_COUNT_US]);
+    pkt->freq_hz = get_le32(&r[CAPTURE_REC_OFF_FREQ_HZ]);
+    pkt->datarate = get_le32(&r[CAPTURE_REC_OFF_DATARATE]);
+    pkt->rssi = get_f32(&r[CAPTURE_REC_OFF_RSSI]);
+    pkt->snr = get_f32(&r[CAPTURE_REC_OFF_SNR]);
+    pkt->snr_min = get_f32(&r[CAPTURE_REC_OFF_SNR_MIN]);
+    pkt->snr_max = get_f32(&r[CAPTURE_REC_OFF_SNR_MAX]);
+    pkt->crc = get_le16(&r[CAPTURE_REC_OFF_CRC]);
+    pkt->if_chain = r[CAPTURE_REC_OFF_IF_CHAIN];
+    pkt->rf_chain = r[CAPTURE_REC_OFF_RF_CHAIN];
+    pkt->status = r[CAPTURE_REC_OFF_STATUS];
+    pkt->modulation = r[CAPTURE_REC_OFF_MODULATION];
+    pkt->bandwidth = r[CAPTURE_REC_OFF_BANDWIDTH];
+    pkt->coderate = r[CAPTURE_REC_OFF_CODERATE];
+    pkt->size = size;
+
+    reader->off += reader->rec_size + size;
+    return 1;
+}
+
+void capture_reader_rewind(struct capture_reader_s *reader) {
+    reader->off = CAPTURE_HDR_SIZE;
+    if (reader->file != NULL) {
+        fseek(reader->file, CAPTURE_HDR_SIZE, SEEK_SET);
+    }
+}
+
+int capture_replay_open(struct capture_replay_s *replay, const char *path, double speed, bool loop) {
+    memset(replay, 0, sizeof *replay);
+    if (capture_reader_open(&replay->reader, path) != 0) {
+        return -1;
+    }
+    replay->speed = (speed < 0) ? 0 : speed;
+    replay->loop = loop;
+    replay->has_next = (capture_reader_next(&replay->reader, &replay->next, &replay->next_time) == 1);
+    if (!replay->has_next) {
+        LOGCAT_ERROR(UP, "[cap ] %s has no packet to replay\n", path);
+        capture_reader_close(&replay->reader);
+        return -1;
+    }
+    if (replay->speed > 0) {
+        LOGCAT_INFO(UP, "[cap ] replaying %s at %.2fx the captured pace%s\n", path, replay->speed, loop ? ", in a loop" : "");
+    } else {
+        LOGCAT_INFO(UP, "[cap ] replaying %s as fast as possible%s\n", path, loop ? ", in a loop" : "");
+    }
+    return 0;
+}
+
+void capture_replay_close(struct capture_replay_s *replay) {
+    capture_reader_close(&replay->reader);
+    LOGCAT_INFO(UP, "[cap ] replay closed, %u packets replayed, %u loops\n", replay->nb_replayed, replay->nb_loops);
+}
+
+int capture_replay_receive(struct capture_replay_s *replay, uint8_t max_pkt, struct lgw_pkt_rx_s *pkts) {
+    struct timespec now;
+    int64_t elapsed_us = 0;
+    int nb = 0;
+
+    if (replay->done) {
+        return 0;
+    }
+    if (replay->speed > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!replay->started) {
+            replay->start = now;
+            replay->first = replay->next_time;
+            replay->started = true;
+        }
+        elapsed_us = (int64_t)(ts_diff_us(&replay->start, &now) * replay->speed);
+    }
+
+    while ((nb < max_pkt) && replay->has_next) {
+        if ((replay->speed > 0) && (tv_diff_us(&replay->first, &replay->next_time) > elapsed_us)) {
+            break; /* not due yet */
+        }
+        pkts[nb++] = replay->next;
+        replay->has_next = (capture_reader_next(&replay->reader, &replay->next, &replay->next_time) == 1);
+        if (!replay->has_next && replay->loop) {
+            capture_reader_rewind(&replay->reader);
+            replay->has_next = (capture_reader_next(&replay->reader, &replay->next, &replay->next_time) == 1);
+            replay->started = false;
+            replay->nb_loops += 1;
+            break; /* the next loop starts on the next call */
+        }
+    }
+    replay->nb_replayed += nb;
+    if (!replay->has_next) {
+        LOGCAT_INFO(UP, "[cap ] end of the capture, %u packets replayed\n", replay->nb_replayed);
+        replay->done = true;
+    }
+    return nb;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Capture of the packets returned by lgw_receive, and replay of a capture in
+    place of the concentrator so field traffic can be fed to the forwarder
+    again, at its original pace, scaled or as fast as possible.
+
+    The file is a header followed by one record per packet, the complete
+    lgw_pkt_rx_s metadata and the payload, see capture_rec.h for the layout.
+
+    A record cut by a power loss ends the capture.
+
+    Not thread safe: a capture or a replay is owned by the upstream thread.
+*/
+
+#ifndef _LORA_PKTFWD_CAPTURE_H
+#define _LORA_PKTFWD_CAPTURE_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stddef.h>     /* size_t */
+#include <stdio.h>      /* FILE */
+#include <time.h>       /* timespec */
+#include <sys/time.h>   /* timeval */
+
+#include "loragw_hal.h"
+#include "capture_rec.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define CAPTURE_PATH_MAX        64
+#define CAPTURE_BATCH_SIZE      4096    /* bytes buffered in RAM before they are written */
+#define CAPTURE_FLUSH_MS        2000    /* max time a record stays in RAM only */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct capture_s {
+    FILE        *file;
+    uint32_t    size_max;       /* max size of the file, 0 = unlimited */
+    uint32_t    size;           /* bytes written to the file */
+    uint8_t     batch[CAPTURE_BATCH_SIZE];
+    uint16_t    batch_len;
+    struct timeval batch_time;  /* capture time of the oldest record in batch */
+    bool        full;           /* size_max reached, records are discarded */
+    /* statistics */
+    uint32_t    nb_rec;         /* records captured */
+    uint32_t    nb_dropped;     /* records discarded, file full or write error */
+};
+
+struct capture_reader_s {
+    const uint8_t *data;        /* whole file when it is mapped, NULL when it is read record by record */
+    size_t      len;
+    size_t      off;            /* offset of the next record */
+    FILE        *file;          /* file read record by record, without mmap */
+    uint8_t     rec[CAPTURE_REC_SIZE]; /* record header read from file */
+    uint16_t    rec_size;       /* record header size of the file */
+    uint64_t    gw_eui;
+};
+
+struct capture_replay_s {
+    struct capture_reader_s reader;
+    double      speed;          /* 1.0: original pace, 2.0: twice as fast, 0: as fast as possible */
+    bool        loop;           /* start again at the end of the capture */
+    bool        started;
+    bool        done;
+    struct timespec start;      /* monotonic time the first record was replayed */
+    struct timeval first;       /* capture time of the first record */
+    struct lgw_pkt_rx_s next;   /* record read ahead, not due yet */
+    struct timeval next_time;
+    bool        has_next;
+    /* statistics */
+    uint32_t    nb_replayed;
+    uint32_t    nb_loops;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Create a capture file, an existing one is overwritten.
+
+@param cap[out] Capture to be initialized
+@param path Path of the capture file
+@param size_max Max size of the file in bytes, 0 for no limit
+@param gw_eui Gateway EUI written in the file header
+@return 0 on success, -1 on failure
+*/
+int capture_open(struct capture_s *cap, const char *path, uint32_t size_max, uint64_t gw_eui);
+
+/**
+@brief Write buffered records and close the file.
+
+@param cap[in] Capture to be closed
+*/
+void capture_close(struct capture_s *cap);
+
+/**
+@brief Append received packets to the capture.
+
+@param cap[in] Capture
+@param nb_pkt Number of packets
+@param pkts[in] Packets as returned by lgw_receive
+@param cap_time[in] Time the packets were fetched
+@return number of packets captured
+
+Records are serialized in RAM and written once the batch is full, the call
+does not block on storage otherwise.
+*/
+int capture_write(struct capture_s *cap, int nb_pkt, const struct lgw_pkt_rx_s *pkts, const struct timeval *cap_time);
+
+/**
+@brief Write buffered records if the oldest one waited more than CAPTURE_FLUSH_MS.
+
+@param cap[in] Capture
+@param now[in] Current time
+@return 0 on success, -1 on storage error
+*/
+int capture_flush_if_due(struct capture_s *cap, const struct timeval *now);
+
+/**
+@brief Open a capture file for reading, it is mapped in memory when the platform allows it
+and read one record at a time otherwise, no memory is allocated.
+
+@param reader[out] Reader to be initialized
+@param path Path of the capture file
+@return 0 on success, -1 on failure or if the file is not a capture
+*/
+int capture_reader_open(struct capture_reader_s *reader, const char *path);
+
+/**
+@brief Release the file.
+
+@param reader[in] Reader
+*/
+void capture_reader_close(struct capture_reader_s *reader);
+
+/**
+@brief Read the next record.
+
+@param reader[in] Reader
+@param pkt[out] Packet
+@param cap_time[out] Capture time of the packet
+@return 1 if a record was read, 0 at the end of the capture
+*/
+int capture_reader_next(struct capture_reader_s *reader, struct lgw_pkt_rx_s *pkt, struct timeval *cap_time);
+
+/**
+@brief Go back to the first record.
+
+@param reader[in] Reader
+*/
+void capture_reader_rewind(struct capture_reader_s *reader);
+
+/**
+@brief Open a capture to be replayed.
+
+@param replay[out] Replay to be initialized
+@param path Path of the capture file
+@param speed Pace of the replay relative to the capture, 0 for as fast as possible
+@param loop Start again at the end of the capture
+@return 0 on success, -1 on failure
+*/
+int capture_replay_open(struct capture_replay_s *replay, const char *path, double speed, bool loop);
+
+/**
+@brief Release the capture file.
+
+@param replay[in] Replay
+*/
+void capture_replay_close(struct capture_replay_s *replay);
+
+/**
+@brief Simulated lgw_receive: return the captured packets that are due.
+
+@param replay[in] Replay
+@param max_pkt Max number of packets
+@param pkts[out] Array receiving the packets
+@return number of packets, 0 when none is due or the capture is over
+
+Packets are returned when the time elapsed since the first one, multiplied by
+the speed, reaches the interval between their capture times. The concentrator
+counter (count_us) is replayed as captured.
+*/
+int capture_replay_receive(struct capture_replay_s *replay, uint8_t max_pkt, struct lgw_pkt_rx_s *pkts);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Layout of the capture files (capture.h), without dependency on the HAL
+    so the host tools generating or reading captures share it with the
+    forwarder.
+
+    A capture file is a 16-byte header followed by records, all multi-byte
+    fields are little endian and floats are IEEE 754 single precision:
+
+        offset  size  field
+        0       4     magic "LGWC"
+        4       2     format version (CAPTURE_VERSION)
+        6       2     record header size (CAPTURE_REC_SIZE)
+        8       8     gateway EUI
+
+    Each record is the complete lgw_pkt_rx_s metadata followed by the payload:
+
+        offset  size  field
+        0       4     capture time, UTC seconds
+        4       4     capture time, microseconds
+        8       4     count_us
+        12      4     freq_hz
+        16      4     datarate
+        20      4     rssi
+        24      4     snr
+        28      4     snr_min
+        32      4     snr_max
+        36      2     crc
+        38      1     if_chain
+        39      1     rf_chain
+        40      1     status
+        41      1     modulation
+        42      1     bandwidth
+        43      1     coderate
+        44      2     size
+        46      size  payload
+
+    The enumerated fields hold the values of loragw_hal.h, the ones the host
+    tools need are repeated below and capture.c checks they match.
+
+    Readers use the record header size of the file, so fields appended by a
+    later version are skipped by older readers.
+*/
+
+#ifndef _LORA_PKTFWD_CAPTURE_REC_H
+#define _LORA_PKTFWD_CAPTURE_REC_H
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define CAPTURE_MAGIC               "LGWC"
+#define CAPTURE_VERSION             1
+#define CAPTURE_HDR_SIZE            16
+#define CAPTURE_REC_SIZE            46      /* record header, without the payload */
+
+/* file header */
+#define CAPTURE_HDR_OFF_VERSION     4
+#define CAPTURE_HDR_OFF_REC_SIZE    6
+#define CAPTURE_HDR_OFF_GW_EUI      8
+
+/* record header */
+#define CAPTURE_REC_OFF_TIME_S      0
+#define CAPTURE_REC_OFF_TIME_US     4
+#define CAPTURE_REC_OFF_COUNT_US    8
+#define CAPTURE_REC_OFF_FREQ_HZ     12
+#define CAPTURE_REC_OFF_DATARATE    16
+#define CAPTURE_REC_OFF_RSSI        20
+#define CAPTURE_REC_OFF_SNR         24
+#define CAPTURE_REC_OFF_SNR_MIN     28
+#define CAPTURE_REC_OFF_SNR_MAX     32
+#define CAPTURE_REC_OFF_CRC         36
+#define CAPTURE_REC_OFF_IF_CHAIN    38
+#define CAPTURE_REC_OFF_RF_CHAIN    39
+#define CAPTURE_REC_OFF_STATUS      40
+#define CAPTURE_REC_OFF_MODULATION  41
+#define CAPTURE_REC_OFF_BANDWIDTH   42
+#define CAPTURE_REC_OFF_CODERATE    43
+#define CAPTURE_REC_OFF_SIZE        44
+
+/* field values, as in loragw_hal.h */
+#define CAPTURE_STAT_CRC_OK         0x10
+#define CAPTURE_STAT_CRC_BAD        0x11
+#define CAPTURE_MOD_LORA            0x10
+#define CAPTURE_BW_125KHZ           0x03
+#define CAPTURE_DR_LORA_SF7         0x02    /* SFn is CAPTURE_DR_LORA_SF7 << (n - 7) */
+#define CAPTURE_CR_LORA_4_5         0x01    /* 4/5 to 4/8 are 1 to 4 */
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Channel occupancy and noise floor, see chanstat.h
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* snprintf */
+#include <string.h>     /* memset */
+#include <math.h>       /* log10f, powf */
+
+#include "chanstat.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static inline float ewma(float avg, float x) {
+    return avg + (x - avg) / (1 << CHANSTAT_EWMA_SHIFT);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void chanstat_init(struct chanstat_s *cs) {
+    memset(cs, 0, sizeof *cs);
+}
+
+void chanstat_set_freq(struct chanstat_s *cs, uint8_t if_chain, uint32_t freq_hz) {
+    if (if_chain < CHANSTAT_NB) {
+        cs->chan[if_chain].freq_hz = freq_hz;
+    }
+}
+
+void chanstat_add(struct chanstat_s *cs, const struct lgw_pkt_rx_s *pkt) {
+    struct chanstat_chan_s *c;
+    struct lgw_pkt_tx_s tx;
+    float noise;
+
+    if (pkt->if_chain >= CHANSTAT_NB) {
+        return;
+    }
+    c = &cs->chan[pkt->if_chain];
+    if (c->freq_hz == 0) {
+        c->freq_hz = pkt->freq_hz;
+    }
+    memset(&tx, 0, sizeof tx);
+    tx.modulation = pkt->modulation;
+    tx.bandwidth = pkt->bandwidth;
+    tx.datarate = pkt->datarate;
+    tx.coderate = pkt->coderate;
+    tx.size = pkt->size;
+    c->airtime_us += lgw_time_on_air(&tx);
+    c->nb_pkt += 1;
+    c->nb_bad += (pkt->status == STAT_CRC_BAD) ? 1 : 0;
+    if ((c->nb_pkt == 1) || (pkt->rssi > c->rssi_max)) {
+        c->rssi_max = pkt->rssi;
+    }
+    /* FSK packets have no SNR */
+    if (pkt->modulation == MOD_LORA) {
+        noise = pkt->rssi - 10.0f * log10f(1.0f + powf(10.0f, pkt->snr / 10.0f));
+        c->noise_sum += noise;
+        c->noise_nb += 1;
+    }
+}
+
+void chanstat_roll(struct chanstat_s *cs, uint64_t window_us) {
+    struct chanstat_chan_s *c;
+    float noise;
+    unsigned i;
+
+    for (i = 0; i < CHANSTAT_NB; ++i) {
+        c = &cs->chan[i];
+        c->util = (window_us > 0) ? (100.0f * c->airtime_us) / window_us : 0;
+        c->util = (c->util < 100.0f) ? c->util : 100.0f;
+        c->util_avg = c->started ? ewma(c->util_avg, c->util) : c->util;
+        c->started = true;
+        if (c->noise_nb > 0) {
+            noise = c->noise_sum / c->noise_nb;
+            c->noise_dbm = (c->noise_dbm != 0) ? ewma(c->noise_dbm, noise) : noise;
+        }
+        c->nb_pkt_last = c->nb_pkt;
+        c->nb_bad_last = c->nb_bad;
+        c->rssi_max_last = c->rssi_max;
+        c->airtime_us = 0;
+        c->nb_pkt = 0;
+        c->nb_bad = 0;
+        c->noise_sum = 0;
+        c->noise_nb = 0;
+        c->rssi_max = 0;
+    }
+}
+
+int chanstat_json(const struct chanstat_s *cs, char *buf, int size) {
+    const struct chanstat_chan_s *c;
+    int len = 0;
+    int n;
+    unsigned i;
+
+    if (size < 3) {
+        return 0;
+    }
+    buf[len++] = '[';
+    for (i = 0; i < CHANSTAT_NB; ++i) {
+        c = &cs->chan[i];
+        if (c->freq_hz == 0) {
+            continue;
+        }
+        n = snprintf(&buf[len], size - len, "%s[%.3f,%.2f,%.1f]", (len > 1) ? "," : "", c->freq_hz / 1e6, c->util_avg, c->noise_dbm);
+        if ((n < 0) || (n >= size - len - 1)) {
+            return 0;
+        }
+        len += n;
+    }
+    buf[len++] = ']';
+    buf[len] = '\0';
+    return len;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
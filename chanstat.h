@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Occupancy and noise floor of the channels of the concentrator, estimated
+    from the packets it receives: the SX1301 does not sample the RSSI of an
+    idle channel, so a channel is measured only while it carries packets.
+
+    Every packet returned by lgw_receive, good CRC or not, adds its time on
+    air to its IF chain, and its noise estimate: the RSSI covers the signal
+    and the noise, the SNR their ratio, so for LoRa
+
+        noise = RSSI - 10 * log10(1 + 10 ^ (SNR / 10))
+
+    A window ends at each statistics report: the channel utilization is its
+    airtime over the window, the noise floor the average of its estimates,
+    and both are smoothed over the windows (weight of a new window: 1 /
+    2^CHANSTAT_EWMA_SHIFT). A channel without packet keeps its noise floor.
+
+    Not thread safe.
+*/
+
+#ifndef _LORA_PKTFWD_CHANSTAT_H
+#define _LORA_PKTFWD_CHANSTAT_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define CHANSTAT_NB             LGW_IF_CHAIN_NB /* 8 multi-SF, LoRa standard, FSK */
+#define CHANSTAT_EWMA_SHIFT     2
+#define CHANSTAT_JSON_SIZE      256     /* chanstat_json of all the IF chains */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct chanstat_chan_s
+@brief Occupancy of one IF chain
+*/
+struct chanstat_chan_s {
+    uint32_t        freq_hz;    /*!> center frequency, from the configuration or from the packets, 0 if unknown */
+    /* window in progress */
+    uint64_t        airtime_us;
+    uint32_t        nb_pkt;
+    uint32_t        nb_bad;     /*!> CRC errors */
+    float           noise_sum;  /*!> noise estimates, dBm */
+    uint32_t        noise_nb;
+    float           rssi_max;
+    /* last window */
+    float           util;       /*!> % of the window */
+    uint32_t        nb_pkt_last;
+    uint32_t        nb_bad_last;
+    float           rssi_max_last;
+    /* over the windows */
+    float           util_avg;   /*!> % */
+    float           noise_dbm;  /*!> noise floor estimated from the received packets, 0 until a LoRa packet is received */
+    bool            started;    /*!> util_avg holds a window */
+};
+
+struct chanstat_s {
+    struct chanstat_chan_s chan[CHANSTAT_NB];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize the statistics, without channel.
+
+@param cs[out] Statistics
+*/
+void chanstat_init(struct chanstat_s *cs);
+
+/**
+@brief Set the center frequency of an IF chain, from the configuration.
+
+@param cs[in] Statistics
+@param if_chain IF chain, 0 to CHANSTAT_NB - 1
+@param freq_hz Center frequency
+*/
+void chanstat_set_freq(struct chanstat_s *cs, uint8_t if_chain, uint32_t freq_hz);
+
+/**
+@brief Account a received packet.
+
+@param cs[in] Statistics
+@param pkt[in] Packet returned by lgw_receive
+*/
+void chanstat_add(struct chanstat_s *cs, const struct lgw_pkt_rx_s *pkt);
+
+/**
+@brief End the window in progress.
+
+@param cs[in] Statistics
+@param window_us Duration of the window
+*/
+void chanstat_roll(struct chanstat_s *cs, uint64_t window_us);
+
+/**
+@brief Write the channels as a JSON array of [MHz, utilization %, noise floor dBm],
+smoothed over the windows, the noise floor being estimated from the received packets.
+
+@param cs[in] Statistics
+@param buf[out] Buffer
+@param size Size of the buffer
+@return length written, or 0 if the buffer is too small
+*/
+int chanstat_json(const struct chanstat_s *cs, char *buf, int size);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
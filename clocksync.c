@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Concentrator counter to UTC mapping, see clocksync.h
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset */
+#include <math.h>       /* sqrt, llround */
+
+#include "clocksync.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static inline int64_t tv_to_us(const struct timeval *tv) {
+    return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static inline int64_t model_to_utc(const struct clocksync_model_s *m, uint32_t cnt) {
+    int64_t d = (int32_t)(cnt - m->cnt_ref);
+
+    return m->utc_ref_us + d + (d * m->drift_ppb) / 1000000000;
+}
+
+/* make the model being built visible to the readers */
+static void publish(struct clocksync_s *cs) {
+    uint32_t seq = cs->seq + 1;
+
+    __atomic_store_n(&cs->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    cs->model = cs->work;
+    __atomic_store_n(&cs->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* least squares fit of UTC against the counter, relative to the newest sample */
+static void fit(struct clocksync_s *cs) {
+    struct clocksync_model_s *m = &cs->work;
+    unsigned newest = (cs->head + CLOCKSYNC_WIN - 1) % CLOCKSYNC_WIN;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, sr = 0;
+    double dx, dy, r, den;
+    double slope = 1.0, icpt = 0.0;
+    double n = cs->nb;
+    unsigned i, k;
+
+    for (i = 0; i < cs->nb; ++i) {
+        k = (cs->head + CLOCKSYNC_WIN - 1 - i) % CLOCKSYNC_WIN;
+        dx = (double)(int64_t)(cs->cnt[k] - cs->cnt[newest]);
+        dy = (double)(cs->utc[k] - cs->utc[newest]);
+        sx += dx;
+        sy += dy;
+        sxx += dx * dx;
+        sxy += dx * dy;
+    }
+    den = n * sxx - sx * sx;
+    if ((cs->nb > 1) && (den > 0)) {
+        slope = (n * sxy - sx * sy) / den;
+        icpt = (sy - slope * sx) / n;
+    } else {
+        icpt = sy / n;
+    }
+    if (fabs(slope - 1.0) * 1e9 > CLOCKSYNC_DRIFT_MAX_PPB) {
+        /* not a crystal drift, keep the newest sample only */
+        cs->nb = 1;
+        slope = 1.0;
+        icpt = 0.0;
+    }
+    for (i = 0; i < cs->nb; ++i) {
+        k = (cs->head + CLOCKSYNC_WIN - 1 - i) % CLOCKSYNC_WIN;
+        dx = (double)(int64_t)(cs->cnt[k] - cs->cnt[newest]);
+        r = (double)(cs->utc[k] - cs->utc[newest]) - (icpt + slope * dx);
+        sr += r * r;
+    }
+
+    m->valid = true;
+    m->cnt_ref = (uint32_t)cs->cnt[newest];
+    m->utc_ref_us = cs->utc[newest] + llround(icpt);
+    m->drift_ppb = (int32_t)llround((slope - 1.0) * 1e9);
+    m->resid_us = (uint32_t)llround(sqrt(sr / cs->nb));
+    m->nb_used = (uint16_t)cs->nb;
+    if (cs->nb > 1) {
+        if (!cs->drift_set || (m->drift_ppb < m->drift_min_ppb)) {
+            m->drift_min_ppb = m->drift_ppb;
+        }
+        if (!cs->drift_set || (m->drift_ppb > m->drift_max_ppb)) {
+            m->drift_max_ppb = m->drift_ppb;
+        }
+        cs->drift_set = true;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void clocksync_init(struct clocksync_s *cs) {
+    memset(cs, 0, sizeof *cs);
+}
+
+int clocksync_sample(struct clocksync_s *cs, uint32_t cnt, const struct timeval *before, const struct timeval *after) {
+    struct clocksync_model_s *m = &cs->work;
+    int64_t read_us = tv_to_us(after) - tv_to_us(before);
+    int64_t utc = tv_to_us(before) + read_us / 2;
+    int64_t err;
+
+    m->nb_sample += 1;
+    if ((read_us < 0) || (read_us > CLOCKSYNC_READ_MAX_US)) {
+        m->nb_rejected += 1;
+        publish(cs);
+        return -1;
+    }
+
+    /* a sample far from the fit is an outlier, unless the next ones agree with it */
+    if (m->valid) {
+        err = utc - model_to_utc(m, cnt);
+        if ((err > CLOCKSYNC_RESID_MAX_US) || (err < -CLOCKSYNC_RESID_MAX_US)) {
+            cs->nb_jump += 1;
+            if (cs->nb_jump < CLOCKSYNC_JUMP_NB) {
+                m->nb_rejected += 1;
+                publish(cs);
+                return -1;
+            }
+            m->nb_restart += 1;
+            cs->nb = 0;
+            cs->cnt_wrap = 0;
+        }
+    }
+    cs->nb_jump = 0;
+
+    if ((cs->nb > 0) && (cnt < cs->cnt_last)) {
+        cs->cnt_wrap += 1ULL << 32;
+    }
+    cs->cnt_last = cnt;
+    cs->cnt[cs->head] = cs->cnt_wrap + cnt;
+    cs->utc[cs->head] = utc;
+    cs->head = (cs->head + 1) % CLOCKSYNC_WIN;
+    if (cs->nb < CLOCKSYNC_WIN) {
+        cs->nb += 1;
+    }
+    fit(cs);
+    publish(cs);
+    return 0;
+}
+
+void clocksync_get(const struct clocksync_s *cs, struct clocksync_model_s *model) {
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&cs->seq, __ATOMIC_ACQUIRE);
+        *model = cs->model;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (seq != __atomic_load_n(&cs->seq, __ATOMIC_RELAXED)));
+}
+
+int clocksync_to_utc(const struct clocksync_s *cs, uint32_t cnt, struct timeval *utc) {
+    struct clocksync_model_s m;
+    int64_t us;
+
+    clocksync_get(cs, &m);
+    if (!m.valid) {
+        return -1;
+    }
+    us = model_to_utc(&m, cnt);
+    utc->tv_sec = (time_t)(us / 1000000);
+    utc->tv_usec = (suseconds_t)(us % 1000000);
+    return 0;
+}
+
+int clocksync_to_cnt(const struct clocksync_s *cs, const struct timeval *utc, uint32_t *cnt) {
+    struct clocksync_model_s m;
+    int64_t d;
+
+    clocksync_get(cs, &m);
+    if (!m.valid) {
+        return -1;
+    }
+    d = tv_to_us(utc) - m.utc_ref_us;
+    if ((d > INT32_MAX) || (d < INT32_MIN)) {
+        return -1;
+    }
+    *cnt = m.cnt_ref + (uint32_t)(d - (d * m.drift_ppb) / 1000000000);
+    return 0;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
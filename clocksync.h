@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Mapping between the concentrator counter (count_us, 1 MHz, 32 bits) and
+    UTC, estimated from periodic samples of both clocks.
+
+    The offset and the drift of the concentrator crystal are a least squares
+    fit over the last CLOCKSYNC_WIN samples. Samples whose counter read took
+    too long are rejected, so are samples far from the fit. A persistent jump
+    (system clock set by SNTP, concentrator restarted) restarts the fit.
+
+    One thread feeds the samples, any thread converts: the model is published
+    with a sequence counter, readers never block and never take a lock.
+*/
+
+#ifndef _LORA_PKTFWD_CLOCKSYNC_H
+#define _LORA_PKTFWD_CLOCKSYNC_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <sys/time.h>   /* timeval */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define CLOCKSYNC_WIN           32      /* samples in the regression */
+#define CLOCKSYNC_READ_MAX_US   2000    /* samples taking longer to read are rejected */
+#define CLOCKSYNC_RESID_MAX_US  1000    /* samples further from the fit are rejected */
+#define CLOCKSYNC_JUMP_NB       3       /* consecutive rejected samples restarting the fit */
+#define CLOCKSYNC_DRIFT_MAX_PPB 200000  /* beyond any crystal tolerance */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct clocksync_model_s
+@brief Published mapping, UTC = utc_ref + (count_us - cnt_ref) * (1 + drift_ppb / 1e9)
+*/
+struct clocksync_model_s {
+    bool            valid;      /*!> at least one sample was accepted */
+    uint32_t        cnt_ref;    /*!> concentrator counter of the reference point */
+    int64_t         utc_ref_us; /*!> UTC of the reference point (us) */
+    int32_t         drift_ppb;  /*!> concentrator clock slower than UTC when positive */
+    uint32_t        resid_us;   /*!> RMS distance of the samples to the fit */
+    uint16_t        nb_used;    /*!> samples in the fit */
+    /* statistics, since clocksync_init */
+    int32_t         drift_min_ppb;
+    int32_t         drift_max_ppb;
+    uint32_t        nb_sample;  /*!> samples received */
+    uint32_t        nb_rejected;/*!> samples rejected */
+    uint32_t        nb_restart; /*!> fits restarted after a jump of one of the clocks */
+};
+
+struct clocksync_s {
+    volatile uint32_t seq;      /* odd while the model is being written */
+    struct clocksync_model_s model;
+    /* writer side */
+    uint64_t        cnt[CLOCKSYNC_WIN]; /* concentrator counter, without wrap-around */
+    int64_t         utc[CLOCKSYNC_WIN]; /* UTC (us) */
+    unsigned        head;       /* next sample slot */
+    unsigned        nb;         /* samples in the window */
+    uint32_t        cnt_last;   /* counter of the last sample, to detect wrap-arounds */
+    uint64_t        cnt_wrap;   /* wrap-arounds * 2^32 */
+    unsigned        nb_jump;    /* consecutive samples far from the fit */
+    bool            drift_set;  /* drift_min_ppb and drift_max_ppb hold a value */
+    struct clocksync_model_s work; /* model being built */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize the estimator, the mapping is not valid until the first sample.
+
+@param cs[out] Estimator
+*/
+void clocksync_init(struct clocksync_s *cs);
+
+/**
+@brief Add a sample of both clocks, the counter being read between before and after.
+
+@param cs[in] Estimator
+@param cnt Concentrator counter
+@param before[in] UTC before the counter was read
+@param after[in] UTC after the counter was read
+@return 0 if the sample was used, -1 if it was rejected
+
+Single writer: only one thread may add samples.
+*/
+int clocksync_sample(struct clocksync_s *cs, uint32_t cnt, const struct timeval *before, const struct timeval *after);
+
+/**
+@brief Copy the current mapping, lock-free.
+
+@param cs[in] Estimator
+@param model[out] Mapping
+*/
+void clocksync_get(const struct clocksync_s *cs, struct clocksync_model_s *model);
+
+/**
+@brief Convert a concentrator counter value to UTC, lock-free.
+
+@param cs[in] Estimator
+@param cnt Concentrator counter, within 35 minutes of the last sample
+@param utc[out] UTC
+@return 0 on success, -1 if there is no mapping yet
+*/
+int clocksync_to_utc(const struct clocksync_s *cs, uint32_t cnt, struct timeval *utc);
+
+/**
+@brief Convert UTC to a concentrator counter value, lock-free.
+
+@param cs[in] Estimator
+@param utc[in] UTC, within 35 minutes of the last sample
+@param cnt[out] Concentrator counter
+@return 0 on success, -1 if there is no mapping yet or utc is too far
+*/
+int clocksync_to_cnt(const struct clocksync_s *cs, const struct timeval *utc, uint32_t *cnt);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Per-device link quality table, see devtable.h
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset */
+
+#include "devtable.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint32_t slot_nb(uint32_t nb_max) {
+    uint32_t n = 4;
+
+    /* keep the load factor under 3/4 */
+    while (n - n / 4 < nb_max) {
+        n <<= 1;
+    }
+    return n;
+}
+
+static inline uint32_t home(const struct devtable_s *table, uint32_t dev_addr) {
+    uint32_t h = dev_addr;
+
+    /* DevAddrs are allocated sequentially by the network servers, mix all their bits */
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    return h & table->mask;
+}
+
+static inline int16_t fixed16(float v) {
+    return (int16_t)((v < 0) ? (v * 16 - 0.5f) : (v * 16 + 0.5f));
+}
+
+static void lru_unlink(struct devtable_s *table, uint32_t i) {
+    struct devtable_entry_s *e = &table->slot[i];
+
+    if (e->prev != DEVTABLE_NIL) {
+        table->slot[e->prev].next = e->next;
+    } else {
+        table->head = e->next;
+    }
+    if (e->next != DEVTABLE_NIL) {
+        table->slot[e->next].prev = e->prev;
+    } else {
+        table->tail = e->prev;
+    }
+}
+
+static void lru_push_head(struct devtable_s *table, uint32_t i) {
+    struct devtable_entry_s *e = &table->slot[i];
+
+    e->prev = DEVTABLE_NIL;
+    e->next = table->head;
+    if (table->head != DEVTABLE_NIL) {
+        table->slot[table->head].prev = i;
+    } else {
+        table->tail = i;
+    }
+    table->head = i;
+}
+
+/* remove the entry of slot i, the following entries of its cluster are shifted back */
+static void remove_slot(struct devtable_s *table, uint32_t i) {
+    struct devtable_entry_s *s = table->slot;
+    uint32_t j = i;
+    uint32_t k;
+
+    lru_unlink(table, i);
+    s[i].used = false;
+    table->nb -= 1;
+    for (;;) {
+        j = (j + 1) & table->mask;
+        if (!s[j].used) {
+            break;
+        }
+        k = home(table, s[j].dev_addr);
+        /* the entry stays if its home slot is cyclically in (i, j] */
+        if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) {
+            continue;
+        }
+        s[i] = s[j];
+        if (s[i].prev != DEVTABLE_NIL) {
+            s[s[i].prev].next = i;
+        } else {
+            table->head = i;
+        }
+        if (s[i].next != DEVTABLE_NIL) {
+            s[s[i].next].prev = i;
+        } else {
+            table->tail = i;
+        }
+        s[j].used = false;
+        i = j;
+    }
+}
+
+static uint32_t lookup(const struct devtable_s *table, uint32_t dev_addr) {
+    uint32_t i = home(table, dev_addr);
+
+    while (table->slot[i].used) {
+        if (table->slot[i].dev_addr == dev_addr) {
+            return i;
+        }
+        i = (i + 1) & table->mask;
+    }
+    return DEVTABLE_NIL;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+size_t devtable_size(uint32_t nb_max) {
+    return slot_nb(nb_max) * sizeof(struct devtable_entry_s);
+}
+
+void devtable_init(struct devtable_s *table, void *buf, uint32_t nb_max) {
+    uint32_t n = slot_nb(nb_max);
+
+    table->slot = buf;
+    table->mask = n - 1;
+    table->nb = 0;
+    table->nb_max = nb_max;
+    table->head = DEVTABLE_NIL;
+    table->tail = DEVTABLE_NIL;
+    table->nb_evicted = 0;
+    memset(buf, 0, n * sizeof(struct devtable_entry_s));
+}
+
+const struct devtable_entry_s * devtable_update(struct devtable_s *table, uint32_t dev_addr, uint16_t fcnt, float rssi, float snr, uint8_t sf, uint8_t size, uint32_t now) {
+    struct devtable_entry_s *e;
+    uint16_t gap;
+    uint32_t i = lookup(table, dev_addr);
+
+    if (i != DEVTABLE_NIL) {
+        e = &table->slot[i];
+        gap = (uint16_t)(fcnt - e->fcnt);
+        if (gap == 0) {
+            e->nb_dup += (e->nb_dup < UINT16_MAX) ? 1 : 0;
+        } else if (gap <= DEVTABLE_FCNT_GAP_MAX) {
+            e->nb_lost += gap - 1;
+        } else {
+            e->nb_reset += (e->nb_reset < UINT16_MAX) ? 1 : 0;
+        }
+        e->rssi_avg += (fixed16(rssi) - e->rssi_avg) / (1 << DEVTABLE_EWMA_SHIFT);
+        e->snr_avg += (fixed16(snr) - e->snr_avg) / (1 << DEVTABLE_EWMA_SHIFT);
+        lru_unlink(table, i);
+    } else {
+        if (table->nb >= table->nb_max) {
+            remove_slot(table, table->tail);
+            table->nb_evicted += 1;
+        }
+        i = home(table, dev_addr);
+        while (table->slot[i].used) {
+            i = (i + 1) & table->mask;
+        }
+        e = &table->slot[i];
+        memset(e, 0, sizeof *e);
+        e->used = true;
+        e->dev_addr = dev_addr;
+        e->rssi_avg = fixed16(rssi);
+        e->snr_avg = fixed16(snr);
+        table->nb += 1;
+    }
+    e->fcnt = fcnt;
+    e->last_seen = now;
+    e->sf_last = sf;
+    e->size_last = size;
+    e->nb_pkt += 1;
+    if ((sf >= DEVTABLE_SF_MIN) && (sf < DEVTABLE_SF_MIN + DEVTABLE_SF_NB) && (e->sf_nb[sf - DEVTABLE_SF_MIN] < UINT16_MAX)) {
+        e->sf_nb[sf - DEVTABLE_SF_MIN] += 1;
+    }
+    lru_push_head(table, i);
+    return e;
+}
+
+const struct devtable_entry_s * devtable_find(const struct devtable_s *table, uint32_t dev_addr) {
+    uint32_t i = lookup(table, dev_addr);
+
+    return (i != DEVTABLE_NIL) ? &table->slot[i] : NULL;
+}
+
+const struct devtable_entry_s * devtable_next(const struct devtable_s *table, const struct devtable_entry_s *dev) {
+    uint32_t i = (dev == NULL) ? table->head : dev->next;
+
+    return (i != DEVTABLE_NIL) ? &table->slot[i] : NULL;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Link quality of the devices heard by the gateway, indexed by DevAddr.
+
+    Open addressing with linear probing over a power of two number of slots,
+    kept at most 3/4 full. The slots are also linked from the most to the
+    least recently heard device: when the table is full, the least recently
+    heard device is evicted. Lookups, updates and evictions are O(1) on
+    average, the memory is provided by the caller and never grows.
+
+    Not thread safe.
+*/
+
+#ifndef _LORA_PKTFWD_DEVTABLE_H
+#define _LORA_PKTFWD_DEVTABLE_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stddef.h>     /* size_t */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define DEVTABLE_NIL            0xFFFFFFFF  /* end of the recency list */
+#define DEVTABLE_SF_MIN         7
+#define DEVTABLE_SF_NB          6           /* SF7 to SF12 */
+#define DEVTABLE_EWMA_SHIFT     3           /* weight of a new sample: 1/8 */
+#define DEVTABLE_FCNT_GAP_MAX   16384       /* larger FCnt steps are counter resets, not losses */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct devtable_entry_s
+@brief Link quality of one device
+*/
+struct devtable_entry_s {
+    uint32_t        dev_addr;
+    uint32_t        last_seen;  /*!> UTC (s) of the last uplink */
+    uint32_t        nb_pkt;     /*!> uplinks received */
+    uint32_t        nb_lost;    /*!> uplinks missed, from the FCnt gaps */
+    uint32_t        prev;       /*!> slot of the device heard just after this one */
+    uint32_t        next;       /*!> slot of the device heard just before this one */
+    uint16_t        fcnt;       /*!> FCnt of the last uplink */
+    uint16_t        nb_dup;     /*!> uplinks received again with the same FCnt */
+    uint16_t        nb_reset;   /*!> FCnt going back, the device joined again */
+    int16_t         rssi_avg;   /*!> EWMA of the RSSI, 1/16 dB */
+    int16_t         snr_avg;    /*!> EWMA of the SNR, 1/16 dB */
+    uint16_t        sf_nb[DEVTABLE_SF_NB]; /*!> uplinks per spreading factor, saturating */
+    uint8_t         sf_last;    /*!> spreading factor of the last uplink, 0 if not LoRa */
+    uint8_t         size_last;  /*!> PHYPayload size of the last uplink */
+    bool            used;
+};
+
+struct devtable_s {
+    struct devtable_entry_s *slot;
+    uint32_t        mask;       /* number of slots - 1 */
+    uint32_t        nb;         /* devices in the table */
+    uint32_t        nb_max;     /* devices kept before the least recently heard one is evicted */
+    uint32_t        head;       /* most recently heard device */
+    uint32_t        tail;       /* least recently heard device */
+    uint32_t        nb_evicted;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Memory needed to track a number of devices.
+
+@param nb_max Max number of devices
+@return size in bytes of the buffer given to devtable_init
+*/
+size_t devtable_size(uint32_t nb_max);
+
+/**
+@brief Initialize an empty table.
+
+@param table[out] Table
+@param buf[in] Buffer of devtable_size(nb_max) bytes, aligned for a devtable_entry_s
+@param nb_max Max number of devices
+*/
+void devtable_init(struct devtable_s *table, void *buf, uint32_t nb_max);
+
+/**
+@brief Account one uplink, the device is added if it is not known yet.
+
+@param table[in] Table
+@param dev_addr DevAddr of the uplink
+@param fcnt FCnt of the uplink, 16 LSB
+@param rssi RSSI (dBm)
+@param snr SNR (dB)
+@param sf Spreading factor, 0 if not LoRa
+@param size PHYPayload size
+@param now UTC (s)
+@return the device entry
+*/
+const struct devtable_entry_s * devtable_update(struct devtable_s *table, uint32_t dev_addr, uint16_t fcnt, float rssi, float snr, uint8_t sf, uint8_t size, uint32_t now);
+
+/**
+@brief Look a device up.
+
+@param table[in] Table
+@param dev_addr DevAddr
+@return the device entry, NULL if the device is not tracked
+*/
+const struct devtable_entry_s * devtable_find(const struct devtable_s *table, uint32_t dev_addr);
+
+/**
+@brief Iterate over the devices, from the most to the least recently heard.
+
+@param table[in] Table
+@param dev[in] Current device, NULL to start with the most recently heard one
+@return the next device, NULL at the end
+*/
+const struct devtable_entry_s * devtable_next(const struct devtable_s *table, const struct devtable_entry_s *dev);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Log messages by subsystem, see logcat.h
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stddef.h>     /* size_t, ptrdiff_t */
+#include <stdarg.h>     /* va_list */
+#include <stdio.h>      /* snprintf, vsnprintf, fputs */
+#include <string.h>     /* strchr, strcmp, memcpy */
+#include <pthread.h>
+
+#include "logcat.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+enum logcat_arg_e {
+    ARG_INT = 0,                                /* int, and the promoted char and short */
+    ARG_UINT,
+    ARG_LONG,
+    ARG_ULONG,
+    ARG_LLONG,
+    ARG_ULLONG,
+    ARG_SIZE,                                   /* z */
+    ARG_INTMAX,                                 /* j */
+    ARG_PTRDIFF,                                /* t */
+    ARG_DOUBLE,
+    ARG_STR,                                    /* copied, offset in the string bytes of the message */
+    ARG_PTR,
+    ARG_NONE,                                   /* %% */
+    ARG_BAD                                     /* %n, long double, wide characters */
+};
+
+union logcat_val_u {
+    long long           i;
+    unsigned long long  u;
+    double              d;
+    const void          *p;
+};
+
+struct logcat_msg_s {
+    const char          *fmt;
+    uint8_t             nb_arg;
+    uint8_t             str_len;
+    union logcat_val_u  arg[LOGCAT_ARG_MAX];
+    char                str[LOGCAT_STR_SIZE];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static const char *cat_name[LOGCAT_NB] = {"main", "up", "down", "jit", "repeater", "config"};
+
+static pthread_mutex_t mx_ring = PTHREAD_MUTEX_INITIALIZER; /* control access to the ring and the counters */
+static pthread_mutex_t mx_drain = PTHREAD_MUTEX_INITIALIZER; /* one thread formats the messages at a time */
+static struct logcat_msg_s ring[LOGCAT_RING_NB];
+static int ring_first = 0;
+static int ring_nb = 0;
+static struct logcat_stat_s counters;
+static uint32_t nb_dropped_told = 0; /* drops already reported by logcat_drain */
+static volatile bool deferred = false;
+static void (*write_line)(const char *line) = NULL;
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC VARIABLES ----------------------------------------------------- */
+
+int logcat_level[LOGCAT_NB] = {LORAPF_INFO_, LORAPF_INFO_, LORAPF_INFO_, LORAPF_INFO_, LORAPF_INFO_, LORAPF_INFO_};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static inline bool is_digit(char c) {
+    return (c >= '0') && (c <= '9');
+}
+
+/* parse the conversion starting at the '%' pointed by f, return the character following it */
+static const char *spec_parse(const char *f, enum logcat_arg_e *type, int *nb_star) {
+    char len = 0;
+    bool twice = false;
+
+    *nb_star = 0;
+    f += 1;
+    if (*f == '%') {
+        *type = ARG_NONE;
+        return f + 1;
+    }
+    while ((*f != '\0') && (strchr("-+ #0", *f) != NULL)) {
+        f += 1;
+    }
+    if (*f == '*') {
+        *nb_star += 1;
+        f += 1;
+    }
+    while (is_digit(*f)) {
+        f += 1;
+    }
+    if (*f == '.') {
+        f += 1;
+        if (*f == '*') {
+            *nb_star += 1;
+            f += 1;
+        }
+        while (is_digit(*f)) {
+            f += 1;
+        }
+    }
+    if ((*f != '\0') && (strchr("hlzjtL", *f) != NULL)) {
+        len = *f++;
+        if (((len == 'h') || (len == 'l')) && (*f == len)) {
+            twice = true;
+            f += 1;
+        }
+    }
+    switch (*f) {
+        case 'd':
+        case 'i':
+            *type = (len == 'l') ? (twice ? ARG_LLONG : ARG_LONG) : ((len == 'z') ? ARG_SIZE : ((len == 'j') ? ARG_INTMAX : ((len == 't') ? ARG_PTRDIFF : ARG_INT)));
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            *type = (len == 'l') ? (twice ? ARG_ULLONG : ARG_ULONG) : ((len == 'z') ? ARG_SIZE : ((len == 'j') ? ARG_INTMAX : ((len == 't') ? ARG_PTRDIFF : ARG_UINT)));
+            break;
+        case 'c':
+            *type = (len == 0) ? ARG_INT : ARG_BAD;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            *type = (len != 'L') ? ARG_DOUBLE : ARG_BAD;
+            break;
+        case 's':
+            *type = (len == 0) ? ARG_STR : ARG_BAD;
+            break;
+        case 'p':
+            *type = ARG_PTR;
+            break;
+        default:
+            *type = ARG_BAD;
+            return f;
+    }
+    return f + 1;
+}
+
+/* copy a string argument, truncated to the room left in the message */
+static uint8_t msg_str(struct logcat_msg_s *m, const char *s) {
+    size_t off = m->str_len;
+    size_t n = 0;
+
+    if (off >= LOGCAT_STR_SIZE) {
+        /* full, the last byte is the null of the last string */
+        return LOGCAT_STR_SIZE - 1;
+    }
+    if (s == NULL) {
+        s = "(null)";
+    }
+    while ((n < LOGCAT_STR_SIZE - 1 - off) && (s[n] != '\0')) {
+        n += 1;
+    }
+    memcpy(&m->str[off], s, n);
+    m->str[off + n] = '\0';
+    m->str_len = (uint8_t)(off + n + 1);
+    return (uint8_t)off;
+}
+
+/* copy the arguments, up to the first one that cannot be */
+static void msg_fill(struct logcat_msg_s *m, const char *fmt, va_list ap) {
+    enum logcat_arg_e type;
+    union logcat_val_u *v;
+    const char *f;
+    int nb_star;
+
+    m->fmt = fmt;
+    m->nb_arg = 0;
+    m->str_len = 0;
+    for (f = strchr(fmt, '%'); f != NULL; f = strchr(f, '%')) {
+        f = spec_parse(f, &type, &nb_star);
+        if (type == ARG_NONE) {
+            continue;
+        }
+        if ((type == ARG_BAD) || (m->nb_arg + nb_star + 1 > LOGCAT_ARG_MAX)) {
+            return;
+        }
+        for (; nb_star > 0; --nb_star) {
+            m->arg[m->nb_arg++].i = va_arg(ap, int);
+        }
+        v = &m->arg[m->nb_arg++];
+        switch (type) {
+            case ARG_INT:       v->i = va_arg(ap, int); break;
+            case ARG_UINT:      v->u = va_arg(ap, unsigned int); break;
+            case ARG_LONG:      v->i = va_arg(ap, long); break;
+            case ARG_ULONG:     v->u = va_arg(ap, unsigned long); break;
+            case ARG_LLONG:     v->i = va_arg(ap, long long); break;
+            case ARG_ULLONG:    v->u = va_arg(ap, unsigned long long); break;
+            case ARG_SIZE:      v->u = va_arg(ap, size_t); break;
+            case ARG_INTMAX:    v->i = va_arg(ap, intmax_t); break;
+            case ARG_PTRDIFF:   v->i = va_arg(ap, ptrdiff_t); break;
+            case ARG_DOUBLE:    v->d = va_arg(ap, double); break;
+            case ARG_STR:       v->u = msg_str(m, va_arg(ap, const char *)); break;
+            default:            v->p = va_arg(ap, const void *); break;
+        }
+    }
+}
+
+/* format one argument with its conversion, return the number of characters written as snprintf does */
+static int arg_print(char *buf, size_t size, const char *spec, enum logcat_arg_e type, const union logcat_val_u *v, const char *str) {
+    switch (type) {
+        case ARG_INT:       return snprintf(buf, size, spec, (int)v->i);
+        case ARG_UINT:      return snprintf(buf, size, spec, (unsigned int)v->u);
+        case ARG_LONG:      return snprintf(buf, size, spec, (long)v->i);
+        case ARG_ULONG:     return snprintf(buf, size, spec, (unsigned long)v->u);
+        case ARG_LLONG:     return snprintf(buf, size, spec, v->i);
+        case ARG_ULLONG:    return snprintf(buf, size, spec, v->u);
+        case ARG_SIZE:      return snprintf(buf, size, spec, (size_t)v->u);
+        case ARG_INTMAX:    return snprintf(buf, size, spec, (intmax_t)v->i);
+        case ARG_PTRDIFF:   return snprintf(buf, size, spec, (ptrdiff_t)v->i);
+        case ARG_DOUBLE:    return snprintf(buf, size, spec, v->d);
+        case ARG_STR:       return snprintf(buf, size, spec, &str[v->u]);
+        default:            return snprintf(buf, size, spec, v->p);
+    }
+}
+
+/* format a message from its copied arguments, the format is written as is from the first one missing */
+static void msg_format(const struct logcat_msg_s *m, char *buf, int size) {
+    enum logcat_arg_e type;
+    const char *f = m->fmt;
+    const char *end;
+    const char *s;
+    char spec[32];
+    int len = 0;
+    int a = 0;
+    int nb_star, k, n;
+
+    while ((*f != '\0') && (len < size - 1)) {
+        if (*f != '%') {
+            buf[len++] = *f++;
+            continue;
+        }
+        end = spec_parse(f, &type, &nb_star);
+        if (type == ARG_NONE) {
+            buf[len++] = '%';
+            f = end;
+            continue;
+        }
+        if ((type == ARG_BAD) || (a + nb_star + 1 > m->nb_arg) || (end - f > (int)sizeof spec - 24)) {
+            buf[len++] = *f++;
+            continue;
+        }
+        /* width and precision given as arguments are written in the conversion */
+        k = 0;
+        for (s = f; s < end; ++s) {
+            if (*s != '*') {
+                spec[k++] = *s;
+            } else if ((s[-1] != '.') || (m->arg[a].i >= 0)) {
+                k += snprintf(&spec[k], sizeof spec - k, "%d", (int)m->arg[a++].i);
+            } else {
+                /* negative precision, as if it was not given */
+                k -= 1;
+                a += 1;
+            }
+        }
+        spec[k] = '\0';
+        n = arg_print(&buf[len], size - len, spec, type, &m->arg[a++], m->str);
+        if (n < 0) {
+            break;
+        }
+        len = (n < size - len) ? len + n : size - 1;
+        f = end;
+    }
+    buf[len] = '\0';
+}
+
+static void line_out(const char *line) {
+    if (write_line != NULL) {
+        write_line(line);
+    } else {
+        fputs(line, stdout);
+    }
+}
+
+/* format and write the messages of the ring, the caller holds mx_drain */
+static int ring_drain(void) {
+    struct logcat_msg_s m;
+    char line[LOGCAT_LINE_SIZE];
+    uint32_t nb_dropped;
+    int nb = 0;
+
+    while (true) {
+        pthread_mutex_lock(&mx_ring);
+        if (ring_nb == 0) {
+            nb_dropped = counters.nb_dropped - nb_dropped_told;
+            nb_dropped_told = counters.nb_dropped;
+            counters.nb_drained += nb;
+            pthread_mutex_unlock(&mx_ring);
+            break;
+        }
+        m = ring[ring_first];
+        ring_first = (ring_first + 1) % LOGCAT_RING_NB;
+        ring_nb -= 1;
+        pthread_mutex_unlock(&mx_ring);
+
+        msg_format(&m, line, sizeof line);
+        line_out(line);
+        nb += 1;
+    }
+    if (nb_dropped > 0) {
+        snprintf(line, sizeof line, "[log ] %u messages dropped, the log ring was full\n", nb_dropped);
+        line_out(line);
+    }
+    return nb;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void logcat_init(void (*out)(const char *line)) {
+    pthread_mutex_lock(&mx_ring);
+    ring_first = 0;
+    ring_nb = 0;
+    memset(&counters, 0, sizeof counters);
+    nb_dropped_told = 0;
+    deferred = false;
+    write_line = out;
+    pthread_mutex_unlock(&mx_ring);
+}
+
+void logcat_defer(bool defer) {
+    if (!defer) {
+        deferred = false;
+        logcat_drain();
+    } else {
+        deferred = true;
+    }
+}
+
+int logcat_set_level(int cat, int level) {
+    int i;
+
+    if ((cat < 0) || (cat > LOGCAT_NB)) {
+        return -1;
+    }
+    for (i = 0; i < LOGCAT_NB; ++i) {
+        if ((cat == LOGCAT_NB) || (cat == i)) {
+            logcat_level[i] = level;
+        }
+    }
+    return 0;
+}
+
+int logcat_find(const char *name) {
+    int i;
+
+    for (i = 0; i < LOGCAT_NB; ++i) {
+        if (strcmp(name, cat_name[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *logcat_name(int cat) {
+    return ((cat >= 0) && (cat < LOGCAT_NB)) ? cat_name[cat] : "?";
+}
+
+void logcat_put(int level, const char *fmt, ...) {
+    char line[LOGCAT_LINE_SIZE];
+    va_list ap;
+
+    /* formatted at once, after the messages waiting, an error is never dropped */
+    if (!deferred || (level <= LORAPF_ERROR_)) {
+        va_start(ap, fmt);
+        vsnprintf(line, sizeof line, fmt, ap);
+        va_end(ap);
+        pthread_mutex_lock(&mx_drain);
+        ring_drain();
+        line_out(line);
+        pthread_mutex_lock(&mx_ring);
+        counters.nb_put += 1;
+        counters.nb_drained += 1;
+        pthread_mutex_unlock(&mx_ring);
+        pthread_mutex_unlock(&mx_drain);
+        return;
+    }
+
+    pthread_mutex_lock(&mx_ring);
+    counters.nb_put += 1;
+    if (ring_nb == LOGCAT_RING_NB) {
+        counters.nb_dropped += 1;
+        pthread_mutex_unlock(&mx_ring);
+        return;
+    }
+    va_start(ap, fmt);
+    msg_fill(&ring[(ring_first + ring_nb) % LOGCAT_RING_NB], fmt, ap);
+    va_end(ap);
+    ring_nb += 1;
+    if ((uint32_t)ring_nb > counters.nb_max) {
+        counters.nb_max = ring_nb;
+    }
+    pthread_mutex_unlock(&mx_ring);
+}
+
+int logcat_drain(void) {
+    int nb;
+
+    pthread_mutex_lock(&mx_drain);
+    nb = ring_drain();
+    pthread_mutex_unlock(&mx_drain);
+    return nb;
+}
+
+void logcat_get_stat(struct logcat_stat_s *stat) {
+    pthread_mutex_lock(&mx_ring);
+    *stat = counters;
+    pthread_mutex_unlock(&mx_ring);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
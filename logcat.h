@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Log messages by subsystem, with a level per subsystem.
+
+    A message is kept when its level is at most the one compiled in for its
+    subsystem (LOGCAT_MAX_<cat>, LORAPF_DEBUG_LEVEL by default) and the one
+    set at run time (logcat_set_level). The first test is a constant: the
+    sites above it are removed by the compiler, format string and arguments
+    included.
+
+    Once logcat_defer is called, the messages are not formatted by the thread
+    logging them: the format string, which must be a literal, and the
+    arguments are copied into a ring, and formatted by logcat_drain, from a
+    thread of low priority. Strings are copied, up to LOGCAT_STR_SIZE bytes
+    per message. The %n conversion is not supported. When the ring is full,
+    the messages are dropped and counted. Errors do not go through the ring,
+    they are formatted and written at once, after the messages waiting.
+*/
+
+#ifndef _LORA_PKTFWD_LOGCAT_H
+#define _LORA_PKTFWD_LOGCAT_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "trace.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define LOGCAT_RING_NB          32      /* messages waiting for logcat_drain */
+#define LOGCAT_ARG_MAX          8       /* arguments of a message, * width and precision included */
+#define LOGCAT_STR_SIZE         64      /* bytes of the string arguments of a message, terminating nulls included */
+#define LOGCAT_LINE_SIZE        256     /* formatted message, truncated above */
+
+/* highest level compiled in, per subsystem */
+#ifndef LOGCAT_MAX_MAIN
+#define LOGCAT_MAX_MAIN         LORAPF_DEBUG_LEVEL
+#endif
+#ifndef LOGCAT_MAX_UP
+#define LOGCAT_MAX_UP           LORAPF_DEBUG_LEVEL
+#endif
+#ifndef LOGCAT_MAX_DOWN
+#define LOGCAT_MAX_DOWN         LORAPF_DEBUG_LEVEL
+#endif
+#ifndef LOGCAT_MAX_JIT
+#define LOGCAT_MAX_JIT          LORAPF_DEBUG_LEVEL
+#endif
+#ifndef LOGCAT_MAX_REPEATER
+#define LOGCAT_MAX_REPEATER     LORAPF_DEBUG_LEVEL
+#endif
+#ifndef LOGCAT_MAX_CONFIG
+#define LOGCAT_MAX_CONFIG       LORAPF_DEBUG_LEVEL
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum logcat_e {
+    LOGCAT_MAIN = 0,                            /* start, threads, statistics */
+    LOGCAT_UP,                                  /* packet fetch, upstream to the servers */
+    LOGCAT_DOWN,                                /* packets sent by the concentrator */
+    LOGCAT_JIT,                                 /* packets timed on the concentrator counter */
+    LOGCAT_REPEATER,                            /* repeater and multi-hop relay */
+    LOGCAT_CONFIG,                              /* configuration files */
+    LOGCAT_NB
+};
+
+/**
+@struct logcat_stat_s
+@brief Counters of the logger, since logcat_init
+*/
+struct logcat_stat_s {
+    uint32_t        nb_put;     /*!> messages logged */
+    uint32_t        nb_drained; /*!> messages written */
+    uint32_t        nb_dropped; /*!> messages lost on a full ring */
+    uint32_t        nb_max;     /*!> most messages waiting in the ring */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC MACROS -------------------------------------------------------- */
+
+extern int logcat_level[LOGCAT_NB];
+
+/* true when a message of the level would be kept, cat without its LOGCAT_ prefix */
+#define LOGCAT_ON(cat, level)   (((level) <= LOGCAT_MAX_##cat) && ((level) <= logcat_level[LOGCAT_##cat]))
+
+#define LOGCAT(cat, level, ...) do { \
+        if (LOGCAT_ON(cat, level)) { \
+            logcat_put((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOGCAT_ERROR(cat, ...)  LOGCAT(cat, LORAPF_ERROR_, __VA_ARGS__)
+#define LOGCAT_WARN(cat, ...)   LOGCAT(cat, LORAPF_WARN_, __VA_ARGS__)
+#define LOGCAT_INFO(cat, ...)   LOGCAT(cat, LORAPF_INFO_, __VA_ARGS__)
+#define LOGCAT_DEBUG(cat, ...)  LOGCAT(cat, LORAPF_DEBUG_, __VA_ARGS__)
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Empty the ring and set the function writing the messages, messages are
+formatted by the thread logging them until logcat_defer is called.
+
+@param out Function writing a formatted message, NULL for stdout
+*/
+void logcat_init(void (*out)(const char *line));
+
+/**
+@brief Defer the formatting of the messages to logcat_drain, or stop doing so.
+
+@param defer false to format the messages in the thread logging them again,
+the ring is drained first
+*/
+void logcat_defer(bool defer);
+
+/**
+@brief Set the level of a subsystem at run time, above the level compiled in
+the messages stay removed.
+
+@param cat Subsystem, LOGCAT_NB for all of them
+@param level LORAPF_ERROR_ to LORAPF_DEBUG_, 0 for none
+@return 0 if successful, -1 if the subsystem does not exist
+*/
+int logcat_set_level(int cat, int level);
+
+/**
+@brief Find a subsystem by name.
+
+@param name "main", "up", "down", "jit", "repeater" or "config"
+@return subsystem, -1 if the name is unknown
+*/
+int logcat_find(const char *name);
+
+/**
+@brief Name of a subsystem.
+
+@param cat Subsystem
+@return name, "?" if the subsystem does not exist
+*/
+const char *logcat_name(int cat);
+
+/**
+@brief Log a message, use the LOGCAT macros instead.
+
+@param level Level of the message
+@param fmt printf format, a literal
+*/
+void logcat_put(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+@brief Format and write the messages waiting in the ring.
+
+@return number of messages written
+*/
+int logcat_drain(void);
+
+/**
+@brief Counters of the logger.
+
+@param stat[out] Copy of the counters
+*/
+void logcat_get_stat(struct logcat_stat_s *stat);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
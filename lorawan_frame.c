@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    LoRaWAN MAC header decoder
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset */
+
+#include "lorawan_frame.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define REJOIN_TYPE_0_2_SIZE    19  /* MHDR + type + NetID(3) + DevEUI(8) + RJcount0(2) + MIC */
+#define REJOIN_TYPE_1_SIZE      24  /* MHDR + type + JoinEUI(8) + DevEUI(8) + RJcount1(2) + MIC */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static inline uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t get_le64(const uint8_t *p) {
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static enum lorawan_frame_error_e parse_data(struct lorawan_frame_view *view) {
+    const uint8_t *buf = view->buf;
+    uint16_t fhdr_end;
+
+    if (view->size < LORAWAN_DATA_MIN_SIZE) {
+        return LORAWAN_FRAME_ERROR_TOO_SHORT;
+    }
+
+    view->has_fhdr = true;
+    view->dev_addr = get_le32(&buf[1]);
+    view->fctrl = buf[5];
+    view->fcnt = get_le16(&buf[6]);
+    view->fopts_len = view->fctrl & LORAWAN_FCTRL_FOPTSLEN;
+    view->fopts_offset = LORAWAN_MHDR_SIZE + LORAWAN_FHDR_MIN_SIZE;
+
+    fhdr_end = view->fopts_offset + view->fopts_len;
+    if (fhdr_end > view->mic_offset) {
+        return LORAWAN_FRAME_ERROR_FOPTS;
+    }
+
+    /* FPort is optional, FRMPayload is only present with it */
+    if (fhdr_end < view->mic_offset) {
+        view->has_fport = true;
+        view->fport = buf[fhdr_end];
+        view->payload_offset = fhdr_end + 1;
+        /* MAC commands are either in FOpts or in the FRMPayload of FPort 0, never both */
+        if ((view->fport == 0) && (view->fopts_len > 0)) {
+            return LORAWAN_FRAME_ERROR_FPORT0;
+        }
+    } else {
+        view->payload_offset = fhdr_end;
+    }
+    view->payload_size = view->mic_offset - view->payload_offset;
+
+    return LORAWAN_FRAME_OK;
+}
+
+static enum lorawan_frame_error_e parse_join_request(struct lorawan_frame_view *view) {
+    const uint8_t *buf = view->buf;
+
+    if (view->size != LORAWAN_JOIN_REQ_SIZE) {
+        return (view->size < LORAWAN_JOIN_REQ_SIZE) ? LORAWAN_FRAME_ERROR_TOO_SHORT : LORAWAN_FRAME_ERROR_JOIN_SIZE;
+    }
+    view->join_eui = get_le64(&buf[1]);
+    view->dev_eui = get_le64(&buf[9]);
+    view->dev_nonce = get_le16(&buf[17]);
+    view->payload_offset = LORAWAN_MHDR_SIZE;
+    view->payload_size = view->mic_offset - LORAWAN_MHDR_SIZE;
+
+    return LORAWAN_FRAME_OK;
+}
+
+static enum lorawan_frame_error_e parse_rejoin_request(struct lorawan_frame_view *view) {
+    const uint8_t *buf = view->buf;
+
+    if (view->size < REJOIN_TYPE_0_2_SIZE) {
+        return LORAWAN_FRAME_ERROR_TOO_SHORT;
+    }
+    switch (buf[1]) {
+        case 0:
+        case 2:
+            if (view->size != REJOIN_TYPE_0_2_SIZE) {
+                return LORAWAN_FRAME_ERROR_JOIN_SIZE;
+            }
+            view->dev_eui = get_le64(&buf[5]);
+            break;
+        case 1:
+            if (view->size != REJOIN_TYPE_1_SIZE) {
+                return LORAWAN_FRAME_ERROR_JOIN_SIZE;
+            }
+            view->join_eui = get_le64(&buf[2]);
+            view->dev_eui = get_le64(&buf[10]);
+            break;
+        default:
+            return LORAWAN_FRAME_ERROR_JOIN_SIZE;
+    }
+    view->payload_offset = LORAWAN_MHDR_SIZE;
+    view->payload_size = view->mic_offset - LORAWAN_MHDR_SIZE;
+
+    return LORAWAN_FRAME_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+enum lorawan_frame_error_e lorawan_frame_parse(const uint8_t *buf, uint16_t size, struct lorawan_frame_view *view) {
+    if ((buf == NULL) || (view == NULL)) {
+        return LORAWAN_FRAME_ERROR_INVALID;
+    }
+
+    memset(view, 0, sizeof *view);
+    view->buf = buf;
+    view->size = size;
+
+    /* the smallest valid frame is MHDR + MIC */
+    if (size < (LORAWAN_MHDR_SIZE + LORAWAN_MIC_SIZE)) {
+        return LORAWAN_FRAME_ERROR_TOO_SHORT;
+    }
+
+    view->mtype = buf[0] >> 5;
+    view->major = buf[0] & 0x03;
+    view->mic_offset = size - LORAWAN_MIC_SIZE;
+    view->mic = get_le32(&buf[view->mic_offset]);
+
+    /* proprietary frames have no defined structure beyond MHDR and MIC */
+    if (view->mtype == LORAWAN_MTYPE_PROPRIETARY) {
+        view->payload_offset = LORAWAN_MHDR_SIZE;
+        view->payload_size = view->mic_offset - LORAWAN_MHDR_SIZE;
+        return LORAWAN_FRAME_OK;
+    }
+
+    if (view->major != LORAWAN_MAJOR_R1) {
+        return LORAWAN_FRAME_ERROR_MAJOR;
+    }
+
+    switch (view->mtype) {
+        case LORAWAN_MTYPE_JOIN_REQUEST:
+            return parse_join_request(view);
+        case LORAWAN_MTYPE_JOIN_ACCEPT:
+            /* encrypted, only the size can be checked */
+            if ((size != LORAWAN_JOIN_ACCEPT_SIZE) && (size != LORAWAN_JOIN_ACCEPT_CF_SIZE)) {
+                return (size < LORAWAN_JOIN_ACCEPT_SIZE) ? LORAWAN_FRAME_ERROR_TOO_SHORT : LORAWAN_FRAME_ERROR_JOIN_SIZE;
+            }
+            view->payload_offset = LORAWAN_MHDR_SIZE;
+            view->payload_size = view->mic_offset - LORAWAN_MHDR_SIZE;
+            return LORAWAN_FRAME_OK;
+        case LORAWAN_MTYPE_REJOIN_REQUEST:
+            return parse_rejoin_request(view);
+        default:
+            return parse_data(view);
+    }
+}
+
+bool lorawan_frame_is_uplink(const struct lorawan_frame_view *view) {
+    switch (view->mtype) {
+        case LORAWAN_MTYPE_JOIN_REQUEST:
+        case LORAWAN_MTYPE_UNCONF_DATA_UP:
+        case LORAWAN_MTYPE_CONF_DATA_UP:
+        case LORAWAN_MTYPE_REJOIN_REQUEST:
+            return true;
+        default:
+            return false;
+    }
+}
+
+const char * lorawan_frame_mtype_str(uint8_t mtype) {
+    static const char * const names[8] = {
+        "JoinRequest", "JoinAccept", "UnconfDataUp", "UnconfDataDown",
+        "ConfDataUp", "ConfDataDown", "RejoinRequest", "Proprietary"
+    };
+    return names[mtype & 0x07];
+}
+
+/* --- EOF ------------------------------------------------------------------ */
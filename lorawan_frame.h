@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    LoRaWAN MAC header decoder. Validates a PHYPayload and exposes its fields
+    (MHDR, FHDR, FPort, FRMPayload, MIC) as a view on the received buffer,
+    nothing is copied.
+*/
+
+#ifndef _LORAWAN_FRAME_H
+#define _LORAWAN_FRAME_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define LORAWAN_MHDR_SIZE           1
+#define LORAWAN_FHDR_MIN_SIZE       7   /* DevAddr(4) + FCtrl(1) + FCnt(2) */
+#define LORAWAN_FOPTS_MAX_SIZE      15
+#define LORAWAN_MIC_SIZE            4
+#define LORAWAN_DATA_MIN_SIZE       (LORAWAN_MHDR_SIZE + LORAWAN_FHDR_MIN_SIZE + LORAWAN_MIC_SIZE)
+#define LORAWAN_JOIN_REQ_SIZE       23  /* MHDR + JoinEUI(8) + DevEUI(8) + DevNonce(2) + MIC */
+#define LORAWAN_JOIN_ACCEPT_SIZE    17  /* without CFList */
+#define LORAWAN_JOIN_ACCEPT_CF_SIZE 33  /* with CFList */
+#define LORAWAN_MAJOR_R1            0
+
+/* FCtrl bit fields */
+#define LORAWAN_FCTRL_ADR           0x80
+#define LORAWAN_FCTRL_ADRACKREQ     0x40 /* uplink only */
+#define LORAWAN_FCTRL_ACK           0x20
+#define LORAWAN_FCTRL_FPENDING      0x10 /* downlink: FPending, uplink: ClassB */
+#define LORAWAN_FCTRL_FOPTSLEN      0x0F
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum lorawan_mtype_e {
+    LORAWAN_MTYPE_JOIN_REQUEST      = 0,
+    LORAWAN_MTYPE_JOIN_ACCEPT       = 1,
+    LORAWAN_MTYPE_UNCONF_DATA_UP    = 2,
+    LORAWAN_MTYPE_UNCONF_DATA_DOWN  = 3,
+    LORAWAN_MTYPE_CONF_DATA_UP      = 4,
+    LORAWAN_MTYPE_CONF_DATA_DOWN    = 5,
+    LORAWAN_MTYPE_REJOIN_REQUEST    = 6,
+    LORAWAN_MTYPE_PROPRIETARY       = 7
+};
+
+enum lorawan_frame_error_e {
+    LORAWAN_FRAME_OK = 0,
+    LORAWAN_FRAME_ERROR_INVALID,    /* NULL buffer or view */
+    LORAWAN_FRAME_ERROR_TOO_SHORT,  /* payload smaller than the minimum for its MType */
+    LORAWAN_FRAME_ERROR_MAJOR,      /* unsupported LoRaWAN major version */
+    LORAWAN_FRAME_ERROR_FOPTS,      /* FOptsLen overruns the frame */
+    LORAWAN_FRAME_ERROR_JOIN_SIZE,  /* join/rejoin frame with a non standard size */
+    LORAWAN_FRAME_ERROR_FPORT0      /* MAC commands both in FOpts and in an FPort 0 FRMPayload */
+};
+
+/**
+@struct lorawan_frame_view
+@brief Decoded view of a LoRaWAN PHYPayload. Offsets are relative to buf, which
+points into the caller's buffer and must outlive the view.
+*/
+struct lorawan_frame_view {
+    const uint8_t   *buf;           /*!> start of the PHYPayload */
+    uint16_t        size;           /*!> size of the PHYPayload */
+    uint8_t         mtype;          /*!> MType, see enum lorawan_mtype_e */
+    uint8_t         major;          /*!> LoRaWAN major version */
+    bool            has_fhdr;       /*!> true for data frames, FHDR fields below are valid */
+    uint32_t        dev_addr;       /*!> FHDR - DevAddr */
+    uint8_t         fctrl;          /*!> FHDR - FCtrl */
+    uint16_t        fcnt;           /*!> FHDR - FCnt (16 LSB) */
+    uint8_t         fopts_len;      /*!> FHDR - FOpts length */
+    uint16_t        fopts_offset;   /*!> FHDR - FOpts offset */
+    bool            has_fport;      /*!> false when the frame carries no FPort (and no FRMPayload) */
+    uint8_t         fport;          /*!> FPort */
+    uint16_t        payload_offset; /*!> FRMPayload (or join/proprietary body) offset */
+    uint16_t        payload_size;   /*!> FRMPayload (or join/proprietary body) size */
+    uint16_t        mic_offset;     /*!> MIC offset */
+    uint32_t        mic;            /*!> MIC value */
+    uint64_t        join_eui;       /*!> join request - JoinEUI */
+    uint64_t        dev_eui;        /*!> join request - DevEUI */
+    uint16_t        dev_nonce;      /*!> join request - DevNonce */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Validate a LoRaWAN PHYPayload and decode its MAC header.
+
+@param buf[in] Received payload (e.g. lgw_pkt_rx_s.payload)
+@param size Number of valid bytes in buf
+@param view[out] Decoded view, only meaningful when LORAWAN_FRAME_OK is returned
+@return LORAWAN_FRAME_OK on success, a lorawan_frame_error_e value otherwise
+
+Never reads beyond buf[size - 1].
+*/
+enum lorawan_frame_error_e lorawan_frame_parse(const uint8_t *buf, uint16_t size, struct lorawan_frame_view *view);
+
+/**
+@brief Tell if a decoded frame travels from a device to the network.
+
+@param view[in] Decoded view
+@return true for join request, rejoin request and data uplinks
+*/
+bool lorawan_frame_is_uplink(const struct lorawan_frame_view *view);
+
+/**
+@brief Return a short human readable name for an MType.
+
+@param mtype MType value (0..7)
+@return Constant string
+*/
+const char * lorawan_frame_mtype_str(uint8_t mtype);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
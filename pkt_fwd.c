@@ -55,6 +55,20 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "timersync.h"
 #include "parson.h"
 #include "base64.h"
+#include "lorawan_frame.h"
+#include "upqueue.h"
+#include "uplink_bin.h"
+#include "rxpk_fmt.h"
+#include "capture.h"
+#include "clocksync.h"
+#include "devtable.h"
+#include "adr.h"
+#include "relay.h"
+#include "relaynet.h"
+#include "tdma.h"
+#include "chanstat.h"
+#include "recover.h"
+#include "logcat.h"
 #include "loragw_hal.h"
 #include "loragw_reg.h"
 #include "loragw_aux.h"
@@ -62,6 +76,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_attr.h"
+#include "esp_heap_caps.h"
 
 #include "lwip/err.h"
 #include "lwip/apps/sntp.h"
@@ -87,14 +102,40 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define VERSION_STRING "undefined"
 #endif
 
+#ifndef FWD_BENCH
+#define FWD_BENCH       0   /* 1 builds the per-stage timing written to bench_path */
+#endif
+
 #define DEFAULT_SERVER      127.0.0.1   /* hostname also supported */
 #define DEFAULT_PORT_UP     1780
 #define DEFAULT_PORT_DW     1782
 #define DEFAULT_KEEPALIVE   5           /* default time interval for downstream keep-alive packet */
 #define DEFAULT_STAT        30          /* default time interval for statistics */
-#define PUSH_TIMEOUT_MS     100
+#define PUSH_TIMEOUT_MS     100         /* PUSH_DATA retransmission time-out until a round-trip time is measured */
+#define PUSH_RTO_MIN_MS     20
+#define PUSH_RTO_MAX_MS     4000
+#define DEFAULT_PUSH_RETRY  1           /* PUSH_DATA retransmissions before a datagram is considered lost */
 #define PULL_TIMEOUT_MS     200
 #define FETCH_SLEEP_MS      50          /* nb of ms waited when a fetch return no packets */
+#define TIMERSYNC_MS        10000       /* interval between two samples of the concentrator counter */
+#define LOG_DRAIN_MS        100         /* interval between two drains of the log messages */
+#define DEFAULT_STORE_SIZE  (256 * 1024) /* max size of the persistent uplink queue, in bytes */
+#define DEFAULT_DEV_MAX     64          /* devices whose link quality is tracked */
+#define DEFAULT_STORE_RATE  10          /* stored packets replayed per second once the server is back */
+#define STORE_ACK_LOSS_MAX  3           /* consecutive PUSH_DATA not acknowledged before the backhaul is considered down */
+#define STORE_PROBE_MS      5000        /* interval between replay attempts while the backhaul is down */
+#define RECOVER_FIFO_MAX    16          /* max number of RX FIFO entries released by a flush */
+#define DEFAULT_PUSH_MTU    1400        /* max size of a PUSH_DATA datagram, in bytes */
+#define DEFAULT_PUSH_FLUSH_US 20000     /* max time a received packet waits to be coalesced with others */
+#define DEFAULT_RELAY_FREQ  869525000   /* repeater TX channel, EU868 sub-band allowing a 10% duty cycle */
+#define DEFAULT_RELAY_POWER 14          /* repeater TX power, in dBm */
+#define DEFAULT_RELAY_DUTY  100         /* repeater duty cycle, in 1/1000 */
+#define RELAY_ACK_LEAD_US   30000       /* min time between lgw_send and the transmission of a device ACK */
+#define DEFAULT_TDMA_PERIOD 60          /* superframe of the time-slotted schedule, in seconds */
+#define DEFAULT_TDMA_BEACON_MS 500      /* holds a SF9 beacon */
+#define DEFAULT_TDMA_SLOT_MS 450        /* SF7 uplink, ACK 200 ms after it, repetition */
+#define DEFAULT_TDMA_DEV_MS 350         /* SF7 uplink and its ACK */
+#define DEFAULT_TDMA_SLOTS  120         /* leaves 5 s of contention for the slot requests */
 
 #define PROTOCOL_VERSION    2           /* v1.3 */
 
@@ -104,6 +145,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define PKT_PULL_RESP   3
 #define PKT_PULL_ACK    4
 #define PKT_TX_ACK      5
+#define PKT_PUSH_BIN    0x10 /* PUSH_DATA with binary records, see uplink_bin.h */
 
 #define NB_PKT_MAX      2 /* max number of packets per fetch/send cycle */
 
@@ -112,8 +154,25 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define MIN_FSK_PREAMB  3 /* minimum FSK preamble length for this application */
 #define STD_FSK_PREAMB  5
 
-#define STATUS_SIZE     200
+#define STATUS_SIZE     (200 + CHANSTAT_JSON_SIZE)
+#define RXPK_SIZE_MAX   540 /* worst case size of one serialized rxpk object */
+#define PUSH_MTU_MAX    1472 /* Ethernet MTU minus IP and UDP headers */
+#define PUSH_MTU_MIN    (RXPK_SIZE_MAX + 32)
+#define PUSH_PKT_MAX    8 /* max number of packets coalesced in one PUSH_DATA datagram */
+#define PUSH_DGRAM_NB   2 /* max number of PUSH_DATA datagrams sent at once */
+#define PUSH_BDP_RATE   10   /* uplinks per second the datagram pool is sized for */
+#define PUSH_BDP_RTT_MS 1000 /* acknowledge delay the datagram pool is sized for, in ms */
+#define PUSH_POOL_NB    (PUSH_DGRAM_NB + (PUSH_BDP_RATE * PUSH_BDP_RTT_MS) / 1000) /* PUSH_DATA datagrams being coalesced or in flight, one uplink per datagram at worst */
+#define PUSH_RETRY_MAX  4
+#define SERV_MAX        4 /* max number of upstream servers */
+#define SERV_PRIMARY    0 /* index of the server whose uplinks are stored when it is unreachable */
 #define TX_BUFF_SIZE    ((540 * NB_PKT_MAX) + 30 + STATUS_SIZE)
+#define RX_RING_NB      16 /* packets fetched from the concentrator, waiting for the upstream thread */
+#define THREAD_CORE_MAX 8  /* cores shown in the utilization statistics */
+#define BENCH_PATH_MAX  64
+#define DEV_PATH_MAX    64
+#define DEV_STATS_NB    5  /* most recently heard devices shown in the statistics */
+#define BENCH_LAT_NB    20 /* log2 buckets of the RX-to-UDP latency, from 1 us to 0.5 s */
 
 #define NI_NUMERICHOST	1	/* return the host address, not the name */
 
@@ -141,6 +200,112 @@ struct coord_s {
     short   alt;    /*!> altitude in meters (WGS 84 geoid ref.) */
 };
 
+/**
+@struct serv_s
+@brief Upstream server, with its own socket, link state and statistics
+*/
+struct serv_s {
+    char            addr[64];                   /*!> address of the server (host name or IPv4/IPv6) */
+    char            port_up[8];                 /*!> server port for upstream traffic */
+    char            port_down[8];               /*!> server port for downstream traffic */
+    int             sock_up;                    /*!> socket for upstream traffic */
+    bool            live;                       /*!> false after STORE_ACK_LOSS_MAX consecutive PUSH_DATA not acknowledged */
+    unsigned        ack_loss;                   /*!> consecutive PUSH_DATA not acknowledged */
+    struct timeval  probe_next;                 /*!> next time a datagram is sent while the server is not live */
+    uint32_t        srtt_us;                    /*!> smoothed round-trip time */
+    uint32_t        rttvar_us;                  /*!> round-trip time variation */
+    uint32_t        rto_us;                     /*!> retransmission time-out, 0 until the first round-trip time is measured */
+    uint32_t        dgram_sent;                 /*!> datagrams sent, protected by mx_meas_up */
+    uint32_t        ack_rcv;                    /*!> datagrams acknowledged, protected by mx_meas_up */
+    uint32_t        network_byte;               /*!> UDP bytes sent, protected by mx_meas_up */
+    uint32_t        retransmit;                 /*!> datagrams sent again, protected by mx_meas_up */
+};
+
+enum push_dgram_state_e {
+    DGRAM_FREE = 0,
+    DGRAM_FILLING,                              /* packets are being coalesced */
+    DGRAM_INFLIGHT                              /* sent, waiting for acknowledges */
+};
+
+enum bench_stage_e {
+    BENCH_FETCH = 0,                            /* lgw_receive, or the replayed capture, per call */
+    BENCH_DECODE,                               /* LoRaWAN header parsing and filtering, per packet */
+    BENCH_SERIALIZE,                            /* rxpk object or binary record, per packet */
+    BENCH_STATS,                                /* statistics collection and display, per interval */
+    BENCH_LOG,                                  /* formatting and writing of the deferred log messages, per message */
+    BENCH_STAGE_NB
+};
+
+enum thread_id_e {
+    THREAD_FETCH = 0,                           /* RX drain: lgw_receive, capture, recovery */
+    THREAD_FORWARD,                             /* decoding, coalescing, PUSH_DATA and acknowledges */
+    THREAD_TIMERSYNC,                           /* concentrator counter to UTC mapping */
+    THREAD_STATS,                               /* statistics, TASK_lora_gw itself */
+    THREAD_NB
+};
+
+struct thread_cfg_s {
+    int             core;                       /*!> core the thread is pinned to, -1 for no affinity */
+    int             prio;                       /*!> FreeRTOS priority */
+};
+
+struct bench_stage_s {
+    uint32_t        nb;
+    uint64_t        sum_ns;
+    uint32_t        max_ns;
+};
+
+/**
+@struct push_dgram_s
+@brief PUSH_DATA datagram being coalesced, with a copy of its packets. The JSON
+payload is serialized once and shared by all servers, only the token in the
+header differs. The datagram is released when every server it was sent to has
+acknowledged it or exhausted its retransmissions.
+*/
+struct push_dgram_s {
+    enum push_dgram_state_e state;
+    uint8_t         buff[PUSH_MTU_MAX + 1];     /*!> datagram, +1 for the string terminator */
+    int             len;                        /*!> bytes used in buff */
+    int             nb_pkt;                     /*!> rxpk objects serialized in buff */
+    struct lgw_pkt_rx_s pkts[PUSH_PKT_MAX];     /*!> packets, kept to be stored if not acknowledged */
+    struct timeval  rx_time[PUSH_PKT_MAX];      /*!> UTC time of reception of each packet */
+    struct timeval  first;                      /*!> time of reception of the oldest packet */
+    uint8_t         token_h[SERV_MAX];          /*!> random token for acknowledgement matching, per server */
+    uint8_t         token_l[SERV_MAX];          /*!> random token for acknowledgement matching, per server */
+    uint32_t        serv_mask;                  /*!> servers the datagram was sent to */
+    uint32_t        ack_mask;                   /*!> servers that acknowledged the datagram */
+    uint32_t        lost_mask;                  /*!> servers that never acknowledged the datagram */
+    int             refcnt;                     /*!> servers still holding a reference to the datagram */
+    struct timeval  sent[SERV_MAX];             /*!> last transmission to each server */
+    uint8_t         retries[SERV_MAX];          /*!> retransmissions to each server */
+    bool            replay;                     /*!> packets come from the persistent queue */
+};
+
+/**
+@struct fwd_mem_s
+@brief Runtime buffers of the forwarder threads
+
+Allocated once by lora_gw_init and kept across restarts of the forwarder, so
+weeks of uptime next to MicroPython do not fragment the heap. Until the
+threads start, it is also the arena of the configuration parser.
+*/
+struct fwd_mem_s {
+    struct push_dgram_s dgram_pool[PUSH_POOL_NB];   /*!> PUSH_DATA datagrams */
+    struct lgw_pkt_rx_s rx_ring[RX_RING_NB];        /*!> packets fetched by thread_fetch, forwarded by thread_up */
+    struct timeval  rx_ring_time[RX_RING_NB];       /*!> UTC time of reception of each packet */
+    struct lgw_pkt_rx_s fetch_pkt[NB_PKT_MAX];      /*!> packets returned by one lgw_receive call */
+    struct lgw_pkt_rx_s up_pkt[NB_PKT_MAX];         /*!> packets popped from the ring by thread_up */
+    struct timeval  up_rx_time[NB_PKT_MAX];         /*!> UTC time of reception of each packet */
+    struct upqueue_s upqueue;                       /*!> store-and-forward queue */
+    struct capture_s capture;                       /*!> capture of the received packets */
+    struct capture_replay_s capture_replay;         /*!> capture replayed instead of the concentrator */
+    struct relay_s  relay;                          /*!> packets waiting to be repeated */
+    struct relaynet_s relaynet;                     /*!> routes and duplicates of the multi-hop relay */
+    struct lgw_pkt_rx_s relay_pkt;                  /*!> frame built for the multi-hop relay */
+    struct lgw_pkt_tx_s relay_ack;                  /*!> ACK of a device uplink */
+    struct tdma_s   tdma;                           /*!> slots of the devices, next beacon */
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
 
@@ -158,7 +323,57 @@ static uint64_t lgwm = 0; /* Lora gateway MAC address */
 static char serv_addr[64] = STR(DEFAULT_SERVER); /* address of the server (host name or IPv4/IPv6) */
 static char serv_port_up[8] = STR(DEFAULT_PORT_UP); /* server port for upstream traffic */
 static char serv_port_down[8] = STR(DEFAULT_PORT_DW); /* server port for downstream traffic */
+static struct serv_s serv[SERV_MAX]; /* upstream servers, defaults to serv_addr when no "servers" list is configured */
+static int serv_nb = 0; /* number of upstream servers */
 static int keepalive_time = DEFAULT_KEEPALIVE; /* send a PULL_DATA request every X seconds, negative = disabled */
+static bool fwd_enabled = false; /* packets are forwarded only when gateway_conf is present, counted otherwise */
+
+/* store-and-forward configuration variables */
+static char store_path[UPQUEUE_PATH_MAX] = ""; /* base path of the persistent uplink queue, empty = disabled */
+static uint32_t store_size = DEFAULT_STORE_SIZE; /* max size of the persistent uplink queue, in bytes */
+static unsigned store_replay_rate = DEFAULT_STORE_RATE; /* max number of stored packets replayed per second */
+
+/* PUSH_DATA coalescing configuration variables */
+static int push_mtu = DEFAULT_PUSH_MTU; /* max size of a PUSH_DATA datagram */
+static uint32_t push_flush_us = DEFAULT_PUSH_FLUSH_US; /* max time a packet waits before its datagram is sent */
+static bool push_binary = false; /* send packets as binary records (PKT_PUSH_BIN) instead of JSON rxpk objects */
+
+/* capture and replay of the concentrator packet stream */
+static char capture_path[CAPTURE_PATH_MAX] = ""; /* file receiving the packets returned by lgw_receive, empty = disabled */
+static uint32_t capture_size = 0; /* max size of the capture file, in bytes, 0 = unlimited */
+static char replay_path[CAPTURE_PATH_MAX] = ""; /* capture fed to the upstream thread instead of the concentrator, empty = disabled */
+static double replay_speed = 1.0; /* pace of the replay relative to the capture, 0 = as fast as possible */
+static bool replay_loop = false; /* start the replay again at the end of the capture */
+
+/* placement of the threads, on the ESP32 lora_gw_init runs TASK_lora_gw on core 1 */
+static struct thread_cfg_s thread_cfg[THREAD_NB] = {
+    {-1, LORA_GW_PRIORITY + 1},
+    {-1, LORA_GW_PRIORITY},
+    {-1, LORA_GW_PRIORITY},
+    {1, LORA_GW_PRIORITY}
+};
+static const char *thread_name[THREAD_NB] = {"fetch", "forward", "timersync", "stats"};
+
+#if FWD_BENCH
+/* benchmark report */
+static char bench_path[BENCH_PATH_MAX] = ""; /* file receiving one JSON object per statistics interval, empty = disabled */
+static bool bench_enabled = false;
+static uint32_t bench_conf_us = 0; /* time taken to parse the configuration file */
+#endif
+
+/* link quality of the devices heard */
+static uint32_t dev_max = DEFAULT_DEV_MAX; /* devices tracked, the least recently heard ones are evicted, 0 = disabled */
+static char dev_path[DEV_PATH_MAX] = ""; /* file receiving the whole table every statistics interval, empty = disabled */
+static float adr_margin = ADR_MARGIN_DEFAULT; /* installation margin of the data rate recommendations, in dB */
+
+/* repeater: packets received on the IF channels are transmitted again on a dedicated channel */
+static bool relay_enabled = false;
+static struct relay_cfg_s relay_cfg = {DEFAULT_RELAY_FREQ, 0, DEFAULT_RELAY_POWER, 0, DEFAULT_RELAY_DUTY, RELAY_GUARD_MS, RELAY_BACKOFF_MS};
+static uint8_t relay_hop_limit = 0; /* max hops of the frames through chained repeaters, 0 = single hop, no hop header */
+static uint16_t relay_node_id = 0; /* node ID in the multi-hop relay, defaults to the 16 LSB of the gateway MAC address */
+static bool relay_sink = false; /* frames of the multi-hop relay are delivered to the server here */
+static bool tdma_enabled = false; /* device uplinks and repeater transmissions in the slots announced by a beacon */
+static struct tdma_cfg_s tdma_cfg = {DEFAULT_TDMA_PERIOD, DEFAULT_TDMA_BEACON_MS, DEFAULT_TDMA_SLOT_MS, DEFAULT_TDMA_DEV_MS, DEFAULT_TDMA_SLOTS};
 
 /* statistics collection configuration variables */
 static unsigned stat_interval = DEFAULT_STAT; /* time interval (in sec) at which statistics are collected and displayed */
@@ -168,11 +383,11 @@ static uint32_t net_mac_h; /* Most Significant Nibble, network order */
 static uint32_t net_mac_l; /* Least Significant Nibble, network order */
 
 /* network sockets */
-static int sock_up; /* socket for upstream traffic */
 static int sock_down; /* socket for downstream traffic */
 
 /* network protocol variables */
-static struct timeval push_timeout_half = {0, (PUSH_TIMEOUT_MS * 500)}; /* cut in half, critical for throughput */
+static uint32_t push_timeout_ms = PUSH_TIMEOUT_MS; /* PUSH_DATA retransmission time-out until a round-trip time is measured */
+static unsigned push_retry = DEFAULT_PUSH_RETRY; /* PUSH_DATA retransmissions before a datagram is considered lost */
 static struct timeval pull_timeout = {0, (PULL_TIMEOUT_MS * 1000)}; /* non critical for throughput */
 
 /* hardware access control and correction */
@@ -195,6 +410,33 @@ static uint32_t meas_up_network_byte = 0; /* sum of UDP bytes sent for upstream
 static uint32_t meas_up_payload_byte = 0; /* sum of radio payload bytes sent for upstream traffic */
 static uint32_t meas_up_dgram_sent = 0; /* number of datagrams sent for upstream traffic */
 static uint32_t meas_up_ack_rcv = 0; /* number of datagrams acknowledged for upstream traffic */
+static uint32_t meas_up_retransmit = 0; /* number of datagrams sent again because their acknowledge was late */
+static uint32_t meas_up_pool_full = 0; /* times the uplinks were held back because every datagram waited for acknowledges */
+static uint32_t meas_up_rtt_sum = 0; /* sum of measured round-trip times, in ms */
+static uint32_t meas_up_rtt_nb = 0; /* number of measured round-trip times */
+static uint32_t meas_up_pkt_stored = 0; /* number of radio packets stored while the server was unreachable */
+static uint32_t meas_up_pkt_replayed = 0; /* number of stored radio packets replayed and acknowledged */
+static uint32_t meas_up_pkt_dropped = 0; /* number of stored radio packets lost because the queue was full */
+static uint32_t meas_up_store_pending = 0; /* number of radio packets waiting in the persistent queue */
+static uint32_t meas_up_hal_error = 0; /* number of failed packet fetches */
+static uint64_t meas_thread_wait_ns[THREAD_NB]; /* time each thread spent waiting */
+static int meas_thread_core[THREAD_NB] = {-1, -1, -1, -1}; /* core each thread last ran on */
+static TaskHandle_t thread_task[THREAD_NB]; /* task running each thread, for its stack high-water mark */
+static uint32_t meas_fetch_late_max = 0; /* longest delay of a packet fetch past its due time, in us */
+static uint32_t meas_rx_ring_full = 0; /* fetches postponed because thread_up did not keep up */
+static uint32_t meas_recover_nb[RECOVER_TIER_NB]; /* concentrator recoveries, per tier */
+static uint32_t meas_recover_ms[RECOVER_TIER_NB]; /* sum of the downtimes, per tier */
+static uint32_t meas_recover_ms_max[RECOVER_TIER_NB]; /* longest downtime, per tier */
+static struct relay_stat_s meas_relay; /* packets repeated, when relay_enabled */
+static struct relaynet_stat_s meas_relaynet; /* frames of the multi-hop relay, when relay_hop_limit is set */
+static struct tdma_stat_s meas_tdma; /* beacons and slots, when tdma_enabled */
+static struct chanstat_s meas_chan; /* occupancy and estimated noise floor of the IF chains */
+#if FWD_BENCH
+static struct bench_stage_s meas_bench_stage[BENCH_STAGE_NB]; /* processing time of each stage, when bench_enabled */
+static uint32_t meas_bench_lat[BENCH_LAT_NB]; /* histogram of the RX-to-UDP latency of live packets */
+static uint64_t meas_bench_lat_sum = 0; /* sum of the RX-to-UDP latencies, in us */
+static uint32_t meas_bench_lat_max = 0; /* highest RX-to-UDP latency, in us */
+#endif
 
 static pthread_mutex_t mx_meas_dw = PTHREAD_MUTEX_INITIALIZER; /* control access to the downstream measurements */
 static uint32_t meas_dw_pull_sent = 0; /* number of PULL requests sent for downstream traffic */
@@ -220,6 +462,43 @@ static uint32_t autoquit_threshold = 0; /* enable auto-quit after a number of no
 /* Just In Time TX scheduling */
 static struct jit_queue_s jit_queue;
 
+/* concentrator counter to UTC, fed by thread_timersync, read by any thread */
+static struct clocksync_s clocksync;
+
+/* link quality of the devices heard, updated by thread_up */
+static pthread_mutex_t mx_devtable = PTHREAD_MUTEX_INITIALIZER; /* control access to the device table */
+static struct devtable_s devtable;
+static void *devtable_buf = NULL; /* kept for the next start of the forwarder */
+static size_t devtable_buf_size = 0;
+static bool devtable_enabled = false;
+
+/* runtime buffers, allocated once by lora_gw_init */
+static struct fwd_mem_s *mem = NULL;
+static size_t conf_arena_used = 0; /* bytes handed to the configuration parser */
+static size_t conf_arena_peak = 0; /* max bytes used by the configuration parser */
+static uint32_t conf_heap_nb = 0; /* parser allocations that did not fit in the arena */
+
+/* packets fetched by thread_fetch, forwarded by thread_up */
+static pthread_mutex_t mx_rx_ring = PTHREAD_MUTEX_INITIALIZER; /* control access to the ring */
+static pthread_cond_t cv_rx_ring = PTHREAD_COND_INITIALIZER; /* signaled when thread_up makes room in the ring */
+static unsigned rx_ring_head = 0; /* oldest packet */
+static unsigned rx_ring_nb = 0; /* packets in the ring */
+static int sock_wake = -1; /* loopback socket, wakes thread_up up when packets are put in an empty ring */
+
+/* Store-and-forward of uplinks during backhaul outages */
+static bool store_enabled = false; /* persistent queue opened */
+
+/* capture and replay */
+static bool capture_enabled = false; /* capture file opened */
+static bool capture_replay_enabled = false; /* packets come from capture_replay instead of the concentrator */
+
+/* PUSH_DATA datagrams, being coalesced by the upstream thread or waiting for their acknowledges (mem->dgram_pool) */
+static struct push_dgram_s *push_dgram[PUSH_DGRAM_NB]; /* datagrams being coalesced */
+static int replay_inflight = 0; /* replayed datagrams waiting for their acknowledges */
+static int replay_nb_pkt = 0; /* packets in the replayed datagrams */
+static bool replay_failed = false; /* one of the replayed datagrams was not acknowledged */
+static struct timeval replay_next = {0, 0}; /* earliest time of the next replay datagram */
+
 /* Gateway specificities */
 static int8_t antenna_gain = 0;
 
@@ -248,6 +527,7 @@ static void obtain_time(void);
 static void loragw_exit(int status);
 
 /* threads */
+void thread_fetch(void);
 void thread_up(void);
 void thread_down(void);
 void thread_jit(void);
@@ -257,10 +537,14 @@ void thread_timersync(void);
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
 static void exit_cleanup(void) {
-    MSG_INFO("[main] Stopping concentrator\n");
+    LOGCAT_INFO(MAIN, "[main] Stopping concentrator\n");
     lgw_stop();
 }
 
+static void log_out(const char *line) {
+    mp_printf(&mp_plat_print, "%s", line);
+}
+
 static IRAM_ATTR void sig_handler(int sigio) {
     if (sigio == SIGQUIT) {
         quit_sig = true;
@@ -272,6 +556,7 @@ static IRAM_ATTR void sig_handler(int sigio) {
 static void loragw_exit(int status)
 {
     exit_sig = false;
+    json_set_allocation_functions(malloc, free);
     if(status == EXIT_FAILURE)
     {
         exit_cleanup();
@@ -292,6 +577,42 @@ static void loragw_exit(int status)
     }
 }
 
+/* configuration parser allocations, carved out of the runtime buffers which are not in use yet */
+static void *conf_malloc(size_t size) {
+    size_t len = (size + 7) & ~(size_t)7;
+    void *p;
+
+    if (len <= sizeof *mem - conf_arena_used) {
+        p = (uint8_t *)mem + conf_arena_used;
+        conf_arena_used += len;
+        if (conf_arena_used > conf_arena_peak) {
+            conf_arena_peak = conf_arena_used;
+        }
+        return p;
+    }
+    ++conf_heap_nb;
+    return malloc(size);
+}
+
+/* arena blocks are released all at once by conf_arena_end */
+static void conf_free(void *p) {
+    if (((uint8_t *)p < (uint8_t *)mem) || ((uint8_t *)p >= (uint8_t *)(mem + 1))) {
+        free(p);
+    }
+}
+
+static void conf_arena_begin(void) {
+    conf_arena_used = 0;
+    json_set_allocation_functions(conf_malloc, conf_free);
+}
+
+/* give the runtime buffers back to the threads, nothing parsed must be used after this */
+static void conf_arena_end(void) {
+    json_set_allocation_functions(malloc, free);
+    memset(mem, 0, sizeof *mem);
+    conf_arena_used = 0;
+}
+
 static int parse_SX1301_configuration(const char * conf_file) {
     int i;
     char param_name[32]; /* used to generate variable parameter names */
@@ -304,21 +625,22 @@ static int parse_SX1301_configuration(const char * conf_file) {
     struct lgw_conf_rxrf_s rfconf;
     struct lgw_conf_rxif_s ifconf;
     uint32_t sf, bw, fdev;
+    uint32_t rf_freq[LGW_RF_CHAIN_NB] = {0}; /* center frequency of the radios, for the channel statistics */
 
     /* try to parse JSON */
     root_val = json_parse_file_with_comments(conf_file);
     if (root_val == NULL) {
-        MSG_ERROR("[main] %s is not a valid JSON file\n", conf_file);
+        LOGCAT_ERROR(CONFIG, "[main] %s is not a valid JSON file\n", conf_file);
         exit(EXIT_FAILURE);
     }
 
     /* point to the gateway configuration object */
     conf_obj = json_object_get_object(json_value_get_object(root_val), conf_obj_name);
     if (conf_obj == NULL) {
-        MSG_INFO("[main] %s does not contain a JSON object named %s\n", conf_file, conf_obj_name);
+        LOGCAT_INFO(CONFIG, "[main] %s does not contain a JSON object named %s\n", conf_file, conf_obj_name);
         return -1;
     } else {
-        //MSG_INFO("[main] %s does contain a JSON object named %s, parsing SX1301 parameters\n", conf_file, conf_obj_name);
+        //LOGCAT_INFO(CONFIG, "[main] %s does contain a JSON object named %s, parsing SX1301 parameters\n", conf_file, conf_obj_name);
     }
 
     /* set board configuration */
@@ -327,20 +649,20 @@ static int parse_SX1301_configuration(const char * conf_file) {
     if (json_value_get_type(val) == JSONBoolean) {
         boardconf.lorawan_public = (bool)json_value_get_boolean(val);
     } else {
-        MSG_WARN("[main] Data type for lorawan_public seems wrong, please check\n");
+        LOGCAT_WARN(CONFIG, "[main] Data type for lorawan_public seems wrong, please check\n");
         boardconf.lorawan_public = false;
     }
     val = json_object_get_value(conf_obj, "clksrc"); /* fetch value (if possible) */
     if (json_value_get_type(val) == JSONNumber) {
         boardconf.clksrc = (uint8_t)json_value_get_number(val);
     } else {
-        MSG_WARN("[main] Data type for clksrc seems wrong, please check\n");
+        LOGCAT_WARN(CONFIG, "[main] Data type for clksrc seems wrong, please check\n");
         boardconf.clksrc = 0;
     }
-    MSG_INFO("[main] lorawan_public %d, clksrc %d\n", boardconf.lorawan_public, boardconf.clksrc);
+    LOGCAT_INFO(CONFIG, "[main] lorawan_public %d, clksrc %d\n", boardconf.lorawan_public, boardconf.clksrc);
     /* all parameters parsed, submitting configuration to the HAL */
     if (lgw_board_setconf(&boardconf) != LGW_HAL_SUCCESS) {
-        MSG_ERROR("[main] Failed to configure board\n");
+        LOGCAT_ERROR(CONFIG, "[main] Failed to configure board\n");
         return -1;
     }
 
@@ -350,11 +672,11 @@ static int parse_SX1301_configuration(const char * conf_file) {
         if (json_value_get_type(val) == JSONNumber) {
             antenna_gain = (int8_t)json_value_get_number(val);
         } else {
-            MSG_WARN("[main] Data type for antenna_gain seems wrong, please check\n");
+            LOGCAT_WARN(CONFIG, "[main] Data type for antenna_gain seems wrong, please check\n");
             antenna_gain = 0;
         }
     }
-    MSG_INFO("[main] antenna_gain %d dBi\n", antenna_gain);
+    LOGCAT_INFO(CONFIG, "[main] antenna_gain %d dBi\n", antenna_gain);
 
     /* set configuration for tx gains */
     memset(&txlut, 0, sizeof txlut); /* initialize configuration structure */
@@ -362,7 +684,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
         snprintf(param_name, sizeof param_name, "tx_lut_%i", i); /* compose parameter path inside JSON structure */
         val = json_object_get_value(conf_obj, param_name); /* fetch value (if possible) */
         if (json_value_get_type(val) != JSONObject) {
-            MSG_INFO("[main] no configuration for tx gain lut %i\n", i);
+            LOGCAT_INFO(CONFIG, "[main] no configuration for tx gain lut %i\n", i);
             continue;
         }
         txlut.size++; /* update TX LUT size based on JSON object found in configuration file */
@@ -372,7 +694,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
         if (json_value_get_type(val) == JSONNumber) {
             txlut.lut[i].pa_gain = (uint8_t)json_value_get_number(val);
         } else {
-            MSG_WARN("[main] Data type for %s[%d] seems wrong, please check\n", param_name, i);
+            LOGCAT_WARN(CONFIG, "[main] Data type for %s[%d] seems wrong, please check\n", param_name, i);
             txlut.lut[i].pa_gain = 0;
         }
         snprintf(param_name, sizeof param_name, "tx_lut_%i.dac_gain", i);
@@ -388,7 +710,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
         if (json_value_get_type(val) == JSONNumber) {
             txlut.lut[i].dig_gain = (uint8_t)json_value_get_number(val);
         } else {
-            MSG_WARN("[main] Data type for %s[%d] seems wrong, please check\n", param_name, i);
+            LOGCAT_WARN(CONFIG, "[main] Data type for %s[%d] seems wrong, please check\n", param_name, i);
             txlut.lut[i].dig_gain = 0;
         }
         snprintf(param_name, sizeof param_name, "tx_lut_%i.mix_gain", i);
@@ -396,7 +718,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
         if (json_value_get_type(val) == JSONNumber) {
             txlut.lut[i].mix_gain = (uint8_t)json_value_get_number(val);
         } else {
-            MSG_WARN("[main] Data type for %s[%d] seems wrong, please check\n", param_name, i);
+            LOGCAT_WARN(CONFIG, "[main] Data type for %s[%d] seems wrong, please check\n", param_name, i);
             txlut.lut[i].mix_gain = 0;
         }
         snprintf(param_name, sizeof param_name, "tx_lut_%i.rf_power", i);
@@ -404,19 +726,19 @@ static int parse_SX1301_configuration(const char * conf_file) {
         if (json_value_get_type(val) == JSONNumber) {
             txlut.lut[i].rf_power = (int8_t)json_value_get_number(val);
         } else {
-            MSG_WARN("[main] Data type for %s[%d] seems wrong, please check\n", param_name, i);
+            LOGCAT_WARN(CONFIG, "[main] Data type for %s[%d] seems wrong, please check\n", param_name, i);
             txlut.lut[i].rf_power = 0;
         }
     }
     /* all parameters parsed, submitting configuration to the HAL */
     if (txlut.size > 0) {
-        MSG_INFO("[main] Configuring TX LUT with %u indexes\n", txlut.size);
+        LOGCAT_INFO(CONFIG, "[main] Configuring TX LUT with %u indexes\n", txlut.size);
         if (lgw_txgain_setconf(&txlut) != LGW_HAL_SUCCESS) {
-            MSG_ERROR("[main] Failed to configure concentrator TX Gain LUT\n");
+            LOGCAT_ERROR(CONFIG, "[main] Failed to configure concentrator TX Gain LUT\n");
             return -1;
         }
     } else {
-        MSG_WARN("[main] No TX gain LUT defined\n");
+        LOGCAT_WARN(CONFIG, "[main] No TX gain LUT defined\n");
     }
 
     /* set configuration for RF chains */
@@ -425,7 +747,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
         snprintf(param_name, sizeof param_name, "radio_%i", i); /* compose parameter path inside JSON structure */
         val = json_object_get_value(conf_obj, param_name); /* fetch value (if possible) */
         if (json_value_get_type(val) != JSONObject) {
-            MSG_INFO("[main] no configuration for radio %i\n", i);
+            LOGCAT_INFO(CONFIG, "[main] no configuration for radio %i\n", i);
             continue;
         }
         /* there is an object to configure that radio, let's parse it */
@@ -437,10 +759,11 @@ static int parse_SX1301_configuration(const char * conf_file) {
             rfconf.enable = false;
         }
         if (rfconf.enable == false) { /* radio disabled, nothing else to parse */
-            MSG_INFO("[main] radio %i disabled\n", i);
+            LOGCAT_INFO(CONFIG, "[main] radio %i disabled\n", i);
         } else  { /* radio enabled, will parse the other parameters */
             snprintf(param_name, sizeof param_name, "radio_%i.freq", i);
             rfconf.freq_hz = (uint32_t)json_object_dotget_number(conf_obj, param_name);
+            rf_freq[i] = rfconf.freq_hz;
             snprintf(param_name, sizeof param_name, "radio_%i.rssi_offset", i);
             rfconf.rssi_offset = (float)json_object_dotget_number(conf_obj, param_name);
             snprintf(param_name, sizeof param_name, "radio_%i.type", i);
@@ -450,7 +773,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
             } else if (!strncmp(str, "SX1257", 6)) {
                 rfconf.type = LGW_RADIO_TYPE_SX1257;
             } else {
-                MSG_WARN("[main] invalid radio type: %s (should be SX1255 or SX1257)\n", str);
+                LOGCAT_WARN(CONFIG, "[main] invalid radio type: %s (should be SX1255 or SX1257)\n", str);
             }
             snprintf(param_name, sizeof param_name, "radio_%i.tx_enable", i);
             val = json_object_dotget_value(conf_obj, param_name);
@@ -463,25 +786,64 @@ static int parse_SX1301_configuration(const char * conf_file) {
                     snprintf(param_name, sizeof param_name, "radio_%i.tx_freq_max", i);
                     tx_freq_max[i] = (uint32_t)json_object_dotget_number(conf_obj, param_name);
                     if ((tx_freq_min[i] == 0) || (tx_freq_max[i] == 0)) {
-                        MSG_WARN("[main] no frequency range specified for TX rf chain %d\n", i);
+                        LOGCAT_WARN(CONFIG, "[main] no frequency range specified for TX rf chain %d\n", i);
                     }
                 }
             } else {
                 rfconf.tx_enable = false;
             }
-            MSG_INFO("[main] radio %i enabled (type %s), center frequency %u, RSSI offset %f, tx enabled %d\n", i, str, rfconf.freq_hz, rfconf.rssi_offset, rfconf.tx_enable);
+            LOGCAT_INFO(CONFIG, "[main] radio %i enabled (type %s), center frequency %u, RSSI offset %f, tx enabled %d\n", i, str, rfconf.freq_hz, rfconf.rssi_offset, rfconf.tx_enable);
         }
         /* all parameters parsed, submitting configuration to the HAL */
         if (lgw_rxrf_setconf(i, &rfconf) != LGW_HAL_SUCCESS) {
-            MSG_ERROR("[main] invalid configuration for radio %i\n", i);
+            LOGCAT_ERROR(CONFIG, "[main] invalid configuration for radio %i\n", i);
+            return -1;
+        }
+    }
+    /* set configuration for Lora multi-SF channels (bandwidth cannot be set) */
+    chanstat_init(&meas_chan);
+    for (i = 0; i < LGW_MULTI_NB; ++i) {
+        memset(&ifconf, 0, sizeof ifconf); /* initialize configuration structure */
+        snprintf(param_name, sizeof param_name, "chan_multiSF_%i", i); /* compose parameter path inside JSON structure */
+        val = json_object_get_value(conf_obj, param_name); /* fetch value (if possible) */
+        if (json_value_get_type(val) != JSONObject) {
+            LOGCAT_INFO(CONFIG, "[main] no configuration for Lora multi-SF channel %i\n", i);
+            continue;
+        }
+        /* there is an object to configure that Lora multi-SF channel, let's parse it */
+        snprintf(param_name, sizeof param_name, "chan_multiSF_%i.enable", i);
+        val = json_object_dotget_value(conf_obj, param_name);
+        if (json_value_get_type(val) == JSONBoolean) {
+            ifconf.enable = (bool)json_value_get_boolean(val);
+        } else {
+            ifconf.enable = false;
+        }
+        if (ifconf.enable == false) {
+            LOGCAT_INFO(CONFIG, "[main] Lora multi-SF channel %i disabled\n", i);
+        } else  {
+            snprintf(param_name, sizeof param_name, "chan_multiSF_%i.radio", i);
+            ifconf.rf_chain = (uint32_t)json_object_dotget_number(conf_obj, param_name);
+            snprintf(param_name, sizeof param_name, "chan_multiSF_%i.if", i);
+            ifconf.freq_hz = (int32_t)json_object_dotget_number(conf_obj, param_name);
+            ifconf.bandwidth = BW_125KHZ;
+            ifconf.datarate = DR_LORA_MULTI;
+            LOGCAT_INFO(CONFIG, "[main] Lora multi-SF channel %i> radio %i, IF %i Hz, 125 kHz bw, SF 7 to 12\n", i, ifconf.rf_chain, ifconf.freq_hz);
+            if ((ifconf.rf_chain < LGW_RF_CHAIN_NB) && (rf_freq[ifconf.rf_chain] != 0)) {
+                chanstat_set_freq(&meas_chan, (uint8_t)i, rf_freq[ifconf.rf_chain] + ifconf.freq_hz);
+            }
+        }
+        /* all parameters parsed, submitting configuration to the HAL */
+        if (lgw_rxif_setconf(i, &ifconf) != LGW_HAL_SUCCESS) {
+            LOGCAT_ERROR(CONFIG, "[main] invalid configuration for Lora multi-SF channel %i\n", i);
             return -1;
         }
     }
+
     /* set configuration for Lora standard channel */
     memset(&ifconf, 0, sizeof ifconf); /* initialize configuration structure */
     val = json_object_get_value(conf_obj, "chan_Lora_std"); /* fetch value (if possible) */
     if (json_value_get_type(val) != JSONObject) {
-        MSG_INFO("[main] no configuration for Lora standard channel\n");
+        LOGCAT_INFO(CONFIG, "[main] no configuration for Lora standard channel\n");
     } else {
         val = json_object_dotget_value(conf_obj, "chan_Lora_std.enable");
         if (json_value_get_type(val) == JSONBoolean) {
@@ -490,7 +852,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
             ifconf.enable = false;
         }
         if (ifconf.enable == false) {
-            MSG_INFO("[main] Lora standard channel %i disabled\n", i);
+            LOGCAT_INFO(CONFIG, "[main] Lora standard channel %i disabled\n", i);
         } else  {
             ifconf.rf_chain = (uint32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.radio");
             ifconf.freq_hz = (int32_t)json_object_dotget_number(conf_obj, "chan_Lora_std.if");
@@ -531,10 +893,13 @@ static int parse_SX1301_configuration(const char * conf_file) {
                 default:
                     ifconf.datarate = DR_UNDEFINED;
             }
-            MSG_INFO("[main] Lora std channel> radio %i, IF %i Hz, %u Hz bw, SF %u\n", ifconf.rf_chain, ifconf.freq_hz, bw, sf);
+            LOGCAT_INFO(CONFIG, "[main] Lora std channel> radio %i, IF %i Hz, %u Hz bw, SF %u\n", ifconf.rf_chain, ifconf.freq_hz, bw, sf);
+            if ((ifconf.rf_chain < LGW_RF_CHAIN_NB) && (rf_freq[ifconf.rf_chain] != 0)) {
+                chanstat_set_freq(&meas_chan, 8, rf_freq[ifconf.rf_chain] + ifconf.freq_hz);
+            }
         }
         if (lgw_rxif_setconf(8, &ifconf) != LGW_HAL_SUCCESS) {
-            MSG_ERROR("[main] invalid configuration for Lora standard channel\n");
+            LOGCAT_ERROR(CONFIG, "[main] invalid configuration for Lora standard channel\n");
             return -1;
         }
     }
@@ -543,7 +908,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
     memset(&ifconf, 0, sizeof ifconf); /* initialize configuration structure */
     val = json_object_get_value(conf_obj, "chan_FSK"); /* fetch value (if possible) */
     if (json_value_get_type(val) != JSONObject) {
-        MSG_INFO("[main] no configuration for FSK channel\n");
+        LOGCAT_INFO(CONFIG, "[main] no configuration for FSK channel\n");
     } else {
         val = json_object_dotget_value(conf_obj, "chan_FSK.enable");
         if (json_value_get_type(val) == JSONBoolean) {
@@ -552,7 +917,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
             ifconf.enable = false;
         }
         if (ifconf.enable == false) {
-            MSG_INFO("[main] FSK channel %i disabled\n", i);
+            LOGCAT_INFO(CONFIG, "[main] FSK channel %i disabled\n", i);
         } else  {
             ifconf.rf_chain = (uint32_t)json_object_dotget_number(conf_obj, "chan_FSK.radio");
             ifconf.freq_hz = (int32_t)json_object_dotget_number(conf_obj, "chan_FSK.if");
@@ -584,10 +949,13 @@ static int parse_SX1301_configuration(const char * conf_file) {
                 ifconf.bandwidth = BW_UNDEFINED;
             }
 
-            MSG_INFO("[main] FSK channel> radio %i, IF %i Hz, %u Hz bw, %u bps datarate\n", ifconf.rf_chain, ifconf.freq_hz, bw, ifconf.datarate);
+            LOGCAT_INFO(CONFIG, "[main] FSK channel> radio %i, IF %i Hz, %u Hz bw, %u bps datarate\n", ifconf.rf_chain, ifconf.freq_hz, bw, ifconf.datarate);
+            if ((ifconf.rf_chain < LGW_RF_CHAIN_NB) && (rf_freq[ifconf.rf_chain] != 0)) {
+                chanstat_set_freq(&meas_chan, 9, rf_freq[ifconf.rf_chain] + ifconf.freq_hz);
+            }
         }
         if (lgw_rxif_setconf(9, &ifconf) != LGW_HAL_SUCCESS) {
-            MSG_ERROR("[main] invalid configuration for FSK channel\n");
+            LOGCAT_ERROR(CONFIG, "[main] invalid configuration for FSK channel\n");
             return -1;
         }
     }
@@ -596,6 +964,383 @@ static int parse_SX1301_configuration(const char * conf_file) {
     return 0;
 }
 
+static int parse_gateway_configuration(const char * conf_file) {
+    const char conf_obj_name[] = "gateway_conf";
+    JSON_Value *root_val;
+    JSON_Object *conf_obj = NULL;
+    JSON_Value *val = NULL; /* needed to detect the absence of some fields */
+    const char *str; /* pointer to sub-strings in the JSON data */
+    unsigned long long ull = 0;
+    JSON_Array *servers = NULL;
+    JSON_Object *serv_obj = NULL;
+    JSON_Object *thread_obj = NULL;
+    JSON_Object *log_obj = NULL;
+    size_t i;
+
+    /* a restart parses the configuration again: drop the servers of the previous run */
+    for (i = 0; i < (size_t)serv_nb; ++i) {
+        if (serv[i].sock_up != -1) {
+            close(serv[i].sock_up);
+        }
+    }
+    memset(serv, 0, sizeof serv);
+    serv_nb = 0;
+
+    /* try to parse JSON */
+    root_val = json_parse_file_with_comments(conf_file);
+    if (root_val == NULL) {
+        LOGCAT_ERROR(CONFIG, "[main] %s is not a valid JSON file\n", conf_file);
+        exit(EXIT_FAILURE);
+    }
+
+    /* point to the gateway configuration object */
+    conf_obj = json_object_get_object(json_value_get_object(root_val), conf_obj_name);
+    if (conf_obj == NULL) {
+        LOGCAT_INFO(CONFIG, "[main] %s does not contain a JSON object named %s\n", conf_file, conf_obj_name);
+        json_value_free(root_val);
+        return -1;
+    }
+
+    /* log level of all the subsystems, or an object with the level of each one (optional) */
+    val = json_object_get_value(conf_obj, "log_level");
+    if (json_value_get_type(val) == JSONNumber) {
+        debug_level = (int)json_value_get_number(val);
+        logcat_set_level(LOGCAT_NB, debug_level);
+    } else if (json_value_get_type(val) == JSONObject) {
+        log_obj = json_value_get_object(val);
+        for (i = 0; i < LOGCAT_NB; ++i) {
+            val = json_object_get_value(log_obj, logcat_name(i));
+            if (json_value_get_type(val) == JSONNumber) {
+                logcat_set_level(i, (int)json_value_get_number(val));
+            }
+        }
+    }
+
+    /* gateway unique identifier (aka MAC address) (optional) */
+    str = json_object_get_string(conf_obj, "gateway_ID");
+    if (str != NULL) {
+        sscanf(str, "%llx", &ull);
+        lgwm = ull;
+        LOGCAT_INFO(CONFIG, "[main] gateway MAC address is configured to %016llX\n", ull);
+    }
+
+    /* server hostname or IP address (optional) */
+    str = json_object_get_string(conf_obj, "server_address");
+    if (str != NULL) {
+        strncpy(serv_addr, str, sizeof serv_addr - 1);
+        LOGCAT_INFO(CONFIG, "[main] server hostname or IP address is configured to \"%s\"\n", serv_addr);
+    }
+
+    /* get up and down ports (optional) */
+    val = json_object_get_value(conf_obj, "serv_port_up");
+    if (val != NULL) {
+        snprintf(serv_port_up, sizeof serv_port_up, "%u", (uint16_t)json_value_get_number(val));
+        LOGCAT_INFO(CONFIG, "[main] upstream port is configured to \"%s\"\n", serv_port_up);
+    }
+    val = json_object_get_value(conf_obj, "serv_port_down");
+    if (val != NULL) {
+        snprintf(serv_port_down, sizeof serv_port_down, "%u", (uint16_t)json_value_get_number(val));
+        LOGCAT_INFO(CONFIG, "[main] downstream port is configured to \"%s\"\n", serv_port_down);
+    }
+
+    /* list of upstream servers, the first one is the primary server (optional) */
+    servers = json_object_get_array(conf_obj, "servers");
+    if (servers != NULL) {
+        for (i = 0; (i < json_array_get_count(servers)) && (serv_nb < SERV_MAX); ++i) {
+            serv_obj = json_array_get_object(servers, i);
+            str = json_object_get_string(serv_obj, "server_address");
+            if (str == NULL) {
+                LOGCAT_WARN(CONFIG, "[main] servers[%u] has no server_address, ignored\n", (unsigned)i);
+                continue;
+            }
+            val = json_object_get_value(serv_obj, "serv_enabled");
+            if ((json_value_get_type(val) == JSONBoolean) && !json_value_get_boolean(val)) {
+                continue;
+            }
+            strncpy(serv[serv_nb].addr, str, sizeof serv[serv_nb].addr - 1);
+            val = json_object_get_value(serv_obj, "serv_port_up");
+            snprintf(serv[serv_nb].port_up, sizeof serv[serv_nb].port_up, "%u", (val != NULL) ? (uint16_t)json_value_get_number(val) : DEFAULT_PORT_UP);
+            val = json_object_get_value(serv_obj, "serv_port_down");
+            snprintf(serv[serv_nb].port_down, sizeof serv[serv_nb].port_down, "%u", (val != NULL) ? (uint16_t)json_value_get_number(val) : DEFAULT_PORT_DW);
+            LOGCAT_INFO(CONFIG, "[main] server %d is configured to \"%s\", ports %s/%s\n", serv_nb, serv[serv_nb].addr, serv[serv_nb].port_up, serv[serv_nb].port_down);
+            ++serv_nb;
+        }
+    }
+
+    /* core and priority of each thread (optional) */
+    for (i = 0; i < THREAD_NB; ++i) {
+        thread_obj = json_object_get_object(json_object_get_object(conf_obj, "threads"), thread_name[i]);
+        if (thread_obj == NULL) {
+            continue;
+        }
+        val = json_object_get_value(thread_obj, "core");
+        if (val != NULL) {
+            thread_cfg[i].core = (int)json_value_get_number(val);
+        }
+        val = json_object_get_value(thread_obj, "priority");
+        if (val != NULL) {
+            thread_cfg[i].prio = (int)json_value_get_number(val);
+        }
+        LOGCAT_INFO(CONFIG, "[main] %s thread is configured to core %d, priority %d\n", thread_name[i], thread_cfg[i].core, thread_cfg[i].prio);
+    }
+
+    /* get keep-alive interval (in seconds) for downstream (optional) */
+    val = json_object_get_value(conf_obj, "keepalive_interval");
+    if (val != NULL) {
+        keepalive_time = (int)json_value_get_number(val);
+        LOGCAT_INFO(CONFIG, "[main] downstream keep-alive interval is configured to %u seconds\n", keepalive_time);
+    }
+
+    /* get interval (in seconds) for statistics display (optional) */
+    val = json_object_get_value(conf_obj, "stat_interval");
+    if (val != NULL) {
+        stat_interval = (unsigned)json_value_get_number(val);
+        LOGCAT_INFO(CONFIG, "[main] statistics display interval is configured to %u seconds\n", stat_interval);
+    }
+
+    /* get initial time-out value (in ms) and number of retransmissions for upstream datagrams (optional) */
+    val = json_object_get_value(conf_obj, "push_timeout_ms");
+    if (val != NULL) {
+        push_timeout_ms = (uint32_t)json_value_get_number(val);
+        if (push_timeout_ms < PUSH_RTO_MIN_MS) {
+            push_timeout_ms = PUSH_RTO_MIN_MS;
+        } else if (push_timeout_ms > PUSH_RTO_MAX_MS) {
+            push_timeout_ms = PUSH_RTO_MAX_MS;
+        }
+        LOGCAT_INFO(CONFIG, "[main] upstream PUSH_DATA initial time-out is configured to %u ms\n", push_timeout_ms);
+    }
+    val = json_object_get_value(conf_obj, "push_retry");
+    if (val != NULL) {
+        push_retry = (unsigned)json_value_get_number(val);
+        if (push_retry > PUSH_RETRY_MAX) {
+            push_retry = PUSH_RETRY_MAX;
+        }
+        LOGCAT_INFO(CONFIG, "[main] upstream PUSH_DATA is sent up to %u more times when not acknowledged\n", push_retry);
+    }
+
+    /* get max size (in bytes) and max delay (in us) of coalesced upstream datagrams (optional) */
+    val = json_object_get_value(conf_obj, "push_mtu");
+    if (val != NULL) {
+        push_mtu = (int)json_value_get_number(val);
+        if (push_mtu < PUSH_MTU_MIN) {
+            push_mtu = PUSH_MTU_MIN;
+        } else if (push_mtu > PUSH_MTU_MAX) {
+            push_mtu = PUSH_MTU_MAX;
+        }
+        LOGCAT_INFO(CONFIG, "[main] upstream PUSH_DATA max size is configured to %d bytes\n", push_mtu);
+    }
+    val = json_object_get_value(conf_obj, "push_flush_us");
+    if (val != NULL) {
+        push_flush_us = (uint32_t)json_value_get_number(val);
+        LOGCAT_INFO(CONFIG, "[main] upstream packets are coalesced for up to %u us\n", push_flush_us);
+    }
+
+    /* get upstream packet encoding, "json" or "binary" (optional) */
+    str = json_object_get_string(conf_obj, "push_format");
+    if (str != NULL) {
+        if (!strcmp(str, "binary")) {
+            push_binary = true;
+        } else if (strcmp(str, "json")) {
+            LOGCAT_WARN(CONFIG, "[main] unknown push_format \"%s\", using json\n", str);
+        }
+        LOGCAT_INFO(CONFIG, "[main] upstream packets are sent as %s\n", push_binary ? "binary records" : "JSON rxpk objects");
+    }
+
+    /* packet filtering parameters */
+    val = json_object_get_value(conf_obj, "forward_crc_valid");
+    if (json_value_get_type(val) == JSONBoolean) {
+        fwd_valid_pkt = (bool)json_value_get_boolean(val);
+    }
+    LOGCAT_INFO(CONFIG, "[main] packets received with a valid CRC will%s be forwarded\n", (fwd_valid_pkt ? "" : " NOT"));
+    val = json_object_get_value(conf_obj, "forward_crc_error");
+    if (json_value_get_type(val) == JSONBoolean) {
+        fwd_error_pkt = (bool)json_value_get_boolean(val);
+    }
+    LOGCAT_INFO(CONFIG, "[main] packets received with a CRC error will%s be forwarded\n", (fwd_error_pkt ? "" : " NOT"));
+    val = json_object_get_value(conf_obj, "forward_crc_disabled");
+    if (json_value_get_type(val) == JSONBoolean) {
+        fwd_nocrc_pkt = (bool)json_value_get_boolean(val);
+    }
+    LOGCAT_INFO(CONFIG, "[main] packets received with no CRC will%s be forwarded\n", (fwd_nocrc_pkt ? "" : " NOT"));
+
+    /* Auto-quit threshold (optional) */
+    val = json_object_get_value(conf_obj, "autoquit_threshold");
+    if (val != NULL) {
+        autoquit_threshold = (uint32_t)json_value_get_number(val);
+        LOGCAT_INFO(CONFIG, "[main] Auto-quit after %u non-acknowledged PULL_DATA\n", autoquit_threshold);
+    }
+
+    /* store-and-forward of uplinks during backhaul outages (optional) */
+    str = json_object_get_string(conf_obj, "store_path");
+    if (str != NULL) {
+        strncpy(store_path, str, sizeof store_path - 1);
+        LOGCAT_INFO(CONFIG, "[main] uplinks not acknowledged will be stored in \"%s\"\n", store_path);
+    }
+    val = json_object_get_value(conf_obj, "store_size_kb");
+    if (val != NULL) {
+        store_size = 1024 * (uint32_t)json_value_get_number(val);
+        LOGCAT_INFO(CONFIG, "[main] uplink store size is configured to %u bytes\n", store_size);
+    }
+    val = json_object_get_value(conf_obj, "store_replay_rate");
+    if (val != NULL) {
+        store_replay_rate = (unsigned)json_value_get_number(val);
+        if (store_replay_rate == 0) {
+            store_replay_rate = 1;
+        }
+        LOGCAT_INFO(CONFIG, "[main] stored uplinks are replayed at %u packets/s\n", store_replay_rate);
+    }
+
+    /* capture of the received packets, or replay of a capture instead of the concentrator (optional) */
+    str = json_object_get_string(conf_obj, "capture_path");
+    if (str != NULL) {
+        strncpy(capture_path, str, sizeof capture_path - 1);
+        LOGCAT_INFO(CONFIG, "[main] received packets will be captured to \"%s\"\n", capture_path);
+    }
+    val = json_object_get_value(conf_obj, "capture_size_kb");
+    if (val != NULL) {
+        capture_size = 1024 * (uint32_t)json_value_get_number(val);
+        LOGCAT_INFO(CONFIG, "[main] capture size is limited to %u bytes\n", capture_size);
+    }
+    str = json_object_get_string(conf_obj, "replay_path");
+    if (str != NULL) {
+        strncpy(replay_path, str, sizeof replay_path - 1);
+        LOGCAT_INFO(CONFIG, "[main] packets will be replayed from \"%s\" instead of the concentrator\n", replay_path);
+    }
+    val = json_object_get_value(conf_obj, "replay_speed");
+    if (val != NULL) {
+        replay_speed = json_value_get_number(val);
+        if (replay_speed < 0) {
+            replay_speed = 0;
+        }
+    }
+    val = json_object_get_value(conf_obj, "replay_loop");
+    if (json_value_get_type(val) == JSONBoolean) {
+        replay_loop = (bool)json_value_get_boolean(val);
+    }
+
+    /* per-device link quality (optional) */
+    val = json_object_get_value(conf_obj, "device_table_size");
+    if (val != NULL) {
+        dev_max = (uint32_t)json_value_get_number(val);
+        LOGCAT_INFO(CONFIG, "[main] link quality of up to %u devices is tracked\n", dev_max);
+    }
+    val = json_object_get_value(conf_obj, "adr_margin");
+    if (val != NULL) {
+        adr_margin = (float)json_value_get_number(val);
+        LOGCAT_INFO(CONFIG, "[main] data rate recommendations keep a %.1f dB margin\n", adr_margin);
+    }
+    str = json_object_get_string(conf_obj, "device_table_path");
+    if (str != NULL) {
+        strncpy(dev_path, str, sizeof dev_path - 1);
+        LOGCAT_INFO(CONFIG, "[main] device table will be written to \"%s\"\n", dev_path);
+    }
+
+    /* repeater on a dedicated TX channel (optional) */
+    val = json_object_dotget_value(conf_obj, "repeater.enable");
+    if (json_value_get_type(val) == JSONBoolean) {
+        relay_enabled = (bool)json_value_get_boolean(val);
+    }
+    if (relay_enabled) {
+        val = json_object_dotget_value(conf_obj, "repeater.freq");
+        if (val != NULL) {
+            relay_cfg.freq_hz = (uint32_t)json_value_get_number(val);
+        }
+        val = json_object_dotget_value(conf_obj, "repeater.radio");
+        if (val != NULL) {
+            relay_cfg.rf_chain = (uint8_t)json_value_get_number(val);
+        }
+        val = json_object_dotget_value(conf_obj, "repeater.power");
+        if (val != NULL) {
+            relay_cfg.rf_power = (int8_t)json_value_get_number(val);
+        }
+        val = json_object_dotget_value(conf_obj, "repeater.spread_factor");
+        if (val != NULL) {
+            ull = (unsigned long long)json_value_get_number(val);
+            relay_cfg.datarate = ((ull >= 7) && (ull <= 12)) ? (DR_LORA_SF7 << (ull - 7)) : 0;
+        }
+        val = json_object_dotget_value(conf_obj, "repeater.duty_cycle");
+        if (val != NULL) {
+            relay_cfg.duty_permil = (uint16_t)(10 * json_value_get_number(val));
+        }
+        val = json_object_dotget_value(conf_obj, "repeater.guard_ms");
+        if (val != NULL) {
+            relay_cfg.guard_ms = (uint16_t)json_value_get_number(val);
+        }
+        val = json_object_dotget_value(conf_obj, "repeater.backoff_ms");
+        if (val != NULL) {
+            relay_cfg.backoff_ms = (uint16_t)json_value_get_number(val);
+        }
+        val = json_object_dotget_value(conf_obj, "repeater.hop_limit");
+        if (val != NULL) {
+            relay_hop_limit = (uint8_t)json_value_get_number(val);
+            relay_hop_limit = (relay_hop_limit > RELAYNET_HOP_MAX) ? RELAYNET_HOP_MAX : relay_hop_limit;
+        }
+        val = json_object_dotget_value(conf_obj, "repeater.node_id");
+        relay_node_id = (val != NULL) ? (uint16_t)json_value_get_number(val) : (uint16_t)lgwm;
+        val = json_object_dotget_value(conf_obj, "repeater.sink");
+        if (json_value_get_type(val) == JSONBoolean) {
+            relay_sink = (bool)json_value_get_boolean(val);
+        }
+        if (relay_hop_limit > 0) {
+            LOGCAT_INFO(CONFIG, "[main] multi-hop relay node %u%s, up to %u hops\n", relay_node_id, relay_sink ? " (sink)" : "", relay_hop_limit);
+        }
+        val = json_object_dotget_value(conf_obj, "repeater.tdma.enable");
+        if (json_value_get_type(val) == JSONBoolean) {
+            tdma_enabled = (bool)json_value_get_boolean(val);
+        }
+        if (tdma_enabled) {
+            val = json_object_dotget_value(conf_obj, "repeater.tdma.period");
+            if (val != NULL) {
+                tdma_cfg.period_s = (uint16_t)json_value_get_number(val);
+            }
+            val = json_object_dotget_value(conf_obj, "repeater.tdma.beacon_ms");
+            if (val != NULL) {
+                tdma_cfg.beacon_ms = (uint16_t)json_value_get_number(val);
+            }
+            val = json_object_dotget_value(conf_obj, "repeater.tdma.slot_ms");
+            if (val != NULL) {
+                tdma_cfg.slot_ms = (uint16_t)json_value_get_number(val);
+            }
+            val = json_object_dotget_value(conf_obj, "repeater.tdma.device_ms");
+            if (val != NULL) {
+                tdma_cfg.dev_ms = (uint16_t)json_value_get_number(val);
+            }
+            val = json_object_dotget_value(conf_obj, "repeater.tdma.slots");
+            if (val != NULL) {
+                tdma_cfg.nb_slot = (uint8_t)json_value_get_number(val);
+            }
+            if (tdma_cfg_valid(&tdma_cfg)) {
+                LOGCAT_INFO(CONFIG, "[main] time-slotted schedule: beacon every %u s, %u slots of %u ms\n", tdma_cfg.period_s, tdma_cfg.nb_slot, tdma_cfg.slot_ms);
+            } else {
+                LOGCAT_ERROR(CONFIG, "[main] %u slots of %u ms do not fit in a %u s superframe, time-slotted schedule disabled\n", tdma_cfg.nb_slot, tdma_cfg.slot_ms, tdma_cfg.period_s);
+                tdma_enabled = false;
+            }
+        }
+        if ((relay_cfg.rf_chain >= LGW_RF_CHAIN_NB) || (relay_cfg.freq_hz < tx_freq_min[relay_cfg.rf_chain]) || (relay_cfg.freq_hz > tx_freq_max[relay_cfg.rf_chain])) {
+            LOGCAT_ERROR(CONFIG, "[main] repeater frequency %u Hz is not in the TX range of radio %u, repeater disabled\n", relay_cfg.freq_hz, relay_cfg.rf_chain);
+            relay_enabled = false;
+        } else {
+            LOGCAT_INFO(CONFIG, "[main] packets received are repeated on %u Hz, %d dBm, %.1f%% duty cycle\n", relay_cfg.freq_hz, relay_cfg.rf_power, relay_cfg.duty_permil / 10.0);
+        }
+    }
+
+    /* per-stage processing time and latency report (optional) */
+    str = json_object_get_string(conf_obj, "bench_path");
+    if (str != NULL) {
+#if FWD_BENCH
+        strncpy(bench_path, str, sizeof bench_path - 1);
+        bench_enabled = true;
+        LOGCAT_INFO(CONFIG, "[main] benchmark results will be appended to \"%s\"\n", bench_path);
+#else
+        LOGCAT_WARN(CONFIG, "[main] bench_path ignored, the forwarder is built without FWD_BENCH\n");
+#endif
+    }
+
+    /* free JSON parsing data structure */
+    json_value_free(root_val);
+    return 0;
+}
+
 static double time_diff(struct timeval x , struct timeval y)
 {
     double x_ms , y_ms , diff;
@@ -616,217 +1361,2092 @@ static void obtain_time(void)
     int retry = 0;
     const int retry_count = 10;
     while(!mach_is_rtc_synced() && ++retry < retry_count) {
-        MSG_INFO("[main] Waiting for system time to be set... (%d/%d)\n", retry, retry_count);
+        LOGCAT_INFO(CONFIG, "[main] Waiting for system time to be set... (%d/%d)\n", retry, retry_count);
         vTaskDelay(2000 / portTICK_PERIOD_MS);
         time(&now);
         localtime_r(&now, &timeinfo);
     }
     if(retry == retry_count)
     {
-        MSG_ERROR("[main] Failed to set system time.. please Sync time via an NTP server using RTC module.!\n");
+        LOGCAT_ERROR(CONFIG, "[main] Failed to set system time.. please Sync time via an NTP server using RTC module.!\n");
         exit(EXIT_FAILURE);
     }
 
 }
 
-//tx_ack not there
+static inline uint64_t bench_ns(void) {
+    struct timespec ts;
 
-void lora_gw_init(const char* global_conf) {
-    MSG_INFO("lora_gw_init() start fh=%u high=%u LORA_GW_STACK_SIZE=%u\n", xPortGetFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL), LORA_GW_STACK_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
 
-    quit_sig = false;
-    exit_sig = false;
+#if FWD_BENCH
+/* account the processing time of nb items of a stage, started at t0 */
+static void bench_add(enum bench_stage_e stage, uint32_t nb, uint64_t t0) {
+    uint64_t ns = bench_ns() - t0;
+    struct bench_stage_s *b = &meas_bench_stage[stage];
+
+    pthread_mutex_lock(&mx_meas_up);
+    b->nb += nb;
+    b->sum_ns += ns;
+    if (ns / nb > b->max_ns) {
+        b->max_ns = (uint32_t)(ns / nb);
+    }
+    pthread_mutex_unlock(&mx_meas_up);
+}
 
-    xTaskCreatePinnedToCore(TASK_lora_gw, "LoraGW",
-        LORA_GW_STACK_SIZE / sizeof(StackType_t),
-        (void *) global_conf,
-        LORA_GW_PRIORITY, &xLoraGwTaskHndl, 1);
-    MSG_INFO("lora_gw_init() done fh=%u high=%u\n", xPortGetFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL));
+/* account the time between the reception of the packets of a datagram and its first transmission, mx_meas_up held */
+static void bench_add_latency(const struct push_dgram_s *d, const struct timeval *sent) {
+    uint32_t lat_us;
+    int i, k;
+
+    for (i = 0; i < d->nb_pkt; ++i) {
+        lat_us = (uint32_t)(time_diff(d->rx_time[i], *sent) * 1e6);
+        for (k = 0; (k < BENCH_LAT_NB - 1) && ((lat_us >> (k + 1)) != 0); ++k);
+        meas_bench_lat[k] += 1;
+        meas_bench_lat_sum += lat_us;
+        if (lat_us > meas_bench_lat_max) {
+            meas_bench_lat_max = lat_us;
+        }
+    }
 }
 
-void pygate_reset() {
-    MSG_INFO("pygate_reset\n");
+/* upper bound of the latency bucket holding the given percentile, 0 without samples */
+static uint32_t bench_percentile(const uint32_t *hist, uint32_t nb, unsigned percent) {
+    uint32_t acc = 0;
+    int k;
 
-    // pull sx1257 and sx1308 reset high, the PIC FW should power cycle the ESP32 as a result
-    pin_obj_t* sx1308_rst = SX1308_RST_PIN;
-    pin_config(sx1308_rst, -1, -1, GPIO_MODE_OUTPUT, MACHPIN_PULL_NONE, 0);
-    pin_obj_t* sx1257_rst = (&PIN_MODULE_P8);
-    pin_config(sx1257_rst, -1, -1, GPIO_MODE_OUTPUT, MACHPIN_PULL_NONE, 0);
+    if (nb == 0) {
+        return 0;
+    }
+    for (k = 0; k < BENCH_LAT_NB - 1; ++k) {
+        acc += hist[k];
+        if ((uint64_t)acc * 100 >= (uint64_t)nb * percent) {
+            break;
+        }
+    }
+    return (2u << k) - 1;
+}
 
-    sx1308_rst->value = 1;
-    sx1257_rst->value = 1;
+static void bench_stage_json(FILE *f, const char *name, const struct bench_stage_s *b, bool last) {
+    fprintf(f, "\"%s\":{\"nb\":%u,\"avg_ns\":%llu,\"max_ns\":%u}%s", name, b->nb, (b->nb > 0) ? (unsigned long long)(b->sum_ns / b->nb) : 0ULL, b->max_ns, last ? "" : ",");
+}
 
-    pin_set_value(sx1308_rst);
-    pin_set_value(sx1257_rst);
+/* append the measurements of one statistics interval to bench_path, as one JSON object per line */
+static void bench_report(const char *timestamp, uint32_t nb_rx, uint32_t nb_fwd, const struct bench_stage_s *stage, const uint32_t *lat, uint64_t lat_sum, uint32_t lat_max) {
+    struct logcat_stat_s log;
+    uint32_t lat_nb = 0;
+    FILE *f;
+    int k;
 
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
+    for (k = 0; k < BENCH_LAT_NB; ++k) {
+        lat_nb += lat[k];
+    }
+    f = fopen(bench_path, "a");
+    if (f == NULL) {
+        LOGCAT_ERROR(MAIN, "[main] failed to open benchmark report %s\n", bench_path);
+        return;
+    }
+    fprintf(f, "{\"time\":\"%s\",\"build\":\"%s\",\"format\":\"%s\",\"conf_parse_us\":%u,\"rx\":%u,\"fwd\":%u,", timestamp, VERSION_STRING, push_binary ? "binary" : "json", bench_conf_us, nb_rx, nb_fwd);
+    bench_stage_json(f, "fetch", &stage[BENCH_FETCH], false);
+    bench_stage_json(f, "decode", &stage[BENCH_DECODE], false);
+    bench_stage_json(f, "serialize", &stage[BENCH_SERIALIZE], false);
+    bench_stage_json(f, "stats", &stage[BENCH_STATS], false);
+    bench_stage_json(f, "log", &stage[BENCH_LOG], false);
+    logcat_get_stat(&log);
+    fprintf(f, "\"log_level\":{");
+    for (k = 0; k < LOGCAT_NB; ++k) {
+        fprintf(f, "\"%s\":%d%s", logcat_name(k), logcat_level[k], (k < LOGCAT_NB - 1) ? "," : "");
+    }
+    fprintf(f, "},\"log_msgs\":%u,\"log_dropped\":%u,", log.nb_put, log.nb_dropped);
+    fprintf(f, "\"latency_us\":{\"nb\":%u,\"avg\":%llu,\"p50\":%u,\"p99\":%u,\"max\":%u}}\n", lat_nb, (lat_nb > 0) ? (unsigned long long)(lat_sum / lat_nb) : 0ULL, bench_percentile(lat, lat_nb, 50), bench_percentile(lat, lat_nb, 99), lat_max);
+    fclose(f);
+}
+#endif
 
-    // if this is still being executed, then it seems the ESP32 reset did not take place
-    // set the two reset lines low again and stop the lora gw task, to make sure we return to a defined state
-    MSG_ERROR("pygate_reset failed to reset\n");
-    sx1308_rst->value = 0;
-    sx1257_rst->value = 0;
-    pin_set_value(sx1308_rst);
-    pin_set_value(sx1257_rst);
+static int thread_core(void) {
+    return xPortGetCoreID();
+}
 
-    if (xLoraGwTaskHndl){
-        vTaskDelete(xLoraGwTaskHndl);
-        xLoraGwTaskHndl = NULL;
-    }
+/* account the time a thread spent waiting since t0 */
+static void thread_waited(enum thread_id_e id, uint64_t t0) {
+    uint64_t ns = bench_ns() - t0;
+    int core = thread_core();
 
+    pthread_mutex_lock(&mx_meas_up);
+    meas_thread_wait_ns[id] += ns;
+    meas_thread_core[id] = core;
+    pthread_mutex_unlock(&mx_meas_up);
 }
 
-int lora_gw_get_debug_level(){
-    return debug_level;
+/* start a thread on the core and with the priority configured for it */
+static int thread_start(pthread_t *thrid, enum thread_id_e id, void (*fn)(void)) {
+    const struct thread_cfg_s *c = &thread_cfg[id];
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+
+    cfg.stack_size = 10 * 1024;
+    cfg.prio = c->prio;
+    cfg.inherit_cfg = false;
+    cfg.thread_name = thread_name[id];
+    cfg.pin_to_core = (c->core >= 0) ? c->core : tskNO_AFFINITY;
+    esp_pthread_set_cfg(&cfg);
+    return pthread_create(thrid, NULL, (void * (*)(void *))fn, NULL);
 }
 
-void lora_gw_set_debug_level(int level){
-    debug_level = level;
+/* apply the configured priority to the calling thread */
+static void thread_place_self(enum thread_id_e id) {
+    const struct thread_cfg_s *c = &thread_cfg[id];
+
+    /* a FreeRTOS task cannot change core, lora_gw_init decides it */
+    if ((c->core >= 0) && (c->core != xPortGetCoreID())) {
+        LOGCAT_WARN(MAIN, "[main] %s thread runs on core %d, not %d\n", thread_name[id], xPortGetCoreID(), c->core);
+    }
+    vTaskPrioritySet(NULL, c->prio);
 }
 
-void TASK_lora_gw(void *pvParameters) {
-	int i;
-	int x;
-	uint32_t cp_nb_rx_rcv;
-	mp_hal_set_signal_exit_cb(sig_handler);
-    	machine_register_pygate_sig_handler(sig_handler);
-    	mp_hal_set_interrupt_char(3);
+/* heap, stacks and buffers, the heap is shared with MicroPython */
+static void mem_report(void) {
+    int i;
+
+    mp_printf(&mp_plat_print, "# heap: %u bytes free, %u min, largest free block %u\n", (unsigned)xPortGetFreeHeapSize(), (unsigned)xPortGetMinimumEverFreeHeapSize(), (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    for (i = 0; i < THREAD_NB; ++i) {
+        if (thread_task[i] != NULL) {
+            mp_printf(&mp_plat_print, "# %s thread: %u bytes of stack never used\n", thread_name[i], (unsigned)uxTaskGetStackHighWaterMark(thread_task[i]));
+        }
+    }
+    mp_printf(&mp_plat_print, "# buffers: %u bytes, configuration parser %u bytes peak, %u heap allocations\n", (unsigned)sizeof *mem, (unsigned)conf_arena_peak, conf_heap_nb);
+}
+
+/* (re)allocate the device table only when its configured size changed */
+static void dev_start(void) {
+    size_t size = devtable_size(dev_max);
+
+    devtable_enabled = false;
+    if (dev_max == 0) {
+        return;
+    }
+    if (size != devtable_buf_size) {
+        free(devtable_buf);
+        devtable_buf = malloc(size);
+        devtable_buf_size = (devtable_buf != NULL) ? size : 0;
+    }
+    if (devtable_buf == NULL) {
+        LOGCAT_ERROR(MAIN, "[main] failed to allocate %u bytes for the device table\n", (unsigned)size);
+        return;
+    }
+    devtable_init(&devtable, devtable_buf, dev_max);
+    devtable_enabled = true;
+}
+
+/* data rate recommendation, once enough uplinks were heard for the SNR average to settle */
+static bool dev_adr(const struct devtable_entry_s *d, struct adr_rec_s *rec) {
+    return (d->nb_pkt >= ADR_PKT_MIN) && (adr_recommend(d->snr_avg / 16.0f, d->sf_last, adr_margin, rec) == 0);
+}
+
+static void dev_json(FILE *f, const struct devtable_entry_s *d) {
+    struct adr_rec_s rec;
+
+    fprintf(f, "{\"devaddr\":\"%08X\",\"last\":%u,\"pkts\":%u,\"lost\":%u,\"dup\":%u,\"reset\":%u,\"rssi\":%.1f,\"lsnr\":%.1f,\"sf\":[%u,%u,%u,%u,%u,%u]", d->dev_addr, d->last_seen, d->nb_pkt, d->nb_lost, d->nb_dup, d->nb_reset, d->rssi_avg / 16.0, d->snr_avg / 16.0, d->sf_nb[0], d->sf_nb[1], d->sf_nb[2], d->sf_nb[3], d->sf_nb[4], d->sf_nb[5]);
+    if (dev_adr(d, &rec)) {
+        fprintf(f, ",\"adr\":{\"sf\":%u,\"txpow\":%u,\"margin\":%.1f}", rec.sf, rec.txpow, rec.margin_db);
+    }
+    fputs("}\n", f);
+}
+
+/* most recently heard devices in the statistics, the whole table in dev_path */
+static void dev_report(time_t now) {
+    const struct devtable_entry_s *d = NULL;
+    struct adr_rec_s rec;
+    uint64_t airtime_us = 0; /* of the uplinks heard */
+    uint64_t airtime_adr_us = 0; /* of the same uplinks at the recommended data rates */
+    uint32_t nb_adr = 0;
+    uint32_t nb_faster = 0;
+    uint32_t nb_slower = 0;
+    FILE *f = NULL;
+    int i;
+
+    if (dev_path[0] != '\0') {
+        f = fopen(dev_path, "w");
+        if (f == NULL) {
+            LOGCAT_ERROR(MAIN, "[main] failed to open device table %s\n", dev_path);
+        }
+    }
+    pthread_mutex_lock(&mx_devtable);
+    mp_printf(&mp_plat_print, "# devices: %u tracked, %u evicted\n", devtable.nb, devtable.nb_evicted);
+    for (i = 0; (d = devtable_next(&devtable, d)) != NULL; ++i) {
+        if (i < DEV_STATS_NB) {
+            mp_printf(&mp_plat_print, "# device %08X: %u uplinks, %.1f%% lost, RSSI %.1f dBm, SNR %.1f dB, heard %u s ago\n", d->dev_addr, d->nb_pkt, 100.0 * d->nb_lost / (d->nb_pkt + d->nb_lost), d->rssi_avg / 16.0, d->snr_avg / 16.0, (unsigned)(now - d->last_seen));
+        }
+        if (dev_adr(d, &rec)) {
+            nb_adr += 1;
+            nb_faster += (rec.sf < d->sf_last) ? 1 : 0;
+            nb_slower += (rec.sf > d->sf_last) ? 1 : 0;
+            airtime_us += (uint64_t)d->nb_pkt * adr_airtime_us(d->sf_last, d->size_last);
+            airtime_adr_us += (uint64_t)d->nb_pkt * adr_airtime_us(rec.sf, d->size_last);
+        }
+        if (f != NULL) {
+            dev_json(f, d);
+        }
+    }
+    pthread_mutex_unlock(&mx_devtable);
+    if (nb_adr > 0) {
+        mp_printf(&mp_plat_print, "# ADR: %u devices rated, %u could use a faster data rate, %u need a slower one, airtime %+.1f%%\n", nb_adr, nb_faster, nb_slower, 100.0 * ((double)airtime_adr_us - (double)airtime_us) / airtime_us);
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+}
+
+/* loopback socket connected to itself, a datagram sent on it wakes up push_wait */
+static int open_sock_wake(void) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof addr;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == -1) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(sock, (struct sockaddr *)&addr, sizeof addr) != 0) || (getsockname(sock, (struct sockaddr *)&addr, &len) != 0) || (connect(sock, (struct sockaddr *)&addr, len) != 0)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* append fetched packets to the ring, the caller checked there is room for them */
+/* packets are timestamped from their count_us once the concentrator counter is mapped to UTC, with the fetch time otherwise */
+static void rx_ring_push(int nb_pkt, const struct lgw_pkt_rx_s *pkts, const struct timeval *rx_time) {
+    bool was_empty;
+    unsigned k;
+    int i;
+
+    pthread_mutex_lock(&mx_rx_ring);
+    was_empty = (rx_ring_nb == 0);
+    for (i = 0; (i < nb_pkt) && (rx_ring_nb < RX_RING_NB); ++i) {
+        k = (rx_ring_head + rx_ring_nb) % RX_RING_NB;
+        mem->rx_ring[k] = pkts[i];
+        if (capture_replay_enabled || (clocksync_to_utc(&clocksync, pkts[i].count_us, &mem->rx_ring_time[k]) != 0)) {
+            mem->rx_ring_time[k] = *rx_time;
+        }
+        ++rx_ring_nb;
+    }
+    pthread_mutex_unlock(&mx_rx_ring);
+    if (was_empty && (sock_wake != -1)) {
+        send(sock_wake, "", 1, MSG_DONTWAIT);
+    }
+}
+
+/* take the oldest packets out of the ring, return their number */
+static int rx_ring_pop(int max_pkt, struct lgw_pkt_rx_s *pkts, struct timeval *rx_time) {
+    int i;
+
+    pthread_mutex_lock(&mx_rx_ring);
+    for (i = 0; (i < max_pkt) && (rx_ring_nb > 0); ++i) {
+        pkts[i] = mem->rx_ring[rx_ring_head];
+        rx_time[i] = mem->rx_ring_time[rx_ring_head];
+        rx_ring_head = (rx_ring_head + 1) % RX_RING_NB;
+        --rx_ring_nb;
+    }
+    if (i > 0) {
+        pthread_cond_signal(&cv_rx_ring);
+    }
+    pthread_mutex_unlock(&mx_rx_ring);
+    return i;
+}
+
+/* start a new PUSH_DATA datagram: header, fresh tokens and beginning of the rxpk array or of the binary records */
+static void dgram_init(struct push_dgram_s *d) {
+    int s;
+
+    for (s = 0; s < SERV_MAX; ++s) {
+        d->token_h[s] = (uint8_t)rand(); /* random token */
+        d->token_l[s] = (uint8_t)rand(); /* random token */
+    }
+    d->buff[0] = PROTOCOL_VERSION;
+    d->buff[1] = d->token_h[0]; /* patched per server when sent */
+    d->buff[2] = d->token_l[0];
+    d->buff[3] = push_binary ? PKT_PUSH_BIN : PKT_PUSH_DATA;
+    *(uint32_t *)(d->buff + 4) = net_mac_h;
+    *(uint32_t *)(d->buff + 8) = net_mac_l;
+    if (push_binary) {
+        d->buff[12] = UPLINK_BIN_VERSION;
+        d->buff[13] = 0; /* number of records */
+        d->len = 12 + UPLINK_BIN_HDR_SIZE;
+    } else {
+        memcpy((void *)(d->buff + 12), (void *)"{\"rxpk\":[", 9);
+        d->len = 12 + 9; /* 12-byte header + start of JSON structure */
+    }
+    d->nb_pkt = 0;
+    d->serv_mask = 0;
+    d->ack_mask = 0;
+    d->lost_mask = 0;
+    d->refcnt = 0;
+    d->replay = false;
+    d->state = DGRAM_FILLING;
+}
+
+/* serialize a packet at the end of a datagram, return 0 if added, 1 if the datagram is full, -1 if the packet cannot be sent */
+static int dgram_add(struct push_dgram_s *d, const struct lgw_pkt_rx_s *p, const struct timeval *rx_time) {
+    int sep = (d->nb_pkt > 0) ? 1 : 0;
+    int j;
+
+    if (d->nb_pkt >= PUSH_PKT_MAX) {
+        return 1;
+    }
+    if (push_binary) {
+        j = uplink_bin_encode(p, rx_time, d->buff + d->len, push_mtu - d->len);
+        if (j < 0) {
+            return (d->nb_pkt > 0) ? 1 : -1;
+        }
+        d->len += j;
+        d->buff[13] = (uint8_t)(d->nb_pkt + 1);
+    } else {
+        /* keep room for the separator and the closing "]}" */
+        j = rxpk_serialize(p, rx_time, (char *)(d->buff + d->len + sep), push_mtu - d->len - sep - 2 + 1);
+        if (j < 0) {
+            return (d->nb_pkt > 0) ? 1 : -1;
+        }
+        if (sep) {
+            d->buff[d->len] = ',';
+        }
+        d->len += sep + j;
+    }
+    if (d->nb_pkt == 0) {
+        d->first = *rx_time;
+    }
+    d->pkts[d->nb_pkt] = *p;
+    d->rx_time[d->nb_pkt] = *rx_time;
+    ++d->nb_pkt;
+    return 0;
+}
+
+/* terminate the JSON payload of a datagram, with the status report if asked and if it fits */
+static bool dgram_close(struct push_dgram_s *d, bool send_report) {
+    int sep = (d->nb_pkt > 0) ? 1 : 0;
+    int j;
+
+    if (push_binary) {
+        if (d->nb_pkt > 0) {
+            return false; /* binary records cannot carry the JSON status report */
+        }
+        /* no packet, the datagram becomes a JSON PUSH_DATA for the report only */
+        d->buff[3] = PKT_PUSH_DATA;
+        d->buff[12] = '{';
+        d->len = 12 + 1;
+    } else if (d->nb_pkt == 0) {
+        d->len -= 8; /* removes "rxpk":[ */
+    } else {
+        d->buff[d->len++] = ']';
+    }
+    if (send_report == true) {
+        pthread_mutex_lock(&mx_stat_rep);
+        j = snprintf((char *)(d->buff + d->len + sep), push_mtu - d->len - sep, "%s", status_report);
+        pthread_mutex_unlock(&mx_stat_rep);
+        if ((j < 0) || (j >= (push_mtu - d->len - sep))) {
+            send_report = false; /* does not fit */
+        } else {
+            if (sep) {
+                d->buff[d->len] = ',';
+            }
+            d->len += sep + j;
+        }
+    }
+    /* end of JSON datagram payload */
+    d->buff[d->len++] = '}';
+    d->buff[d->len] = 0; /* add string terminator, for safety */
+    return send_report;
+}
+
+/* send datagrams to one server, the token of the server is written in each one */
+static void send_dgrams(int s, struct push_dgram_s **d, int nb_dgram) {
+    int i;
+
+    for (i = 0; i < nb_dgram; ++i) {
+        d[i]->buff[1] = d[i]->token_h[s];
+        d[i]->buff[2] = d[i]->token_l[s];
+        send(serv[s].sock_up, (void *)d[i]->buff, d[i]->len, 0);
+    }
+}
+
+/* servers a datagram can be sent to now: live ones, the primary unless its uplinks are stored, the others once per STORE_PROBE_MS */
+static uint32_t serv_send_mask(const struct timeval *now) {
+    uint32_t mask = 0;
+    int s;
+
+    for (s = 0; s < serv_nb; ++s) {
+        if (serv[s].sock_up == -1) {
+            continue;
+        }
+        if ((s == SERV_PRIMARY) && !serv[s].live && store_enabled) {
+            continue; /* probed by push_replay, live uplinks are stored meanwhile */
+        }
+        if (serv[s].live || (s == SERV_PRIMARY) || (time_diff(serv[s].probe_next, *now) >= 0)) {
+            mask |= 1u << s;
+        }
+    }
+    return mask;
+}
+
+/* record the outcome of an exchange with a server, return true if the server is usable */
+static bool serv_update(int s, bool acked) {
+    struct serv_s *sv = &serv[s];
+
+    if (acked) {
+        if (!sv->live) {
+            if ((s == SERV_PRIMARY) && store_enabled) {
+                LOGCAT_INFO(UP, "[up  ] PUSH_ACK received again, replaying %u stored uplinks\n", upqueue_pending(&mem->upqueue));
+                gettimeofday(&replay_next, NULL); /* no need to wait for the next probe */
+            } else {
+                LOGCAT_INFO(UP, "[up  ] server %d acknowledges PUSH_DATA again\n", s);
+            }
+        }
+        sv->ack_loss = 0;
+        sv->live = true;
+    } else if (++sv->ack_loss >= STORE_ACK_LOSS_MAX) {
+        if (sv->live) {
+            LOGCAT_WARN(UP, "[up  ] no PUSH_ACK from server %d for %u datagrams%s\n", s, sv->ack_loss, ((s == SERV_PRIMARY) && store_enabled) ? ", storing uplinks" : "");
+        }
+        sv->live = false;
+        gettimeofday(&sv->probe_next, NULL);
+        sv->probe_next.tv_sec += STORE_PROBE_MS / 1000;
+    }
+    return sv->live;
+}
+
+/* retransmission time-out of a server for a datagram already sent 'retries' more times, in us */
+static uint32_t serv_rto(const struct serv_s *sv, unsigned retries) {
+    uint32_t rto_us = (sv->rto_us != 0) ? sv->rto_us : push_timeout_ms * 1000;
+
+    rto_us <<= retries; /* exponential back-off */
+    return (rto_us > PUSH_RTO_MAX_MS * 1000) ? PUSH_RTO_MAX_MS * 1000 : rto_us;
+}
+
+/* update the smoothed round-trip time, its variation and the retransmission time-out (RFC 6298) */
+static void serv_rtt_sample(struct serv_s *sv, uint32_t rtt_us) {
+    uint32_t delta;
+
+    if (sv->rto_us == 0) {
+        sv->srtt_us = rtt_us;
+        sv->rttvar_us = rtt_us / 2;
+    } else {
+        delta = (sv->srtt_us > rtt_us) ? (sv->srtt_us - rtt_us) : (rtt_us - sv->srtt_us);
+        sv->rttvar_us = (3 * sv->rttvar_us + delta) / 4;
+        sv->srtt_us = (7 * sv->srtt_us + rtt_us) / 8;
+    }
+    sv->rto_us = sv->srtt_us + 4 * sv->rttvar_us;
+    if (sv->rto_us < PUSH_RTO_MIN_MS * 1000) {
+        sv->rto_us = PUSH_RTO_MIN_MS * 1000;
+    } else if (sv->rto_us > PUSH_RTO_MAX_MS * 1000) {
+        sv->rto_us = PUSH_RTO_MAX_MS * 1000;
+    }
+}
+
+/* all the fetched records were sent, remove them from the queue if every datagram was acknowledged */
+static void replay_done(void) {
+    if (replay_failed) {
+        upqueue_nack(&mem->upqueue);
+        return;
+    }
+    upqueue_ack(&mem->upqueue);
+    pthread_mutex_lock(&mx_meas_up);
+    meas_up_pkt_replayed += replay_nb_pkt;
+    pthread_mutex_unlock(&mx_meas_up);
+}
+
+/* every server acknowledged the datagram or gave up, count its packets or store them */
+static void push_release(struct push_dgram_s *d) {
+    bool acked = (d->ack_mask & (1u << SERV_PRIMARY)) != 0;
+    int k;
+
+    if (d->replay) {
+        replay_failed |= !acked;
+        if (--replay_inflight == 0) {
+            replay_done();
+        }
+    } else if (acked || !store_enabled) {
+        /* only the primary server gets the uplinks it missed, other servers are best effort */
+        pthread_mutex_lock(&mx_meas_up);
+        for (k = 0; k < d->nb_pkt; ++k) {
+            meas_up_pkt_fwd += 1;
+            meas_up_payload_byte += d->pkts[k].size;
+        }
+        pthread_mutex_unlock(&mx_meas_up);
+    } else {
+        for (k = 0; k < d->nb_pkt; ++k) {
+            upqueue_push(&mem->upqueue, &d->pkts[k], &d->rx_time[k]);
+        }
+    }
+    d->state = DGRAM_FREE;
+}
+
+/* a server did not acknowledge a datagram after all its retransmissions */
+static void push_lost(struct push_dgram_s *d, int s) {
+    d->lost_mask |= 1u << s;
+    serv_update(s, false);
+    if (--d->refcnt == 0) {
+        push_release(d);
+    }
+}
+
+/* stop waiting for the acknowledges of a datagram, as if every server had exhausted its retransmissions */
+static void push_abort(struct push_dgram_s *d) {
+    uint32_t pending = d->serv_mask & ~(d->ack_mask | d->lost_mask);
+    int s;
+
+    for (s = 0; (s < serv_nb) && (d->state == DGRAM_INFLIGHT); ++s) {
+        if (pending & (1u << s)) {
+            push_lost(d, s);
+        }
+    }
+}
+
+/* send datagrams to a set of servers, acknowledges are processed later by push_poll */
+static void push_send(struct push_dgram_s **d, int nb_dgram, uint32_t serv_mask) {
+    struct timeval now;
+    int i, s;
+
+    for (i = 0; i < nb_dgram; ++i) {
+        d[i]->state = DGRAM_INFLIGHT;
+        d[i]->serv_mask = serv_mask;
+        memset(d[i]->retries, 0, sizeof d[i]->retries);
+        gettimeofday(&d[i]->sent[0], NULL); /* age of the datagram, when server 0 is not used */
+    }
+    for (s = 0; s < serv_nb; ++s) {
+        if (!(serv_mask & (1u << s))) {
+            continue;
+        }
+        gettimeofday(&now, NULL);
+        send_dgrams(s, d, nb_dgram);
+        pthread_mutex_lock(&mx_meas_up);
+        for (i = 0; i < nb_dgram; ++i) {
+            d[i]->sent[s] = now;
+            ++d[i]->refcnt;
+            serv[s].dgram_sent += 1;
+            serv[s].network_byte += d[i]->len;
+            if (s == SERV_PRIMARY) {
+                meas_up_dgram_sent += 1;
+                meas_up_network_byte += d[i]->len;
+            }
+#if FWD_BENCH
+            if (bench_enabled && (d[i]->refcnt == 1) && !d[i]->replay) {
+                bench_add_latency(d[i], &now);
+            }
+#endif
+        }
+        pthread_mutex_unlock(&mx_meas_up);
+    }
+    for (i = 0; i < nb_dgram; ++i) {
+        if (d[i]->refcnt == 0) {
+            push_release(d[i]); /* no server to send to */
+        }
+    }
+}
+
+/* read the acknowledges received so far, without blocking */
+static void push_poll(void) {
+    uint8_t buff_ack[32]; /* buffer to receive acknowledges */
+    struct push_dgram_s *d;
+    struct timeval recv_time;
+    uint32_t rtt_us;
+    int j, k, s;
+
+    for (s = 0; s < serv_nb; ++s) {
+        if (serv[s].sock_up == -1) {
+            continue;
+        }
+        while ((j = recv(serv[s].sock_up, (void *)buff_ack, sizeof buff_ack, MSG_DONTWAIT)) >= 0) {
+            if ((j < 4) || (buff_ack[0] != PROTOCOL_VERSION) || (buff_ack[3] != PKT_PUSH_ACK)) {
+                continue; /* ignore invalid non-ACK packet */
+            }
+            gettimeofday(&recv_time, NULL);
+            for (k = 0; k < PUSH_POOL_NB; ++k) {
+                d = &mem->dgram_pool[k];
+                if ((d->state != DGRAM_INFLIGHT) || !(d->serv_mask & (1u << s)) || ((d->ack_mask | d->lost_mask) & (1u << s))) {
+                    continue;
+                }
+                if ((buff_ack[1] != d->token_h[s]) || (buff_ack[2] != d->token_l[s])) {
+                    continue;
+                }
+                d->ack_mask |= 1u << s;
+                rtt_us = (uint32_t)(1e6 * time_diff(d->sent[s], recv_time));
+                pthread_mutex_lock(&mx_meas_up);
+                serv[s].ack_rcv += 1;
+                if (s == SERV_PRIMARY) {
+                    meas_up_ack_rcv += 1;
+                }
+                /* a retransmitted datagram gives an ambiguous round-trip time (Karn's algorithm) */
+                if (d->retries[s] == 0) {
+                    serv_rtt_sample(&serv[s], rtt_us);
+                    if (s == SERV_PRIMARY) {
+                        meas_up_rtt_sum += rtt_us / 1000;
+                        meas_up_rtt_nb += 1;
+                    }
+                }
+                pthread_mutex_unlock(&mx_meas_up);
+                LOGCAT_DEBUG(UP, "[up  ] PUSH_ACK received from server %d in %u ms\n", s, rtt_us / 1000);
+                serv_update(s, true);
+                if (--d->refcnt == 0) {
+                    push_release(d);
+                }
+                break;
+            }
+            /* late or out-of sync ACK packets are ignored */
+        }
+    }
+}
+
+/* send again datagrams not acknowledged within the retransmission time-out, give up after push_retry retransmissions */
+static void push_expire(const struct timeval *now) {
+    struct push_dgram_s *d;
+    uint32_t pending;
+    int k, s;
+
+    for (k = 0; k < PUSH_POOL_NB; ++k) {
+        d = &mem->dgram_pool[k];
+        if (d->state != DGRAM_INFLIGHT) {
+            continue;
+        }
+        pending = d->serv_mask & ~(d->ack_mask | d->lost_mask);
+        for (s = 0; (s < serv_nb) && (d->state == DGRAM_INFLIGHT); ++s) {
+            if (!(pending & (1u << s)) || ((1e6 * time_diff(d->sent[s], *now)) < serv_rto(&serv[s], d->retries[s]))) {
+                continue;
+            }
+            if (d->retries[s] >= push_retry) {
+                push_lost(d, s);
+                continue;
+            }
+            d->retries[s] += 1;
+            d->sent[s] = *now;
+            send_dgrams(s, &d, 1);
+            pthread_mutex_lock(&mx_meas_up);
+            serv[s].retransmit += 1;
+            serv[s].network_byte += d->len;
+            if (s == SERV_PRIMARY) {
+                meas_up_retransmit += 1;
+                meas_up_network_byte += d->len;
+            }
+            pthread_mutex_unlock(&mx_meas_up);
+        }
+    }
+}
+
+/* time until the next retransmission time-out, in us, capped to max_us */
+static long push_next_expiry(const struct timeval *now, long max_us) {
+    struct push_dgram_s *d;
+    long left;
+    int k, s;
+
+    for (k = 0; k < PUSH_POOL_NB; ++k) {
+        d = &mem->dgram_pool[k];
+        if (d->state != DGRAM_INFLIGHT) {
+            continue;
+        }
+        for (s = 0; s < serv_nb; ++s) {
+            if (!(d->serv_mask & ~(d->ack_mask | d->lost_mask) & (1u << s))) {
+                continue;
+            }
+            left = (long)serv_rto(&serv[s], d->retries[s]) - (long)(1e6 * time_diff(d->sent[s], *now));
+            if (left < max_us) {
+                max_us = (left > 0) ? left : 0;
+            }
+        }
+    }
+    return max_us;
+}
+
+/* sleep up to wait_us, waking up as soon as an acknowledge arrives */
+static void push_wait(long wait_us) {
+    struct timeval timeout;
+    fd_set fds;
+    uint64_t t0 = bench_ns();
+    uint8_t buff_wake[8];
+    int sock_max = sock_wake;
+    int s;
+
+    FD_ZERO(&fds);
+    if (sock_wake != -1) {
+        FD_SET(sock_wake, &fds);
+    }
+    for (s = 0; s < serv_nb; ++s) {
+        if (serv[s].sock_up != -1) {
+            FD_SET(serv[s].sock_up, &fds);
+            if (serv[s].sock_up > sock_max) {
+                sock_max = serv[s].sock_up;
+            }
+        }
+    }
+    if (sock_max == -1) {
+        wait_ms(wait_us / 1000);
+        thread_waited(THREAD_FORWARD, t0);
+        return;
+    }
+    timeout.tv_sec = wait_us / 1000000;
+    timeout.tv_usec = wait_us % 1000000;
+    if (select(sock_max + 1, &fds, NULL, NULL, &timeout) > 0) {
+        thread_waited(THREAD_FORWARD, t0);
+        if ((sock_wake != -1) && FD_ISSET(sock_wake, &fds)) {
+            while (recv(sock_wake, buff_wake, sizeof buff_wake, MSG_DONTWAIT) > 0);
+        }
+        push_poll();
+    } else {
+        thread_waited(THREAD_FORWARD, t0);
+    }
+}
+
+/* number of datagrams of the pool neither being coalesced nor waiting for acknowledges */
+static int dgram_nb_free(void) {
+    int nb = 0;
+    int k;
+
+    for (k = 0; k < PUSH_POOL_NB; ++k) {
+        if (mem->dgram_pool[k].state == DGRAM_FREE) {
+            ++nb;
+        }
+    }
+    return nb;
+}
+
+/* take a datagram from the pool, when all of them wait for acknowledges the
+   uplinks are held back until one is acknowledged or lost: the rx ring fills up
+   and thread_fetch leaves the packets in the concentrator */
+static struct push_dgram_s *dgram_alloc(void) {
+    struct push_dgram_s *oldest;
+    struct timeval now;
+    bool held = false;
+    int k;
+
+    for (;;) {
+        oldest = NULL;
+        for (k = 0; k < PUSH_POOL_NB; ++k) {
+            if (mem->dgram_pool[k].state == DGRAM_FREE) {
+                dgram_init(&mem->dgram_pool[k]);
+                return &mem->dgram_pool[k];
+            }
+            if ((mem->dgram_pool[k].state == DGRAM_INFLIGHT) && ((oldest == NULL) || (time_diff(mem->dgram_pool[k].sent[0], oldest->sent[0]) < 0))) {
+                oldest = &mem->dgram_pool[k];
+            }
+        }
+        if (!held) {
+            LOGCAT_WARN(UP, "[up  ] all PUSH_DATA datagrams are waiting for acknowledges, holding the uplinks back\n");
+            pthread_mutex_lock(&mx_meas_up);
+            meas_up_pool_full += 1;
+            pthread_mutex_unlock(&mx_meas_up);
+            held = true;
+        }
+        if (exit_sig || quit_sig) {
+            /* PUSH_DGRAM_NB < PUSH_POOL_NB, there is always a datagram in flight here;
+               it is given up like the ones still in flight when thread_up ends */
+            push_abort(oldest);
+            dgram_init(oldest);
+            return oldest;
+        }
+        gettimeofday(&now, NULL);
+        push_wait(push_next_expiry(&now, FETCH_SLEEP_MS * 1000));
+        gettimeofday(&now, NULL);
+        push_expire(&now);
+    }
+}
+
+/* send the live datagrams being coalesced, packets not acknowledged will go to the persistent queue */
+static void push_flush(int nb_dgram, bool send_report) {
+    struct timeval now;
+    bool report_sent = false;
+    int i;
+
+    while ((nb_dgram > 0) && (push_dgram[nb_dgram - 1]->nb_pkt == 0)) {
+        --nb_dgram; /* trailing empty datagram */
+    }
+    if ((nb_dgram == 0) && (send_report == false)) {
+        return;
+    }
+    for (i = 0; i < nb_dgram; ++i) {
+        report_sent = dgram_close(push_dgram[i], (send_report == true) && (i == nb_dgram - 1));
+    }
+    if ((send_report == true) && !report_sent && (nb_dgram < PUSH_DGRAM_NB)) {
+        /* no packet to send, or no room left for the report: send it alone */
+        report_sent = dgram_close(push_dgram[nb_dgram], true);
+        ++nb_dgram;
+    }
+    if (report_sent) {
+        pthread_mutex_lock(&mx_stat_rep);
+        report_ready = false;
+        pthread_mutex_unlock(&mx_stat_rep);
+    }
+
+    gettimeofday(&now, NULL);
+    push_send(push_dgram, nb_dgram, serv_send_mask(&now));
+    for (i = 0; i < nb_dgram; ++i) {
+        push_dgram[i] = dgram_alloc();
+    }
+}
+
+/* replay packets from the persistent queue, return the number of packets fetched */
+static int push_replay(void) {
+    struct lgw_pkt_rx_s pkt;
+    struct timeval rx_time;
+    int per_dgram; /* packets that always fit in one datagram */
+    int budget;
+    int nb_fetched = 0;
+    int nb_sent = 0;
+    int nb_dgram;
+    int cur = 0;
+    int i;
+
+    per_dgram = (push_mtu - 24) / RXPK_SIZE_MAX;
+    if (per_dgram < 1) {
+        per_dgram = 1;
+    } else if (per_dgram > PUSH_PKT_MAX) {
+        per_dgram = PUSH_PKT_MAX;
+    }
+    /* a single packet probes the primary server while it is unreachable */
+    budget = serv[SERV_PRIMARY].live ? (PUSH_DGRAM_NB * per_dgram) : 1;
+    if (serv[SERV_PRIMARY].live && (budget > (int)store_replay_rate)) {
+        budget = store_replay_rate;
+    }
+
+    while (nb_fetched < budget) {
+        if (push_dgram[cur]->nb_pkt >= per_dgram) {
+            if (cur + 1 >= PUSH_DGRAM_NB) {
+                break;
+            }
+            ++cur;
+        }
+        if (upqueue_fetch(&mem->upqueue, 1, &pkt, &rx_time) != 1) {
+            break;
+        }
+        ++nb_fetched;
+        if (dgram_add(push_dgram[cur], &pkt, &rx_time) != 0) {
+            LOGCAT_WARN(UP, "[up  ] stored packet cannot be serialized, discarded\n");
+            continue;
+        }
+        ++nb_sent;
+    }
+
+    nb_dgram = cur + 1;
+    while ((nb_dgram > 0) && (push_dgram[nb_dgram - 1]->nb_pkt == 0)) {
+        --nb_dgram;
+    }
+    if (nb_dgram == 0) {
+        if (nb_fetched > 0) {
+            upqueue_ack(&mem->upqueue); /* nothing could be serialized */
+        }
+        return nb_fetched;
+    }
+
+    /* stored packets go to the primary server only, records are removed when every datagram is acknowledged */
+    for (i = 0; i < nb_dgram; ++i) {
+        dgram_close(push_dgram[i], false);
+        push_dgram[i]->replay = true;
+    }
+    replay_inflight = nb_dgram;
+    replay_nb_pkt = nb_sent;
+    replay_failed = false;
+    push_send(push_dgram, nb_dgram, 1u << SERV_PRIMARY);
+    for (i = 0; i < nb_dgram; ++i) {
+        push_dgram[i] = dgram_alloc();
+    }
+    return nb_fetched;
+}
+
+/* open the upstream socket and connect it to the server */
+static int open_sock_up(struct serv_s *sv) {
+    struct addrinfo hints;
+    struct addrinfo *result; /* store result of getaddrinfo */
+    struct addrinfo *q; /* pointer to move into *result data */
+    char host_name[64];
+    char port_name[64];
+    int i;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET; /* WA: Forcing IPv4 as AF_UNSPEC makes connection on localhost to fail */
+    hints.ai_socktype = SOCK_DGRAM;
+
+    sv->sock_up = -1;
+
+    /* look for server address w/ upstream port */
+    i = getaddrinfo(sv->addr, sv->port_up, &hints, &result);
+    if (i != 0) {
+        LOGCAT_ERROR(UP, "[up  ] getaddrinfo on address %s (PORT %s) returned %d\n", sv->addr, sv->port_up, i);
+        return -1;
+    }
+
+    /* try to open socket for upstream traffic */
+    for (q=result; q!=NULL; q=q->ai_next) {
+        sv->sock_up = socket(q->ai_family, q->ai_socktype,q->ai_protocol);
+        if (sv->sock_up == -1) continue; /* try next field */
+        else break; /* success, get out of loop */
+    }
+    if (q == NULL) {
+        LOGCAT_ERROR(UP, "[up  ] failed to open socket to any of server %s addresses (port %s)\n", sv->addr, sv->port_up);
+        i = 1;
+        for (q=result; q!=NULL; q=q->ai_next) {
+            getnameinfo(q->ai_addr, q->ai_addrlen, host_name, sizeof host_name, port_name, sizeof port_name, NI_NUMERICHOST);
+            LOGCAT_ERROR(UP, "[up  ] result %i host:%s service:%s\n", i, host_name, port_name);
+            ++i;
+        }
+        freeaddrinfo(result);
+        return -1;
+    }
+
+    /* connect so we can send/receive packet with the server only */
+    i = connect(sv->sock_up, q->ai_addr, q->ai_addrlen);
+    freeaddrinfo(result);
+    if (i != 0) {
+        LOGCAT_ERROR(UP, "[up  ] connect returned %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+//tx_ack not there
+
+void lora_gw_init(const char* global_conf) {
+    LOGCAT_INFO(MAIN, "lora_gw_init() start fh=%u high=%u LORA_GW_STACK_SIZE=%u\n", xPortGetFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL), LORA_GW_STACK_SIZE);
+
+    /* kept for the next start of the forwarder, so the heap is not fragmented by restarts */
+    if (mem == NULL) {
+        mem = malloc(sizeof *mem);
+        if (mem == NULL) {
+            LOGCAT_ERROR(MAIN, "lora_gw_init() failed to allocate %u bytes of buffers\n", (unsigned)sizeof *mem);
+            return;
+        }
+    }
+    quit_sig = false;
+    exit_sig = false;
+
+    xTaskCreatePinnedToCore(TASK_lora_gw, "LoraGW",
+        LORA_GW_STACK_SIZE / sizeof(StackType_t),
+        (void *) global_conf,
+        LORA_GW_PRIORITY, &xLoraGwTaskHndl, 1);
+    LOGCAT_INFO(MAIN, "lora_gw_init() done fh=%u high=%u buffers=%u\n", xPortGetFreeHeapSize(), uxTaskGetStackHighWaterMark(NULL), (unsigned)sizeof *mem);
+}
+
+void pygate_reset() {
+    LOGCAT_INFO(MAIN, "pygate_reset\n");
+
+    // pull sx1257 and sx1308 reset high, the PIC FW should power cycle the ESP32 as a result
+    pin_obj_t* sx1308_rst = SX1308_RST_PIN;
+    pin_config(sx1308_rst, -1, -1, GPIO_MODE_OUTPUT, MACHPIN_PULL_NONE, 0);
+    pin_obj_t* sx1257_rst = (&PIN_MODULE_P8);
+    pin_config(sx1257_rst, -1, -1, GPIO_MODE_OUTPUT, MACHPIN_PULL_NONE, 0);
+
+    sx1308_rst->value = 1;
+    sx1257_rst->value = 1;
+
+    pin_set_value(sx1308_rst);
+    pin_set_value(sx1257_rst);
+
+    vTaskDelay(5000 / portTICK_PERIOD_MS);
+
+    // if this is still being executed, then it seems the ESP32 reset did not take place
+    // set the two reset lines low again and stop the lora gw task, to make sure we return to a defined state
+    LOGCAT_ERROR(MAIN, "pygate_reset failed to reset\n");
+    sx1308_rst->value = 0;
+    sx1257_rst->value = 0;
+    pin_set_value(sx1308_rst);
+    pin_set_value(sx1257_rst);
+
+    if (xLoraGwTaskHndl){
+        vTaskDelete(xLoraGwTaskHndl);
+        xLoraGwTaskHndl = NULL;
+    }
+
+}
+
+/* link quality of one device, for queries from the Python side */
+int lora_gw_get_device(uint32_t dev_addr, struct devtable_entry_s *dev) {
+    const struct devtable_entry_s *d = NULL;
+
+    pthread_mutex_lock(&mx_devtable);
+    if (devtable_enabled) {
+        d = devtable_find(&devtable, dev_addr);
+        if (d != NULL) {
+            *dev = *d;
+        }
+    }
+    pthread_mutex_unlock(&mx_devtable);
+    return (d != NULL) ? 0 : -1;
+}
+
+int lora_gw_get_debug_level(){
+    return debug_level;
+}
+
+void lora_gw_set_debug_level(int level){
+    debug_level = level;
+    logcat_set_level(LOGCAT_NB, level);
+}
+
+/* level of one subsystem: "main", "up", "down", "jit", "repeater" or "config", -1 if it does not exist */
+int lora_gw_get_subsystem_debug_level(const char *subsystem){
+    int cat = logcat_find(subsystem);
+
+    return (cat >= 0) ? logcat_level[cat] : -1;
+}
+
+int lora_gw_set_subsystem_debug_level(const char *subsystem, int level){
+    return logcat_set_level(logcat_find(subsystem), level);
+}
+
+void TASK_lora_gw(void *pvParameters) {
+	int i;
+	int x;
+	uint32_t cp_nb_rx_rcv;
+	uint32_t cp_nb_rx_ok;
+	uint32_t cp_nb_rx_bad;
+	uint32_t cp_nb_rx_nocrc;
+	uint32_t cp_up_pkt_fwd;
+	uint32_t cp_up_network_byte;
+	uint32_t cp_up_payload_byte;
+	uint32_t cp_up_dgram_sent;
+	uint32_t cp_up_ack_rcv;
+	uint32_t cp_up_retransmit;
+	uint32_t cp_up_pool_full;
+	uint32_t cp_up_rtt_sum;
+	uint32_t cp_up_rtt_nb;
+	uint32_t cp_up_pkt_stored;
+	uint32_t cp_up_pkt_replayed;
+	uint32_t cp_up_pkt_dropped;
+	uint32_t cp_up_store_pending;
+	uint32_t cp_up_hal_error;
+	uint64_t cp_thread_wait_ns[THREAD_NB];
+	int cp_thread_core[THREAD_NB];
+	uint32_t cp_fetch_late_max;
+	uint32_t cp_rx_ring_full;
+	uint64_t stat_ns;
+	uint64_t stat_t0;
+	uint64_t core_active_ns[THREAD_CORE_MAX];
+	int core;
+	uint32_t cp_recover_nb[RECOVER_TIER_NB];
+	uint32_t cp_recover_ms[RECOVER_TIER_NB];
+	uint32_t cp_recover_ms_max[RECOVER_TIER_NB];
+	struct serv_s cp_serv[SERV_MAX];
+#if FWD_BENCH
+	struct bench_stage_s cp_bench_stage[BENCH_STAGE_NB];
+	uint32_t cp_bench_lat[BENCH_LAT_NB];
+	uint64_t cp_bench_lat_sum;
+	uint32_t cp_bench_lat_max;
+#endif
+	uint64_t bench_t0;
+	uint32_t cp_dw_dgram_rcv;
+	uint32_t cp_nb_tx_ok;
+	float up_ack_ratio;
+	time_t t;
+	char stat_timestamp[24];
+	mp_hal_set_signal_exit_cb(sig_handler);
+    	machine_register_pygate_sig_handler(sig_handler);
+    	mp_hal_set_interrupt_char(3);
+	pthread_t thrid_fetch;
 	pthread_t thrid_up;
+	pthread_t thrid_timersync;
+	struct clocksync_model_s cp_clocksync;
+	struct relay_stat_s cp_relay;
+	struct relaynet_stat_s cp_relaynet;
+	struct tdma_stat_s cp_tdma;
+	struct chanstat_s cp_chan;
+	char chan_json[CHANSTAT_JSON_SIZE];
+	struct logcat_stat_s cp_log;
+	const struct relaynet_route_s *route;
 	const char com_path_default[] = COM_PATH_DEFAULT;
     	const char *com_path = com_path_default;
 	
+	logcat_init(log_out);
 	x = lgw_connect(NULL);
   	if (x == LGW_REG_ERROR) {
-       	MSG_ERROR("[main] FAIL TO CONNECT BOARD ON %s\n", com_path);
+       	LOGCAT_ERROR(MAIN, "[main] FAIL TO CONNECT BOARD ON %s\n", com_path);
        	exit(EXIT_FAILURE);
   	}
   	 
   	
   	#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    	MSG_INFO("[main] Little endian host\n");
+    	LOGCAT_INFO(MAIN, "[main] Little endian host\n");
 	#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-    	MSG_INFO("[main] Big endian host\n");
+    	LOGCAT_INFO(MAIN, "[main] Big endian host\n");
 	#else
-    	MSG_INFO("[main] Host endianness unknown\n");
+    	LOGCAT_INFO(MAIN, "[main] Host endianness unknown\n");
 	#endif
+  	bench_t0 = bench_ns();
+  	conf_arena_begin();
   	x = parse_SX1301_configuration((char *)pvParameters);
   	if (x != 0) {
        	exit(EXIT_FAILURE);
   	}
+  	/* gateway_conf is optional, without it packets are only counted */
+  	x = parse_gateway_configuration((char *)pvParameters);
+  	fwd_enabled = (x == 0);
+  	conf_arena_end();
+  	dev_start();
+#if FWD_BENCH
+  	bench_conf_us = (uint32_t)((bench_ns() - bench_t0) / 1000);
+#endif
   
-  	MSG_INFO("[main] found global configuration file and parsed correctly\n");
+  	LOGCAT_INFO(MAIN, "[main] found global configuration file and parsed correctly\n");
     	wait_ms (2000);
 
 	i = lgw_start();
     	if (i == LGW_HAL_SUCCESS) {
-        	MSG_INFO("[main] concentrator started, packet can now be received\n");
+        	LOGCAT_INFO(MAIN, "[main] concentrator started, packet can now be received\n");
     	} else {
-        	MSG_ERROR("[main] failed to start the concentrator\n");
+        	LOGCAT_ERROR(MAIN, "[main] failed to start the concentrator\n");
         	//exit(EXIT_FAILURE);
     	}
-	esp_pthread_cfg_t cfg = {
-            (10 * 1024),
-            10,
-            true
-    	};
-    	esp_pthread_set_cfg(&cfg);
-    	
-	i = pthread_create( &thrid_up, NULL, (void * (*)(void *))thread_up, NULL);
+
+	if (fwd_enabled) {
+    	/* process some of the configuration variables */
+    	net_mac_h = htonl((uint32_t)(0xFFFFFFFF & (lgwm>>32)));
+    	net_mac_l = htonl((uint32_t)(0xFFFFFFFF &  lgwm  ));
+    	/* without a "servers" list, the legacy server_address is the only server */
+    	if (serv_nb == 0) {
+        	strncpy(serv[0].addr, serv_addr, sizeof serv[0].addr - 1);
+        	strncpy(serv[0].port_up, serv_port_up, sizeof serv[0].port_up - 1);
+        	strncpy(serv[0].port_down, serv_port_down, sizeof serv[0].port_down - 1);
+        	serv_nb = 1;
+    	}
+    	for (i = 0; i < serv_nb; ++i) {
+        	serv[i].live = true;
+        	if (open_sock_up(&serv[i]) != 0) {
+            	if (i == SERV_PRIMARY) {
+                	exit(EXIT_FAILURE);
+            	}
+            	LOGCAT_WARN(MAIN, "[main] server %d (%s) disabled\n", i, serv[i].addr);
+            	if (serv[i].sock_up != -1) {
+                	close(serv[i].sock_up);
+            	}
+            	serv[i].sock_up = -1;
+        	}
+    	}
+	}
+	sock_wake = open_sock_wake();
+	if (sock_wake == -1) {
+    	LOGCAT_WARN(MAIN, "[main] no loopback socket, forwarding is delayed by up to %u ms\n", FETCH_SLEEP_MS);
+	}
+	clocksync_init(&clocksync);
+	thread_place_self(THREAD_STATS);
+	thread_task[THREAD_STATS] = xTaskGetCurrentTaskHandle();
+
+	i = thread_start(&thrid_fetch, THREAD_FETCH, thread_fetch);
+    	if (i != 0) {
+        	LOGCAT_ERROR(MAIN, "[main] impossible to create fetch thread\n");
+        	exit(EXIT_FAILURE);
+    	}
+	i = thread_start(&thrid_up, THREAD_FORWARD, thread_up);
     	if (i != 0) {
-        	MSG_ERROR("[main] impossible to create upstream thread\n");
+        	LOGCAT_ERROR(MAIN, "[main] impossible to create upstream thread\n");
+        	exit(EXIT_FAILURE);
+    	}
+	i = thread_start(&thrid_timersync, THREAD_TIMERSYNC, thread_timersync);
+    	if (i != 0) {
+        	LOGCAT_ERROR(MAIN, "[main] impossible to create Time Sync thread\n");
         	exit(EXIT_FAILURE);
     	}
     	machine_pygate_set_status(PYGATE_STARTED);
     	mp_printf(&mp_plat_print, "LoRa GW started\n");
     	
+    	/* from now on, messages are formatted here, between the statistics */
+    	logcat_defer(true);
+    	stat_t0 = bench_ns();
     	while (!exit_sig && !quit_sig) {
-    		wait_ms ((1000 * stat_interval) / portTICK_PERIOD_MS);
+    		do {
+    			bench_t0 = bench_ns();
+    			wait_ms(LOG_DRAIN_MS);
+    			thread_waited(THREAD_STATS, bench_t0);
+    			bench_t0 = bench_ns();
+    			x = logcat_drain();
+#if FWD_BENCH
+    			if (bench_enabled && (x > 0)) {
+    				bench_add(BENCH_LOG, x, bench_t0);
+    			}
+#endif
+    		} while (!exit_sig && !quit_sig && ((bench_ns() - stat_t0) < 1000000000ULL * stat_interval));
+    		bench_t0 = bench_ns();
+    		stat_ns = bench_t0 - stat_t0;
+    		stat_t0 = bench_t0;
+    		/* get timestamp for statistics */
+    		t = time(NULL);
+    		strftime(stat_timestamp, sizeof stat_timestamp, "%Y-%m-%d %H:%M:%S GMT", gmtime(&t));
+
+    		/* access upstream statistics, copy and reset them */
     		pthread_mutex_lock(&mx_meas_up);
         	cp_nb_rx_rcv       = meas_nb_rx_rcv;
+        	cp_nb_rx_ok        = meas_nb_rx_ok;
+        	cp_nb_rx_bad       = meas_nb_rx_bad;
+        	cp_nb_rx_nocrc     = meas_nb_rx_nocrc;
+        	cp_up_pkt_fwd      = meas_up_pkt_fwd;
+        	cp_up_network_byte = meas_up_network_byte;
+        	cp_up_payload_byte = meas_up_payload_byte;
+        	cp_up_dgram_sent   = meas_up_dgram_sent;
+        	cp_up_ack_rcv      = meas_up_ack_rcv;
+        	cp_up_retransmit   = meas_up_retransmit;
+        	cp_up_pool_full    = meas_up_pool_full;
+        	cp_up_rtt_sum      = meas_up_rtt_sum;
+        	cp_up_rtt_nb       = meas_up_rtt_nb;
+        	cp_up_pkt_stored   = meas_up_pkt_stored;
+        	cp_up_pkt_replayed = meas_up_pkt_replayed;
+        	cp_up_pkt_dropped  = meas_up_pkt_dropped;
+        	cp_up_store_pending = meas_up_store_pending;
+        	cp_up_hal_error    = meas_up_hal_error;
+        	memcpy(cp_recover_nb, meas_recover_nb, sizeof cp_recover_nb);
+        	memcpy(cp_recover_ms, meas_recover_ms, sizeof cp_recover_ms);
+        	memcpy(cp_recover_ms_max, meas_recover_ms_max, sizeof cp_recover_ms_max);
+        	meas_up_hal_error = 0;
+        	memcpy(cp_thread_wait_ns, meas_thread_wait_ns, sizeof cp_thread_wait_ns);
+        	memcpy(cp_thread_core, meas_thread_core, sizeof cp_thread_core);
+        	cp_fetch_late_max  = meas_fetch_late_max;
+        	cp_rx_ring_full    = meas_rx_ring_full;
+        	cp_relay           = meas_relay;
+        	memset(&meas_relay, 0, sizeof meas_relay);
+        	cp_relaynet        = meas_relaynet;
+        	memset(&meas_relaynet, 0, sizeof meas_relaynet);
+        	cp_tdma            = meas_tdma;
+        	memset(&meas_tdma, 0, sizeof meas_tdma);
+        	chanstat_roll(&meas_chan, stat_ns / 1000);
+        	cp_chan            = meas_chan;
+        	memset(meas_thread_wait_ns, 0, sizeof meas_thread_wait_ns);
+        	meas_fetch_late_max = 0;
+        	meas_rx_ring_full = 0;
+        	memset(meas_recover_nb, 0, sizeof meas_recover_nb);
+        	memset(meas_recover_ms, 0, sizeof meas_recover_ms);
+        	memset(meas_recover_ms_max, 0, sizeof meas_recover_ms_max);
         	meas_nb_rx_rcv = 0;
+        	meas_nb_rx_ok = 0;
+        	meas_nb_rx_bad = 0;
+        	meas_nb_rx_nocrc = 0;
+        	meas_up_pkt_fwd = 0;
+        	meas_up_network_byte = 0;
+        	meas_up_payload_byte = 0;
+        	meas_up_dgram_sent = 0;
+        	meas_up_ack_rcv = 0;
+        	meas_up_retransmit = 0;
+        	meas_up_pool_full = 0;
+        	meas_up_rtt_sum = 0;
+        	meas_up_rtt_nb = 0;
+        	meas_up_pkt_stored = 0;
+        	meas_up_pkt_replayed = 0;
+        	meas_up_pkt_dropped = 0;
+#if FWD_BENCH
+        	if (bench_enabled) {
+            	memcpy(cp_bench_stage, meas_bench_stage, sizeof cp_bench_stage);
+            	memcpy(cp_bench_lat, meas_bench_lat, sizeof cp_bench_lat);
+            	cp_bench_lat_sum = meas_bench_lat_sum;
+            	cp_bench_lat_max = meas_bench_lat_max;
+            	memset(meas_bench_stage, 0, sizeof meas_bench_stage);
+            	memset(meas_bench_lat, 0, sizeof meas_bench_lat);
+            	meas_bench_lat_sum = 0;
+            	meas_bench_lat_max = 0;
+        	}
+#endif
+        	for (i = 0; i < serv_nb; ++i) {
+            	cp_serv[i].dgram_sent = serv[i].dgram_sent;
+            	cp_serv[i].ack_rcv = serv[i].ack_rcv;
+            	cp_serv[i].network_byte = serv[i].network_byte;
+            	cp_serv[i].live = serv[i].live;
+            	cp_serv[i].srtt_us = serv[i].srtt_us;
+            	cp_serv[i].rto_us = serv[i].rto_us;
+            	cp_serv[i].retransmit = serv[i].retransmit;
+            	serv[i].retransmit = 0;
+            	serv[i].dgram_sent = 0;
+            	serv[i].ack_rcv = 0;
+            	serv[i].network_byte = 0;
+        	}
         	pthread_mutex_unlock(&mx_meas_up);
-    	#if LORAPF_DEBUG_LEVEL >= LORAPF_INFO_
-        	if ( debug_level >= LORAPF_INFO_){
+        	pthread_mutex_lock(&mx_meas_dw);
+        	cp_dw_dgram_rcv    = meas_dw_dgram_rcv;
+        	cp_nb_tx_ok        = meas_nb_tx_ok;
+        	pthread_mutex_unlock(&mx_meas_dw);
+        	if (cp_up_dgram_sent > 0) {
+            	up_ack_ratio = (float)cp_up_ack_rcv / (float)cp_up_dgram_sent;
+        	} else {
+            	up_ack_ratio = 0.0;
+        	}
+        	if (LOGCAT_ON(MAIN, LORAPF_INFO_)) {
         	mp_printf(&mp_plat_print, "### [UPSTREAM] ###\n");
         	mp_printf(&mp_plat_print, "# RF packets received by concentrator: %u\n", cp_nb_rx_rcv);
+        	mp_printf(&mp_plat_print, "# CRC_OK: %u, CRC_FAIL: %u, NO_CRC: %u\n", cp_nb_rx_ok, cp_nb_rx_bad, cp_nb_rx_nocrc);
+        	if (fwd_enabled) {
+        	mp_printf(&mp_plat_print, "# RF packets forwarded: %u (%u bytes)\n", cp_up_pkt_fwd, cp_up_payload_byte);
+        	mp_printf(&mp_plat_print, "# PUSH_DATA datagrams sent: %u (%u bytes)\n", cp_up_dgram_sent, cp_up_network_byte);
+        	mp_printf(&mp_plat_print, "# PUSH_DATA acknowledged: %.2f%%, retransmitted: %u, uplinks held back for acknowledges: %u times\n", 100.0 * up_ack_ratio, cp_up_retransmit, cp_up_pool_full);
+        	mp_printf(&mp_plat_print, "# PUSH_DATA round-trip time: %u ms average, %u ms smoothed, time-out %u ms\n", (cp_up_rtt_nb > 0) ? (cp_up_rtt_sum / cp_up_rtt_nb) : 0, cp_serv[SERV_PRIMARY].srtt_us / 1000, ((cp_serv[SERV_PRIMARY].rto_us != 0) ? cp_serv[SERV_PRIMARY].rto_us / 1000 : push_timeout_ms));
+        	for (i = 1; i < serv_nb; ++i) {
+        	mp_printf(&mp_plat_print, "# server %d %s: %u datagrams sent (%u bytes), %u acknowledged, %u retransmitted, RTT %u ms%s\n", i, serv[i].addr, cp_serv[i].dgram_sent, cp_serv[i].network_byte, cp_serv[i].ack_rcv, cp_serv[i].retransmit, cp_serv[i].srtt_us / 1000, cp_serv[i].live ? "" : ", unreachable");
+        	}
+        	}
+        	if (cp_up_hal_error > 0) {
+        	mp_printf(&mp_plat_print, "# concentrator errors: %u (%.2f/min)\n", cp_up_hal_error, (60.0 * cp_up_hal_error) / stat_interval);
+        	for (i = RECOVER_FLUSH; i < RECOVER_TIER_NB; ++i) {
+        	if (cp_recover_nb[i] > 0) {
+        	mp_printf(&mp_plat_print, "# recovered by %s: %u, downtime %u ms average, %u ms max\n", (i == RECOVER_FLUSH) ? "FIFO flush" : ((i == RECOVER_RESTART) ? "restart" : "reset"), cp_recover_nb[i], cp_recover_ms[i] / cp_recover_nb[i], cp_recover_ms_max[i]);
+        	}
+        	}
+        	}
+        	mp_printf(&mp_plat_print, "# RX drain: fetch late by %u us max, %u fetches postponed by a full ring\n", cp_fetch_late_max, cp_rx_ring_full);
+        	for (i = 0; i < CHANSTAT_NB; ++i) {
+        	if ((cp_chan.chan[i].freq_hz != 0) && cp_chan.chan[i].started) {
+        	mp_printf(&mp_plat_print, "# channel %.3f MHz: %.2f%% busy (%.2f%% average), %u packets, %u CRC errors, noise floor %.1f dBm (estimated from received packets), strongest %.1f dBm\n", cp_chan.chan[i].freq_hz / 1e6, cp_chan.chan[i].util, cp_chan.chan[i].util_avg, cp_chan.chan[i].nb_pkt_last, cp_chan.chan[i].nb_bad_last, cp_chan.chan[i].noise_dbm, cp_chan.chan[i].rssi_max_last);
+        	}
+        	}
+        	if (relay_enabled) {
+        	mp_printf(&mp_plat_print, "# repeater: %u/%u packets repeated, airtime %.2f%%, waited %u ms average, %u ms max\n", cp_relay.nb_sent, cp_relay.nb_queued, (100.0 * cp_relay.airtime_us) / (stat_ns / 1000), (cp_relay.nb_sent > 0) ? (uint32_t)(cp_relay.wait_us / cp_relay.nb_sent / 1000) : 0, cp_relay.wait_max_us / 1000);
+        	mp_printf(&mp_plat_print, "# repeater: %u duplicates, %u invalid frames, dropped %u on a full queue, %u expired, %u rejected by the concentrator\n", cp_relay.nb_dup, cp_relay.nb_invalid, cp_relay.nb_full, cp_relay.nb_expired, cp_relay.nb_fail);
+        	mp_printf(&mp_plat_print, "# repeater: %u transmissions deferred on a busy channel, dropped %u past their time to live, %u relayed by another repeater first\n", cp_relay.nb_busy, cp_relay.nb_late, cp_relay.nb_cancel);
+        	if (cp_relaynet.nb_ack > 0) {
+        	mp_printf(&mp_plat_print, "# repeater: %u device uplinks acknowledged, %u ACKs missed\n", cp_relaynet.nb_ack, cp_relaynet.nb_ack_missed);
+        	}
+        	if (relay_hop_limit > 0) {
+        	route = relaynet_route(&mem->relaynet, (uint32_t)(bench_ns() / 1000000000));
+        	if (route != NULL) {
+        	mp_printf(&mp_plat_print, "# relay: node %u, sink %u at %u hops through node %u\n", relay_node_id, route->sink, route->hops, route->via);
+        	} else {
+        	mp_printf(&mp_plat_print, "# relay: node %u, %s\n", relay_node_id, relay_sink ? "sink" : "no route to a sink");
+        	}
+        	mp_printf(&mp_plat_print, "# relay: %u uplinks sent, %u forwarded, %u delivered (1/2/3+ hops: %u/%u/%u), %u advertisements heard\n", cp_relaynet.nb_orig, cp_relaynet.nb_fwd, cp_relaynet.nb_deliv, cp_relaynet.nb_deliv_hops[1], cp_relaynet.nb_deliv_hops[2], cp_relaynet.nb_deliv - cp_relaynet.nb_deliv_hops[1] - cp_relaynet.nb_deliv_hops[2], cp_relaynet.nb_adv);
+        	mp_printf(&mp_plat_print, "# relay: dropped %u duplicates, %u at their hop limit, %u without route, %u overheard\n", cp_relaynet.nb_dup, cp_relaynet.nb_hop_limit, cp_relaynet.nb_no_route, cp_relaynet.nb_overheard);
+        	}
+        	if (tdma_enabled) {
+        	mp_printf(&mp_plat_print, "# tdma: %u/%u slots used, %u beacons sent, %u missed\n", mem->tdma.nb_used, tdma_cfg.nb_slot, cp_tdma.nb_beacon, cp_tdma.nb_beacon_missed);
+        	mp_printf(&mp_plat_print, "# tdma: %u slots given, %u taken back from idle devices, %u requests without free slot, uplinks in/out of their slot: %u/%u\n", cp_tdma.nb_assigned, cp_tdma.nb_released, cp_tdma.nb_full, cp_tdma.nb_in_slot, cp_tdma.nb_off_slot);
+        	}
+        	}
+        	clocksync_get(&clocksync, &cp_clocksync);
+        	if (cp_clocksync.valid) {
+        	mp_printf(&mp_plat_print, "# time sync: drift %.3f ppm (%.3f to %.3f), fit residual %u us over %u samples, %u/%u samples rejected, %u restarts\n", cp_clocksync.drift_ppb / 1000.0, cp_clocksync.drift_min_ppb / 1000.0, cp_clocksync.drift_max_ppb / 1000.0, cp_clocksync.resid_us, cp_clocksync.nb_used, cp_clocksync.nb_rejected, cp_clocksync.nb_sample, cp_clocksync.nb_restart);
+        	} else {
+        	mp_printf(&mp_plat_print, "# time sync: concentrator counter not mapped to UTC yet\n");
+        	}
+        	memset(core_active_ns, 0, sizeof core_active_ns);
+        	for (i = 0; i < THREAD_NB; ++i) {
+        	cp_thread_wait_ns[i] = (cp_thread_wait_ns[i] < stat_ns) ? cp_thread_wait_ns[i] : stat_ns;
+        	core = cp_thread_core[i];
+        	if ((core >= 0) && (core < THREAD_CORE_MAX)) {
+            	core_active_ns[core] += stat_ns - cp_thread_wait_ns[i];
+        	}
+        	mp_printf(&mp_plat_print, "# %s thread: core %d, active %.1f%%\n", thread_name[i], core, 100.0 * (stat_ns - cp_thread_wait_ns[i]) / stat_ns);
+        	}
+        	for (i = 0; i < THREAD_CORE_MAX; ++i) {
+        	if (core_active_ns[i] > 0) {
+        	mp_printf(&mp_plat_print, "# core %d: %.1f%% used by the forwarder threads\n", i, 100.0 * core_active_ns[i] / stat_ns);
+        	}
+        	}
+        	if (store_path[0] != '\0') {
+        	mp_printf(&mp_plat_print, "# RF packets stored: %u, replayed: %u, dropped: %u, pending: %u\n", cp_up_pkt_stored, cp_up_pkt_replayed, cp_up_pkt_dropped, cp_up_store_pending);
+        	}
+        	mem_report();
+        	if (devtable_enabled) {
+        	dev_report(t);
+        	}
+        	logcat_get_stat(&cp_log);
+        	mp_printf(&mp_plat_print, "# log: %u messages, %u dropped on a full ring, up to %u waiting\n", cp_log.nb_put, cp_log.nb_dropped, cp_log.nb_max);
     		mp_printf(&mp_plat_print, "##### END #####\n");
     		}
-    	#endif	
+#if FWD_BENCH
+    		if (bench_enabled) {
+        		bench_add(BENCH_STATS, 1, bench_t0);
+        		bench_report(stat_timestamp, cp_nb_rx_rcv, cp_up_pkt_fwd, cp_bench_stage, cp_bench_lat, cp_bench_lat_sum, cp_bench_lat_max);
+    		}
+#endif
+    		bench_t0 = bench_ns();
     		wait_ms(50);
-    		
+    		thread_waited(THREAD_STATS, bench_t0);
+
+    		/* generate a JSON report (will be sent to server by upstream thread) */
+    		pthread_mutex_lock(&mx_stat_rep);
+    		x = chanstat_json(&cp_chan, chan_json, sizeof chan_json);
+    		snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%.1f,\"dwnb\":%u,\"txnb\":%u%s%s}", stat_timestamp, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok, (x > 2) ? ",\"chan\":" : "", (x > 2) ? chan_json : "");
     		report_ready = true;
+    		pthread_mutex_unlock(&mx_stat_rep);
     	}
 	
+	logcat_defer(false);
+	pthread_join(thrid_fetch, NULL);
 	pthread_join(thrid_up, NULL);
+	pthread_join(thrid_timersync, NULL);
+	if (sock_wake != -1) {
+    	close(sock_wake);
+    	sock_wake = -1;
+	}
+}
+
+/* apply the recovery tier due after a failed packet fetch */
+static void concent_recover(struct recover_s *rec) {
+    static const char *tier_str[RECOVER_TIER_NB] = {"none", "flushing the RX FIFO", "restarting the concentrator", "resetting the gateway"};
+    int32_t nb;
+    int i, x = LGW_HAL_SUCCESS;
+
+    pthread_mutex_lock(&mx_meas_up);
+    meas_up_hal_error += 1;
+    pthread_mutex_unlock(&mx_meas_up);
+
+    recover_escalate(rec, bench_ns());
+    if (rec->tier_nb == 1) {
+        LOGCAT_WARN(UP, "[up  ] failed packet fetch, %s\n", tier_str[rec->tier]);
+    }
+
+    switch (rec->tier) {
+        case RECOVER_FLUSH:
+            pthread_mutex_lock(&mx_concent);
+            for (i = 0; i < RECOVER_FIFO_MAX; ++i) {
+                x = lgw_reg_r(LGW_RX_PACKET_DATA_FIFO_NUM_STORED, &nb);
+                if ((x != LGW_REG_SUCCESS) || (nb == 0)) {
+                    break;
+                }
+                x = lgw_reg_w(LGW_RX_PACKET_DATA_FIFO_NUM_STORED, 0);
+            }
+            pthread_mutex_unlock(&mx_concent);
+            break;
+        case RECOVER_RESTART:
+            pthread_mutex_lock(&mx_concent);
+            lgw_stop();
+            x = lgw_connect(NULL);
+            if (x == LGW_REG_SUCCESS) {
+                x = lgw_start();
+            }
+            pthread_mutex_unlock(&mx_concent);
+            break;
+        default:
+            pygate_reset();
+            break;
+    }
+    if (x != LGW_HAL_SUCCESS) {
+        LOGCAT_ERROR(UP, "[up  ] %s failed\n", tier_str[rec->tier]);
+    }
+}
+
+/* account the downtime once a packet fetch succeeds again */
+static void concent_recovered(struct recover_s *rec) {
+    uint32_t down_ms = recover_end(rec, bench_ns());
+
+    pthread_mutex_lock(&mx_meas_up);
+    meas_recover_nb[rec->tier] += 1;
+    meas_recover_ms[rec->tier] += down_ms;
+    if (down_ms > meas_recover_ms_max[rec->tier]) {
+        meas_recover_ms_max[rec->tier] = down_ms;
+    }
+    pthread_mutex_unlock(&mx_meas_up);
+    LOGCAT_INFO(UP, "[up  ] concentrator recovered after %u ms (tier %d)\n", down_ms, rec->tier);
 }
 
+/* schedule the ACK of a device uplink, delay_us after it, unless it is too late or the TX chain is busy */
+static void relay_ack_send(struct lgw_pkt_tx_s *tx, int32_t delay_us) {
+    struct timeval now;
+    uint32_t cnt;
+    int32_t lead_us;
+    uint8_t tx_status = TX_STATUS_UNKNOWN;
+    int x = LGW_HAL_ERROR;
+
+    tx->rf_chain = relay_cfg.rf_chain;
+    tx->rf_power = relay_cfg.rf_power;
+    /* the counter comes from the time sync model, reading it would hold the concentrator */
+    gettimeofday(&now, NULL);
+    if (clocksync_to_cnt(&clocksync, &now, &cnt) == 0) {
+        lead_us = (int32_t)(tx->count_us - cnt);
+        if ((lead_us > RELAY_ACK_LEAD_US) && (lead_us <= delay_us)) {
+            pthread_mutex_lock(&mx_concent);
+            lgw_status(TX_STATUS, &tx_status);
+            if (tx_status == TX_FREE) {
+                x = lgw_send(tx);
+            }
+            pthread_mutex_unlock(&mx_concent);
+        }
+    }
+    if (x != LGW_HAL_SUCCESS) {
+        mem->relaynet.stat.nb_ack_missed += 1;
+        LOGCAT_DEBUG(DOWN, "[down] ACK at counter %u missed\n", tx->count_us);
+    }
+}
+
+/* queue the received packets to be repeated, return the number of packets left for the server */
+static int relay_input(int nb_pkt, struct lgw_pkt_rx_s *rxpkt) {
+    struct relay_s *relay = &mem->relay;
+    struct relaynet_s *rn = &mem->relaynet;
+    uint64_t now = bench_ns();
+    uint32_t now_s = (uint32_t)(now / 1000000000);
+    struct timeval utc;
+    bool keep;
+    int i;
+    int nb_up = 0;
+
+    for (i = 0; i < nb_pkt; ++i) {
+        keep = true;
+        /* ACKs are timed by the concentrator, they do not wait for the RX FIFO to be drained */
+        if (relaynet_ack(rn, &rxpkt[i], &mem->relay_ack) == 0) {
+            /* the ACK tells the device its slot */
+            if (tdma_enabled && (clocksync_to_utc(&clocksync, rxpkt[i].count_us, &utc) == 0)) {
+                tdma_ack(&mem->tdma, &rxpkt[i], &utc, &mem->relay_ack);
+            }
+            relay_ack_send(&mem->relay_ack, (int32_t)(mem->relay_ack.count_us - rxpkt[i].count_us));
+        }
+        if (relay_hop_limit == 0) {
+            /* the packets repeated by another repeater are not repeated again, nor the copies waiting here */
+            if (rxpkt[i].freq_hz != relay_cfg.freq_hz) {
+                relay_push(relay, &rxpkt[i], now);
+            } else {
+                relay_overheard(relay, &rxpkt[i], now);
+            }
+        } else if (rxpkt[i].status == STAT_CRC_OK) {
+            switch (relaynet_input(rn, &rxpkt[i], now_s)) {
+                case RELAYNET_PLAIN:
+                    if (!rn->sink && (relaynet_encap(rn, &rxpkt[i], &mem->relay_pkt, now_s) == 0)) {
+                        relay_push(relay, &mem->relay_pkt, now);
+                    }
+                    break;
+                case RELAYNET_FORWARD:
+                    relay_push(relay, &rxpkt[i], now);
+                    keep = false;
+                    break;
+                case RELAYNET_DELIVER:
+                    break;
+                default:
+                    keep = false;
+                    break;
+            }
+        }
+        if (keep) {
+            if (nb_up != i) {
+                rxpkt[nb_up] = rxpkt[i];
+            }
+            nb_up += 1;
+        }
+    }
+    relay_rx_seen(relay, now);
+    return nb_up;
+}
+
+/* give the next beacon to the concentrator, timed on the UTC second by the time sync model */
+static void tdma_tx(void) {
+    struct lgw_pkt_tx_s tx;
+    struct timeval now;
+    struct timeval when;
+    uint32_t cnt;
+    uint8_t tx_status = TX_STATUS_UNKNOWN;
+
+    memset(&tx, 0, sizeof tx);
+    tx.freq_hz = relay_cfg.freq_hz;
+    tx.tx_mode = TIMESTAMPED;
+    tx.rf_chain = relay_cfg.rf_chain;
+    tx.rf_power = relay_cfg.rf_power;
+    tx.modulation = MOD_LORA;
+    tx.bandwidth = BW_125KHZ;
+    tx.datarate = (relay_cfg.datarate != 0) ? relay_cfg.datarate : DR_LORA_SF9;
+    tx.coderate = CR_LORA_4_5;
+    tx.invert_pol = false;
+    tx.preamble = 8;
+    gettimeofday(&now, NULL);
+    if ((tdma_beacon(&mem->tdma, relay_node_id, &now, &tx, &when) != 1) || (clocksync_to_cnt(&clocksync, &when, &cnt) != 0)) {
+        return;
+    }
+    tx.count_us = cnt;
+    pthread_mutex_lock(&mx_concent);
+    lgw_status(TX_STATUS, &tx_status);
+    if ((tx_status == TX_FREE) && (lgw_send(&tx) == LGW_HAL_SUCCESS)) {
+        tdma_sent(&mem->tdma);
+        LOGCAT_DEBUG(JIT, "[jit ] beacon programmed at counter %u\n", cnt);
+    }
+    pthread_mutex_unlock(&mx_concent);
+}
+
+/* start the transmission of the next repeated packet, if it is due and the TX chain is free */
+static void relay_tx(void) {
+    struct relay_s *relay = &mem->relay;
+    struct lgw_pkt_rx_s *adv = &mem->relay_pkt;
+    struct lgw_pkt_tx_s tx;
+    struct timeval utc;
+    uint8_t tx_status = TX_STATUS_UNKNOWN;
+    int32_t nb_fifo = 0;
+    uint64_t now = bench_ns();
+    uint64_t next;
+    int x;
+
+    if (tdma_enabled) {
+        tdma_tx();
+    }
+    if (relay_hop_limit > 0) {
+        memset(adv, 0, sizeof *adv);
+        adv->status = STAT_CRC_OK;
+        adv->modulation = MOD_LORA;
+        adv->bandwidth = BW_125KHZ;
+        adv->datarate = (relay_cfg.datarate != 0) ? relay_cfg.datarate : DR_LORA_SF9;
+        adv->coderate = CR_LORA_4_5;
+        if (relaynet_adv(&mem->relaynet, adv, (uint32_t)(now / 1000000000)) == 1) {
+            relay_push(relay, adv, now);
+        }
+    }
+    next = relay_next_ns(relay);
+    if ((next == 0) || (next > now)) {
+        return;
+    }
+    gettimeofday(&utc, NULL);
+    pthread_mutex_lock(&mx_concent);
+    lgw_status(TX_STATUS, &tx_status);
+    /* with the time-slotted schedule, not over the beacon or the uplink of a device */
+    if ((tx_status == TX_FREE) && (relay_peek(relay, now, &tx) == 1) && (!tdma_enabled || tdma_tx_ok(&mem->tdma, &utc, lgw_time_on_air(&tx)))) {
+        /* listen before talk: a packet received since the FIFO was drained, the channel is busy */
+        if (lgw_reg_r(LGW_RX_PACKET_DATA_FIFO_NUM_STORED, &nb_fifo) != LGW_REG_SUCCESS) {
+            nb_fifo = 0;
+        }
+        x = relay_lbt(relay, now, nb_fifo, &tx);
+        if (x < 0) {
+            LOGCAT_DEBUG(REPEATER, "[rep ] channel busy, transmission deferred\n");
+        } else if (x == 1) {
+            if (lgw_send(&tx) == LGW_HAL_SUCCESS) {
+                relay_sent(relay, now, lgw_time_on_air(&tx));
+                LOGCAT_DEBUG(REPEATER, "[rep ] %u bytes repeated on %u Hz\n", tx.size, tx.freq_hz);
+            } else {
+                relay->stat.nb_fail += 1;
+                LOGCAT_WARN(REPEATER, "[rep ] packet rejected by the concentrator\n");
+            }
+        }
+    }
+    pthread_mutex_unlock(&mx_concent);
+}
+
+/* move the repeater counters to the statistics */
+static void relay_account(void) {
+    struct relay_stat_s *st = &mem->relay.stat;
+    struct relaynet_stat_s *rs = &mem->relaynet.stat;
+    struct tdma_stat_s *ts = &mem->tdma.stat;
+    int i;
+
+    pthread_mutex_lock(&mx_meas_up);
+    meas_relay.nb_queued += st->nb_queued;
+    meas_relay.nb_sent += st->nb_sent;
+    meas_relay.nb_dup += st->nb_dup;
+    meas_relay.nb_full += st->nb_full;
+    meas_relay.nb_expired += st->nb_expired;
+    meas_relay.nb_fail += st->nb_fail;
+    meas_relay.nb_busy += st->nb_busy;
+    meas_relay.nb_late += st->nb_late;
+    meas_relay.nb_cancel += st->nb_cancel;
+    meas_relay.nb_invalid += st->nb_invalid;
+    meas_relay.airtime_us += st->airtime_us;
+    meas_relay.wait_us += st->wait_us;
+    if (st->wait_max_us > meas_relay.wait_max_us) {
+        meas_relay.wait_max_us = st->wait_max_us;
+    }
+    meas_relaynet.nb_orig += rs->nb_orig;
+    meas_relaynet.nb_fwd += rs->nb_fwd;
+    meas_relaynet.nb_deliv += rs->nb_deliv;
+    for (i = 0; i <= RELAYNET_HOP_MAX; ++i) {
+        meas_relaynet.nb_deliv_hops[i] += rs->nb_deliv_hops[i];
+    }
+    meas_relaynet.nb_dup += rs->nb_dup;
+    meas_relaynet.nb_hop_limit += rs->nb_hop_limit;
+    meas_relaynet.nb_no_route += rs->nb_no_route;
+    meas_relaynet.nb_overheard += rs->nb_overheard;
+    meas_relaynet.nb_adv += rs->nb_adv;
+    meas_relaynet.nb_ack += rs->nb_ack;
+    meas_relaynet.nb_ack_missed += rs->nb_ack_missed;
+    meas_tdma.nb_beacon += ts->nb_beacon;
+    meas_tdma.nb_beacon_missed += ts->nb_beacon_missed;
+    meas_tdma.nb_assigned += ts->nb_assigned;
+    meas_tdma.nb_released += ts->nb_released;
+    meas_tdma.nb_full += ts->nb_full;
+    meas_tdma.nb_in_slot += ts->nb_in_slot;
+    meas_tdma.nb_off_slot += ts->nb_off_slot;
+    pthread_mutex_unlock(&mx_meas_up);
+    memset(st, 0, sizeof *st);
+    memset(rs, 0, sizeof *rs);
+    memset(ts, 0, sizeof *ts);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- THREAD 0: DRAINING THE CONCENTRATOR RX FIFO -------------------------- */
+
+void thread_fetch(void) {
+    struct lgw_pkt_rx_s *rxpkt = mem->fetch_pkt; /* packets fetched by one lgw_receive call */
+    struct timeval now;
+    struct timespec deadline;
+    struct recover_s recover = {RECOVER_NONE, 0, 0, 0, 0};
+    uint64_t t0;
+    uint64_t due = 0; /* time the next fetch should happen, 0 if not known */
+    uint32_t late_us;
+    unsigned room;
+    int nb_pkt;
+    int nb_up;
+
+    LOGCAT_INFO(UP, "[rx  ] start\n");
+    thread_task[THREAD_FETCH] = xTaskGetCurrentTaskHandle();
+    if (replay_path[0] != '\0') {
+        capture_replay_enabled = (capture_replay_open(&mem->capture_replay, replay_path, replay_speed, replay_loop) == 0);
+        if (!capture_replay_enabled) {
+            LOGCAT_ERROR(UP, "[rx  ] failed to open capture %s, packets come from the concentrator\n", replay_path);
+        }
+    }
+    if ((capture_path[0] != '\0') && !capture_replay_enabled) {
+        capture_enabled = (capture_open(&mem->capture, capture_path, capture_size, lgwm) == 0);
+    }
+    if (relay_enabled) {
+        relay_init(&mem->relay, &relay_cfg, (uint32_t)(lgwm ^ (lgwm >> 32)));
+        relaynet_init(&mem->relaynet, relay_node_id, relay_sink, relay_hop_limit);
+        tdma_init(&mem->tdma, &tdma_cfg);
+    }
+
+    while (!exit_sig && !quit_sig) {
+        /* do not fetch more than the ring can hold, the concentrator FIFO keeps the rest */
+        pthread_mutex_lock(&mx_rx_ring);
+        room = RX_RING_NB - rx_ring_nb;
+        if (room == 0) {
+            t0 = bench_ns();
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += FETCH_SLEEP_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&cv_rx_ring, &mx_rx_ring, &deadline);
+            pthread_mutex_unlock(&mx_rx_ring);
+            thread_waited(THREAD_FETCH, t0);
+            pthread_mutex_lock(&mx_meas_up);
+            meas_rx_ring_full += 1;
+            pthread_mutex_unlock(&mx_meas_up);
+            due = 0;
+            continue;
+        }
+        pthread_mutex_unlock(&mx_rx_ring);
+
+        /* how late is the fetch, because of other tasks running on this core */
+        t0 = bench_ns();
+        if ((due != 0) && (t0 > due)) {
+            late_us = (uint32_t)((t0 - due) / 1000);
+            pthread_mutex_lock(&mx_meas_up);
+            if (late_us > meas_fetch_late_max) {
+                meas_fetch_late_max = late_us;
+            }
+            pthread_mutex_unlock(&mx_meas_up);
+        }
+
+        if (capture_replay_enabled) {
+            nb_pkt = capture_replay_receive(&mem->capture_replay, (room < NB_PKT_MAX) ? room : NB_PKT_MAX, rxpkt);
+        } else {
+            pthread_mutex_lock(&mx_concent);
+            nb_pkt = lgw_receive((room < NB_PKT_MAX) ? room : NB_PKT_MAX, rxpkt);
+            pthread_mutex_unlock(&mx_concent);
+        }
+#if FWD_BENCH
+        if (bench_enabled) {
+            bench_add(BENCH_FETCH, 1, t0);
+        }
+#endif
+        if (nb_pkt == LGW_HAL_ERROR) {
+            concent_recover(&recover);
+            nb_pkt = 0;
+        } else if (recover.down_ns != 0) {
+            concent_recovered(&recover);
+        }
+
+        if (nb_pkt > 0) {
+            LOGCAT_DEBUG(UP, "[rx  ] %d packets fetched\n", nb_pkt);
+        }
+
+        gettimeofday(&now, NULL);
+        if (capture_enabled) {
+            if (nb_pkt > 0) {
+                capture_write(&mem->capture, nb_pkt, rxpkt, &now);
+            }
+            capture_flush_if_due(&mem->capture, &now);
+        }
+
+        /* frames of the multi-hop relay are unwrapped or dropped before the server sees them */
+        nb_up = (relay_enabled && (nb_pkt > 0)) ? relay_input(nb_pkt, rxpkt) : nb_pkt;
+        if (nb_up > 0) {
+            rx_ring_push(nb_up, rxpkt, &now);
+        }
+
+        /* a transmission blinds every RX channel: only start one once the FIFO is drained */
+        if (relay_enabled) {
+            if (nb_pkt == 0) {
+                relay_tx();
+            }
+            relay_account();
+        }
+
+        if (nb_pkt == 0) {
+            t0 = bench_ns();
+            due = t0 + FETCH_SLEEP_MS * 1000000ULL;
+            wait_ms(FETCH_SLEEP_MS);
+            thread_waited(THREAD_FETCH, t0);
+        } else {
+            due = bench_ns();
+        }
+    }
+
+    if (capture_enabled) {
+        capture_close(&mem->capture);
+    }
+    if (capture_replay_enabled) {
+        capture_replay_close(&mem->capture_replay);
+    }
+    LOGCAT_INFO(UP, "[rx  ] End of fetch thread\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- THREAD 1: FORWARDING PACKETS TO THE SERVERS -------------------------- */
+
 void thread_up(void) {
 
-  MSG_INFO("[up  ] start\n");
+  LOGCAT_INFO(UP, "[up  ] start\n");
+  thread_task[THREAD_FORWARD] = xTaskGetCurrentTaskHandle();
   int i;
-  unsigned pkt_in_dgram;
+  int x;
+  int nb_fwd;
 
-  struct lgw_pkt_rx_s rxpkt[NB_PKT_MAX]; /* array containing inbound packets + metadata */
+  struct lgw_pkt_rx_s *rxpkt = mem->up_pkt; /* array containing inbound packets + metadata */
+  struct timeval *rx_time = mem->up_rx_time; /* UTC time of reception of each packet */
   struct lgw_pkt_rx_s *p; 
+  struct timeval now;
   int nb_pkt;
+  int cur_dgram = 0; /* datagram being filled */
+  int pool_free; /* datagrams of the pool free to replace the ones sent */
+  long wait_us;
+#if FWD_BENCH
+  uint64_t bench_t0 = 0;
+#endif
 
   bool send_report = false;
+  bool live_due;
+  bool replay_due;
+
+  /* store-and-forward variables */
+  uint32_t stored_before;
 
   /* mote info variables */
-  uint32_t mote_addr = 0;
-  uint16_t mote_fcnt = 0;
+  struct lorawan_frame_view frame;
+  enum lorawan_frame_error_e frame_err;
+
+  if (fwd_enabled && (store_path[0] != '\0')) {
+      store_enabled = (upqueue_open(&mem->upqueue, store_path, store_size) == 0);
+      if (!store_enabled) {
+          LOGCAT_ERROR(UP, "[up  ] failed to open uplink store %s, uplinks will not be stored\n", store_path);
+      }
+  }
+  for (i = 0; i < PUSH_DGRAM_NB; ++i) {
+      push_dgram[i] = dgram_alloc();
+  }
   
    while (!exit_sig && !quit_sig) {
         
-        pthread_mutex_lock(&mx_concent);
-        nb_pkt = lgw_receive(NB_PKT_MAX, rxpkt);  // Crashing here
-        pthread_mutex_unlock(&mx_concent);
-	if (nb_pkt == LGW_HAL_ERROR) {
-            MSG_ERROR("[up  ] failed packet fetch, exiting\n");
-            //exit(EXIT_FAILURE);
-        }
-        
-        if(nb_pkt!=0){
-        printf("inicio +%d + fim\n",nb_pkt);
-        } 
+        /* packets fetched by thread_fetch */
+        nb_pkt = rx_ring_pop(NB_PKT_MAX, rxpkt, rx_time);
 	
 	send_report = report_ready;
+        gettimeofday(&now, NULL);
+        /* while the datagrams sent wait for their acknowledges, the live ones keep coalescing past their deadline */
+        pool_free = dgram_nb_free();
+        live_due = (push_dgram[0]->nb_pkt > 0) && (pool_free > cur_dgram) && ((time_diff(push_dgram[0]->first, now) * 1e6) >= push_flush_us);
+        replay_due = store_enabled && (replay_inflight == 0) && (pool_free >= PUSH_DGRAM_NB) && (upqueue_pending(&mem->upqueue) > 0) && (time_diff(replay_next, now) >= 0);
+        if (fwd_enabled) {
+            push_poll();
+            push_expire(&now);
+        }
 	
-	if ((nb_pkt == 0) && (send_report == false)) {
-            wait_ms ((FETCH_SLEEP_MS));
+	if ((nb_pkt == 0) && (send_report == false) && !live_due && !replay_due) {
+            if (store_enabled) {
+                upqueue_flush_if_due(&mem->upqueue, &now);
+            }
+            /* do not sleep past the flush deadline of the datagram being coalesced */
+            wait_us = FETCH_SLEEP_MS * 1000;
+            if ((push_dgram[0]->nb_pkt > 0) && (pool_free > cur_dgram)) {
+                wait_us = (long)push_flush_us - (long)(time_diff(push_dgram[0]->first, now) * 1e6);
+                wait_us = (wait_us < 1000) ? 1000 : ((wait_us > FETCH_SLEEP_MS * 1000) ? FETCH_SLEEP_MS * 1000 : wait_us);
+            }
+            /* nor past the next retransmission time-out, acknowledges wake the thread up */
+            push_wait(push_next_expiry(&now, wait_us));
             continue;
         }
-        //printf("pos nb_packet \n");
-        
 
- /* serialize Lora packets metadata and payload */
- 	pkt_in_dgram = 0;
+ /* filter Lora packets, the ones to be forwarded are kept at the beginning of rxpkt */
+ 	nb_fwd = 0;
+#if FWD_BENCH
+        if (bench_enabled) {
+            bench_t0 = bench_ns();
+        }
+#endif
         for (i = 0; i < nb_pkt; ++i) {
             p = &rxpkt[i];
-	    //printf(p);
             /* Get mote information from current packet (addr, fcnt) */
-            /* FHDR - DevAddr */
-            mote_addr  = p->payload[1];
-            mote_addr |= p->payload[2] << 8;
-            mote_addr |= p->payload[3] << 16;
-            mote_addr |= p->payload[4] << 24;
-            /* FHDR - FCnt */
-            mote_fcnt  = p->payload[6];
-            mote_fcnt |= p->payload[7] << 8;
-            
-            //printf("inicio +%d + fim\n",mote_addr);
-	    //printf("inicio +%d + fim\n",mote_fcnt);
- 	    //wait_ms(5);
-		    
+            frame_err = lorawan_frame_parse(p->payload, p->size, &frame);
+            if (frame_err != LORAWAN_FRAME_OK) {
+                LOGCAT_DEBUG(UP, "[up  ] not a valid LoRaWAN frame (size %u, error %d)\n", p->size, frame_err);
+            } else if (frame.has_fhdr) {
+                LOGCAT_DEBUG(UP, "[up  ] %s from mote: %08X (fcnt=%u)\n", lorawan_frame_mtype_str(frame.mtype), frame.dev_addr, frame.fcnt);
+                if (devtable_enabled && (p->status == STAT_CRC_OK) && lorawan_frame_is_uplink(&frame)) {
+                    pthread_mutex_lock(&mx_devtable);
+                    devtable_update(&devtable, frame.dev_addr, frame.fcnt, p->rssi, p->snr, (p->modulation == MOD_LORA) ? __builtin_ctz(p->datarate) + 6 : 0, (uint8_t)p->size, (uint32_t)rx_time[i].tv_sec);
+                    pthread_mutex_unlock(&mx_devtable);
+                }
+            } else if (frame.mtype == LORAWAN_MTYPE_JOIN_REQUEST) {
+                LOGCAT_DEBUG(UP, "[up  ] JoinRequest from DevEUI: %016llX\n", (unsigned long long)frame.dev_eui);
+            }
+
+	    /* basic packet filtering */
 	    pthread_mutex_lock(&mx_meas_up);
             meas_nb_rx_rcv += 1;   
+            chanstat_add(&meas_chan, p);
+            switch(p->status) {
+                case STAT_CRC_OK:
+                    meas_nb_rx_ok += 1;
+                    if (!fwd_valid_pkt) {
+                        pthread_mutex_unlock(&mx_meas_up);
+                        continue; /* skip that packet */
+                    }
+                    break;
+                case STAT_CRC_BAD:
+                    meas_nb_rx_bad += 1;
+                    if (!fwd_error_pkt) {
+                        pthread_mutex_unlock(&mx_meas_up);
+                        continue; /* skip that packet */
+                    }
+                    break;
+                case STAT_NO_CRC:
+                    meas_nb_rx_nocrc += 1;
+                    if (!fwd_nocrc_pkt) {
+                        pthread_mutex_unlock(&mx_meas_up);
+                        continue; /* skip that packet */
+                    }
+                    break;
+                default:
+                    LOGCAT_WARN(UP, "[up  ] received packet with unknown status %u (size %u, modulation %u, BW %u, DR %u, RSSI %.1f)\n", p->status, p->size, p->modulation, p->bandwidth, p->datarate, p->rssi);
+                    pthread_mutex_unlock(&mx_meas_up);
+                    continue; /* skip that packet */
+            }
             pthread_mutex_unlock(&mx_meas_up);
+            if (nb_fwd != i) {
+                rxpkt[nb_fwd] = *p;
+                rx_time[nb_fwd] = rx_time[i];
+            }
+            ++nb_fwd;
 	}
-         if (send_report == true) {
-            pthread_mutex_lock(&mx_stat_rep);
-            report_ready = false;
-            pthread_mutex_unlock(&mx_stat_rep);
+#if FWD_BENCH
+        if (bench_enabled && (nb_pkt > 0)) {
+            bench_add(BENCH_DECODE, nb_pkt, bench_t0);
+        }
+#endif
+
+        if (!fwd_enabled) {
+            if (send_report == true) {
+                pthread_mutex_lock(&mx_stat_rep);
+                report_ready = false;
+                pthread_mutex_unlock(&mx_stat_rep);
+            }
+            push_wait(5000);
+            continue;
+        }
+        stored_before = store_enabled ? mem->upqueue.nb_stored : 0;
+
+        /* coalesce live packets, or store them while the server is unreachable */
+        for (i = 0; i < nb_fwd; ++i) {
+            if (!serv[SERV_PRIMARY].live && store_enabled && (serv_send_mask(&now) == 0)) {
+                upqueue_push(&mem->upqueue, &rxpkt[i], &rx_time[i]);
+                continue;
+            }
+#if FWD_BENCH
+            if (bench_enabled) {
+                bench_t0 = bench_ns();
+            }
+#endif
+            x = dgram_add(push_dgram[cur_dgram], &rxpkt[i], &rx_time[i]);
+#if FWD_BENCH
+            if (bench_enabled && (x == 0)) {
+                bench_add(BENCH_SERIALIZE, 1, bench_t0);
+            }
+#endif
+            if (x == 1) {
+                /* datagram full, move to the next one or send them all */
+                if (cur_dgram + 1 < PUSH_DGRAM_NB) {
+                    ++cur_dgram;
+                } else {
+                    push_flush(PUSH_DGRAM_NB, false);
+                    cur_dgram = 0;
+                }
+                x = dgram_add(push_dgram[cur_dgram], &rxpkt[i], &rx_time[i]);
+            }
+            if (x < 0) {
+                LOGCAT_WARN(UP, "[up  ] packet cannot be serialized, discarded\n");
+            }
         }
-     wait_ms (5);
+
+        /* send on size, on deadline, or to carry the status report */
+        pool_free = dgram_nb_free();
+        live_due = (push_dgram[0]->nb_pkt > 0) && (pool_free > cur_dgram) && ((time_diff(push_dgram[0]->first, now) * 1e6) >= push_flush_us);
+        if (((cur_dgram > 0) && (pool_free > cur_dgram)) || live_due || (send_report == true)) {
+            push_flush(cur_dgram + 1, send_report);
+            cur_dgram = 0;
+        }
+
+        /* replay stored packets once the live traffic is sent, rate limited */
+        if (replay_due && (push_dgram[0]->nb_pkt == 0)) {
+            x = push_replay();
+            replay_next = now;
+            if (serv[SERV_PRIMARY].live) {
+                replay_next.tv_usec += (1000000 / store_replay_rate) * (x > 0 ? x : 1);
+            } else {
+                replay_next.tv_usec += STORE_PROBE_MS * 1000;
+            }
+            replay_next.tv_sec += replay_next.tv_usec / 1000000;
+            replay_next.tv_usec %= 1000000;
+        }
+
+        if (store_enabled) {
+            upqueue_flush_if_due(&mem->upqueue, &now);
+            pthread_mutex_lock(&mx_meas_up);
+            meas_up_pkt_stored += mem->upqueue.nb_stored - stored_before;
+            meas_up_pkt_dropped += mem->upqueue.nb_dropped;
+            meas_up_store_pending = upqueue_pending(&mem->upqueue);
+            pthread_mutex_unlock(&mx_meas_up);
+            mem->upqueue.nb_dropped = 0;
+        }
+        /* wait for acknowledges, unless packets are already waiting in the ring */
+        pthread_mutex_lock(&mx_rx_ring);
+        x = rx_ring_nb;
+        pthread_mutex_unlock(&mx_rx_ring);
+        if (x == 0) {
+            push_wait(5000);
+        }
+    }
+
+    /* datagrams still waiting for acknowledges are given up, their packets are stored */
+    for (i = 0; i < PUSH_POOL_NB; ++i) {
+        if (mem->dgram_pool[i].state == DGRAM_INFLIGHT) {
+            push_abort(&mem->dgram_pool[i]);
+        }
+    }
+    if (store_enabled) {
+        upqueue_close(&mem->upqueue);
     }
-}
\ No newline at end of file
+    LOGCAT_INFO(UP, "[up  ] End of upstream thread\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- THREAD 2: MAPPING THE CONCENTRATOR COUNTER TO UTC -------------------- */
+
+void thread_timersync(void) {
+    struct timeval before, after;
+    uint32_t cnt;
+    uint64_t t0;
+    int x;
+
+    LOGCAT_INFO(JIT, "[sync] start\n");
+    thread_task[THREAD_TIMERSYNC] = xTaskGetCurrentTaskHandle();
+    while (!exit_sig && !quit_sig) {
+        /* without GPS, the PPS counter register follows the free running counter while GPS_EN is cleared */
+        pthread_mutex_lock(&mx_concent);
+        lgw_reg_w(LGW_GPS_EN, 0);
+        gettimeofday(&before, NULL);
+        x = lgw_get_trigcnt(&cnt);
+        gettimeofday(&after, NULL);
+        lgw_reg_w(LGW_GPS_EN, 1);
+        pthread_mutex_unlock(&mx_concent);
+        if (x != LGW_HAL_SUCCESS) {
+            LOGCAT_WARN(JIT, "[sync] failed to read the concentrator counter\n");
+        } else if (clocksync_sample(&clocksync, cnt, &before, &after) != 0) {
+            LOGCAT_DEBUG(JIT, "[sync] sample rejected, counter read in %ld us\n", (long)((after.tv_sec - before.tv_sec) * 1000000 + (after.tv_usec - before.tv_usec)));
+        }
+
+        t0 = bench_ns();
+        wait_ms(TIMERSYNC_MS);
+        thread_waited(THREAD_TIMERSYNC, t0);
+    }
+    LOGCAT_INFO(JIT, "[sync] End of Time Sync thread\n");
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Escalation of the concentrator recovery, see recover.h
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+
+#include "recover.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+enum recover_tier_e recover_escalate(struct recover_s *rec, uint64_t now_ns) {
+    if (rec->down_ns == 0) {
+        rec->down_ns = now_ns;
+        /* start from the first tier, unless the previous recovery did not hold */
+        if ((rec->tier == RECOVER_NONE) || ((now_ns - rec->up_ns) >= RECOVER_HOLD_MS * 1000000ULL)) {
+            rec->tier = RECOVER_NONE;
+        }
+    }
+    if ((rec->tier == RECOVER_NONE) || ((rec->tier < RECOVER_RESET) && (rec->tier_nb >= RECOVER_RETRY_NB) && ((now_ns - rec->tier_ns) >= RECOVER_RETRY_MS * 1000000ULL))) {
+        rec->tier += 1;
+        rec->tier_ns = now_ns;
+        rec->tier_nb = 0;
+    }
+    rec->tier_nb += 1;
+    return rec->tier;
+}
+
+uint32_t recover_end(struct recover_s *rec, uint64_t now_ns) {
+    uint32_t down_ms = (uint32_t)((now_ns - rec->down_ns) / 1000000);
+
+    rec->down_ns = 0;
+    rec->up_ns = now_ns;
+    return down_ms;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
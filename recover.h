@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Escalation of the recovery of the concentrator after failed packet
+    fetches: flush the RX FIFO, then restart the concentrator, then reset
+    the gateway. Each tier is applied again on the next failures, and the
+    next one is only tried once the tier failed RECOVER_RETRY_NB times over
+    RECOVER_RETRY_MS at least, so a short SPI glitch is handled by flushes
+    whatever the fetch period. An error within RECOVER_HOLD_MS of a
+    recovery continues the escalation where it was, after a longer clean
+    period recovery starts again from the FIFO flush.
+
+    Only the choice of the tier and the downtime are kept here, the caller
+    applies the tier and passes the time, so the escalation runs on a host
+    without the HAL.
+*/
+
+#ifndef _LORA_PKTFWD_RECOVER_H
+#define _LORA_PKTFWD_RECOVER_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define RECOVER_HOLD_MS     10000   /* a concentrator error after a shorter clean period continues the escalation */
+#define RECOVER_RETRY_NB    3       /* failures of a tier before the next one is tried */
+#define RECOVER_RETRY_MS    1000    /* and time since the tier was first applied */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum recover_tier_e {
+    RECOVER_NONE = 0,
+    RECOVER_FLUSH,              /* release the RX FIFO entries */
+    RECOVER_RESTART,            /* lgw_stop and lgw_start, the HAL keeps the configuration */
+    RECOVER_RESET,              /* power cycle through the PIC, pygate_reset */
+    RECOVER_TIER_NB
+};
+
+/**
+@struct recover_s
+@brief Recovery state of the concentrator, zeroed before the first fetch
+*/
+struct recover_s {
+    enum recover_tier_e tier;   /*!> last tier applied */
+    uint64_t        tier_ns;    /*!> time the tier was first applied */
+    uint32_t        tier_nb;    /*!> failures the tier was applied to */
+    uint64_t        down_ns;    /*!> time of the first failed fetch, 0 while the concentrator works */
+    uint64_t        up_ns;      /*!> time the concentrator was last recovered */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Choose the tier to apply after a failed packet fetch.
+
+@param rec[in,out] Recovery state
+@param now_ns Monotonic time (ns), never 0
+@return tier to apply, the same one until it failed RECOVER_RETRY_NB times over RECOVER_RETRY_MS
+*/
+enum recover_tier_e recover_escalate(struct recover_s *rec, uint64_t now_ns);
+
+/**
+@brief End the outage once a packet fetch succeeds again.
+
+@param rec[in,out] Recovery state, with an outage in progress
+@param now_ns Monotonic time (ns)
+@return downtime since the first failed fetch (ms), to be accounted against rec->tier
+*/
+uint32_t recover_end(struct recover_s *rec, uint64_t now_ns);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Multi-channel repeater scheduling, see relay.h
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset, memcpy */
+
+#include "relay.h"
+#include "lorawan_frame.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* FNV-1a of the PHYPayload */
+static uint32_t payload_hash(const struct lgw_pkt_rx_s *pkt) {
+    uint32_t h = 2166136261u;
+    uint16_t i;
+
+    for (i = 0; i < pkt->size; ++i) {
+        h = (h ^ pkt->payload[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* true if the payload was seen recently, it is remembered otherwise */
+static bool dedup_seen(struct relay_s *relay, uint32_t h, uint64_t now_ns) {
+    unsigned i;
+
+    for (i = 0; i < RELAY_DEDUP_NB; ++i) {
+        if ((relay->dedup[i] == h) && (relay->dedup_ns[i] != 0) && (now_ns - relay->dedup_ns[i] < RELAY_DEDUP_MS * 1000000ULL)) {
+            return true;
+        }
+    }
+    relay->dedup[relay->dedup_head] = h;
+    relay->dedup_ns[relay->dedup_head] = now_ns;
+    relay->dedup_head = (relay->dedup_head + 1) % RELAY_DEDUP_NB;
+    return false;
+}
+
+/* xorshift32, the backoffs only need to differ between repeaters */
+static uint32_t rand_next(struct relay_s *relay) {
+    uint32_t x = relay->rand;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    relay->rand = x;
+    return x;
+}
+
+/* random wait after the guard time, in a window doubled on each busy channel */
+static void backoff_draw(struct relay_s *relay) {
+    uint32_t window_us = ((uint32_t)relay->cfg.backoff_ms << relay->backoff_shift) * 1000;
+
+    relay->backoff_ns = (window_us > 0) ? (uint64_t)(rand_next(relay) % window_us) * 1000 : 0;
+}
+
+/* drop the packets that waited too long, the oldest ones are at the head */
+static void expire(struct relay_s *relay, uint64_t now_ns) {
+    while ((relay->nb > 0) && (now_ns - relay->queue_ns[relay->head] > RELAY_TTL_MS * 1000000ULL)) {
+        relay->head = (relay->head + 1) % RELAY_QUEUE_NB;
+        relay->nb -= 1;
+        relay->stat.nb_expired += 1;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void relay_init(struct relay_s *relay, const struct relay_cfg_s *cfg, uint32_t seed) {
+    memset(relay, 0, sizeof *relay);
+    relay->cfg = *cfg;
+    if (relay->cfg.duty_permil == 0 || relay->cfg.duty_permil > 1000) {
+        relay->cfg.duty_permil = 1000;
+    }
+    relay->rand = (seed != 0) ? seed : 1;
+}
+
+void relay_rx_seen(struct relay_s *relay, uint64_t now_ns) {
+    uint64_t idle_ns = relay->rx_last_ns + relay->cfg.guard_ms * 1000000ULL;
+
+    /* the backoff only runs down while the channel is free */
+    if ((relay->nb > 0) && (now_ns > idle_ns)) {
+        relay->backoff_ns -= (now_ns - idle_ns < relay->backoff_ns) ? (now_ns - idle_ns) : relay->backoff_ns;
+    }
+    relay->rx_last_ns = now_ns;
+}
+
+void relay_busy(struct relay_s *relay, uint64_t now_ns) {
+    uint64_t next;
+
+    relay->stat.nb_busy += 1;
+    if (relay->backoff_shift < RELAY_BACKOFF_SHIFT) {
+        relay->backoff_shift += 1;
+    }
+    relay_rx_seen(relay, now_ns);
+    backoff_draw(relay);
+
+    /* the packets that cannot be sent before their time to live any more */
+    next = relay_next_ns(relay);
+    while ((relay->nb > 0) && (relay->queue_ns[relay->head] + RELAY_TTL_MS * 1000000ULL < next)) {
+        relay->head = (relay->head + 1) % RELAY_QUEUE_NB;
+        relay->nb -= 1;
+        relay->stat.nb_late += 1;
+    }
+}
+
+int relay_push(struct relay_s *relay, const struct lgw_pkt_rx_s *pkt, uint64_t now_ns) {
+    struct lorawan_frame_view frame;
+    uint32_t h;
+    unsigned i;
+
+    /* only valid LoRa packets */
+    if ((pkt->status != STAT_CRC_OK) || (pkt->modulation != MOD_LORA)) {
+        return -1;
+    }
+    /* a frame the network server would reject is not worth the airtime */
+    if (lorawan_frame_parse(pkt->payload, pkt->size, &frame) != LORAWAN_FRAME_OK) {
+        relay->stat.nb_invalid += 1;
+        return -1;
+    }
+    h = payload_hash(pkt);
+    if (dedup_seen(relay, h, now_ns)) {
+        relay->stat.nb_dup += 1;
+        return -1;
+    }
+    expire(relay, now_ns);
+    if (relay->nb >= RELAY_QUEUE_NB) {
+        relay->stat.nb_full += 1;
+        return -1;
+    }
+    if (relay->nb == 0) {
+        /* the window doubled for packets dropped since, at its largest it exceeds the time to live */
+        relay->backoff_shift = 0;
+        relay->rx_last_ns = now_ns;
+        backoff_draw(relay);
+    }
+    i = (relay->head + relay->nb) % RELAY_QUEUE_NB;
+    relay->queue[i] = *pkt;
+    relay->queue_ns[i] = now_ns;
+    relay->queue_hash[i] = h;
+    relay->nb += 1;
+    relay->stat.nb_queued += 1;
+    return 0;
+}
+
+int relay_overheard(struct relay_s *relay, const struct lgw_pkt_rx_s *pkt, uint64_t now_ns) {
+    uint32_t h;
+    unsigned i, j, from, to;
+
+    if (pkt->status != STAT_CRC_OK) {
+        return -1;
+    }
+    /* copies of the packet heard later are not queued either */
+    h = payload_hash(pkt);
+    dedup_seen(relay, h, now_ns);
+    for (i = 0; i < relay->nb; ++i) {
+        if (relay->queue_hash[(relay->head + i) % RELAY_QUEUE_NB] != h) {
+            continue;
+        }
+        /* close the gap, the queue stays in arrival order */
+        for (j = i; j + 1 < relay->nb; ++j) {
+            from = (relay->head + j + 1) % RELAY_QUEUE_NB;
+            to = (relay->head + j) % RELAY_QUEUE_NB;
+            relay->queue[to] = relay->queue[from];
+            relay->queue_ns[to] = relay->queue_ns[from];
+            relay->queue_hash[to] = relay->queue_hash[from];
+        }
+        relay->nb -= 1;
+        relay->stat.nb_cancel += 1;
+        return 0;
+    }
+    return -1;
+}
+
+uint64_t relay_next_ns(const struct relay_s *relay) {
+    uint64_t t = relay->rx_last_ns + relay->cfg.guard_ms * 1000000ULL + relay->backoff_ns;
+
+    if (relay->nb == 0) {
+        return 0;
+    }
+    if (relay->tx_next_ns > t) {
+        t = relay->tx_next_ns;
+    }
+    return (t > 0) ? t : 1;
+}
+
+int relay_peek(struct relay_s *relay, uint64_t now_ns, struct lgw_pkt_tx_s *tx) {
+    const struct lgw_pkt_rx_s *pkt;
+
+    expire(relay, now_ns);
+    if ((relay->nb == 0) || (now_ns < relay_next_ns(relay))) {
+        return 0;
+    }
+    pkt = &relay->queue[relay->head];
+
+    memset(tx, 0, sizeof *tx);
+    tx->freq_hz = relay->cfg.freq_hz;
+    tx->tx_mode = IMMEDIATE;
+    tx->rf_chain = relay->cfg.rf_chain;
+    tx->rf_power = relay->cfg.rf_power;
+    tx->modulation = MOD_LORA;
+    tx->bandwidth = pkt->bandwidth;
+    tx->datarate = (relay->cfg.datarate != 0) ? relay->cfg.datarate : pkt->datarate;
+    tx->coderate = pkt->coderate;
+    tx->invert_pol = false; /* heard as an uplink by the gateways */
+    tx->preamble = 8;
+    tx->size = pkt->size;
+    memcpy(tx->payload, pkt->payload, pkt->size);
+    return 1;
+}
+
+int relay_pop(struct relay_s *relay, uint64_t now_ns, struct lgw_pkt_tx_s *tx) {
+    uint32_t wait_us;
+
+    if (relay_peek(relay, now_ns, tx) == 0) {
+        return 0;
+    }
+    wait_us = (uint32_t)((now_ns - relay->queue_ns[relay->head]) / 1000);
+    relay->stat.wait_us += wait_us;
+    if (wait_us > relay->stat.wait_max_us) {
+        relay->stat.wait_max_us = wait_us;
+    }
+    relay->head = (relay->head + 1) % RELAY_QUEUE_NB;
+    relay->nb -= 1;
+    return 1;
+}
+
+int relay_lbt(struct relay_s *relay, uint64_t now_ns, int32_t nb_rx, struct lgw_pkt_tx_s *tx) {
+    if (relay_peek(relay, now_ns, tx) == 0) {
+        return 0;
+    }
+    /* a packet received since the RX FIFO was drained: a transmission now would blind the RX chains */
+    if (nb_rx > 0) {
+        relay_busy(relay, now_ns);
+        return -1;
+    }
+    return relay_pop(relay, now_ns, tx);
+}
+
+void relay_sent(struct relay_s *relay, uint64_t now_ns, uint32_t airtime_us) {
+    /* the sub-band is free again after airtime / duty cycle */
+    relay->tx_next_ns = now_ns + (uint64_t)airtime_us * 1000000ULL / relay->cfg.duty_permil;
+    relay->backoff_shift = 0;
+    backoff_draw(relay);
+    relay->stat.nb_sent += 1;
+    relay->stat.airtime_us += airtime_us;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
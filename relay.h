@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Repeater: packets received on any IF channel are transmitted again on a
+    dedicated TX channel, so end devices out of reach of a gateway are heard
+    through the repeater.
+
+    The concentrator is half-duplex, a transmission blinds all the RX
+    channels. Transmissions are only started when the RX FIFO is drained and
+    no packet was received for a guard time, and are spaced by the duty cycle
+    of the TX sub-band. Packets waiting longer than their time to live are
+    dropped, duplicates (heard on several channels, or relayed by another
+    repeater) are relayed once.
+
+    The HAL cannot sense a demodulation in progress, so listen before talk
+    works with what the concentrator reports:
+    - a random backoff is added to the guard time, so repeaters hearing the
+      same uplink do not transmit it at the same time. It is drawn when a
+      packet is queued or sent, and only runs down while the channel is
+      free, so a busy channel delays the repeater without starving it;
+    - the caller reads the number of packets in the RX FIFO right before
+      the emission and gives it to relay_lbt: when a packet arrived since
+      the FIFO was drained, the transmission is deferred with a doubled
+      backoff window, the packets that can no longer be sent before their
+      time to live are dropped;
+    - a packet heard on the TX channel, relayed by another repeater, cancels
+      the copy waiting in the queue.
+
+    Times are monotonic nanoseconds. Not thread safe.
+*/
+
+#ifndef _LORA_PKTFWD_RELAY_H
+#define _LORA_PKTFWD_RELAY_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define RELAY_QUEUE_NB      8       /* packets waiting to be relayed */
+#define RELAY_DEDUP_NB      32      /* payloads remembered to detect duplicates */
+#define RELAY_DEDUP_MS      10000   /* how long a payload is remembered */
+#define RELAY_TTL_MS        2000    /* packets not relayed by then are dropped */
+#define RELAY_GUARD_MS      50      /* RX silence required before a transmission */
+#define RELAY_BACKOFF_MS    500     /* random backoff added to the guard time, max: several airtimes of a relayed packet */
+#define RELAY_BACKOFF_SHIFT 3       /* the backoff window doubles at most this many times on a busy channel */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct relay_cfg_s
+@brief TX channel of the repeater
+*/
+struct relay_cfg_s {
+    uint32_t        freq_hz;    /*!> TX frequency, outside of the RX channels */
+    uint8_t         rf_chain;
+    int8_t          rf_power;   /*!> dBm */
+    uint32_t        datarate;   /*!> DR_LORA_SFx, 0 to keep the datarate of the received packet */
+    uint16_t        duty_permil;/*!> duty cycle of the TX sub-band, in 1/1000 */
+    uint16_t        guard_ms;   /*!> RX silence required before a transmission */
+    uint16_t        backoff_ms; /*!> random backoff added to the guard time, max, 0 to disable */
+};
+
+struct relay_stat_s {
+    uint32_t        nb_queued;
+    uint32_t        nb_sent;
+    uint32_t        nb_dup;     /*!> duplicates not relayed */
+    uint32_t        nb_full;    /*!> dropped, queue full */
+    uint32_t        nb_expired; /*!> dropped, waited longer than RELAY_TTL_MS */
+    uint32_t        nb_fail;    /*!> rejected by the concentrator */
+    uint32_t        nb_busy;    /*!> transmissions deferred, channel busy right before the emission */
+    uint32_t        nb_late;    /*!> dropped, deferred past their time to live */
+    uint32_t        nb_cancel;  /*!> dropped, relayed by another repeater first */
+    uint32_t        nb_invalid; /*!> not relayed, not a valid LoRaWAN frame */
+    uint64_t        airtime_us; /*!> time spent transmitting */
+    uint64_t        wait_us;    /*!> sum of the times between reception and transmission */
+    uint32_t        wait_max_us;
+};
+
+struct relay_s {
+    struct relay_cfg_s cfg;
+    struct lgw_pkt_rx_s queue[RELAY_QUEUE_NB];
+    uint64_t        queue_ns[RELAY_QUEUE_NB]; /* time each packet was queued */
+    uint32_t        queue_hash[RELAY_QUEUE_NB]; /* payload hash of each packet */
+    unsigned        head;
+    unsigned        nb;
+    uint32_t        dedup[RELAY_DEDUP_NB]; /* payload hashes */
+    uint64_t        dedup_ns[RELAY_DEDUP_NB];
+    unsigned        dedup_head;
+    uint64_t        rx_last_ns; /* last packet received */
+    uint64_t        backoff_ns; /* random wait after the guard time, left */
+    unsigned        backoff_shift; /* backoff window doublings since the last transmission */
+    uint32_t        rand;       /* xorshift state */
+    uint64_t        tx_next_ns; /* earliest next transmission: end of the current one, plus the duty cycle */
+    struct relay_stat_s stat;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize an empty repeater.
+
+@param relay[out] Repeater
+@param cfg[in] TX channel
+@param seed Seed of the backoffs, different on each repeater
+*/
+void relay_init(struct relay_s *relay, const struct relay_cfg_s *cfg, uint32_t seed);
+
+/**
+@brief Account RX activity, transmissions wait for the guard time after it.
+
+@param relay[in] Repeater
+@param now_ns Current time
+*/
+void relay_rx_seen(struct relay_s *relay, uint64_t now_ns);
+
+/**
+@brief Account a channel found busy right before an emission, the transmission is deferred.
+
+@param relay[in] Repeater
+@param now_ns Current time
+*/
+void relay_busy(struct relay_s *relay, uint64_t now_ns);
+
+/**
+@brief Queue a received packet.
+
+@param relay[in] Repeater
+@param pkt[in] Received packet
+@param now_ns Current time
+@return 0 if the packet is queued, -1 if it is not relayed
+*/
+int relay_push(struct relay_s *relay, const struct lgw_pkt_rx_s *pkt, uint64_t now_ns);
+
+/**
+@brief Account a packet heard on the TX channel, the same packet waiting in the queue is dropped.
+
+@param relay[in] Repeater
+@param pkt[in] Packet relayed by another repeater
+@param now_ns Current time
+@return 0 if a queued packet was dropped, -1 otherwise
+*/
+int relay_overheard(struct relay_s *relay, const struct lgw_pkt_rx_s *pkt, uint64_t now_ns);
+
+/**
+@brief Earliest time a transmission can start.
+
+@param relay[in] Repeater
+@return time, 0 if there is nothing to relay
+*/
+uint64_t relay_next_ns(const struct relay_s *relay);
+
+/**
+@brief Build the next packet to transmit now, without taking it from the queue.
+
+@param relay[in] Repeater
+@param now_ns Current time
+@param tx[out] Packet relay_pop would return
+@return 1 if a packet is due, 0 otherwise
+*/
+int relay_peek(struct relay_s *relay, uint64_t now_ns, struct lgw_pkt_tx_s *tx);
+
+/**
+@brief Take the next packet to transmit now, the caller checked the TX chain is free.
+
+@param relay[in] Repeater
+@param now_ns Current time
+@param tx[out] Packet to give to lgw_send
+@return 1 if a packet must be transmitted, 0 otherwise
+*/
+int relay_pop(struct relay_s *relay, uint64_t now_ns, struct lgw_pkt_tx_s *tx);
+
+/**
+@brief Listen before talk: take the next packet to transmit now, unless the channel is busy.
+
+@param relay[in] Repeater
+@param now_ns Current time
+@param nb_rx Packets in the RX FIFO, read right before the emission, the channel is busy when it is not 0
+@param tx[out] Packet to give to lgw_send
+@return 1 if a packet must be transmitted, 0 if none is due, -1 if the transmission is deferred, see relay_busy
+*/
+int relay_lbt(struct relay_s *relay, uint64_t now_ns, int32_t nb_rx, struct lgw_pkt_tx_s *tx);
+
+/**
+@brief Account a transmission started by the caller.
+
+@param relay[in] Repeater
+@param now_ns Time the transmission started
+@param airtime_us Time on air of the packet
+*/
+void relay_sent(struct relay_s *relay, uint64_t now_ns, uint32_t airtime_us);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Multi-hop relay protocol, see relaynet.h
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset, memcpy, memmove */
+
+#include "relaynet.h"
+#include "adr.h"
+#include "lorawan_frame.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static inline uint16_t get_le16(const uint8_t *b) {
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static inline void put_le16(uint8_t *b, uint16_t v) {
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+}
+
+static inline bool route_live(const struct relaynet_route_s *r, uint32_t now) {
+    return r->used && (now - r->seen <= RELAYNET_ROUTE_TTL_S);
+}
+
+/* true if (src, seq) was seen recently, it is remembered otherwise */
+static bool dup_seen(struct relaynet_s *rn, uint16_t src, uint16_t seq, uint32_t now) {
+    unsigned i;
+
+    for (i = 0; i < RELAYNET_DUP_NB; ++i) {
+        if ((rn->dup_seen[i] != 0) && (rn->dup_src[i] == src) && (rn->dup_seq[i] == seq) && (now - rn->dup_seen[i] <= RELAYNET_DUP_S)) {
+            return true;
+        }
+    }
+    rn->dup_src[rn->dup_head] = src;
+    rn->dup_seq[rn->dup_head] = seq;
+    rn->dup_seen[rn->dup_head] = (now != 0) ? now : 1;
+    rn->dup_head = (rn->dup_head + 1) % RELAYNET_DUP_NB;
+    return false;
+}
+
+/* ACK slot of an uplink to everybody, the counters of the nodes are not synchronized so it differs between nodes and between uplinks */
+static uint32_t ack_slot(uint16_t node_id, uint32_t count_us) {
+    uint32_t h = (count_us ^ ((uint32_t)node_id << 16)) * 2654435761u;
+
+    return (h >> 16) % RELAYNET_ACK_SLOT_NB;
+}
+
+/* account the advertisement of a neighbour */
+static void route_update(struct relaynet_s *rn, const struct relaynet_hdr_s *hdr, const struct lgw_pkt_rx_s *pkt, uint32_t now) {
+    struct relaynet_route_s *r = NULL;
+    const uint8_t *body = &pkt->payload[RELAYNET_HDR_SIZE];
+    uint16_t sink = get_le16(&body[0]);
+    uint16_t via = get_le16(&body[2]);
+    uint8_t hops = hdr->hops + 1;
+    uint8_t sf = (uint8_t)(__builtin_ctz(pkt->datarate) + 6);
+    float snr = pkt->snr;
+    unsigned i;
+
+    /* split horizon: a neighbour routing through this node is not a route */
+    if ((sink == rn->node_id) || (via == rn->node_id) || (hops > rn->hop_limit)) {
+        return;
+    }
+    if ((sf < ADR_SF_MIN) || (sf > ADR_SF_MAX) || (snr < adr_snr_floor(sf) + RELAYNET_LINK_MARGIN)) {
+        return;
+    }
+    for (i = 0; i < RELAYNET_ROUTE_NB; ++i) {
+        if (rn->route[i].used && (rn->route[i].sink == sink)) {
+            r = &rn->route[i];
+            break;
+        }
+    }
+    if (r == NULL) {
+        for (i = 0; i < RELAYNET_ROUTE_NB; ++i) {
+            if (!route_live(&rn->route[i], now)) {
+                r = &rn->route[i];
+                break;
+            }
+        }
+        if (r == NULL) {
+            return;
+        }
+    } else if ((r->via != hdr->src) && route_live(r, now) && (hops > r->hops || ((hops == r->hops) && (snr < r->snr + RELAYNET_SNR_HYST)))) {
+        /* the current route is at least as good */
+        return;
+    }
+    r->used = true;
+    r->sink = sink;
+    r->via = hdr->src;
+    r->hops = hops;
+    r->snr = snr;
+    r->seen = now;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void relaynet_init(struct relaynet_s *rn, uint16_t node_id, bool sink, uint8_t hop_limit) {
+    memset(rn, 0, sizeof *rn);
+    rn->node_id = node_id;
+    rn->sink = sink;
+    rn->hop_limit = (hop_limit < 1) ? 1 : ((hop_limit > RELAYNET_HOP_MAX) ? RELAYNET_HOP_MAX : hop_limit);
+}
+
+void relaynet_put_hdr(uint8_t *payload, const struct relaynet_hdr_s *hdr) {
+    payload[0] = RELAYNET_MHDR;
+    payload[1] = (uint8_t)((RELAYNET_VERSION << 4) | (hdr->type & 0x0F));
+    payload[2] = (uint8_t)((hdr->hops << 4) | (hdr->hop_limit & 0x0F));
+    put_le16(&payload[3], hdr->src);
+    put_le16(&payload[5], hdr->next);
+    put_le16(&payload[7], hdr->seq);
+}
+
+int relaynet_parse(const uint8_t *payload, uint16_t size, struct relaynet_hdr_s *hdr) {
+    struct lorawan_frame_view frame;
+    const uint8_t *p;
+
+    /* the hop header follows the MHDR of a Proprietary frame */
+    if ((size < RELAYNET_HDR_SIZE) || (lorawan_frame_parse(payload, size, &frame) != LORAWAN_FRAME_OK)) {
+        return -1;
+    }
+    if ((frame.mtype != LORAWAN_MTYPE_PROPRIETARY) || (frame.major != LORAWAN_MAJOR_R1)) {
+        return -1;
+    }
+    p = &frame.buf[frame.payload_offset];
+    if ((p[0] >> 4) != RELAYNET_VERSION) {
+        return -1;
+    }
+    hdr->type = p[0] & 0x0F;
+    hdr->hops = p[1] >> 4;
+    hdr->hop_limit = p[1] & 0x0F;
+    hdr->src = get_le16(&p[2]);
+    hdr->next = get_le16(&p[4]);
+    hdr->seq = get_le16(&p[6]);
+    if ((hdr->type == RELAYNET_ADV) && (size < RELAYNET_HDR_SIZE + 4)) {
+        return -1;
+    }
+    return 0;
+}
+
+int relaynet_input(struct relaynet_s *rn, struct lgw_pkt_rx_s *pkt, uint32_t now) {
+    struct relaynet_hdr_s hdr;
+    const struct relaynet_route_s *r;
+
+    if (relaynet_parse(pkt->payload, pkt->size, &hdr) != 0) {
+        return RELAYNET_PLAIN;
+    }
+    if (hdr.type == RELAYNET_ADV) {
+        rn->stat.nb_adv += 1;
+        route_update(rn, &hdr, pkt, now);
+        return RELAYNET_DROP;
+    }
+    if (hdr.type == RELAYNET_UP) {
+        /* the device did not get the ACK of an uplink already sent */
+        if (dup_seen(rn, hdr.src, hdr.seq, now)) {
+            rn->stat.nb_dup += 1;
+            return RELAYNET_DROP;
+        }
+        return RELAYNET_PLAIN;
+    }
+    if (hdr.type != RELAYNET_DATA) {
+        return RELAYNET_DROP;
+    }
+    if ((hdr.next != rn->node_id) && !((hdr.next == RELAYNET_BROADCAST) && rn->sink)) {
+        rn->stat.nb_overheard += 1;
+        return RELAYNET_DROP;
+    }
+    if (dup_seen(rn, hdr.src, hdr.seq, now)) {
+        rn->stat.nb_dup += 1;
+        return RELAYNET_DROP;
+    }
+
+    if (rn->sink) {
+        rn->stat.nb_deliv += 1;
+        rn->stat.nb_deliv_hops[hdr.hops] += 1;
+        pkt->size -= RELAYNET_HDR_SIZE;
+        memmove(pkt->payload, &pkt->payload[RELAYNET_HDR_SIZE], pkt->size);
+        return RELAYNET_DELIVER;
+    }
+    if (hdr.hops >= hdr.hop_limit) {
+        rn->stat.nb_hop_limit += 1;
+        return RELAYNET_DROP;
+    }
+    r = relaynet_route(rn, now);
+    if (r == NULL) {
+        rn->stat.nb_no_route += 1;
+        return RELAYNET_DROP;
+    }
+    hdr.hops += 1;
+    hdr.next = r->via;
+    relaynet_put_hdr(pkt->payload, &hdr);
+    rn->stat.nb_fwd += 1;
+    return RELAYNET_FORWARD;
+}
+
+int relaynet_encap(struct relaynet_s *rn, const struct lgw_pkt_rx_s *pkt, struct lgw_pkt_rx_s *out, uint32_t now) {
+    struct relaynet_hdr_s hdr;
+    const struct relaynet_route_s *r = relaynet_route(rn, now);
+
+    if (r == NULL) {
+        rn->stat.nb_no_route += 1;
+        return -1;
+    }
+    if (pkt->size > 255 - RELAYNET_HDR_SIZE) {
+        return -1;
+    }
+    hdr.type = RELAYNET_DATA;
+    hdr.hops = 1;
+    hdr.hop_limit = rn->hop_limit;
+    hdr.src = rn->node_id;
+    hdr.next = r->via;
+    hdr.seq = rn->seq++;
+    /* a frame coming back to its source is dropped as a duplicate */
+    dup_seen(rn, hdr.src, hdr.seq, now);
+
+    *out = *pkt;
+    relaynet_put_hdr(out->payload, &hdr);
+    memcpy(&out->payload[RELAYNET_HDR_SIZE], pkt->payload, pkt->size);
+    out->size = pkt->size + RELAYNET_HDR_SIZE;
+    rn->stat.nb_orig += 1;
+    return 0;
+}
+
+int relaynet_ack(struct relaynet_s *rn, const struct lgw_pkt_rx_s *pkt, struct lgw_pkt_tx_s *tx) {
+    struct relaynet_hdr_s hdr;
+    uint8_t sf;
+    uint32_t slot_us = 0;
+
+    if ((pkt->status != STAT_CRC_OK) || (pkt->modulation != MOD_LORA) || (relaynet_parse(pkt->payload, pkt->size, &hdr) != 0) || (hdr.type != RELAYNET_UP)) {
+        return -1;
+    }
+    /* an uplink addressed to another node is acknowledged by that node only */
+    if ((hdr.next != RELAYNET_BROADCAST) && (hdr.next != rn->node_id)) {
+        return -1;
+    }
+    sf = (uint8_t)(__builtin_ctz(pkt->datarate) + 6);
+    if ((hdr.next == RELAYNET_BROADCAST) && (sf >= ADR_SF_MIN) && (sf <= ADR_SF_MAX)) {
+        /* a slot holds the ACK with the slot byte of the time-slotted schedule */
+        slot_us = ack_slot(rn->node_id, pkt->count_us) * (adr_airtime_us(sf, RELAYNET_HDR_SIZE + 1) + RELAYNET_ACK_GUARD_US);
+    }
+    memset(tx, 0, sizeof *tx);
+    tx->freq_hz = pkt->freq_hz;
+    tx->tx_mode = TIMESTAMPED;
+    tx->count_us = pkt->count_us + RELAYNET_ACK_DELAY_US + slot_us;
+    tx->modulation = MOD_LORA;
+    tx->bandwidth = pkt->bandwidth;
+    tx->datarate = pkt->datarate;
+    tx->coderate = pkt->coderate;
+    tx->invert_pol = false;
+    tx->preamble = 8;
+
+    /* acknowledged sequence number, addressed to the device */
+    hdr.type = RELAYNET_ACK;
+    hdr.hops = 0;
+    hdr.hop_limit = 0;
+    hdr.next = hdr.src;
+    hdr.src = rn->node_id;
+    relaynet_put_hdr(tx->payload, &hdr);
+    tx->size = RELAYNET_HDR_SIZE;
+    rn->stat.nb_ack += 1;
+    return 0;
+}
+
+int relaynet_adv(struct relaynet_s *rn, struct lgw_pkt_rx_s *out, uint32_t now) {
+    struct relaynet_hdr_s hdr;
+    const struct relaynet_route_s *r = NULL;
+
+    if ((rn->adv_next != 0) && ((int32_t)(now - rn->adv_next) < 0)) {
+        return 0;
+    }
+    if (!rn->sink) {
+        r = relaynet_route(rn, now);
+        if (r == NULL) {
+            return 0;
+        }
+    }
+    /* spread the advertisements of neighbours started together */
+    rn->adv_next = now + RELAYNET_ADV_S - 4 + ((rn->node_id ^ rn->seq) % 8);
+    hdr.type = RELAYNET_ADV;
+    hdr.hops = rn->sink ? 0 : r->hops;
+    hdr.hop_limit = rn->hop_limit;
+    hdr.src = rn->node_id;
+    hdr.next = RELAYNET_BROADCAST;
+    hdr.seq = rn->seq++;
+
+    relaynet_put_hdr(out->payload, &hdr);
+    put_le16(&out->payload[RELAYNET_HDR_SIZE], rn->sink ? rn->node_id : r->sink);
+    put_le16(&out->payload[RELAYNET_HDR_SIZE + 2], rn->sink ? rn->node_id : r->via);
+    out->size = RELAYNET_HDR_SIZE + 4;
+    return 1;
+}
+
+const struct relaynet_route_s * relaynet_route(const struct relaynet_s *rn, uint32_t now) {
+    const struct relaynet_route_s *best = NULL;
+    const struct relaynet_route_s *r;
+    unsigned i;
+
+    for (i = 0; i < RELAYNET_ROUTE_NB; ++i) {
+        r = &rn->route[i];
+        if (!route_live(r, now)) {
+            continue;
+        }
+        if ((best == NULL) || (r->hops < best->hops) || ((r->hops == best->hops) && (r->snr > best->snr))) {
+            best = r;
+        }
+    }
+    return best;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Multi-hop relay protocol between chained repeaters and a sink gateway.
+
+    Relayed frames are LoRaWAN Proprietary frames (MHDR 0xE0), ignored by
+    the network servers and by the devices, carrying a 9 bytes hop header:
+
+        byte 0      MHDR, 0xE0
+        byte 1      version (4 MSB), frame type (4 LSB)
+        byte 2      hops done (4 MSB), hop limit (4 LSB)
+        byte 3-4    source node, little endian
+        byte 5-6    next hop node, little endian, 0xFFFF for everybody
+        byte 7-8    sequence number of the source, little endian
+
+    followed by the relayed PHYPayload (RELAYNET_DATA), or by the node IDs of
+    the sink and of the next hop towards it (RELAYNET_ADV), little endian.
+
+    Devices not speaking LoRaWAN send RELAYNET_UP frames, with their own ID
+    as source and the application payload as body. A node hearing one answers
+    with a RELAYNET_ACK (source: the node, next hop: the device, same
+    sequence number) and sends it into the relay network like a LoRaWAN
+    uplink. A device addresses its uplinks to the node that acknowledged the
+    previous one: only that node answers, in the first ACK slot,
+    RELAYNET_ACK_DELAY_US after the end of the uplink. Uplinks to everybody
+    are answered by every node hearing them, each one in one of
+    RELAYNET_ACK_SLOT_NB slots drawn from its counter, so the ACKs of two
+    nodes only collide when they draw the same slot, and rarely again on the
+    retransmission. A device retransmitting because the ACK was lost gets a
+    new ACK, the relay network does not see the duplicate. RELAYNET_BEACON
+    frames start the superframes of the time-slotted schedule, see tdma.h.
+
+    Sinks advertise themselves periodically with a hop count of 0, every node
+    having a route re-advertises it with its own hop count. A node routes
+    towards the sink through the neighbour advertising the fewest hops,
+    ignoring the neighbours routing through itself and the ones heard without
+    RELAYNET_LINK_MARGIN (a short route over a weak link loses more frames
+    than a longer one), and only the next hop named in a frame forwards it. A
+    frame is dropped once its hop limit is reached, or when its (source,
+    sequence) was seen recently, so a routing loop cannot make frames
+    circulate.
+
+    Not thread safe.
+*/
+
+#ifndef _LORA_PKTFWD_RELAYNET_H
+#define _LORA_PKTFWD_RELAYNET_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define RELAYNET_MHDR           0xE0    /* LoRaWAN Proprietary frame */
+#define RELAYNET_VERSION        1
+#define RELAYNET_HDR_SIZE       9
+#define RELAYNET_BROADCAST      0xFFFF
+#define RELAYNET_HOP_MAX        15      /* 4 bits */
+#define RELAYNET_ROUTE_NB       8       /* sinks a node keeps a route to */
+#define RELAYNET_DUP_NB         64      /* (source, sequence) remembered */
+#define RELAYNET_DUP_S          120     /* how long a (source, sequence) is remembered */
+#define RELAYNET_ADV_S          60      /* interval between two advertisements */
+#define RELAYNET_ROUTE_TTL_S    (3 * RELAYNET_ADV_S) /* routes not advertised again by then are dropped */
+#define RELAYNET_SNR_HYST       3.0     /* dB better for a route of the same length to replace the current one */
+#define RELAYNET_LINK_MARGIN    5.0f    /* dB above the demodulation floor for a neighbour to be used as next hop */
+#define RELAYNET_ACK_DELAY_US   200000  /* ACK transmission, after the end of the uplink */
+#define RELAYNET_ACK_SLOT_NB    4       /* ACK slots of an uplink to everybody */
+#define RELAYNET_ACK_GUARD_US   20000   /* between the end of an ACK and the next slot */
+
+enum relaynet_type_e {
+    RELAYNET_DATA = 0,                  /* relayed PHYPayload */
+    RELAYNET_ADV = 1,                   /* route to a sink */
+    RELAYNET_UP = 2,                    /* device uplink requesting an ACK */
+    RELAYNET_ACK = 3,                   /* ACK of a device uplink */
+    RELAYNET_BEACON = 4                 /* start of a superframe, see tdma.h */
+};
+
+enum relaynet_action_e {
+    RELAYNET_PLAIN = 0,                 /* not a relayed frame */
+    RELAYNET_DROP,                      /* nothing to do: advertisement, duplicate, not for this node */
+    RELAYNET_FORWARD,                   /* the packet was rewritten for the next hop */
+    RELAYNET_DELIVER                    /* the packet was rewritten to the relayed PHYPayload */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct relaynet_hdr_s
+@brief Decoded hop header
+*/
+struct relaynet_hdr_s {
+    uint8_t         type;       /*!> enum relaynet_type_e */
+    uint8_t         hops;       /*!> transmissions done, including the one received */
+    uint8_t         hop_limit;
+    uint16_t        src;
+    uint16_t        next;
+    uint16_t        seq;
+};
+
+struct relaynet_route_s {
+    uint16_t        sink;
+    uint16_t        via;        /*!> neighbour the frames are sent to */
+    uint8_t         hops;       /*!> transmissions to reach the sink */
+    float           snr;        /*!> SNR of the last advertisement of the neighbour */
+    uint32_t        seen;       /*!> time (s) of the last advertisement */
+    bool            used;
+};
+
+struct relaynet_stat_s {
+    uint32_t        nb_orig;    /*!> device uplinks sent into the relay network */
+    uint32_t        nb_fwd;     /*!> frames forwarded for other nodes */
+    uint32_t        nb_deliv;   /*!> frames delivered, on a sink */
+    uint32_t        nb_deliv_hops[RELAYNET_HOP_MAX + 1]; /*!> frames delivered, by number of hops */
+    uint32_t        nb_dup;     /*!> duplicates dropped */
+    uint32_t        nb_hop_limit; /*!> dropped at their hop limit */
+    uint32_t        nb_no_route; /*!> dropped, no route to a sink */
+    uint32_t        nb_overheard; /*!> frames for other nodes */
+    uint32_t        nb_adv;     /*!> advertisements received */
+    uint32_t        nb_ack;     /*!> device uplinks acknowledged */
+    uint32_t        nb_ack_missed; /*!> ACKs not sent: too late, or TX chain busy */
+};
+
+struct relaynet_s {
+    uint16_t        node_id;
+    bool            sink;       /* frames are delivered here, not forwarded */
+    uint8_t         hop_limit;  /* given to the frames sent by this node */
+    uint16_t        seq;
+    struct relaynet_route_s route[RELAYNET_ROUTE_NB];
+    uint16_t        dup_src[RELAYNET_DUP_NB];
+    uint16_t        dup_seq[RELAYNET_DUP_NB];
+    uint32_t        dup_seen[RELAYNET_DUP_NB];
+    unsigned        dup_head;
+    uint32_t        adv_next;   /* time (s) of the next advertisement */
+    struct relaynet_stat_s stat;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a node without routes.
+
+@param rn[out] Node
+@param node_id Node ID, unique in the relay network, not RELAYNET_BROADCAST
+@param sink True if the node delivers the frames to the network server
+@param hop_limit Max number of transmissions of the frames sent by the node
+*/
+void relaynet_init(struct relaynet_s *rn, uint16_t node_id, bool sink, uint8_t hop_limit);
+
+/**
+@brief Decode a hop header.
+
+@param payload[in] PHYPayload
+@param size PHYPayload size
+@param hdr[out] Hop header
+@return 0 if the payload is a relayed frame, -1 otherwise
+*/
+int relaynet_parse(const uint8_t *payload, uint16_t size, struct relaynet_hdr_s *hdr);
+
+/**
+@brief Encode a hop header.
+
+@param payload[out] PHYPayload, RELAYNET_HDR_SIZE bytes are written
+@param hdr[in] Hop header
+*/
+void relaynet_put_hdr(uint8_t *payload, const struct relaynet_hdr_s *hdr);
+
+/**
+@brief Process a received packet.
+
+@param rn[in] Node
+@param pkt[in,out] Received packet, rewritten for RELAYNET_FORWARD and RELAYNET_DELIVER
+@param now Time (s)
+@return action for the caller, enum relaynet_action_e
+*/
+int relaynet_input(struct relaynet_s *rn, struct lgw_pkt_rx_s *pkt, uint32_t now);
+
+/**
+@brief Wrap a device uplink for the next hop towards a sink.
+
+@param rn[in] Node
+@param pkt[in] Device uplink
+@param out[out] Relayed frame
+@param now Time (s)
+@return 0 on success, -1 if there is no route or the frame is too large
+*/
+int relaynet_encap(struct relaynet_s *rn, const struct lgw_pkt_rx_s *pkt, struct lgw_pkt_rx_s *out, uint32_t now);
+
+/**
+@brief Build the ACK of a device uplink.
+
+The caller sets the RF chain and the power, and sends the ACK at count_us.
+
+@param rn[in] Node
+@param pkt[in] Received packet
+@param tx[out] ACK, timestamped in the ACK slot of the node after the uplink, on its channel and datarate
+@return 0 if pkt is a device uplink this node acknowledges, -1 otherwise
+*/
+int relaynet_ack(struct relaynet_s *rn, const struct lgw_pkt_rx_s *pkt, struct lgw_pkt_tx_s *tx);
+
+/**
+@brief Build the advertisement of the node, when it is due.
+
+@param rn[in] Node
+@param out[in,out] Packet with the modulation parameters set, receives the advertisement
+@param now Time (s)
+@return 1 if an advertisement must be sent, 0 otherwise
+*/
+int relaynet_adv(struct relaynet_s *rn, struct lgw_pkt_rx_s *out, uint32_t now);
+
+/**
+@brief Best route to a sink.
+
+@param rn[in] Node
+@param now Time (s)
+@return the route, NULL if no sink is reachable
+*/
+const struct relaynet_route_s * relaynet_route(const struct relaynet_s *rn, uint32_t now);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Base64 codec, integer/fixed-point formatters and rxpk serialization
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <string.h>     /* memcpy, strlen */
+#include <math.h>       /* lrint */
+#include <time.h>       /* gmtime_r */
+
+#include "rxpk_fmt.h"
+#include "loragw_hal.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define B64_SSSE3
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define B64_NEON
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+static const char b64_enc[64] = {
+    'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P',
+    'Q','R','S','T','U','V','W','X','Y','Z','a','b','c','d','e','f',
+    'g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v',
+    'w','x','y','z','0','1','2','3','4','5','6','7','8','9','+','/'
+};
+
+#define B64_INVALID 0xFF
+
+/* 0xFF for characters outside of the alphabet, padding included */
+static const uint8_t b64_dec[256] = {
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,  62,0xFF,0xFF,0xFF,  63,
+      52,  53,  54,  55,  56,  57,  58,  59,  60,  61,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+      15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+      41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,
+    0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF
+};
+
+/* two decimal digits per entry, halves the number of divisions */
+static const char digits_lut[200] = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+    '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+    '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+    '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+    '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+    '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+    '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+    '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+    '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
+
+static const uint32_t pow10_u32[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+/* copy a string literal, without its terminator */
+#define PUT_LIT(dst, s) do { memcpy((dst), (s), sizeof(s) - 1); (dst) += sizeof(s) - 1; } while (0)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+#if defined(B64_SSSE3)
+/* true if a & b has no bit set, _mm_testz_si128 needs SSE4.1 */
+static inline int sse_and_is_zero(__m128i a, __m128i b) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(a, b), _mm_setzero_si128())) == 0xFFFF;
+}
+
+/* 12 bytes -> 16 characters, reads 16 bytes (W. Mula, D. Lemire) */
+static inline void b64_enc_block(const uint8_t *in, char *out) {
+    __m128i v = _mm_loadu_si128((const __m128i *)in);
+    __m128i t0, t1, t2, t3, idx, res, less;
+
+    v = _mm_shuffle_epi8(v, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    idx = _mm_or_si128(t1, t3);
+
+    /* index -> character: offset selected by range */
+    res = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+    res = _mm_or_si128(res, _mm_and_si128(less, _mm_set1_epi8(13)));
+    res = _mm_shuffle_epi8(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0), res);
+    _mm_storeu_si128((__m128i *)out, _mm_add_epi8(res, idx));
+}
+
+/* 16 characters -> 12 bytes, writes 16 bytes, return -1 on invalid character */
+static inline int b64_dec_block(const char *in, uint8_t *out) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    __m128i v = _mm_loadu_si128((const __m128i *)in);
+    __m128i hi_nib, lo_nib, lo, hi, roll;
+
+    hi_nib = _mm_and_si128(_mm_srli_epi32(v, 4), mask_2f);
+    lo_nib = _mm_and_si128(v, mask_2f);
+    lo = _mm_shuffle_epi8(lut_lo, lo_nib);
+    hi = _mm_shuffle_epi8(lut_hi, hi_nib);
+    if (!sse_and_is_zero(lo, hi)) {
+        return -1;
+    }
+    roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, mask_2f), hi_nib));
+    v = _mm_add_epi8(v, roll);
+
+    /* pack 4 x 6 bits into 3 bytes */
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i *)out, v);
+    return 0;
+}
+#elif defined(B64_NEON)
+/* 48 bytes -> 64 characters */
+static inline void b64_enc_block(const uint8_t *in, char *out) {
+    const uint8x16x4_t lut = vld1q_u8_x4((const uint8_t *)b64_enc);
+    uint8x16x3_t v = vld3q_u8(in);
+    uint8x16x4_t r;
+
+    r.val[0] = vshrq_n_u8(v.val[0], 2);
+    r.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(v.val[0], 4), vshrq_n_u8(v.val[1], 4)), vdupq_n_u8(0x3F));
+    r.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(v.val[1], 2), vshrq_n_u8(v.val[2], 6)), vdupq_n_u8(0x3F));
+    r.val[3] = vandq_u8(v.val[2], vdupq_n_u8(0x3F));
+    r.val[0] = vqtbl4q_u8(lut, r.val[0]);
+    r.val[1] = vqtbl4q_u8(lut, r.val[1]);
+    r.val[2] = vqtbl4q_u8(lut, r.val[2]);
+    r.val[3] = vqtbl4q_u8(lut, r.val[3]);
+    vst4q_u8((uint8_t *)out, r);
+}
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int rxpk_b64_encode(const uint8_t *in, int size, char *out, int max_len) {
+    uint32_t v;
+    int i = 0;
+    int j = 0;
+
+    if ((in == NULL) || (out == NULL) || (size < 0)) {
+        return -1;
+    }
+    if (max_len < (((size + 2) / 3) * 4 + 1)) {
+        return -1;
+    }
+
+#if defined(B64_SSSE3)
+    for (; (size - i) >= 16; i += 12, j += 16) {
+        b64_enc_block(&in[i], &out[j]);
+    }
+#elif defined(B64_NEON)
+    for (; (size - i) >= 48; i += 48, j += 64) {
+        b64_enc_block(&in[i], &out[j]);
+    }
+#endif
+    for (; (size - i) >= 3; i += 3, j += 4) {
+        v = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | in[i + 2];
+        out[j] = b64_enc[v >> 18];
+        out[j + 1] = b64_enc[(v >> 12) & 0x3F];
+        out[j + 2] = b64_enc[(v >> 6) & 0x3F];
+        out[j + 3] = b64_enc[v & 0x3F];
+    }
+    if ((size - i) == 1) {
+        out[j++] = b64_enc[in[i] >> 2];
+        out[j++] = b64_enc[(in[i] & 0x03) << 4];
+        out[j++] = '=';
+        out[j++] = '=';
+    } else if ((size - i) == 2) {
+        out[j++] = b64_enc[in[i] >> 2];
+        out[j++] = b64_enc[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+        out[j++] = b64_enc[(in[i + 1] & 0x0F) << 2];
+        out[j++] = '=';
+    }
+    out[j] = 0;
+    return j;
+}
+
+int rxpk_b64_decode(const char *in, int size, uint8_t *out, int max_len) {
+    uint8_t c[4];
+    int full, last, len;
+    int i = 0;
+    int j = 0;
+    int k;
+
+    if ((in == NULL) || (out == NULL) || (size < 0)) {
+        return -1;
+    }
+    /* padding is optional */
+    if ((size >= 2) && ((size % 4) == 0) && (in[size - 1] == '=')) {
+        size -= (in[size - 2] == '=') ? 2 : 1;
+    }
+    last = size % 4;
+    if (last == 1) {
+        return -1;
+    }
+    full = size - last;
+    len = (full / 4) * 3 + ((last > 0) ? (last - 1) : 0);
+    if (max_len < len) {
+        return -1;
+    }
+
+#if defined(B64_SSSE3)
+    /* the block writes 16 bytes for 12 decoded, keep it inside out */
+    for (; ((full - i) >= 16) && ((j + 16) <= max_len); i += 16, j += 12) {
+        if (b64_dec_block(&in[i], &out[j]) != 0) {
+            return -1;
+        }
+    }
+#endif
+    for (; i < full; i += 4, j += 3) {
+        for (k = 0; k < 4; ++k) {
+            c[k] = b64_dec[(uint8_t)in[i + k]];
+            if (c[k] == B64_INVALID) {
+                return -1;
+            }
+        }
+        out[j] = (uint8_t)((c[0] << 2) | (c[1] >> 4));
+        out[j + 1] = (uint8_t)((c[1] << 4) | (c[2] >> 2));
+        out[j + 2] = (uint8_t)((c[2] << 6) | c[3]);
+    }
+    if (last > 0) {
+        c[2] = 0;
+        for (k = 0; k < last; ++k) {
+            c[k] = b64_dec[(uint8_t)in[i + k]];
+            if (c[k] == B64_INVALID) {
+                return -1;
+            }
+        }
+        out[j++] = (uint8_t)((c[0] << 2) | (c[1] >> 4));
+        if (last == 3) {
+            out[j++] = (uint8_t)((c[1] << 4) | (c[2] >> 2));
+        }
+    }
+    return len;
+}
+
+char * rxpk_fmt_u32(char *dst, uint32_t v) {
+    char tmp[RXPK_FMT_U32_MAX];
+    char *p = tmp + sizeof tmp;
+    int n;
+
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, &digits_lut[2 * (v % 100)], 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, &digits_lut[2 * v], 2);
+    } else {
+        *--p = (char)('0' + v);
+    }
+    n = (int)(tmp + sizeof tmp - p);
+    memcpy(dst, p, n);
+    return dst + n;
+}
+
+char * rxpk_fmt_i32(char *dst, int32_t v) {
+    if (v < 0) {
+        *dst++ = '-';
+        return rxpk_fmt_u32(dst, (uint32_t)0 - (uint32_t)v);
+    }
+    return rxpk_fmt_u32(dst, (uint32_t)v);
+}
+
+char * rxpk_fmt_digits(char *dst, uint32_t v, unsigned width) {
+    char *p = dst + width;
+
+    while (p > dst) {
+        *--p = (char)('0' + (v % 10));
+        v /= 10;
+    }
+    return dst + width;
+}
+
+char * rxpk_fmt_fixed(char *dst, int32_t v, unsigned decimals) {
+    uint32_t u;
+
+    if (v < 0) {
+        *dst++ = '-';
+        u = (uint32_t)0 - (uint32_t)v;
+    } else {
+        u = (uint32_t)v;
+    }
+    dst = rxpk_fmt_u32(dst, u / pow10_u32[decimals]);
+    *dst++ = '.';
+    return rxpk_fmt_digits(dst, u % pow10_u32[decimals], decimals);
+}
+
+int rxpk_serialize(const struct lgw_pkt_rx_s *p, const struct timeval *rx_time, char *buf, int size) {
+    char meta[RXPK_FMT_META_MAX]; /* every field but the payload, formatted without snprintf */
+    char *m = meta;
+    const char *sf = NULL, *bw = NULL, *cr = NULL;
+    struct tm x;
+    time_t t;
+    int meta_len;
+    int j;
+
+    /* check the metadata before writing anything */
+    if ((p->status != STAT_CRC_OK) && (p->status != STAT_CRC_BAD) && (p->status != STAT_NO_CRC)) {
+        return -1;
+    }
+    if (p->modulation == MOD_LORA) {
+        switch (p->datarate) {
+            case DR_LORA_SF7:  sf = "SF7";  break;
+            case DR_LORA_SF8:  sf = "SF8";  break;
+            case DR_LORA_SF9:  sf = "SF9";  break;
+            case DR_LORA_SF10: sf = "SF10"; break;
+            case DR_LORA_SF11: sf = "SF11"; break;
+            case DR_LORA_SF12: sf = "SF12"; break;
+            default: return -1;
+        }
+        switch (p->bandwidth) {
+            case BW_125KHZ: bw = "BW125"; break;
+            case BW_250KHZ: bw = "BW250"; break;
+            case BW_500KHZ: bw = "BW500"; break;
+            default: return -1;
+        }
+        switch (p->coderate) {
+            case CR_LORA_4_5: cr = "4/5"; break;
+            case CR_LORA_4_6: cr = "4/6"; break;
+            case CR_LORA_4_7: cr = "4/7"; break;
+            case CR_LORA_4_8: cr = "4/8"; break;
+            case 0:           cr = "OFF"; break; /* treat the CR0 case (mostly false sync) */
+            default: return -1;
+        }
+    } else if (p->modulation != MOD_FSK) {
+        return -1;
+    }
+
+    /* RAW timestamp, UTC time of reception, concentrator channel, RF chain & RX frequency */
+    t = rx_time->tv_sec;
+    gmtime_r(&t, &x);
+    PUT_LIT(m, "{\"tmst\":");
+    m = rxpk_fmt_u32(m, p->count_us);
+    PUT_LIT(m, ",\"time\":\"");
+    m = rxpk_fmt_digits(m, x.tm_year + 1900, 4);
+    *m++ = '-';
+    m = rxpk_fmt_digits(m, x.tm_mon + 1, 2);
+    *m++ = '-';
+    m = rxpk_fmt_digits(m, x.tm_mday, 2);
+    *m++ = 'T';
+    m = rxpk_fmt_digits(m, x.tm_hour, 2);
+    *m++ = ':';
+    m = rxpk_fmt_digits(m, x.tm_min, 2);
+    *m++ = ':';
+    m = rxpk_fmt_digits(m, x.tm_sec, 2);
+    *m++ = '.';
+    m = rxpk_fmt_digits(m, (uint32_t)rx_time->tv_usec, 6);
+    PUT_LIT(m, "Z\",\"chan\":");
+    m = rxpk_fmt_u32(m, p->if_chain);
+    PUT_LIT(m, ",\"rfch\":");
+    m = rxpk_fmt_u32(m, p->rf_chain);
+    PUT_LIT(m, ",\"freq\":");
+    m = rxpk_fmt_fixed(m, (int32_t)p->freq_hz, 6); /* MHz */
+
+    /* Packet status */
+    switch (p->status) {
+        case STAT_CRC_OK:  PUT_LIT(m, ",\"stat\":1");  break;
+        case STAT_CRC_BAD: PUT_LIT(m, ",\"stat\":-1"); break;
+        default:           PUT_LIT(m, ",\"stat\":0");  break;
+    }
+
+    /* Packet modulation, datarate, bandwidth, coding rate and SNR, rounded like printf %.1f */
+    if (p->modulation == MOD_LORA) {
+        PUT_LIT(m, ",\"modu\":\"LORA\",\"datr\":\"");
+        j = strlen(sf);
+        memcpy(m, sf, j);
+        m += j;
+        memcpy(m, bw, 5);
+        m += 5;
+        PUT_LIT(m, "\",\"codr\":\"");
+        memcpy(m, cr, 3);
+        m += 3;
+        PUT_LIT(m, "\",\"lsnr\":");
+        m = rxpk_fmt_fixed(m, (int32_t)lrint((double)p->snr * 10), 1);
+    } else {
+        PUT_LIT(m, ",\"modu\":\"FSK\",\"datr\":");
+        m = rxpk_fmt_u32(m, p->datarate);
+    }
+
+    /* Packet RSSI, payload size */
+    PUT_LIT(m, ",\"rssi\":");
+    m = rxpk_fmt_i32(m, (int32_t)lrint((double)p->rssi));
+    PUT_LIT(m, ",\"size\":");
+    m = rxpk_fmt_u32(m, p->size);
+    PUT_LIT(m, ",\"data\":\"");
+    meta_len = m - meta;
+
+    /* base64-encoded payload, closing quote and brace, terminator */
+    if (size < (meta_len + ((p->size + 2) / 3) * 4 + 3)) {
+        return -1;
+    }
+    memcpy(buf, meta, meta_len);
+    j = rxpk_b64_encode(p->payload, p->size, buf + meta_len, size - meta_len);
+    if (j < 0) {
+        return -1;
+    }
+    j += meta_len;
+    buf[j++] = '"';
+    buf[j++] = '}';
+    buf[j] = 0;
+
+    return j;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Base64 codec and integer/fixed-point formatters used to serialize rxpk
+    objects without snprintf, and the rxpk serializer itself. Base64 is vectorized with SSSE3 or NEON when the
+    compiler targets them, the scalar code (Xtensa) handles 3 bytes at a time.
+
+    The formatters write digits only, no string terminator, and return a
+    pointer past the last character written. The caller sizes the buffer.
+*/
+
+#ifndef _LORA_PKTFWD_RXPK_FMT_H
+#define _LORA_PKTFWD_RXPK_FMT_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <sys/time.h>   /* timeval */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define RXPK_FMT_U32_MAX    10  /* digits of UINT32_MAX */
+#define RXPK_FMT_I32_MAX    11  /* sign + digits of INT32_MIN */
+#define RXPK_FMT_META_MAX   256 /* worst case size of an rxpk object without its payload */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct lgw_pkt_rx_s;
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Encode binary data as padded base64, same contract as bin_to_b64.
+
+@param in[in] Data to encode
+@param size Number of bytes to encode
+@param out[out] Output string, null terminated
+@param max_len Size of out, terminator included
+@return length of the string, -1 if it does not fit
+*/
+int rxpk_b64_encode(const uint8_t *in, int size, char *out, int max_len);
+
+/**
+@brief Decode base64, padded or not, same contract as b64_to_bin.
+
+@param in[in] Base64 string
+@param size Number of characters
+@param out[out] Decoded data
+@param max_len Size of out
+@return number of bytes decoded, -1 on invalid input or if it does not fit
+*/
+int rxpk_b64_decode(const char *in, int size, uint8_t *out, int max_len);
+
+/**
+@brief Write an unsigned integer in decimal.
+
+@param dst[out] At least RXPK_FMT_U32_MAX characters
+@param v Value
+@return pointer past the last digit
+*/
+char * rxpk_fmt_u32(char *dst, uint32_t v);
+
+/**
+@brief Write a signed integer in decimal.
+
+@param dst[out] At least RXPK_FMT_I32_MAX characters
+@param v Value
+@return pointer past the last digit
+*/
+char * rxpk_fmt_i32(char *dst, int32_t v);
+
+/**
+@brief Write an unsigned integer on a fixed number of digits, zero padded.
+
+@param dst[out] At least width characters
+@param v Value, truncated to its width least significant digits
+@param width Number of digits
+@return pointer past the last digit
+*/
+char * rxpk_fmt_digits(char *dst, uint32_t v, unsigned width);
+
+/**
+@brief Write a fixed-point value: v / 10^decimals, with all its decimals.
+
+@param dst[out] At least RXPK_FMT_I32_MAX + 1 characters
+@param v Scaled value (e.g. 868100000 with 6 decimals for 868.100000)
+@param decimals Number of decimals (1..9)
+@return pointer past the last digit
+*/
+char * rxpk_fmt_fixed(char *dst, int32_t v, unsigned decimals);
+
+/**
+@brief Serialize one received packet as a JSON rxpk object, null terminated.
+
+@param p[in] Received packet
+@param rx_time[in] UTC time of reception
+@param buf[out] Output buffer
+@param size Size of buf, terminator included
+@return length of the object, -1 if it does not fit or the packet has unknown metadata
+*/
+int rxpk_serialize(const struct lgw_pkt_rx_s *p, const struct timeval *rx_time, char *buf, int size);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Time-slotted schedule, see tdma.h
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset */
+
+#include "tdma.h"
+#include "relaynet.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static inline uint64_t tv_ms(const struct timeval *tv) {
+    return (uint64_t)tv->tv_sec * 1000 + (uint64_t)tv->tv_usec / 1000;
+}
+
+static inline void put_le16(uint8_t *b, uint16_t v) {
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+}
+
+/* true if nobody sent an uplink in the slot for TDMA_IDLE_NB superframes */
+static inline bool slot_idle(const struct tdma_s *t, unsigned i, uint32_t frame) {
+    return (t->seen[i] == 0) || (frame + 1 - t->seen[i] > TDMA_IDLE_NB);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+bool tdma_cfg_valid(const struct tdma_cfg_s *cfg) {
+    uint32_t used = cfg->beacon_ms + (uint32_t)cfg->nb_slot * cfg->slot_ms + TDMA_BEACON_LEAD_MS;
+
+    return (cfg->period_s > 0) && (cfg->nb_slot > 0) && (cfg->nb_slot <= TDMA_SLOT_NB) && (cfg->dev_ms <= cfg->slot_ms) && (used <= cfg->period_s * 1000U);
+}
+
+void tdma_init(struct tdma_s *t, const struct tdma_cfg_s *cfg) {
+    memset(t, 0, sizeof *t);
+    t->cfg = *cfg;
+}
+
+int tdma_ack(struct tdma_s *t, const struct lgw_pkt_rx_s *pkt, const struct timeval *rx, struct lgw_pkt_tx_s *ack) {
+    struct relaynet_hdr_s hdr;
+    uint32_t frame = (uint32_t)rx->tv_sec / t->cfg.period_s;
+    uint32_t off = (uint32_t)(tv_ms(rx) % (t->cfg.period_s * 1000U));
+    uint32_t start;
+    int slot = -1;
+    unsigned i;
+
+    if ((relaynet_parse(pkt->payload, pkt->size, &hdr) != 0) || (ack->size >= sizeof ack->payload)) {
+        return -1;
+    }
+    for (i = 0; i < t->cfg.nb_slot; ++i) {
+        if (!slot_idle(t, i, frame) && (t->dev[i] == hdr.src)) {
+            slot = (int)i;
+            break;
+        }
+    }
+    if (slot >= 0) {
+        /* the uplink ends in the device part of its slot */
+        start = t->cfg.beacon_ms + (uint32_t)slot * t->cfg.slot_ms;
+        if ((off > start) && (off <= start + t->cfg.dev_ms)) {
+            t->stat.nb_in_slot += 1;
+        } else {
+            t->stat.nb_off_slot += 1;
+        }
+    } else {
+        for (i = 0; i < t->cfg.nb_slot; ++i) {
+            if (slot_idle(t, i, frame)) {
+                if (t->seen[i] != 0) {
+                    t->stat.nb_released += 1;
+                }
+                t->stat.nb_assigned += 1;
+                slot = (int)i;
+                break;
+            }
+        }
+        if (slot < 0) {
+            t->stat.nb_full += 1;
+        }
+    }
+    if (slot >= 0) {
+        t->dev[slot] = hdr.src;
+        t->seen[slot] = frame + 1;
+    }
+    ack->payload[ack->size++] = (slot >= 0) ? (uint8_t)slot : TDMA_NO_SLOT;
+    return slot;
+}
+
+int tdma_beacon(struct tdma_s *t, uint16_t node_id, const struct timeval *now, struct lgw_pkt_tx_s *tx, struct timeval *when) {
+    struct relaynet_hdr_s hdr;
+    uint64_t now_ms = tv_ms(now);
+    uint32_t period = t->cfg.period_s;
+    uint32_t frame;
+    uint8_t *body;
+    unsigned i;
+
+    if ((t->beacon_next != 0) && (now_ms + TDMA_BEACON_LATE_MS > (uint64_t)t->beacon_next * 1000)) {
+        t->stat.nb_beacon_missed += 1;
+        t->beacon_next = 0;
+    }
+    if (t->beacon_next == 0) {
+        t->beacon_next = ((uint32_t)now->tv_sec / period + 1) * period;
+        if (now_ms + TDMA_BEACON_LATE_MS > (uint64_t)t->beacon_next * 1000) {
+            t->beacon_next += period;
+        }
+    }
+    if ((uint64_t)t->beacon_next * 1000 - now_ms > TDMA_BEACON_LEAD_MS) {
+        return 0;
+    }
+    frame = t->beacon_next / period;
+
+    /* beacons are for the devices around, other nodes do not relay them */
+    hdr.type = RELAYNET_BEACON;
+    hdr.hops = 0;
+    hdr.hop_limit = 0;
+    hdr.src = node_id;
+    hdr.next = RELAYNET_BROADCAST;
+    hdr.seq = (uint16_t)frame;
+    relaynet_put_hdr(tx->payload, &hdr);
+    body = &tx->payload[RELAYNET_HDR_SIZE];
+    put_le16(&body[0], (uint16_t)t->beacon_next);
+    put_le16(&body[2], (uint16_t)(t->beacon_next >> 16));
+    put_le16(&body[4], t->cfg.period_s);
+    put_le16(&body[6], t->cfg.beacon_ms);
+    put_le16(&body[8], t->cfg.slot_ms);
+    put_le16(&body[10], t->cfg.dev_ms);
+    body[12] = t->cfg.nb_slot;
+    tx->size = RELAYNET_HDR_SIZE + TDMA_BEACON_BODY;
+    when->tv_sec = t->beacon_next;
+    when->tv_usec = 0;
+
+    t->nb_used = 0;
+    for (i = 0; i < t->cfg.nb_slot; ++i) {
+        t->nb_used += slot_idle(t, i, frame) ? 0 : 1;
+    }
+    return 1;
+}
+
+void tdma_sent(struct tdma_s *t) {
+    t->beacon_next += t->cfg.period_s;
+    t->stat.nb_beacon += 1;
+}
+
+bool tdma_tx_ok(const struct tdma_s *t, const struct timeval *now, uint32_t airtime_us) {
+    uint32_t frame = (uint32_t)now->tv_sec / t->cfg.period_s;
+    uint32_t off = (uint32_t)(tv_ms(now) % (t->cfg.period_s * 1000U));
+    uint32_t end = off + (airtime_us + 999) / 1000;
+    uint32_t start;
+    unsigned i;
+
+    if ((off < t->cfg.beacon_ms) || (end + TDMA_BEACON_LEAD_MS > t->cfg.period_s * 1000U)) {
+        return false;
+    }
+    /* the slots the transmission overlaps, from the one it starts in */
+    for (i = (off - t->cfg.beacon_ms) / t->cfg.slot_ms; i < t->cfg.nb_slot; ++i) {
+        start = t->cfg.beacon_ms + i * t->cfg.slot_ms;
+        if (start >= end) {
+            break;
+        }
+        if (!slot_idle(t, i, frame) && (off < start + t->cfg.dev_ms)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Time-slotted schedule of the device uplinks and of the repeater
+    transmissions, synchronized by a beacon.
+
+    Time is divided in superframes of period_s seconds, starting at the UTC
+    multiples of period_s, the concentrator counter being mapped to UTC by
+    clocksync. A superframe is laid out as:
+
+        beacon_ms               beacon, a RELAYNET_BEACON frame
+        nb_slot * slot_ms       one slot per device: its RELAYNET_UP frame
+                                and the ACK in the first dev_ms, the
+                                repetition of the uplink after it
+        rest                    contention: devices without a slot, repeater
+
+    The beacon body carries the UTC second of the superframe and the layout
+    (little endian): utc_s (4), period_s (2), beacon_ms (2), slot_ms (2),
+    dev_ms (2), nb_slot (1).
+
+    A device asks for a slot by sending a RELAYNET_UP frame in the contention
+    part, the ACK of every uplink carries one more byte, the slot of the
+    device or TDMA_NO_SLOT. The device then sends its uplinks in its slot,
+    timed from the last beacon heard. A slot not used for TDMA_IDLE_NB
+    superframes is given to another device.
+
+    The repeater only transmits where it cannot blind an uplink: after the
+    device part of the slots, in the slots nobody uses and in the contention
+    part, never in the beacon.
+
+    Not thread safe.
+*/
+
+#ifndef _LORA_PKTFWD_TDMA_H
+#define _LORA_PKTFWD_TDMA_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <sys/time.h>   /* timeval */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define TDMA_SLOT_NB            128     /* max slots in a superframe */
+#define TDMA_NO_SLOT            0xFF    /* slot byte of the ACK, no slot free */
+#define TDMA_IDLE_NB            3       /* superframes without uplink before a slot is given to another device */
+#define TDMA_BEACON_LEAD_MS     500     /* the beacon is given to the concentrator at most this early */
+#define TDMA_BEACON_LATE_MS     50      /* beacon missed if not given to the concentrator by then */
+#define TDMA_BEACON_BODY        13      /* bytes after the hop header */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct tdma_cfg_s
+@brief Layout of a superframe
+*/
+struct tdma_cfg_s {
+    uint16_t        period_s;   /*!> superframe, starting at the UTC multiples of period_s */
+    uint16_t        beacon_ms;  /*!> time reserved for the beacon */
+    uint16_t        slot_ms;    /*!> one device uplink, its ACK and its repetition */
+    uint16_t        dev_ms;     /*!> part of the slot for the uplink and its ACK */
+    uint8_t         nb_slot;
+};
+
+struct tdma_stat_s {
+    uint32_t        nb_beacon;  /*!> beacons given to the concentrator */
+    uint32_t        nb_beacon_missed; /*!> beacons not sent: no time sync, or TX chain busy */
+    uint32_t        nb_assigned; /*!> slots given to a device */
+    uint32_t        nb_released; /*!> slots taken back from an idle device */
+    uint32_t        nb_full;    /*!> slot requests without free slot */
+    uint32_t        nb_in_slot; /*!> uplinks of devices with a slot, received in it */
+    uint32_t        nb_off_slot; /*!> uplinks of devices with a slot, received outside of it */
+};
+
+struct tdma_s {
+    struct tdma_cfg_s cfg;
+    uint16_t        dev[TDMA_SLOT_NB];  /* device ID of each slot */
+    uint32_t        seen[TDMA_SLOT_NB]; /* superframe of the last uplink + 1, 0 if the slot was never used */
+    uint32_t        beacon_next;        /* UTC (s) of the next beacon, 0 if not known yet */
+    uint16_t        nb_used;            /* slots given, for the statistics */
+    struct tdma_stat_s stat;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Check that a layout fits in its superframe.
+
+@param cfg[in] Layout
+@return true if the beacon, the slots and the beacon lead fit in period_s
+*/
+bool tdma_cfg_valid(const struct tdma_cfg_s *cfg);
+
+/**
+@brief Initialize a schedule without devices.
+
+@param t[out] Schedule
+@param cfg[in] Layout, valid
+*/
+void tdma_init(struct tdma_s *t, const struct tdma_cfg_s *cfg);
+
+/**
+@brief Give a slot to the device of an uplink, and tell it in the ACK.
+
+@param t[in] Schedule
+@param pkt[in] RELAYNET_UP frame of the device
+@param rx[in] UTC of the end of the uplink
+@param ack[in,out] ACK built by relaynet_ack, the slot byte is appended
+@return the slot of the device, -1 if there is none
+*/
+int tdma_ack(struct tdma_s *t, const struct lgw_pkt_rx_s *pkt, const struct timeval *rx, struct lgw_pkt_tx_s *ack);
+
+/**
+@brief Build the next beacon, when it must be given to the concentrator.
+
+The caller sets the modulation parameters, converts the beacon time to the
+concentrator counter and calls tdma_sent once the beacon is accepted.
+
+@param t[in] Schedule
+@param node_id Source of the beacon
+@param now[in] UTC
+@param tx[in,out] Packet with the modulation parameters set, receives the beacon
+@param when[out] UTC the beacon must be transmitted at
+@return 1 if the beacon must be sent, 0 otherwise
+*/
+int tdma_beacon(struct tdma_s *t, uint16_t node_id, const struct timeval *now, struct lgw_pkt_tx_s *tx, struct timeval *when);
+
+/**
+@brief Account the beacon built by tdma_beacon as sent.
+
+@param t[in] Schedule
+*/
+void tdma_sent(struct tdma_s *t);
+
+/**
+@brief Check a repeater transmission does not overlap the beacon or the uplink of a device.
+
+@param t[in] Schedule
+@param now[in] UTC the transmission starts at
+@param airtime_us Time on air of the transmission
+@return true if the transmission can start now
+*/
+bool tdma_tx_ok(const struct tdma_s *t, const struct timeval *now, uint32_t airtime_us);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
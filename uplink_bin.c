@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Compact binary encoding of received packets
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memcpy */
+#include <math.h>       /* lroundf */
+
+#include "uplink_bin.h"
+#ifndef UPLINK_BIN_DECODER_ONLY
+#include "loragw_hal.h"
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static inline void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#ifndef UPLINK_BIN_DECODER_ONLY
+static inline int8_t clamp_s8(long v) {
+    return (int8_t)((v < -128) ? -128 : ((v > 127) ? 127 : v));
+}
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+#ifndef UPLINK_BIN_DECODER_ONLY
+int uplink_bin_encode(const struct lgw_pkt_rx_s *pkt, const struct timeval *rx_time, uint8_t *buf, int size) {
+    uint32_t freq;
+    uint8_t dr, cr, stat;
+
+    if ((pkt->size > 255) || (size < (UPLINK_BIN_REC_SIZE + pkt->size))) {
+        return -1;
+    }
+
+    switch (pkt->status) {
+        case STAT_CRC_OK:  stat = UPLINK_BIN_STAT_CRC_OK;  break;
+        case STAT_CRC_BAD: stat = UPLINK_BIN_STAT_CRC_BAD; break;
+        case STAT_NO_CRC:  stat = UPLINK_BIN_STAT_NO_CRC;  break;
+        default: return -1;
+    }
+
+    if (pkt->modulation == MOD_LORA) {
+        switch (pkt->datarate) {
+            case DR_LORA_SF7:  dr = 7;  break;
+            case DR_LORA_SF8:  dr = 8;  break;
+            case DR_LORA_SF9:  dr = 9;  break;
+            case DR_LORA_SF10: dr = 10; break;
+            case DR_LORA_SF11: dr = 11; break;
+            case DR_LORA_SF12: dr = 12; break;
+            default: return -1;
+        }
+        switch (pkt->bandwidth) {
+            case BW_125KHZ: dr |= UPLINK_BIN_BW_125 << 4; break;
+            case BW_250KHZ: dr |= UPLINK_BIN_BW_250 << 4; break;
+            case BW_500KHZ: dr |= UPLINK_BIN_BW_500 << 4; break;
+            default: return -1;
+        }
+        switch (pkt->coderate) {
+            case CR_LORA_4_5: cr = 1; break;
+            case CR_LORA_4_6: cr = 2; break;
+            case CR_LORA_4_7: cr = 3; break;
+            case CR_LORA_4_8: cr = 4; break;
+            case 0:           cr = 0; break; /* CR0, mostly false sync */
+            default: return -1;
+        }
+    } else if (pkt->modulation == MOD_FSK) {
+        dr = 0x80 | (uint8_t)(((pkt->datarate + 500) / 1000) & 0x7F);
+        cr = 0;
+    } else {
+        return -1;
+    }
+
+    freq = (pkt->freq_hz + 50) / 100;
+    put_le32(&buf[0], pkt->count_us);
+    put_le32(&buf[4], (rx_time != NULL) ? (uint32_t)rx_time->tv_sec : 0);
+    buf[8] = (uint8_t)freq;
+    buf[9] = (uint8_t)(freq >> 8);
+    buf[10] = (uint8_t)(freq >> 16);
+    buf[11] = (uint8_t)((pkt->rf_chain << 4) | (pkt->if_chain & 0x0F));
+    buf[12] = dr;
+    buf[13] = (uint8_t)((cr << 2) | stat);
+    buf[14] = (uint8_t)clamp_s8(lroundf(pkt->rssi));
+    buf[15] = (uint8_t)clamp_s8(lroundf(pkt->snr * 4));
+    buf[16] = (uint8_t)pkt->size;
+    memcpy(&buf[UPLINK_BIN_REC_SIZE], pkt->payload, pkt->size);
+
+    return UPLINK_BIN_REC_SIZE + pkt->size;
+}
+#endif
+
+int uplink_bin_decode_hdr(const uint8_t *buf, int size, uint8_t *nb_rec) {
+    if ((size < UPLINK_BIN_HDR_SIZE) || (buf[0] != UPLINK_BIN_VERSION)) {
+        return -1;
+    }
+    *nb_rec = buf[1];
+    return UPLINK_BIN_HDR_SIZE;
+}
+
+int uplink_bin_decode(const uint8_t *buf, int size, struct uplink_bin_rec *rec) {
+    static const uint16_t bw_khz[4] = {125, 250, 500, 0};
+
+    if ((size < UPLINK_BIN_REC_SIZE) || (size < (UPLINK_BIN_REC_SIZE + buf[16]))) {
+        return -1;
+    }
+
+    memset(rec, 0, sizeof *rec);
+    rec->tmst = get_le32(&buf[0]);
+    rec->utc_sec = get_le32(&buf[4]);
+    rec->freq_hz = 100 * ((uint32_t)buf[8] | ((uint32_t)buf[9] << 8) | ((uint32_t)buf[10] << 16));
+    rec->rf_chain = buf[11] >> 4;
+    rec->if_chain = buf[11] & 0x0F;
+    if (buf[12] & 0x80) {
+        rec->fsk = true;
+        rec->fsk_bps = 1000 * (uint32_t)(buf[12] & 0x7F);
+    } else {
+        rec->sf = buf[12] & 0x0F;
+        rec->bw_khz = bw_khz[(buf[12] >> 4) & 0x03];
+        if ((rec->sf < 7) || (rec->sf > 12) || (rec->bw_khz == 0)) {
+            return -1;
+        }
+    }
+    rec->coderate = (buf[13] >> 2) & 0x07;
+    rec->status = buf[13] & 0x03;
+    if ((rec->coderate > 4) || (rec->status > UPLINK_BIN_STAT_NO_CRC)) {
+        return -1;
+    }
+    rec->rssi = (int8_t)buf[14];
+    rec->snr = (float)(int8_t)buf[15] / 4;
+    rec->size = buf[16];
+    rec->payload = &buf[UPLINK_BIN_REC_SIZE];
+
+    return UPLINK_BIN_REC_SIZE + rec->size;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
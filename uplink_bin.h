@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Compact binary encoding of received packets, an alternative to the JSON
+    rxpk array of PUSH_DATA for metered backhauls.
+
+    A PKT_PUSH_BIN datagram is the usual 12-byte header (version, token,
+    identifier, gateway EUI) followed by:
+
+        offset  size  field
+        0       1     format version (UPLINK_BIN_VERSION)
+        1       1     number of records
+        2       ...   records
+
+    Each record is a fixed 17-byte header followed by the raw payload, all
+    multi-byte fields are little endian:
+
+        offset  size  field
+        0       4     tmst, concentrator counter (us)
+        4       4     UTC time of reception (s), 0 if unknown
+        8       3     RX central frequency (100 Hz)
+        11      1     RF chain (bits 7..4), IF chain (bits 3..0)
+        12      1     LoRa: BW code (bits 5..4), SF (bits 3..0)
+                      FSK: bit 7 set, datarate in kbps (bits 6..0)
+        13      1     coding rate (bits 4..2, 0: off or FSK, 1..4: 4/5..4/8)
+                      CRC status (bits 1..0, 0: OK, 1: bad, 2: no CRC)
+        14      1     RSSI (dBm, signed)
+        15      1     SNR (0.25 dB, signed)
+        16      1     payload size
+        17      size  payload
+
+    The decoder has no dependency on the concentrator HAL, build with
+    UPLINK_BIN_DECODER_ONLY defined to use it on the server side.
+*/
+
+#ifndef _LORA_PKTFWD_UPLINK_BIN_H
+#define _LORA_PKTFWD_UPLINK_BIN_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <sys/time.h>   /* timeval */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define UPLINK_BIN_VERSION      1
+#define UPLINK_BIN_HDR_SIZE     2       /* format version + number of records */
+#define UPLINK_BIN_REC_SIZE     17      /* record header, without the payload */
+#define UPLINK_BIN_REC_MAX      (UPLINK_BIN_REC_SIZE + 255)
+
+#define UPLINK_BIN_BW_125       0
+#define UPLINK_BIN_BW_250       1
+#define UPLINK_BIN_BW_500       2
+
+#define UPLINK_BIN_STAT_CRC_OK  0
+#define UPLINK_BIN_STAT_CRC_BAD 1
+#define UPLINK_BIN_STAT_NO_CRC  2
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct uplink_bin_rec
+@brief Decoded record, payload points into the datagram
+*/
+struct uplink_bin_rec {
+    uint32_t        tmst;       /*!> concentrator counter at reception (us) */
+    uint32_t        utc_sec;    /*!> UTC time of reception (s), 0 if unknown */
+    uint32_t        freq_hz;    /*!> RX central frequency (100 Hz resolution) */
+    uint8_t         rf_chain;
+    uint8_t         if_chain;
+    bool            fsk;        /*!> FSK packet, LoRa otherwise */
+    uint8_t         sf;         /*!> LoRa spreading factor (7..12) */
+    uint16_t        bw_khz;     /*!> LoRa bandwidth (125, 250 or 500) */
+    uint32_t        fsk_bps;    /*!> FSK datarate (1 kbps resolution) */
+    uint8_t         coderate;   /*!> 0: off or FSK, 1..4: 4/5..4/8 */
+    uint8_t         status;     /*!> UPLINK_BIN_STAT_xxx */
+    int8_t          rssi;       /*!> dBm */
+    float           snr;        /*!> dB */
+    uint8_t         size;
+    const uint8_t   *payload;
+};
+
+struct lgw_pkt_rx_s;
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+#ifndef UPLINK_BIN_DECODER_ONLY
+/**
+@brief Encode one received packet as a binary record.
+
+@param pkt[in] Received packet
+@param rx_time[in] UTC time of reception
+@param buf[out] Output buffer
+@param size Room left in buf
+@return number of bytes written, -1 if the packet does not fit or has unknown metadata
+*/
+int uplink_bin_encode(const struct lgw_pkt_rx_s *pkt, const struct timeval *rx_time, uint8_t *buf, int size);
+#endif
+
+/**
+@brief Check the datagram header following the 12-byte protocol header.
+
+@param buf[in] Datagram body
+@param size Size of the datagram body
+@param nb_rec[out] Number of records announced
+@return offset of the first record, -1 if the header is invalid
+*/
+int uplink_bin_decode_hdr(const uint8_t *buf, int size, uint8_t *nb_rec);
+
+/**
+@brief Decode one record.
+
+@param buf[in] Start of the record
+@param size Bytes left in the datagram
+@param rec[out] Decoded record
+@return size of the record, -1 if it is truncated or invalid
+*/
+int uplink_bin_decode(const uint8_t *buf, int size, struct uplink_bin_rec *rec);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Persistent store-and-forward queue for uplink packets
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* fopen, fread, fwrite */
+#include <stddef.h>     /* offsetof */
+#include <string.h>     /* memset, memcpy */
+#include <unistd.h>     /* fsync */
+
+#include "logcat.h"
+#include "upqueue.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define REC_MAGIC           0x5155  /* "UQ" */
+#define REC_PKT_HDR_SIZE    offsetof(struct lgw_pkt_rx_s, payload)
+#define REC_BODY_MAX        (8 + REC_PKT_HDR_SIZE + sizeof(((struct lgw_pkt_rx_s *)0)->payload))
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct rec_hdr_s {
+    uint16_t    magic;
+    uint16_t    len;    /* body length: rx time (8 bytes) + packet metadata + payload */
+    uint32_t    seq;
+    uint32_t    crc;    /* CRC-32 of seq and body */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t size) {
+    static uint32_t table[256];
+    static bool table_ready = false;
+    uint32_t i, j, c;
+
+    if (!table_ready) {
+        for (i = 0; i < 256; ++i) {
+            c = i;
+            for (j = 0; j < 8; ++j) {
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        table_ready = true;
+    }
+    crc = ~crc;
+    for (i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t rec_crc(uint32_t seq, const uint8_t *body, uint16_t len) {
+    return crc32_update(crc32_update(0, (const uint8_t *)&seq, sizeof seq), body, len);
+}
+
+static inline bool seq_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static void seg_path(const struct upqueue_s *queue, int seg, char *buf, size_t size) {
+    snprintf(buf, size, "%s.%d", queue->path, seg);
+}
+
+/* read one record at the current position of f, return its total size or 0 if invalid */
+static uint32_t rec_read(FILE *f, struct rec_hdr_s *hdr, uint8_t *body) {
+    if (fread(hdr, sizeof *hdr, 1, f) != 1) {
+        return 0;
+    }
+    if ((hdr->magic != REC_MAGIC) || (hdr->len < (8 + REC_PKT_HDR_SIZE)) || (hdr->len > REC_BODY_MAX)) {
+        return 0;
+    }
+    if (fread(body, hdr->len, 1, f) != 1) {
+        return 0;
+    }
+    if (rec_crc(hdr->seq, body, hdr->len) != hdr->crc) {
+        return 0;
+    }
+    return sizeof *hdr + hdr->len;
+}
+
+/* scan a segment, keep its valid prefix and locate the acknowledged cursor in it */
+static void seg_recover(struct upqueue_s *queue, int seg, uint32_t ack_seq, bool *ack_found, uint32_t *last_seq) {
+    char path[UPQUEUE_PATH_MAX + 8];
+    uint8_t body[REC_BODY_MAX];
+    struct rec_hdr_s hdr;
+    uint32_t off = 0, size;
+    long file_len;
+    bool first = true;
+    FILE *f;
+
+    queue->seg_len[seg] = 0;
+    seg_path(queue, seg, path, sizeof path);
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return;
+    }
+    while ((size = rec_read(f, &hdr, body)) != 0) {
+        /* sequence numbers are contiguous inside a segment */
+        if (!first && (hdr.seq != *last_seq + 1)) {
+            break;
+        }
+        if (first) {
+            queue->seg_first[seg] = hdr.seq;
+            first = false;
+        }
+        if (hdr.seq == ack_seq) {
+            queue->ack.seg = seg;
+            queue->ack.off = off;
+            queue->ack.seq = ack_seq;
+            *ack_found = true;
+        }
+        *last_seq = hdr.seq;
+        off += size;
+    }
+    queue->seg_len[seg] = off;
+
+    /* whatever follows the last valid record is a torn or corrupted write */
+    fseek(f, 0, SEEK_END);
+    file_len = ftell(f);
+    if (file_len > (long)off) {
+        LOGCAT_WARN(UP, "[upq ] %s: discarding %ld bytes after offset %u\n", path, file_len - (long)off, off);
+        queue->nb_corrupted += 1;
+    }
+    fclose(f);
+}
+
+static uint32_t cursor_read(const struct upqueue_s *queue, bool *valid) {
+    char path[UPQUEUE_PATH_MAX + 8];
+    uint32_t buf[2];
+    FILE *f;
+
+    *valid = false;
+    snprintf(path, sizeof path, "%s.idx", queue->path);
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    if ((fread(buf, sizeof buf, 1, f) == 1) && (buf[1] == crc32_update(0, (const uint8_t *)&buf[0], sizeof buf[0]))) {
+        *valid = true;
+    }
+    fclose(f);
+    return buf[0];
+}
+
+/* write the acknowledged cursor next to the log, atomically replaced through rename */
+static void cursor_write(struct upqueue_s *queue) {
+    char path[UPQUEUE_PATH_MAX + 8];
+    char tmp[UPQUEUE_PATH_MAX + 8];
+    uint32_t buf[2];
+    FILE *f;
+
+    snprintf(path, sizeof path, "%s.idx", queue->path);
+    snprintf(tmp, sizeof tmp, "%s.tmp", queue->path);
+    buf[0] = queue->ack.seq;
+    buf[1] = crc32_update(0, (const uint8_t *)&buf[0], sizeof buf[0]);
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        LOGCAT_ERROR(UP, "[upq ] failed to open %s\n", tmp);
+        return;
+    }
+    fwrite(buf, sizeof buf, 1, f);
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+    if (rename(tmp, path) != 0) {
+        LOGCAT_ERROR(UP, "[upq ] failed to rename %s\n", tmp);
+    }
+    queue->ack_unsynced = 0;
+}
+
+static FILE * seg_open_write(struct upqueue_s *queue, int seg, bool truncate) {
+    char path[UPQUEUE_PATH_MAX + 8];
+    FILE *f;
+
+    seg_path(queue, seg, path, sizeof path);
+    f = fopen(path, truncate ? "wb" : "r+b");
+    if ((f == NULL) && !truncate) {
+        f = fopen(path, "wb");
+    }
+    if (f == NULL) {
+        LOGCAT_ERROR(UP, "[upq ] failed to open %s for writing\n", path);
+        return NULL;
+    }
+    /* new records overwrite a possible torn tail */
+    fseek(f, queue->seg_len[seg], SEEK_SET);
+    return f;
+}
+
+static void rd_close(struct upqueue_s *queue) {
+    if (queue->rd_file != NULL) {
+        fclose(queue->rd_file);
+        queue->rd_file = NULL;
+    }
+    queue->rd_file_seg = -1;
+}
+
+/* the log is full: discard the oldest segment and start appending to it */
+static int seg_rotate(struct upqueue_s *queue) {
+    uint8_t old = queue->wr_seg;
+    uint8_t next = 1 - old;
+
+    /* unacknowledged records of the discarded segment are lost */
+    if (queue->ack.seg == next) {
+        if (seq_before(queue->ack.seq, queue->seg_first[old])) {
+            queue->nb_dropped += queue->seg_first[old] - queue->ack.seq;
+            LOGCAT_WARN(UP, "[upq ] log full, %u records dropped\n", queue->seg_first[old] - queue->ack.seq);
+        }
+        queue->ack.seg = old;
+        queue->ack.off = 0;
+        queue->ack.seq = queue->seg_first[old];
+        cursor_write(queue);
+    }
+    if (queue->rd.seg == next) {
+        queue->rd = queue->ack;
+    }
+    if (queue->rd_file_seg == next) {
+        rd_close(queue);
+    }
+
+    fclose(queue->wr_file);
+    queue->seg_len[next] = 0;
+    queue->seg_first[next] = queue->wr_seq - queue->batch_nb; /* the batch being flushed goes first */
+    queue->wr_seg = next;
+    queue->wr_file = seg_open_write(queue, next, true);
+    return (queue->wr_file == NULL) ? -1 : 0;
+}
+
+/* all records have been acknowledged: empty the log to keep it short */
+static void reset_log(struct upqueue_s *queue) {
+    FILE *f;
+    int i;
+
+    rd_close(queue);
+    fclose(queue->wr_file);
+    for (i = 0; i < 2; ++i) {
+        queue->seg_len[i] = 0;
+        queue->seg_first[i] = queue->wr_seq;
+    }
+    queue->wr_seg = 0;
+    queue->wr_file = seg_open_write(queue, 0, true);
+    f = seg_open_write(queue, 1, true);
+    if (f != NULL) {
+        fclose(f);
+    }
+    queue->ack.seg = 0;
+    queue->ack.off = 0;
+    queue->ack.seq = queue->wr_seq;
+    queue->rd = queue->ack;
+    cursor_write(queue);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int upqueue_open(struct upqueue_s *queue, const char *path, uint32_t size_max) {
+    uint32_t ack_seq, last_seq[2] = {0, 0};
+    bool ack_valid, ack_found = false;
+    int i, oldest;
+
+    if ((queue == NULL) || (path == NULL) || (strlen(path) >= UPQUEUE_PATH_MAX)) {
+        return -1;
+    }
+    memset(queue, 0, sizeof *queue);
+    strncpy(queue->path, path, sizeof queue->path - 1);
+    if (size_max < UPQUEUE_SIZE_MIN) {
+        size_max = UPQUEUE_SIZE_MIN;
+    }
+    queue->seg_size_max = size_max / 2;
+    queue->rd_file_seg = -1;
+
+    ack_seq = cursor_read(queue, &ack_valid);
+    for (i = 0; i < 2; ++i) {
+        seg_recover(queue, i, ack_seq, &ack_found, &last_seq[i]);
+    }
+
+    /* the segment with the most recent records is the one being appended */
+    if (queue->seg_len[0] == 0 && queue->seg_len[1] == 0) {
+        queue->wr_seg = 0;
+        queue->wr_seq = ack_valid ? ack_seq : 0;
+        queue->seg_first[0] = queue->seg_first[1] = queue->wr_seq;
+    } else if (queue->seg_len[1] == 0) {
+        queue->wr_seg = 0;
+        queue->wr_seq = last_seq[0] + 1;
+        queue->seg_first[1] = queue->wr_seq;
+    } else if (queue->seg_len[0] == 0) {
+        queue->wr_seg = 1;
+        queue->wr_seq = last_seq[1] + 1;
+        queue->seg_first[0] = queue->wr_seq;
+    } else {
+        queue->wr_seg = seq_before(last_seq[0], last_seq[1]) ? 1 : 0;
+        queue->wr_seq = last_seq[queue->wr_seg] + 1;
+    }
+
+    /* resume replay where it stopped, or at the oldest record if the cursor is unknown */
+    if (!ack_found) {
+        oldest = 1 - queue->wr_seg;
+        if (queue->seg_len[oldest] == 0) {
+            oldest = queue->wr_seg;
+        }
+        if (ack_valid && !seq_before(ack_seq, queue->seg_first[oldest]) && !seq_before(queue->wr_seq, ack_seq)) {
+            /* everything stored was already acknowledged */
+            queue->ack.seg = queue->wr_seg;
+            queue->ack.off = queue->seg_len[queue->wr_seg];
+            queue->ack.seq = queue->wr_seq;
+        } else {
+            queue->ack.seg = oldest;
+            queue->ack.off = 0;
+            queue->ack.seq = queue->seg_first[oldest];
+        }
+    }
+    queue->rd = queue->ack;
+
+    queue->wr_file = seg_open_write(queue, queue->wr_seg, false);
+    if (queue->wr_file == NULL) {
+        return -1;
+    }
+    LOGCAT_INFO(UP, "[upq ] %s opened, %u records pending, %u corrupted\n", path, upqueue_pending(queue), queue->nb_corrupted);
+    return 0;
+}
+
+void upqueue_close(struct upqueue_s *queue) {
+    if (queue->wr_file == NULL) {
+        return;
+    }
+    upqueue_flush(queue);
+    cursor_write(queue);
+    rd_close(queue);
+    fclose(queue->wr_file);
+    queue->wr_file = NULL;
+}
+
+int upqueue_push(struct upqueue_s *queue, const struct lgw_pkt_rx_s *pkt, const struct timeval *rx_time) {
+    struct rec_hdr_s hdr;
+    uint32_t t[2];
+    uint8_t *body;
+    uint16_t size;
+
+    if (queue->wr_file == NULL) {
+        return -1;
+    }
+    size = sizeof hdr + sizeof t + REC_PKT_HDR_SIZE + pkt->size;
+    if ((queue->batch_len + size) > UPQUEUE_BATCH_SIZE) {
+        if (upqueue_flush(queue) != 0) {
+            return -1;
+        }
+    }
+
+    hdr.magic = REC_MAGIC;
+    hdr.len = size - sizeof hdr;
+    hdr.seq = queue->wr_seq;
+    body = &queue->batch[queue->batch_len + sizeof hdr];
+    t[0] = (uint32_t)rx_time->tv_sec;
+    t[1] = (uint32_t)rx_time->tv_usec;
+    memcpy(body, t, sizeof t);
+    memcpy(body + sizeof t, pkt, REC_PKT_HDR_SIZE);
+    memcpy(body + sizeof t + REC_PKT_HDR_SIZE, pkt->payload, pkt->size);
+    hdr.crc = rec_crc(hdr.seq, body, hdr.len);
+    memcpy(&queue->batch[queue->batch_len], &hdr, sizeof hdr);
+
+    if (queue->batch_nb == 0) {
+        queue->batch_time = *rx_time;
+    }
+    queue->batch_len += size;
+    queue->batch_nb += 1;
+    queue->wr_seq += 1;
+    queue->nb_stored += 1;
+    return 0;
+}
+
+int upqueue_flush(struct upqueue_s *queue) {
+    if ((queue->batch_len == 0) || (queue->wr_file == NULL)) {
+        return 0;
+    }
+    if ((queue->seg_len[queue->wr_seg] + queue->batch_len) > queue->seg_size_max) {
+        if (seg_rotate(queue) != 0) {
+            return -1;
+        }
+    }
+    if (fwrite(queue->batch, 1, queue->batch_len, queue->wr_file) != queue->batch_len) {
+        LOGCAT_ERROR(UP, "[upq ] failed to write %u bytes to the log\n", queue->batch_len);
+        return -1;
+    }
+    fflush(queue->wr_file);
+    fsync(fileno(queue->wr_file));
+    queue->seg_len[queue->wr_seg] += queue->batch_len;
+    queue->batch_len = 0;
+    queue->batch_nb = 0;
+    return 0;
+}
+
+int upqueue_flush_if_due(struct upqueue_s *queue, const struct timeval *now) {
+    long elapsed_ms;
+
+    if (queue->batch_nb == 0) {
+        return 0;
+    }
+    elapsed_ms = (now->tv_sec - queue->batch_time.tv_sec) * 1000 + (now->tv_usec - queue->batch_time.tv_usec) / 1000;
+    if ((elapsed_ms < UPQUEUE_FLUSH_MS) && (queue->batch_len < (UPQUEUE_BATCH_SIZE / 2))) {
+        return 0;
+    }
+    return upqueue_flush(queue);
+}
+
+int upqueue_fetch(struct upqueue_s *queue, int max_pkt, struct lgw_pkt_rx_s *pkts, struct timeval *rx_time) {
+    char path[UPQUEUE_PATH_MAX + 8];
+    uint8_t body[REC_BODY_MAX];
+    struct rec_hdr_s hdr;
+    uint32_t size, t[2];
+    int nb = 0;
+
+    /* records still in RAM must reach the log to be fetched */
+    if (upqueue_flush(queue) != 0) {
+        return -1;
+    }
+
+    while ((nb < max_pkt) && seq_before(queue->rd.seq, queue->wr_seq)) {
+        /* end of the older segment, continue with the one being appended */
+        if ((queue->rd.off >= queue->seg_len[queue->rd.seg]) && (queue->rd.seg != queue->wr_seg)) {
+            queue->rd.seg = queue->wr_seg;
+            queue->rd.off = 0;
+        }
+        if (queue->rd_file_seg != queue->rd.seg) {
+            rd_close(queue);
+            seg_path(queue, queue->rd.seg, path, sizeof path);
+            queue->rd_file = fopen(path, "rb");
+            if (queue->rd_file == NULL) {
+                LOGCAT_ERROR(UP, "[upq ] failed to open %s for reading\n", path);
+                return -1;
+            }
+            queue->rd_file_seg = queue->rd.seg;
+        }
+        fseek(queue->rd_file, queue->rd.off, SEEK_SET);
+        size = rec_read(queue->rd_file, &hdr, body);
+        if ((size == 0) || (hdr.seq != queue->rd.seq)) {
+            /* should not happen after recovery, skip the rest of the segment */
+            LOGCAT_ERROR(UP, "[upq ] invalid record %u in segment %u\n", queue->rd.seq, queue->rd.seg);
+            queue->nb_corrupted += 1;
+            if (queue->rd.seg == queue->wr_seg) {
+                queue->rd.seq = queue->wr_seq;
+                break;
+            }
+            queue->rd.off = queue->seg_len[queue->rd.seg];
+            queue->rd.seq = queue->seg_first[queue->wr_seg];
+            continue;
+        }
+        memcpy(t, body, sizeof t);
+        rx_time[nb].tv_sec = t[0];
+        rx_time[nb].tv_usec = t[1];
+        memset(&pkts[nb], 0, sizeof pkts[nb]);
+        memcpy(&pkts[nb], body + sizeof t, REC_PKT_HDR_SIZE);
+        memcpy(pkts[nb].payload, body + sizeof t + REC_PKT_HDR_SIZE, hdr.len - sizeof t - REC_PKT_HDR_SIZE);
+        queue->rd.off += size;
+        queue->rd.seq += 1;
+        nb += 1;
+    }
+    return nb;
+}
+
+void upqueue_ack(struct upqueue_s *queue) {
+    uint32_t nb = queue->rd.seq - queue->ack.seq;
+
+    if (nb == 0) {
+        return;
+    }
+    queue->ack = queue->rd;
+    queue->nb_replayed += nb;
+    queue->ack_unsynced += nb;
+    if (upqueue_pending(queue) == 0) {
+        reset_log(queue);
+    } else if (queue->ack_unsynced >= UPQUEUE_CURSOR_SYNC) {
+        cursor_write(queue);
+    }
+}
+
+void upqueue_nack(struct upqueue_s *queue) {
+    queue->rd = queue->ack;
+}
+
+uint32_t upqueue_pending(const struct upqueue_s *queue) {
+    return queue->wr_seq - queue->ack.seq;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2021, Pycom Limited.
+ *
+ * This software is licensed under the GNU GPL version 3 or any
+ * later version, with permitted additional terms. For more information
+ * see the Pycom Licence v1.0 document supplied with this file, or
+ * available at https://www.pycom.io/opensource/licensing
+ */
+/*
+Description:
+    Persistent store-and-forward queue for uplink packets. Packets that could
+    not be delivered to the server are appended to a bounded log made of two
+    segment files, each record being framed by a CRC-32. The log survives a
+    reboot and is replayed once the server acknowledges PUSH_DATA again.
+
+    Not thread safe: the queue is owned by the upstream thread.
+*/
+
+#ifndef _LORA_PKTFWD_UPQUEUE_H
+#define _LORA_PKTFWD_UPQUEUE_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* FILE */
+#include <sys/time.h>   /* timeval */
+
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define UPQUEUE_PATH_MAX        64      /* max length of the log base path */
+#define UPQUEUE_BATCH_SIZE      2048    /* bytes buffered in RAM before they are written to the log */
+#define UPQUEUE_FLUSH_MS        1000    /* max time a record stays in RAM only */
+#define UPQUEUE_CURSOR_SYNC     64      /* acknowledged records between two cursor file updates */
+#define UPQUEUE_SIZE_MIN        (4 * 1024)
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct upqueue_pos_s {
+    uint8_t     seg;    /* segment index (0 or 1) */
+    uint32_t    off;    /* byte offset in the segment */
+    uint32_t    seq;    /* sequence number of the record at that offset */
+};
+
+struct upqueue_s {
+    char        path[UPQUEUE_PATH_MAX];
+    uint32_t    seg_size_max;   /* max size of one segment file, in bytes */
+    uint32_t    seg_len[2];     /* valid bytes in each segment */
+    uint32_t    seg_first[2];   /* sequence number of the first record of each segment */
+    FILE        *wr_file;       /* segment being appended */
+    uint8_t     wr_seg;
+    uint32_t    wr_seq;         /* sequence number of the next record appended */
+    FILE        *rd_file;
+    int         rd_file_seg;    /* segment rd_file is opened on, -1 if none */
+    struct upqueue_pos_s ack;   /* first record not acknowledged yet */
+    struct upqueue_pos_s rd;    /* first record not fetched yet */
+    uint32_t    ack_unsynced;   /* records acknowledged since the last cursor file update */
+    uint8_t     batch[UPQUEUE_BATCH_SIZE];
+    uint16_t    batch_len;
+    uint16_t    batch_nb;
+    struct timeval batch_time;  /* time of the oldest record in batch */
+    /* statistics */
+    uint32_t    nb_stored;      /* records appended */
+    uint32_t    nb_replayed;    /* records fetched and acknowledged */
+    uint32_t    nb_dropped;     /* records overwritten before being replayed */
+    uint32_t    nb_corrupted;   /* records discarded on recovery (torn write, bad CRC) */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Open (or create) a persistent queue and recover its content.
+
+@param queue[out] Queue to be initialized
+@param path Base path of the log, "<path>.0", "<path>.1" and "<path>.idx" are used
+@param size_max Max size of the log on storage, in bytes
+@return 0 on success, -1 on failure
+
+Records are validated on open: the log is cut at the first record with a bad
+frame or CRC, which is what a power loss in the middle of a write leaves.
+*/
+int upqueue_open(struct upqueue_s *queue, const char *path, uint32_t size_max);
+
+/**
+@brief Flush pending records and close the log files.
+
+@param queue[in] Queue to be closed
+*/
+void upqueue_close(struct upqueue_s *queue);
+
+/**
+@brief Append a received packet to the queue.
+
+@param queue[in] Queue
+@param pkt[in] Packet to be stored
+@param rx_time[in] UTC time of reception, replayed along with the packet
+@return 0 on success, -1 on storage error
+
+The record is buffered in RAM and written with the next batch. When the log
+is full the oldest segment is discarded.
+*/
+int upqueue_push(struct upqueue_s *queue, const struct lgw_pkt_rx_s *pkt, const struct timeval *rx_time);
+
+/**
+@brief Write buffered records to storage and sync the file.
+
+@param queue[in] Queue
+@return 0 on success, -1 on storage error
+*/
+int upqueue_flush(struct upqueue_s *queue);
+
+/**
+@brief Write buffered records if the oldest one waited more than UPQUEUE_FLUSH_MS.
+
+@param queue[in] Queue
+@param now[in] Current time
+@return 0 on success, -1 on storage error
+*/
+int upqueue_flush_if_due(struct upqueue_s *queue, const struct timeval *now);
+
+/**
+@brief Read the next records to be replayed, without removing them.
+
+@param queue[in] Queue
+@param max_pkt Max number of records to read
+@param pkts[out] Array receiving the packets
+@param rx_time[out] Array receiving the time of reception of each packet
+@return number of records read, -1 on storage error
+
+Fetched records are removed by upqueue_ack() or given back by upqueue_nack().
+*/
+int upqueue_fetch(struct upqueue_s *queue, int max_pkt, struct lgw_pkt_rx_s *pkts, struct timeval *rx_time);
+
+/**
+@brief Remove the records returned by the previous fetches.
+
+@param queue[in] Queue
+*/
+void upqueue_ack(struct upqueue_s *queue);
+
+/**
+@brief Give back the records returned by the previous fetches, they will be fetched again.
+
+@param queue[in] Queue
+*/
+void upqueue_nack(struct upqueue_s *queue);
+
+/**
+@brief Number of records not acknowledged yet.
+
+@param queue[in] Queue
+@return number of records
+*/
+uint32_t upqueue_pending(const struct upqueue_s *queue);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */